@@ -1442,10 +1442,15 @@ void Input::send(void *data, size_t length)
 {
 	auto gstr = g_string_new_len((gchar *)data, length);
 	auto ret = sr_input_send(_structure, gstr);
-	g_string_free(gstr, false);
+	g_string_free(gstr, true);
 	check(ret);
 }
 
+void Input::send_file(string filename)
+{
+	check(sr_input_send_file(_structure, filename.c_str()));
+}
+
 void Input::end()
 {
 	check(sr_input_end(_structure));
@@ -1596,6 +1601,26 @@ string Output::receive(shared_ptr<Packet> packet)
 	}
 }
 
+static int output_stream_callback(const struct sr_output *output,
+	const char *data, gsize len, void *cb_data)
+{
+	(void) output;
+	auto stream = static_cast<ostream *>(cb_data);
+	stream->write(data, len);
+	return stream->good() ? SR_OK : SR_ERR_IO;
+}
+
+void Output::receive(shared_ptr<Packet> packet, ostream &stream)
+{
+	check(sr_output_send_callback(_structure, packet->_structure,
+		output_stream_callback, &stream));
+}
+
+void Output::receive(shared_ptr<Packet> packet, int fd)
+{
+	check(sr_output_send_fd(_structure, packet->_structure, fd));
+}
+
 #include "enums.cpp"
 
 }
@@ -74,6 +74,7 @@ raised, which provides access to the error code and description.
 #include <glibmm.h>
 
 #include <stdexcept>
+#include <ostream>
 #include <memory>
 #include <vector>
 #include <map>
@@ -891,6 +892,10 @@ public:
 	 * @param data Next stream data.
 	 * @param length Length of data. */
 	void send(void *data, size_t length);
+	/** Send the contents of a file, mapped into memory rather than read.
+	 * Returns once the device is ready, call again to send the rest.
+	 * @param filename File to send. */
+	void send_file(string filename);
 	/** Signal end of input data. */
 	void end();
 protected:
@@ -974,6 +979,16 @@ public:
 	/** Update output with data from the given packet.
 	 * @param packet Packet to handle. */
 	string receive(shared_ptr<Packet> packet);
+	/** Update output with data from the given packet, writing the
+	 * output to a stream.
+	 * @param packet Packet to handle.
+	 * @param stream Stream to write the output to. */
+	void receive(shared_ptr<Packet> packet, ostream &stream);
+	/** Update output with data from the given packet, writing the
+	 * output to a file descriptor.
+	 * @param packet Packet to handle.
+	 * @param fd File descriptor to write the output to. */
+	void receive(shared_ptr<Packet> packet, int fd);
 protected:
 	Output(shared_ptr<OutputFormat> format, shared_ptr<Device> device);
 	Output(shared_ptr<OutputFormat> format,
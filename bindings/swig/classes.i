@@ -139,6 +139,7 @@ template< class T > class enable_shared_from_this;
 
 %ignore sigrok::DatafeedCallbackData;
 %ignore sigrok::SourceCallbackData;
+%ignore sigrok::Output::receive(std::shared_ptr<sigrok::Packet>, std::ostream &);
 
 #define SWIG_ATTRIBUTE_TEMPLATE
 
@@ -171,6 +171,8 @@ enum sr_packettype {
 	SR_DF_FRAME_END,
 	/** Payload is struct sr_datafeed_analog2. */
 	SR_DF_ANALOG2,
+	/** Payload is struct sr_datafeed_logic_repeat. */
+	SR_DF_LOGIC_REPEAT,
 };
 
 /** Measured quantity, sr_datafeed_analog.mq. */
@@ -455,6 +457,22 @@ struct sr_datafeed_logic {
 	void *data;
 };
 
+/**
+ * Logic datafeed payload for type SR_DF_LOGIC_REPEAT.
+ *
+ * A single sample which stays the same for a number of sample periods,
+ * such as an idle stretch of a capture. Datafeed callbacks only get these
+ * if enabled with sr_session_logic_repeat_set(), otherwise the session
+ * expands them to SR_DF_LOGIC packets.
+ */
+struct sr_datafeed_logic_repeat {
+	/** Number of sample periods the sample lasts, at least 1. */
+	uint64_t count;
+	uint16_t unitsize;
+	/** The sample, unitsize bytes. */
+	void *data;
+};
+
 /** Analog datafeed payload for type SR_DF_ANALOG. */
 struct sr_datafeed_analog {
 	/** The channels for which data is included in this packet. */
@@ -920,6 +938,33 @@ enum sr_configkey {
 	/** The device supports setting a probe factor. */
 	SR_CONF_PROBE_FACTOR,
 
+	/**
+	 * The device supports starting acquisition at a given sample, for
+	 * example replaying a session file from the middle of a capture.
+	 */
+	SR_CONF_CAPTURE_START,
+
+	/**
+	 * Logic channels in the samples that follow, as a mask of channel
+	 * indices. Sent in a meta packet by transforms which pack samples
+	 * down to these channels: they then follow each other from bit 0
+	 * up, in order of their index. If not sent, a channel's bit in a
+	 * sample is at its index.
+	 */
+	SR_CONF_PACKED_CHANNELS,
+
+	/**
+	 * Number of samples summarized by every bucket of the samples that
+	 * follow. Sent in a meta packet by transforms which decimate, along
+	 * with the samplerate of their output. Every bucket is two samples:
+	 * for logic channels the bucket's last sample, then a mask of the
+	 * channels which changed in the bucket. For analog channels, the
+	 * minimum then the maximum, in packets with SR_MQFLAG_MIN and
+	 * SR_MQFLAG_MAX set, or the mean twice, in packets with SR_MQFLAG_AVG
+	 * set.
+	 */
+	SR_CONF_BUCKET_SIZE,
+
 	/*--- Acquisition modes, sample limiting ----------------------------*/
 
 	/**
@@ -107,6 +107,9 @@ SR_API struct sr_trigger *sr_session_trigger_get(struct sr_session *session);
 /* Session setup */
 SR_API int sr_session_load(struct sr_context *ctx, const char *filename,
 	struct sr_session **session);
+SR_API int sr_session_overview_get(const char *filename, int level,
+		uint64_t start, uint64_t num_samples, uint8_t **data,
+		uint64_t *num_blocks, int *unitsize);
 SR_API int sr_session_new(struct sr_context *ctx, struct sr_session **session);
 SR_API int sr_session_destroy(struct sr_session *session);
 SR_API int sr_session_dev_remove_all(struct sr_session *session);
@@ -119,11 +122,21 @@ SR_API int sr_session_trigger_set(struct sr_session *session, struct sr_trigger
 SR_API int sr_session_datafeed_callback_remove_all(struct sr_session *session);
 SR_API int sr_session_datafeed_callback_add(struct sr_session *session,
 		sr_datafeed_callback cb, void *cb_data);
+SR_API int sr_session_datafeed_queue_set(struct sr_session *session,
+		unsigned int size);
+SR_API int sr_session_datafeed_queue_stats(struct sr_session *session,
+		unsigned int *depth, unsigned int *max_depth,
+		unsigned int *overruns);
+SR_API int sr_session_logic_repeat_set(struct sr_session *session,
+		gboolean enable);
+SR_API int sr_session_buffer_pool_stats(struct sr_session *session,
+		uint64_t *hits, uint64_t *misses, uint64_t *peak_bytes);
 
 /* Session control */
 SR_API int sr_session_start(struct sr_session *session);
 SR_API int sr_session_run(struct sr_session *session);
 SR_API int sr_session_stop(struct sr_session *session);
+SR_API int sr_session_epoll_set(struct sr_session *session, gboolean enable);
 SR_API int sr_session_save(struct sr_session *session, const char *filename,
 		const struct sr_dev_inst *sdi, unsigned char *buf, int unitsize,
 		int units);
@@ -145,6 +158,11 @@ SR_API int sr_session_source_remove_pollfd(struct sr_session *session,
 SR_API int sr_session_source_remove_channel(struct sr_session *session,
 		GIOChannel *channel);
 
+/* Datafeed packets */
+SR_API struct sr_datafeed_packet *sr_packet_ref(
+		const struct sr_datafeed_packet *packet);
+SR_API void sr_packet_free(struct sr_datafeed_packet *packet);
+
 /*--- input/input.c ---------------------------------------------------------*/
 
 SR_API const struct sr_input_module **sr_input_list(void);
@@ -162,11 +180,14 @@ SR_API int sr_input_scan_buffer(GString *buf, const struct sr_input **in);
 SR_API int sr_input_scan_file(const char *filename, const struct sr_input **in);
 SR_API struct sr_dev_inst *sr_input_dev_inst_get(const struct sr_input *in);
 SR_API int sr_input_send(const struct sr_input *in, GString *buf);
+SR_API int sr_input_send_file(const struct sr_input *in, const char *filename);
 SR_API int sr_input_end(const struct sr_input *in);
 SR_API void sr_input_free(const struct sr_input *in);
 
 /*--- output/output.c -------------------------------------------------------*/
 
+typedef int (*sr_output_callback)(const struct sr_output *o,
+		const char *data, gsize len, void *cb_data);
 SR_API const struct sr_output_module **sr_output_list(void);
 SR_API const char *sr_output_id_get(const struct sr_output_module *omod);
 SR_API const char *sr_output_name_get(const struct sr_output_module *omod);
@@ -180,6 +201,13 @@ SR_API const struct sr_output *sr_output_new(const struct sr_output_module *omod
 		GHashTable *params, const struct sr_dev_inst *sdi);
 SR_API int sr_output_send(const struct sr_output *o,
 		const struct sr_datafeed_packet *packet, GString **out);
+SR_API int sr_output_send_buffer(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *buf);
+SR_API int sr_output_send_callback(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet,
+		sr_output_callback cb, void *cb_data);
+SR_API int sr_output_send_fd(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, int fd);
 SR_API int sr_output_free(const struct sr_output *o);
 
 /*--- transform/transform.c -------------------------------------------------*/
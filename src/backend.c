@@ -298,8 +298,8 @@ static int sanity_check_all_output_modules(void)
 			sr_err("No description in module '%s'.", d);
 			errors++;
 		}
-		if (!outputs[i]->receive) {
-			sr_err("No receive in module '%s'.", d);
+		if (!outputs[i]->receive && !outputs[i]->append) {
+			sr_err("No receive or append in module '%s'.", d);
 			errors++;
 		}
 
@@ -116,7 +116,10 @@ struct dev_context {
 	gboolean continuous;
 	uint64_t limit_samples;
 	uint64_t limit_msec;
+	uint64_t capture_ratio;
 	uint64_t logic_counter;
+	/* Logic samples sent from the trigger on. */
+	uint64_t sent_samples;
 	uint64_t analog_counter;
 	int64_t starttime;
 	uint64_t step;
@@ -126,6 +129,8 @@ struct dev_context {
 	/* There is only ever one logic channel group, so its pattern goes here. */
 	uint8_t logic_pattern;
 	unsigned char logic_data[LOGIC_BUFSIZE];
+	/* Pending soft trigger, NULL once it fired. */
+	struct soft_trigger_logic *stl;
 	/* Analog */
 	int32_t num_analog_channels;
 	GHashTable *ch_ag;
@@ -151,6 +156,16 @@ static const uint32_t devopts[] = {
 	SR_CONF_SAMPLERATE | SR_CONF_GET | SR_CONF_SET | SR_CONF_LIST,
 	SR_CONF_AVERAGING | SR_CONF_GET | SR_CONF_SET,
 	SR_CONF_AVG_SAMPLES | SR_CONF_GET | SR_CONF_SET,
+	SR_CONF_TRIGGER_MATCH | SR_CONF_LIST,
+	SR_CONF_CAPTURE_RATIO | SR_CONF_GET | SR_CONF_SET,
+};
+
+static const int32_t soft_trigger_matches[] = {
+	SR_TRIGGER_ZERO,
+	SR_TRIGGER_ONE,
+	SR_TRIGGER_RISING,
+	SR_TRIGGER_FALLING,
+	SR_TRIGGER_EDGE,
 };
 
 static const uint32_t devopts_cg_logic[] = {
@@ -301,6 +316,7 @@ static GSList *scan(struct sr_dev_driver *di, GSList *options)
 	devc->cur_samplerate = SR_KHZ(200);
 	devc->limit_samples = 0;
 	devc->limit_msec = 0;
+	devc->capture_ratio = 0;
 	devc->step = 0;
 	devc->continuous = FALSE;
 	devc->num_logic_channels = num_logic_channels;
@@ -309,6 +325,7 @@ static GSList *scan(struct sr_dev_driver *di, GSList *options)
 	devc->num_analog_channels = num_analog_channels;
 	devc->avg = FALSE;
 	devc->avg_samples = 0;
+	devc->stl = NULL;
 
 	/* Logic channels, all in one channel group. */
 	cg = g_malloc0(sizeof(struct sr_channel_group));
@@ -432,6 +449,9 @@ static int config_get(uint32_t key, GVariant **data, const struct sr_dev_inst *s
 	case SR_CONF_AVG_SAMPLES:
 		*data = g_variant_new_uint64(devc->avg_samples);
 		break;
+	case SR_CONF_CAPTURE_RATIO:
+		*data = g_variant_new_uint64(devc->capture_ratio);
+		break;
 	case SR_CONF_PATTERN_MODE:
 		if (!cg)
 			return SR_ERR_CHANNEL_GROUP;
@@ -501,6 +521,11 @@ static int config_set(uint32_t key, GVariant *data, const struct sr_dev_inst *sd
 		devc->avg_samples = g_variant_get_uint64(data);
 		sr_dbg("Setting averaging rate to %" PRIu64, devc->avg_samples);
 		break;
+	case SR_CONF_CAPTURE_RATIO:
+		if (g_variant_get_uint64(data) > 100)
+			return SR_ERR_ARG;
+		devc->capture_ratio = g_variant_get_uint64(data);
+		break;
 	case SR_CONF_PATTERN_MODE:
 		if (!cg)
 			return SR_ERR_CHANNEL_GROUP;
@@ -597,6 +622,11 @@ static int config_list(uint32_t key, GVariant **data, const struct sr_dev_inst *
 			g_variant_builder_add(&gvb, "{sv}", "samplerate-steps", gvar);
 			*data = g_variant_builder_end(&gvb);
 			break;
+		case SR_CONF_TRIGGER_MATCH:
+			*data = g_variant_new_fixed_array(G_VARIANT_TYPE_INT32,
+					soft_trigger_matches, ARRAY_SIZE(soft_trigger_matches),
+					sizeof(int32_t));
+			break;
 		default:
 			return SR_ERR_NA;
 		}
@@ -734,13 +764,51 @@ do_send:
 	}
 }
 
+/*
+ * Send num_samples samples from logic_data, holding them back until the
+ * soft trigger fires if there is one.
+ */
+static void send_logic_packet(struct sr_dev_inst *sdi, uint64_t num_samples)
+{
+	struct dev_context *devc;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	int trigger_offset, pre_trigger_samples;
+
+	devc = sdi->priv;
+	logic.unitsize = devc->logic_unitsize;
+	logic.data = devc->logic_data;
+
+	if (devc->stl) {
+		trigger_offset = soft_trigger_logic_check(devc->stl, devc->logic_data,
+				num_samples * devc->logic_unitsize, &pre_trigger_samples);
+		if (trigger_offset < 0)
+			return;
+		soft_trigger_logic_free(devc->stl);
+		devc->stl = NULL;
+		devc->sent_samples += pre_trigger_samples;
+		logic.data = devc->logic_data + trigger_offset * devc->logic_unitsize;
+		num_samples -= trigger_offset;
+	}
+
+	if (!devc->continuous)
+		num_samples = MIN(num_samples, devc->limit_samples - devc->sent_samples);
+	if (!num_samples)
+		return;
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.length = num_samples * devc->logic_unitsize;
+	sr_session_send(sdi, &packet);
+	devc->sent_samples += num_samples;
+}
+
 /* Callback handling data */
 static int prepare_data(int fd, int revents, void *cb_data)
 {
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
 	struct analog_gen *ag;
 	GHashTableIter iter;
 	void *value;
@@ -759,27 +827,27 @@ static int prepare_data(int fd, int revents, void *cb_data)
 	elapsed = time - devc->starttime;
 	expected_samplenum = elapsed * devc->cur_samplerate / (1000 * 1000);
 
-	/* But never more than the limit, if there is one. */
-	if (!devc->continuous)
-		expected_samplenum = MIN(expected_samplenum, devc->limit_samples);
-
 	/* Of those, how many do we still have to send? */
 	if (devc->num_logic_channels)
 		logic_todo = expected_samplenum - devc->logic_counter;
+	/* But never more than the limit, if there is one. */
+	if (!devc->continuous)
+		expected_samplenum = MIN(expected_samplenum, devc->limit_samples);
 	if (devc->num_analog_channels)
 		analog_todo = expected_samplenum - devc->analog_counter;
 
 	while (logic_todo || analog_todo) {
-		/* Logic */
+		/*
+		 * Logic. Samples before the trigger do not count towards
+		 * the limit, so they keep coming until it fires.
+		 */
+		if (!devc->stl && !devc->continuous)
+			logic_todo = MIN(logic_todo,
+					devc->limit_samples - devc->sent_samples);
 		if (logic_todo > 0) {
 			sending_now = MIN(logic_todo, LOGIC_BUFSIZE / devc->logic_unitsize);
 			logic_generator(sdi, sending_now * devc->logic_unitsize);
-			packet.type = SR_DF_LOGIC;
-			packet.payload = &logic;
-			logic.length = sending_now * devc->logic_unitsize;
-			logic.unitsize = devc->logic_unitsize;
-			logic.data = devc->logic_data;
-			sr_session_send(sdi, &packet);
+			send_logic_packet(sdi, sending_now);
 			logic_todo -= sending_now;
 			devc->logic_counter += sending_now;
 		}
@@ -799,7 +867,7 @@ static int prepare_data(int fd, int revents, void *cb_data)
 	}
 
 	if (!devc->continuous
-			&& (!devc->num_logic_channels || devc->logic_counter >= devc->limit_samples)
+			&& (!devc->num_logic_channels || devc->sent_samples >= devc->limit_samples)
 			&& (!devc->num_analog_channels || devc->analog_counter >= devc->limit_samples)) {
 		/* If we're averaging everything - now is the time to send data */
 		if (devc->avg_samples == 0) {
@@ -825,6 +893,7 @@ static int prepare_data(int fd, int revents, void *cb_data)
 static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 {
 	struct dev_context *devc;
+	struct sr_trigger *trigger;
 	GHashTableIter iter;
 	void *value;
 
@@ -836,6 +905,9 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	devc = sdi->priv;
 	devc->continuous = !devc->limit_samples;
 	devc->logic_counter = devc->analog_counter = 0;
+	devc->sent_samples = 0;
+	/* Every acquisition starts at the beginning of the logic pattern. */
+	devc->step = 0;
 
 	/*
 	 * Setting two channels connected by a pipe is a remnant from when the
@@ -849,6 +921,14 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		return SR_ERR;
 	}
 
+	if (devc->num_logic_channels
+			&& (trigger = sr_session_trigger_get(sdi->session))) {
+		devc->stl = soft_trigger_logic_new(sdi, trigger,
+				devc->capture_ratio * devc->limit_samples / 100);
+		if (!devc->stl)
+			return SR_ERR_MALLOC;
+	}
+
 	g_hash_table_iter_init(&iter, devc->ch_ag);
 	while (g_hash_table_iter_next(&iter, NULL, &value))
 		generate_analog_pattern(value, devc->cur_samplerate);
@@ -889,6 +969,11 @@ static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 	g_io_channel_unref(devc->channel);
 	devc->channel = NULL;
 
+	if (devc->stl) {
+		soft_trigger_logic_free(devc->stl);
+		devc->stl = NULL;
+	}
+
 	/* Send last packet. */
 	packet.type = SR_DF_END;
 	sr_session_send(sdi, &packet);
@@ -614,7 +614,7 @@ static int start_transfers(const struct sr_dev_inst *sdi)
 	struct libusb_transfer *transfer;
 	unsigned int i, num_transfers;
 	int endpoint, timeout, ret;
-	unsigned char *buf;
+	struct sr_buffer *buf;
 	size_t size;
 
 	devc = sdi->priv;
@@ -642,8 +642,12 @@ static int start_transfers(const struct sr_dev_inst *sdi)
 	devc->submitted_transfers = 0;
 
 	devc->transfers = g_try_malloc0(sizeof(*devc->transfers) * num_transfers);
-	if (!devc->transfers) {
+	devc->transfer_buffers = g_try_malloc0(
+			sizeof(*devc->transfer_buffers) * num_transfers);
+	if (!devc->transfers || !devc->transfer_buffers) {
 		sr_err("USB transfers malloc failed.");
+		g_free(devc->transfers);
+		g_free(devc->transfer_buffers);
 		return SR_ERR_MALLOC;
 	}
 
@@ -651,23 +655,22 @@ static int start_transfers(const struct sr_dev_inst *sdi)
 	endpoint = devc->dslogic ? 6 : 2;
 	devc->num_transfers = num_transfers;
 	for (i = 0; i < num_transfers; i++) {
-		if (!(buf = g_try_malloc(size))) {
-			sr_err("USB transfer buffer malloc failed.");
-			return SR_ERR_MALLOC;
-		}
+		/* Reuse the previous acquisition's buffers, if any. */
+		buf = sr_session_buffer_get(sdi->session, size);
 		transfer = libusb_alloc_transfer(0);
 		libusb_fill_bulk_transfer(transfer, usb->devhdl,
-				endpoint | LIBUSB_ENDPOINT_IN, buf, size,
+				endpoint | LIBUSB_ENDPOINT_IN, buf->data, size,
 				fx2lafw_receive_transfer, (void *)sdi, timeout);
 		if ((ret = libusb_submit_transfer(transfer)) != 0) {
 			sr_err("Failed to submit transfer: %s.",
 			       libusb_error_name(ret));
 			libusb_free_transfer(transfer);
-			g_free(buf);
+			sr_buffer_unref(buf);
 			fx2lafw_abort_acquisition(devc);
 			return SR_ERR;
 		}
 		devc->transfers[i] = transfer;
+		devc->transfer_buffers[i] = buf;
 		devc->submitted_transfers++;
 	}
 
@@ -331,6 +331,7 @@ static void finish_acquisition(struct sr_dev_inst *sdi)
 
 	devc->num_transfers = 0;
 	g_free(devc->transfers);
+	g_free(devc->transfer_buffers);
 
 	if (devc->stl) {
 		soft_trigger_logic_free(devc->stl);
@@ -347,13 +348,15 @@ static void free_transfer(struct libusb_transfer *transfer)
 	sdi = transfer->user_data;
 	devc = sdi->priv;
 
-	g_free(transfer->buffer);
 	transfer->buffer = NULL;
 	libusb_free_transfer(transfer);
 
+	/* Return the buffer to the session's pool for the next run. */
 	for (i = 0; i < devc->num_transfers; i++) {
 		if (devc->transfers[i] == transfer) {
 			devc->transfers[i] = NULL;
+			sr_buffer_unref(devc->transfer_buffers[i]);
+			devc->transfer_buffers[i] = NULL;
 			break;
 		}
 	}
@@ -115,6 +115,8 @@ struct dev_context {
 	void *cb_data;
 	unsigned int num_transfers;
 	struct libusb_transfer **transfers;
+	/* Buffers of the transfers, taken from the session's pool. */
+	struct sr_buffer **transfer_buffers;
 	struct sr_context *ctx;
 
 	/* Is this a DSLogic? */
@@ -185,6 +185,12 @@ static struct sr_config_info sr_config_info_data[] = {
 		"Data source", NULL},
 	{SR_CONF_PROBE_FACTOR, SR_T_UINT64, "probe_factor",
 		"Probe factor", NULL},
+	{SR_CONF_CAPTURE_START, SR_T_UINT64, "capture_start",
+		"Capture start sample", NULL},
+	{SR_CONF_PACKED_CHANNELS, SR_T_UINT64, "packed_channels",
+		"Packed logic channels", NULL},
+	{SR_CONF_BUCKET_SIZE, SR_T_UINT64, "bucket_size",
+		"Samples per bucket", NULL},
 
 	/* Acquisition modes, sample limiting */
 	{SR_CONF_LIMIT_MSEC, SR_T_UINT64, "limit_time",
@@ -28,7 +28,6 @@
 
 #define LOG_PREFIX "input/binary"
 
-#define MAX_CHUNK_SIZE        4096
 #define DEFAULT_NUM_CHANNELS  8
 #define DEFAULT_SAMPLERATE    0
 
@@ -62,48 +61,42 @@ static int init(struct sr_input *in, GHashTable *options)
 	return SR_OK;
 }
 
-static int process_buffer(struct sr_input *in)
+static void send_header(struct sr_input *in)
 {
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_meta meta;
-	struct sr_datafeed_logic logic;
 	struct sr_config *src;
 	struct context *inc;
-	gsize chunk_size, i;
-	int chunk;
 
 	inc = in->priv;
-	if (!inc->started) {
-		std_session_send_df_header(in->sdi, LOG_PREFIX);
-
-		if (inc->samplerate) {
-			packet.type = SR_DF_META;
-			packet.payload = &meta;
-			src = sr_config_new(SR_CONF_SAMPLERATE, g_variant_new_uint64(inc->samplerate));
-			meta.config = g_slist_append(NULL, src);
-			sr_session_send(in->sdi, &packet);
-			sr_config_free(src);
-		}
-
-		inc->started = TRUE;
-	}
+	if (inc->started)
+		return;
 
-	packet.type = SR_DF_LOGIC;
-	packet.payload = &logic;
-	logic.unitsize = (g_slist_length(in->sdi->channels) + 7) / 8;
+	std_session_send_df_header(in->sdi, LOG_PREFIX);
 
-	/* Cut off at multiple of unitsize. */
-	chunk_size = in->buf->len / logic.unitsize * logic.unitsize;
-
-	for (i = 0; i < chunk_size; i += chunk) {
-		logic.data = in->buf->str + i;
-		chunk = MIN(MAX_CHUNK_SIZE, chunk_size - i);
-		logic.length = chunk;
+	if (inc->samplerate) {
+		packet.type = SR_DF_META;
+		packet.payload = &meta;
+		src = sr_config_new(SR_CONF_SAMPLERATE, g_variant_new_uint64(inc->samplerate));
+		meta.config = g_slist_append(NULL, src);
 		sr_session_send(in->sdi, &packet);
+		sr_config_free(src);
 	}
-	g_string_erase(in->buf, 0, chunk_size);
 
-	return SR_OK;
+	inc->started = TRUE;
+}
+
+static int process_buffer(struct sr_input *in)
+{
+	gsize used;
+	int ret;
+
+	send_header(in);
+	ret = sr_input_send_logic(in, (const uint8_t *)in->buf->str,
+			in->buf->len, NULL, &used);
+	g_string_erase(in->buf, 0, used);
+
+	return ret;
 }
 
 static int receive(struct sr_input *in, GString *buf)
@@ -123,6 +116,14 @@ static int receive(struct sr_input *in, GString *buf)
 	return ret;
 }
 
+static int receive_mapped(struct sr_input *in, const uint8_t *data,
+		gsize len, struct sr_buffer *buf)
+{
+	send_header(in);
+
+	return sr_input_send_logic_mapped(in, data, len, buf);
+}
+
 static int end(struct sr_input *in)
 {
 	struct context *inc;
@@ -167,5 +168,6 @@ SR_PRIV struct sr_input_module input_binary = {
 	.options = get_options,
 	.init = init,
 	.receive = receive,
+	.receive_mapped = receive_mapped,
 	.end = end,
 };
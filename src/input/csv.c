@@ -18,6 +18,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 #include <string.h>
 #include <glib.h>
 #include "libsigrok.h"
@@ -64,8 +65,17 @@
  *
  * startline:     Line number to start processing sample data. Must be greater
  *                than 0. The default line number to start processing is 1.
+ *
+ * workers:       Number of threads used to parse large inputs. Parsing is
+ *                serial by default, 0 uses one thread per CPU.
  */
 
+/* Bytes of sample data collected before they are sent. */
+#define CHUNK_SIZE (1024 * 1024)
+
+/* Smallest part of the input that is handed to a worker thread. */
+#define MIN_SEGMENT_SIZE (64 * 1024)
+
 /* Single column formats. */
 enum {
 	FORMAT_BIN,
@@ -73,6 +83,40 @@ enum {
 	FORMAT_OCT
 };
 
+/* A column of the current line, pointing into the input buffer. */
+struct column {
+	const char *str;
+	gsize len;
+};
+
+/* Parser state, one for the session thread and one per segment. */
+struct parser {
+	/* Columns of the current line. */
+	struct column *columns;
+
+	/* Parsed sample data, for up to max_samples samples. */
+	uint8_t *samples;
+	gsize num_samples;
+	gsize max_samples;
+
+	/* Current line number. */
+	gsize line_number;
+
+	/* Whether parse errors are logged. Workers stay quiet. */
+	gboolean report;
+};
+
+/* Lines of the input parsed by a worker thread. */
+struct segment {
+	const char *start;
+	const char *end;
+	struct parser parser;
+
+	/* Line which failed to parse, if any. */
+	const char *error_start;
+	const char *error_end;
+};
+
 struct context {
 	gboolean started;
 
@@ -91,6 +135,9 @@ struct context {
 	/* Termination  character(s) used in current stream. */
 	char *termination;
 
+	/* Last character of the termination, used to split lines. */
+	char term_char;
+
 	/* Determines if sample data is stored in multiple columns. */
 	gboolean multi_column_mode;
 
@@ -122,16 +169,32 @@ struct context {
 	/* Format sample data is stored in single column mode. */
 	int format;
 
-	/* Size of the sample buffer. */
+	/* Size of a single sample. */
 	gsize sample_buffer_size;
 
-	/* Buffer to store sample data. */
-	uint8_t *sample_buffer;
+	/* Maximum number of columns to parse per line. */
+	gsize max_columns;
 
-	/* Current line number. */
-	gsize line_number;
+	/* Parser used on the session thread. */
+	struct parser parser;
+
+	/* Number of threads to parse with. */
+	gsize num_workers;
+
+	/* Worker threads, only used if there is more than one. */
+	GThreadPool *workers;
+	struct segment *segments;
+	GMutex mutex;
+	GCond cond;
+	gsize pending;
 };
 
+/* Log a parse error, unless the parser belongs to a worker thread. */
+#define parse_err(p, ...) do { \
+	if ((p)->report) \
+		sr_err(__VA_ARGS__); \
+} while (0)
+
 static int format_match(GHashTable *metadata)
 {
 	char *buf;
@@ -143,40 +206,86 @@ static int format_match(GHashTable *metadata)
 	return SR_ERR;
 }
 
-static void strip_comment(char *buf, const GString *prefix)
+/* Find the first occurrence of str in [s, end), or NULL. */
+static const char *find_str(const char *s, const char *end, const GString *str)
 {
-	char *ptr;
+	const char *p;
 
-	if (!prefix->len)
-		return;
+	if (str->len == 1)
+		return memchr(s, str->str[0], end - s);
+
+	while ((gsize)(end - s) >= str->len) {
+		if (!(p = memchr(s, str->str[0], end - s - str->len + 1)))
+			return NULL;
+		if (!memcmp(p, str->str, str->len))
+			return p;
+		s = p + 1;
+	}
 
-	if ((ptr = strstr(buf, prefix->str)))
-		*ptr = '\0';
+	return NULL;
 }
 
-static int parse_binstr(const char *str, struct context *inc)
+static void strip_whitespace(const char **s, const char **end)
+{
+	while (*s < *end && g_ascii_isspace(**s))
+		(*s)++;
+	while (*end > *s && g_ascii_isspace((*end)[-1]))
+		(*end)--;
+}
+
+/*
+ * Remove surrounding whitespace and a trailing comment from the line in
+ * [s, end), by moving the bounds only. Returns FALSE if nothing is left.
+ */
+static gboolean line_content(const struct context *inc,
+		const struct parser *p, const char **s, const char **end)
 {
-	gsize i, j, length;
+	const char *c;
+
+	strip_whitespace(s, end);
+	if (*s == *end) {
+		if (p->report)
+			sr_spew("Blank line %zu skipped.", p->line_number);
+		return FALSE;
+	}
+
+	if (inc->comment->len && (c = find_str(*s, *end, inc->comment))) {
+		*end = c;
+		strip_whitespace(s, end);
+		if (*s == *end) {
+			if (p->report)
+				sr_spew("Comment-only line %zu skipped.",
+					p->line_number);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
 
-	length = strlen(str);
+static int parse_binstr(const char *str, gsize length, uint8_t *sample,
+		const struct context *inc, const struct parser *p)
+{
+	gsize i, j;
 
 	if (!length) {
-		sr_err("Column %zu in line %zu is empty.", inc->single_column,
-			inc->line_number);
+		parse_err(p, "Column %zu in line %zu is empty.",
+			inc->single_column, p->line_number);
 		return SR_ERR;
 	}
 
 	/* Clear buffer in order to set bits only. */
-	memset(inc->sample_buffer, 0, (inc->num_channels + 7) >> 3);
+	memset(sample, 0, (inc->num_channels + 7) >> 3);
 
 	i = inc->first_channel;
 
 	for (j = 0; i < length && j < inc->num_channels; i++, j++) {
 		if (str[length - i - 1] == '1') {
-			inc->sample_buffer[j / 8] |= (1 << (j % 8));
+			sample[j / 8] |= (1 << (j % 8));
 		} else if (str[length - i - 1] != '0') {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				str, inc->single_column, inc->line_number);
+			parse_err(p, "Invalid value '%.*s' in column %zu in line %zu.",
+				(int)length, str, inc->single_column,
+				p->line_number);
 			return SR_ERR;
 		}
 	}
@@ -184,22 +293,21 @@ static int parse_binstr(const char *str, struct context *inc)
 	return SR_OK;
 }
 
-static int parse_hexstr(const char *str, struct context *inc)
+static int parse_hexstr(const char *str, gsize length, uint8_t *sample,
+		const struct context *inc, const struct parser *p)
 {
-	gsize i, j, k, length;
+	gsize i, j, k;
 	uint8_t value;
 	char c;
 
-	length = strlen(str);
-
 	if (!length) {
-		sr_err("Column %zu in line %zu is empty.", inc->single_column,
-			inc->line_number);
+		parse_err(p, "Column %zu in line %zu is empty.",
+			inc->single_column, p->line_number);
 		return SR_ERR;
 	}
 
 	/* Clear buffer in order to set bits only. */
-	memset(inc->sample_buffer, 0, (inc->num_channels + 7) >> 3);
+	memset(sample, 0, (inc->num_channels + 7) >> 3);
 
 	/* Calculate the position of the first hexadecimal digit. */
 	i = inc->first_channel / 4;
@@ -208,8 +316,9 @@ static int parse_hexstr(const char *str, struct context *inc)
 		c = str[length - i - 1];
 
 		if (!g_ascii_isxdigit(c)) {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				str, inc->single_column, inc->line_number);
+			parse_err(p, "Invalid value '%.*s' in column %zu in line %zu.",
+				(int)length, str, inc->single_column,
+				p->line_number);
 			return SR_ERR;
 		}
 
@@ -219,7 +328,7 @@ static int parse_hexstr(const char *str, struct context *inc)
 
 		for (; j < inc->num_channels && k < 4; k++) {
 			if (value & (1 << k))
-				inc->sample_buffer[j / 8] |= (1 << (j % 8));
+				sample[j / 8] |= (1 << (j % 8));
 
 			j++;
 		}
@@ -228,22 +337,21 @@ static int parse_hexstr(const char *str, struct context *inc)
 	return SR_OK;
 }
 
-static int parse_octstr(const char *str, struct context *inc)
+static int parse_octstr(const char *str, gsize length, uint8_t *sample,
+		const struct context *inc, const struct parser *p)
 {
-	gsize i, j, k, length;
+	gsize i, j, k;
 	uint8_t value;
 	char c;
 
-	length = strlen(str);
-
 	if (!length) {
-		sr_err("Column %zu in line %zu is empty.", inc->single_column,
-			inc->line_number);
+		parse_err(p, "Column %zu in line %zu is empty.",
+			inc->single_column, p->line_number);
 		return SR_ERR;
 	}
 
 	/* Clear buffer in order to set bits only. */
-	memset(inc->sample_buffer, 0, (inc->num_channels + 7) >> 3);
+	memset(sample, 0, (inc->num_channels + 7) >> 3);
 
 	/* Calculate the position of the first octal digit. */
 	i = inc->first_channel / 3;
@@ -252,8 +360,9 @@ static int parse_octstr(const char *str, struct context *inc)
 		c = str[length - i - 1];
 
 		if (c < '0' || c > '7') {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				str, inc->single_column, inc->line_number);
+			parse_err(p, "Invalid value '%.*s' in column %zu in line %zu.",
+				(int)length, str, inc->single_column,
+				p->line_number);
 			return SR_ERR;
 		}
 
@@ -263,7 +372,7 @@ static int parse_octstr(const char *str, struct context *inc)
 
 		for (; j < inc->num_channels && k < 3; k++) {
 			if (value & (1 << k))
-				inc->sample_buffer[j / 8] |= (1 << (j % 8));
+				sample[j / 8] |= (1 << (j % 8));
 
 			j++;
 		}
@@ -272,72 +381,59 @@ static int parse_octstr(const char *str, struct context *inc)
 	return SR_OK;
 }
 
-static char **parse_line(char *buf, struct context *inc, int max_columns)
+/*
+ * Split the non-empty line in [s, end) into at most max_columns columns,
+ * starting at the first column to parse. The columns point into the line
+ * and have their surrounding whitespace removed. Returns the number of
+ * columns found.
+ */
+static gsize parse_line(const char *s, const char *end,
+		const struct context *inc,
+		struct column *columns, gsize max_columns)
 {
-	const char *str, *remainder;
-	GSList *list, *l;
-	char **columns;
-	char *column;
+	const char *d, *e;
 	gsize n, k;
 
 	n = 0;
 	k = 0;
-	list = NULL;
-
-	remainder = buf;
-	str = strstr(remainder, inc->delimiter->str);
 
-	while (str && max_columns) {
+	while (k < max_columns) {
+		d = find_str(s, end, inc->delimiter);
 		if (n >= inc->first_column) {
-			column = g_strndup(remainder, str - remainder);
-			list = g_slist_prepend(list, g_strstrip(column));
-
-			max_columns--;
+			e = d ? d : end;
+			strip_whitespace(&s, &e);
+			columns[k].str = s;
+			columns[k].len = e - s;
 			k++;
 		}
-
-		remainder = str + inc->delimiter->len;
-		str = strstr(remainder, inc->delimiter->str);
+		if (!d)
+			break;
+		s = d + inc->delimiter->len;
 		n++;
 	}
 
-	if (buf[0] && max_columns && n >= inc->first_column) {
-		column = g_strdup(remainder);
-		list = g_slist_prepend(list, g_strstrip(column));
-		k++;
-	}
-
-	if (!(columns = g_try_new(char *, k + 1)))
-		return NULL;
-
-	columns[k--] = NULL;
-
-	for (l = list; l; l = l->next)
-		columns[k--] = l->data;
-
-	g_slist_free(list);
-
-	return columns;
+	return k;
 }
 
-static int parse_multi_columns(char **columns, struct context *inc)
+static int parse_multi_columns(const struct column *columns, uint8_t *sample,
+		const struct context *inc, const struct parser *p)
 {
 	gsize i;
 
 	/* Clear buffer in order to set bits only. */
-	memset(inc->sample_buffer, 0, (inc->num_channels + 7) >> 3);
+	memset(sample, 0, (inc->num_channels + 7) >> 3);
 
 	for (i = 0; i < inc->num_channels; i++) {
-		if (columns[i][0] == '1') {
-			inc->sample_buffer[i / 8] |= (1 << (i % 8));
-		} else if (!strlen(columns[i])) {
-			sr_err("Column %zu in line %zu is empty.",
-				inc->first_channel + i, inc->line_number);
+		if (!columns[i].len) {
+			parse_err(p, "Column %zu in line %zu is empty.",
+				inc->first_channel + i, p->line_number);
 			return SR_ERR;
-		} else if (columns[i][0] != '0') {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				columns[i], inc->first_channel + i,
-				inc->line_number);
+		} else if (columns[i].str[0] == '1') {
+			sample[i / 8] |= (1 << (i % 8));
+		} else if (columns[i].str[0] != '0') {
+			parse_err(p, "Invalid value '%.*s' in column %zu in line %zu.",
+				(int)columns[i].len, columns[i].str,
+				inc->first_channel + i, p->line_number);
 			return SR_ERR;
 		}
 	}
@@ -345,7 +441,8 @@ static int parse_multi_columns(char **columns, struct context *inc)
 	return SR_OK;
 }
 
-static int parse_single_column(const char *column, struct context *inc)
+static int parse_single_column(const struct column *column, uint8_t *sample,
+		const struct context *inc, const struct parser *p)
 {
 	int res;
 
@@ -353,41 +450,182 @@ static int parse_single_column(const char *column, struct context *inc)
 
 	switch (inc->format) {
 	case FORMAT_BIN:
-		res = parse_binstr(column, inc);
+		res = parse_binstr(column->str, column->len, sample, inc, p);
 		break;
 	case FORMAT_HEX:
-		res = parse_hexstr(column, inc);
+		res = parse_hexstr(column->str, column->len, sample, inc, p);
 		break;
 	case FORMAT_OCT:
-		res = parse_octstr(column, inc);
+		res = parse_octstr(column->str, column->len, sample, inc, p);
 		break;
 	}
 
 	return res;
 }
 
-static int send_samples(const struct sr_dev_inst *sdi, uint8_t *buffer,
-		gsize buffer_size, gsize count)
+/*
+ * Parse the line in [s, end) into the next sample of the parser, unless
+ * it is blank or a comment. The parser must have room for one sample.
+ */
+static int parse_sample(const struct context *inc, struct parser *p,
+		const char *s, const char *end)
 {
-	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
-	int res;
-	gsize i;
+	gsize num_columns;
+	uint8_t *sample;
+	int ret;
 
-	packet.type = SR_DF_LOGIC;
-	packet.payload = &logic;
-	logic.unitsize = buffer_size;
-	logic.length = buffer_size;
-	logic.data = buffer;
+	if (!line_content(inc, p, &s, &end))
+		return SR_OK;
 
-	for (i = 0; i < count; i++) {
-		if ((res = sr_session_send(sdi, &packet)) != SR_OK)
-			return res;
+	num_columns = parse_line(s, end, inc, p->columns, inc->max_columns);
+	if (!num_columns) {
+		parse_err(p, "Column %zu in line %zu is out of bounds.",
+			inc->first_column, p->line_number);
+		return SR_ERR;
+	}
+	/*
+	 * Ensure that the number of channels does not exceed the number
+	 * of columns in multi column mode.
+	 */
+	if (inc->multi_column_mode && num_columns < inc->num_channels) {
+		parse_err(p, "Not enough columns for desired number of channels in line %zu.",
+			p->line_number);
+		return SR_ERR;
 	}
 
+	sample = p->samples + p->num_samples * inc->sample_buffer_size;
+	if (inc->multi_column_mode)
+		ret = parse_multi_columns(p->columns, sample, inc, p);
+	else
+		ret = parse_single_column(p->columns, sample, inc, p);
+	if (ret != SR_OK)
+		return SR_ERR;
+
+	p->num_samples++;
+
 	return SR_OK;
 }
 
+static int flush_samples(const struct sr_input *in)
+{
+	struct context *inc;
+	gsize count;
+
+	inc = in->priv;
+	count = inc->parser.num_samples;
+	inc->parser.num_samples = 0;
+
+	return sr_input_send_logic(in, inc->parser.samples,
+			count * inc->sample_buffer_size, NULL, NULL);
+}
+
+/* Find the termination of the line at s. Sets eol to the end of the line. */
+static const char *line_end(const struct context *inc, const char *s,
+		const char *end, const char **eol)
+{
+	const char *nl;
+
+	if (!(nl = memchr(s, inc->term_char, end - s)))
+		return NULL;
+	*eol = nl;
+	if (nl > s && nl[-1] == '\r')
+		(*eol)--;
+
+	return nl;
+}
+
+/* Worker thread: parse all lines of one segment. */
+static void parse_segment(gpointer data, gpointer user_data)
+{
+	struct context *inc;
+	struct segment *seg;
+	struct parser *p;
+	const char *s, *nl, *eol;
+
+	seg = data;
+	inc = user_data;
+	p = &seg->parser;
+
+	for (s = seg->start; s < seg->end; s = nl + 1) {
+		nl = line_end(inc, s, seg->end, &eol);
+		if (p->num_samples == p->max_samples) {
+			p->max_samples *= 2;
+			p->samples = g_realloc(p->samples,
+				p->max_samples * inc->sample_buffer_size);
+		}
+		p->line_number++;
+		if (parse_sample(inc, p, s, eol) != SR_OK) {
+			/* Leave it to the session thread to report. */
+			p->line_number--;
+			seg->error_start = s;
+			seg->error_end = eol;
+			break;
+		}
+	}
+
+	g_mutex_lock(&inc->mutex);
+	if (--inc->pending == 0)
+		g_cond_signal(&inc->cond);
+	g_mutex_unlock(&inc->mutex);
+}
+
+static void parser_init(struct parser *p, const struct context *inc,
+		gsize max_samples, gboolean report)
+{
+	p->columns = g_malloc(inc->max_columns * sizeof(struct column));
+	p->samples = g_malloc(max_samples * inc->sample_buffer_size);
+	p->num_samples = 0;
+	p->max_samples = max_samples;
+	p->report = report;
+}
+
+static void parser_free(struct parser *p)
+{
+	g_free(p->columns);
+	g_free(p->samples);
+}
+
+static void workers_start(struct context *inc)
+{
+	GError *error;
+	gsize i;
+
+	if (inc->num_workers < 2)
+		return;
+
+	error = NULL;
+	if (!(inc->workers = g_thread_pool_new(parse_segment, inc,
+			inc->num_workers, TRUE, &error))) {
+		/* Not fatal, parse on the session thread instead. */
+		sr_warn("Failed to start parser threads: %s.", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	g_mutex_init(&inc->mutex);
+	g_cond_init(&inc->cond);
+	inc->segments = g_malloc0(inc->num_workers * sizeof(struct segment));
+	for (i = 0; i < inc->num_workers; i++)
+		parser_init(&inc->segments[i].parser, inc,
+			MAX(CHUNK_SIZE / inc->sample_buffer_size, 1), FALSE);
+}
+
+static void workers_stop(struct context *inc)
+{
+	gsize i;
+
+	if (!inc->workers)
+		return;
+
+	g_thread_pool_free(inc->workers, FALSE, TRUE);
+	inc->workers = NULL;
+	for (i = 0; i < inc->num_workers; i++)
+		parser_free(&inc->segments[i].parser);
+	g_free(inc->segments);
+	g_cond_clear(&inc->cond);
+	g_mutex_clear(&inc->mutex);
+}
+
 static int init(struct sr_input *in, GHashTable *options)
 {
 	struct context *inc;
@@ -451,6 +689,15 @@ static int init(struct sr_input *in, GHashTable *options)
 		return SR_ERR_ARG;
 	}
 
+	inc->num_workers = g_variant_get_uint32(g_hash_table_lookup(options, "workers"));
+	if (inc->num_workers == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		inc->num_workers = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+#else
+		inc->num_workers = 1;
+#endif
+	}
+
 	return SR_OK;
 }
 
@@ -469,61 +716,54 @@ static const char *get_line_termination(GString *buf)
 	return term;
 }
 
-static int initial_parse(const struct sr_input *in, GString *buf)
+static int initial_parse(const struct sr_input *in, const char *data, gsize len)
 {
 	struct context *inc;
 	GString *channel_name;
-	gsize num_columns, l, i;
-	unsigned int line_number;
+	struct column *columns;
+	const char *s, *end, *nl;
+	struct parser p;
+	gsize num_columns, i;
 	int ret;
-	char **lines, **columns;
 
 	ret = SR_OK;
 	inc = in->priv;
 	columns = NULL;
 
-	line_number = 0;
-	lines = g_strsplit_set(buf->str, "\r\n", 0);
-	for (l = 0; lines[l]; l++) {
-		line_number++;
-		if (inc->start_line > line_number) {
-			sr_spew("Line %zu skipped.", line_number);
-			continue;
-		}
-		if (lines[l][0] == '\0') {
-			sr_spew("Blank line %zu skipped.", line_number);
+	memset(&p, 0, sizeof(p));
+	p.report = TRUE;
+	end = data + len;
+	for (s = data; (nl = memchr(s, inc->term_char, end - s)); s = nl + 1) {
+		p.line_number++;
+		if (inc->start_line > p.line_number) {
+			sr_spew("Line %zu skipped.", p.line_number);
 			continue;
 		}
-		strip_comment(lines[l], inc->comment);
-		if (lines[l][0] == '\0') {
-			sr_spew("Comment-only line %zu skipped.", line_number);
-			continue;
-		}
-
-		/* Reached first proper line. */
-		break;
+		end = nl;
+		if (line_content(inc, &p, &s, &end))
+			/* Reached first proper line. */
+			break;
+		end = data + len;
 	}
-	if (!lines[l]) {
+	if (!nl) {
 		/* Not enough data for a proper line yet. */
-		ret = SR_ERR_NA;
-		goto out;
+		return SR_ERR_NA;
 	}
 
 	/*
 	 * In order to determine the number of columns parse the current line
 	 * without limiting the number of columns.
 	 */
-	if (!(columns = parse_line(lines[l], inc, -1))) {
-		sr_err("Error while parsing line %zu.", line_number);
-		ret = SR_ERR;
-		goto out;
-	}
-	num_columns = g_strv_length(columns);
+	num_columns = 1;
+	for (nl = s; (nl = find_str(nl, end, inc->delimiter)); nl += inc->delimiter->len)
+		num_columns++;
+	columns = g_malloc(num_columns * sizeof(struct column));
+	num_columns = parse_line(s, end, inc, columns, num_columns);
 
 	/* Ensure that the first column is not out of bounds. */
 	if (!num_columns) {
 		sr_err("Column %zu in line %zu is out of bounds.",
-			inc->first_column, line_number);
+			inc->first_column, p.line_number);
 		ret = SR_ERR;
 		goto out;
 	}
@@ -545,7 +785,7 @@ static int initial_parse(const struct sr_input *in, GString *buf)
 		 */
 		if (num_columns < inc->num_channels) {
 			sr_err("Not enough columns for desired number of channels in line %zu.",
-				line_number);
+				p.line_number);
 			ret = SR_ERR;
 			goto out;
 		}
@@ -553,25 +793,33 @@ static int initial_parse(const struct sr_input *in, GString *buf)
 
 	channel_name = g_string_sized_new(64);
 	for (i = 0; i < inc->num_channels; i++) {
-		if (inc->header && inc->multi_column_mode && strlen(columns[i]))
-			g_string_assign(channel_name, columns[i]);
+		if (inc->header && inc->multi_column_mode && columns[i].len)
+			g_string_append_len(g_string_truncate(channel_name, 0),
+				columns[i].str, columns[i].len);
 		else
 			g_string_printf(channel_name, "%zu", i);
 		sr_channel_new(in->sdi, i, SR_CHANNEL_LOGIC, TRUE, channel_name->str);
 	}
 	g_string_free(channel_name, TRUE);
 
+	/* Limit the number of columns to parse. */
+	if (inc->multi_column_mode)
+		inc->max_columns = inc->num_channels;
+	else
+		inc->max_columns = 1;
+
 	/*
 	 * Calculate the minimum buffer size to store the sample data of the
 	 * channels.
 	 */
 	inc->sample_buffer_size = (inc->num_channels + 7) >> 3;
-	inc->sample_buffer = g_malloc(inc->sample_buffer_size);
+	parser_init(&inc->parser, inc,
+		MAX(CHUNK_SIZE / inc->sample_buffer_size, 1), TRUE);
+
+	workers_start(inc);
 
 out:
-	if (columns)
-		g_strfreev(columns);
-	g_strfreev(lines);
+	g_free(columns);
 
 	return ret;
 }
@@ -579,10 +827,8 @@ out:
 static int initial_receive(const struct sr_input *in)
 {
 	struct context *inc;
-	GString *new_buf;
-	int len, ret;
-	char *p;
 	const char *termination;
+	int ret;
 
 	inc = in->priv;
 
@@ -590,144 +836,223 @@ static int initial_receive(const struct sr_input *in)
 		/* Don't have a full line yet. */
 		return SR_ERR_NA;
 
-	if (!(p = g_strrstr_len(in->buf->str, in->buf->len, termination)))
-		/* Don't have a full line yet. */
-		return SR_ERR_NA;
-	len = p - in->buf->str - 1;
-	new_buf = g_string_new_len(in->buf->str, len);
-	g_string_append_c(new_buf, '\0');
-
-	inc->termination = g_strdup(termination);
-
-	if (in->buf->str[0] != '\0')
-		ret = initial_parse(in, new_buf);
-	else
-		ret = SR_OK;
-
-	g_string_free(new_buf, TRUE);
+	inc->term_char = termination[strlen(termination) - 1];
+	if ((ret = initial_parse(in, in->buf->str, in->buf->len)) == SR_OK)
+		inc->termination = g_strdup(termination);
 
 	return ret;
 }
 
-static int process_buffer(struct sr_input *in)
+static void send_header(const struct sr_input *in)
 {
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_meta meta;
 	struct sr_config *src;
 	struct context *inc;
-	gsize num_columns;
 	uint64_t samplerate;
-	int max_columns, ret, l;
-	char *p, **lines, **columns;
 
 	inc = in->priv;
-	if (!inc->started) {
-		std_session_send_df_header(in->sdi, LOG_PREFIX);
-
-		if (inc->samplerate) {
-			packet.type = SR_DF_META;
-			packet.payload = &meta;
-			samplerate = inc->samplerate;
-			src = sr_config_new(SR_CONF_SAMPLERATE, g_variant_new_uint64(samplerate));
-			meta.config = g_slist_append(NULL, src);
-			sr_session_send(in->sdi, &packet);
-			sr_config_free(src);
-		}
-
-		inc->started = TRUE;
+	std_session_send_df_header(in->sdi, LOG_PREFIX);
+
+	if (inc->samplerate) {
+		packet.type = SR_DF_META;
+		packet.payload = &meta;
+		samplerate = inc->samplerate;
+		src = sr_config_new(SR_CONF_SAMPLERATE, g_variant_new_uint64(samplerate));
+		meta.config = g_slist_append(NULL, src);
+		sr_session_send(in->sdi, &packet);
+		sr_config_free(src);
 	}
 
-	if (!(p = g_strrstr_len(in->buf->str, in->buf->len, inc->termination)))
-		/* Don't have a full line. */
-		return SR_ERR;
+	inc->started = TRUE;
+}
 
-	*p = '\0';
-	g_strstrip(in->buf->str);
+/* Parse the line in [s, end) on the session thread. */
+static int process_line(const struct sr_input *in, const char *s,
+		const char *end)
+{
+	struct context *inc;
+	struct parser *p;
+	int ret;
 
-	/* Limit the number of columns to parse. */
-	if (inc->multi_column_mode)
-		max_columns = inc->num_channels;
-	else
-		max_columns = 1;
+	inc = in->priv;
+	p = &inc->parser;
+	p->line_number++;
+	if (inc->start_line > p->line_number) {
+		sr_spew("Line %zu skipped.", p->line_number);
+		return SR_OK;
+	}
 
-	ret = SR_OK;
-	lines = g_strsplit_set(in->buf->str, "\r\n", 0);
-	for (l = 0; lines[l]; l++) {
-		inc->line_number++;
-		if (lines[l][0] == '\0') {
-			sr_spew("Blank line %zu skipped.", inc->line_number);
-			continue;
+	/* Skip the header line, its content was used as the channel names. */
+	if (inc->header) {
+		if (line_content(inc, p, &s, &end)) {
+			sr_spew("Header line %zu skipped.", p->line_number);
+			inc->header = FALSE;
 		}
+		return SR_OK;
+	}
 
-		/* Remove trailing comment. */
-		strip_comment(lines[l], inc->comment);
-		if (lines[l][0] == '\0') {
-			sr_spew("Comment-only line %zu skipped.", inc->line_number);
-			continue;
-		}
+	if ((ret = parse_sample(inc, p, s, end)) != SR_OK)
+		return ret;
 
-		/* Skip the header line, its content was used as the channel names. */
-		if (inc->header) {
-			sr_spew("Header line %zu skipped.", inc->line_number);
-			inc->header = FALSE;
-			continue;
-		}
+	if (p->num_samples == p->max_samples)
+		return flush_samples(in);
 
-		if (!(columns = parse_line(lines[l], inc, max_columns))) {
-			sr_err("Error while parsing line %zu.", inc->line_number);
-			return SR_ERR;
-		}
-		num_columns = g_strv_length(columns);
-		if (!num_columns) {
-			sr_err("Column %zu in line %zu is out of bounds.",
-				inc->first_column, inc->line_number);
-			g_strfreev(columns);
-			return SR_ERR;
-		}
-		/*
-		 * Ensure that the number of channels does not exceed the number
-		 * of columns in multi column mode.
-		 */
-		if (inc->multi_column_mode && num_columns < inc->num_channels) {
-			sr_err("Not enough columns for desired number of channels in line %zu.",
-				inc->line_number);
-			g_strfreev(columns);
-			return SR_ERR;
-		}
+	return SR_OK;
+}
+
+/*
+ * Split [data, data + len), which ends with a complete line, into one
+ * segment per worker and parse them in parallel. The samples are sent in
+ * order once all workers are done.
+ */
+static int process_parallel(const struct sr_input *in, const char *data,
+		gsize len)
+{
+	struct context *inc;
+	struct segment *seg;
+	const char *s, *e, *end;
+	gsize num_segments, i;
+	int ret;
 
-		if (inc->multi_column_mode)
-			ret = parse_multi_columns(columns, inc);
+	inc = in->priv;
+	num_segments = MIN(inc->num_workers, len / MIN_SEGMENT_SIZE);
+
+	/* Samples parsed so far go first. */
+	if ((ret = flush_samples(in)) != SR_OK)
+		return ret;
+
+	end = data + len;
+	s = data;
+	for (i = 0; i < num_segments; i++) {
+		seg = &inc->segments[i];
+		/* Split after the line crossing the even split point. */
+		e = MAX(s, data + len / num_segments * (i + 1));
+		if (i < num_segments - 1 && e < end)
+			e = (const char *)memchr(e, inc->term_char, end - e) + 1;
 		else
-			ret = parse_single_column(columns[0], inc);
-		if (ret != SR_OK) {
-			g_strfreev(columns);
+			e = end;
+		seg->start = s;
+		seg->end = e;
+		seg->parser.num_samples = 0;
+		seg->parser.line_number = 0;
+		seg->error_start = NULL;
+		s = e;
+	}
+
+	inc->pending = num_segments;
+	for (i = 0; i < num_segments; i++)
+		g_thread_pool_push(inc->workers, &inc->segments[i], NULL);
+	g_mutex_lock(&inc->mutex);
+	while (inc->pending)
+		g_cond_wait(&inc->cond, &inc->mutex);
+	g_mutex_unlock(&inc->mutex);
+
+	for (i = 0; i < num_segments; i++) {
+		seg = &inc->segments[i];
+		ret = sr_input_send_logic(in, seg->parser.samples,
+			seg->parser.num_samples * inc->sample_buffer_size,
+			NULL, NULL);
+		if (ret != SR_OK)
+			return ret;
+		inc->parser.line_number += seg->parser.line_number;
+		if (seg->error_start) {
+			/* Parse the line again, to report the error. */
+			process_line(in, seg->error_start, seg->error_end);
 			return SR_ERR;
 		}
+	}
 
-		/* Send sample data to the session bus. */
-		ret = send_samples(in->sdi, inc->sample_buffer,
-			inc->sample_buffer_size, 1);
-		if (ret != SR_OK) {
-			sr_err("Sending samples failed.");
-			return SR_ERR;
+	return SR_OK;
+}
+
+/*
+ * Process all complete lines in [data, data + len) in place. On return,
+ * consumed holds the number of bytes up to and including the last
+ * termination that was processed.
+ */
+static int process_lines(const struct sr_input *in, const char *data,
+		gsize len, gsize *consumed)
+{
+	struct context *inc;
+	const char *p, *end, *nl, *eol;
+	gboolean parallel;
+	gsize n;
+	int ret;
+
+	inc = in->priv;
+	ret = SR_OK;
+	end = data + len;
+	parallel = inc->workers != NULL;
+	for (p = data; p < end; p = nl + 1) {
+		/*
+		 * Once the start line and the header are behind, the lines
+		 * don't depend on each other and can be split across workers.
+		 */
+		if (parallel && !inc->header
+				&& inc->parser.line_number + 1 >= inc->start_line) {
+			parallel = FALSE;
+			for (n = end - p; n > 0 && p[n - 1] != inc->term_char; n--);
+			if (n >= 2 * MIN_SEGMENT_SIZE) {
+				ret = process_parallel(in, p, n);
+				p += n;
+				break;
+			}
 		}
-		g_strfreev(columns);
+		if (!(nl = line_end(inc, p, end, &eol)))
+			break;
+		if ((ret = process_line(in, p, eol)) != SR_OK)
+			break;
 	}
-	g_strfreev(lines);
-	g_string_erase(in->buf, 0, p - in->buf->str + 1);
+	*consumed = p - data;
 
 	return ret;
 }
 
-static int receive(struct sr_input *in, GString *buf)
+/*
+ * Process new data without copying it. Only a partial line at the end of
+ * the data is kept in in->buf, to be completed by the next call.
+ */
+static int process_buffer(struct sr_input *in, const char *data, gsize len)
 {
 	struct context *inc;
+	const char *nl;
+	gsize n, consumed;
 	int ret;
 
-	g_string_append_len(in->buf, buf->str, buf->len);
+	inc = in->priv;
+	if (!inc->started)
+		send_header(in);
+
+	if (in->buf->len) {
+		/* Complete the pending line with the start of the new data. */
+		nl = len ? memchr(data, inc->term_char, len) : NULL;
+		n = nl ? (gsize)(nl - data) + 1 : len;
+		g_string_append_len(in->buf, data, n);
+		data += n;
+		len -= n;
+
+		ret = process_lines(in, in->buf->str, in->buf->len, &consumed);
+		if (ret != SR_OK)
+			return ret;
+		g_string_erase(in->buf, 0, consumed);
+	}
+
+	if ((ret = process_lines(in, data, len, &consumed)) != SR_OK)
+		return ret;
+	g_string_append_len(in->buf, data + consumed, len - consumed);
+
+	return flush_samples(in);
+}
+
+static int receive(struct sr_input *in, GString *buf)
+{
+	struct context *inc;
+	int ret;
 
 	inc = in->priv;
 	if (!inc->termination) {
+		g_string_append_len(in->buf, buf->str, buf->len);
 		if ((ret = initial_receive(in)) == SR_ERR_NA)
 			/* Not enough data yet. */
 			return SR_OK;
@@ -739,9 +1064,7 @@ static int receive(struct sr_input *in, GString *buf)
 		return SR_OK;
 	}
 
-	ret = process_buffer(in);
-
-	return ret;
+	return process_buffer(in, buf->str, buf->len);
 }
 
 static int end(struct sr_input *in)
@@ -750,10 +1073,19 @@ static int end(struct sr_input *in)
 	struct sr_datafeed_packet packet;
 	int ret;
 
-	if (in->sdi_ready)
-		ret = process_buffer(in);
-	else
+	if (in->sdi_ready) {
+		ret = process_buffer(in, "", 0);
+		if (ret == SR_OK && in->buf->len) {
+			/* The last line lacks a termination. */
+			ret = process_line(in, in->buf->str,
+				in->buf->str + in->buf->len);
+			if (ret == SR_OK)
+				ret = flush_samples(in);
+		}
+		g_string_truncate(in->buf, 0);
+	} else {
 		ret = SR_OK;
+	}
 
 	inc = in->priv;
 	if (inc->started) {
@@ -778,7 +1110,8 @@ static void cleanup(struct sr_input *in)
 		g_string_free(inc->comment, TRUE);
 
 	g_free(inc->termination);
-	g_free(inc->sample_buffer);
+	workers_stop(inc);
+	parser_free(&inc->parser);
 }
 
 static struct sr_option options[] = {
@@ -791,6 +1124,7 @@ static struct sr_option options[] = {
 	{ "first-channel", "First channel", "Column number of first channel", NULL, NULL },
 	{ "header", "Header", "Treat first line as header with channel names", NULL, NULL },
 	{ "startline", "Start line", "Line number at which to start processing samples", NULL, NULL },
+	{ "workers", "Workers", "Number of parsing threads (0 = one per CPU)", NULL, NULL },
 	ALL_ZERO
 };
 
@@ -806,6 +1140,7 @@ static struct sr_option *get_options(void)
 		options[6].def = g_variant_ref_sink(g_variant_new_int32(0));
 		options[7].def = g_variant_ref_sink(g_variant_new_boolean(FALSE));
 		options[8].def = g_variant_ref_sink(g_variant_new_int32(1));
+		options[9].def = g_variant_ref_sink(g_variant_new_uint32(1));
 	}
 
 	return options;
@@ -30,6 +30,14 @@
 #define LOG_PREFIX "input"
 /** @endcond */
 
+/* Largest logic packet sent by sr_input_send_logic(), in bytes. */
+#define LOGIC_CHUNK_SIZE (1024 * 1024)
+
+/* Chunks of a mapped file passed to receive() until the device is ready. */
+#define FILE_HEADER_CHUNK_SIZE (64 * 1024)
+/* Chunks passed to receive() by modules which can't use the mapping. */
+#define FILE_CHUNK_SIZE (4 * 1024 * 1024)
+
 /**
  * @file
  *
@@ -515,6 +523,130 @@ SR_API int sr_input_scan_file(const char *filename, const struct sr_input **in)
 	return ret;
 }
 
+/**
+ * Get the smallest unitsize which holds all logic channels of an input
+ * instance's device.
+ *
+ * @param in The input instance. Its device instance must have all its
+ *           channels.
+ *
+ * @return The unitsize in bytes, at least 1.
+ *
+ * @private
+ */
+SR_PRIV unsigned int sr_input_logic_unitsize(const struct sr_input *in)
+{
+	const struct sr_channel *ch;
+	unsigned int num_channels;
+	GSList *l;
+
+	num_channels = 0;
+	for (l = in->sdi->channels; l; l = l->next) {
+		ch = l->data;
+		if (ch->type == SR_CHANNEL_LOGIC)
+			num_channels++;
+	}
+
+	return MAX((num_channels + 7) / 8, 1);
+}
+
+/**
+ * Send logic samples on behalf of an input module.
+ *
+ * The samples are sent in as few packets as reasonable, with the unitsize
+ * given by sr_input_logic_unitsize(). Input modules should collect as many
+ * samples as they have at hand, rather than send them one at a time.
+ *
+ * @param in The input instance.
+ * @param data The samples, packed into sr_input_logic_unitsize() bytes
+ *             each.
+ * @param len Size of data in bytes. A trailing partial sample is not
+ *            sent.
+ * @param buf Buffer holding data, or NULL. See sr_session_send_buffer().
+ * @param used Number of bytes sent, i.e. len rounded down to a whole
+ *             number of samples. Can be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval other Error sending the samples.
+ *
+ * @private
+ */
+SR_PRIV int sr_input_send_logic(const struct sr_input *in, const uint8_t *data,
+		gsize len, struct sr_buffer *buf, gsize *used)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	gsize size, max_size, i;
+	int ret;
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.unitsize = sr_input_logic_unitsize(in);
+
+	/* Cut off at multiple of unitsize. */
+	size = len / logic.unitsize * logic.unitsize;
+	max_size = MAX(LOGIC_CHUNK_SIZE / logic.unitsize, 1) * logic.unitsize;
+	if (used)
+		*used = size;
+
+	for (i = 0; i < size; i += logic.length) {
+		logic.data = (uint8_t *)data + i;
+		logic.length = MIN(max_size, size - i);
+		if ((ret = sr_session_send_buffer(in->sdi, &packet, buf)) != SR_OK) {
+			sr_err("Sending samples failed.");
+			return ret;
+		}
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Send logic samples from a mapped file, for a module's receive_mapped().
+ *
+ * Samples left in the instance's buffer by earlier calls are sent first,
+ * the partial sample at its end completed from data. The samples in data
+ * are then sent from the mapping, without being copied. A trailing partial
+ * sample is kept in the instance's buffer.
+ *
+ * @param in The input instance.
+ * @param data The mapped samples, packed into sr_input_logic_unitsize()
+ *             bytes each.
+ * @param len Size of data in bytes.
+ * @param buf Buffer holding data. See sr_session_send_buffer().
+ *
+ * @retval SR_OK Success.
+ * @retval other Error sending the samples.
+ *
+ * @private
+ */
+SR_PRIV int sr_input_send_logic_mapped(struct sr_input *in,
+		const uint8_t *data, gsize len, struct sr_buffer *buf)
+{
+	gsize n, used;
+	int ret;
+
+	if (in->buf->len > 0) {
+		n = in->buf->len % sr_input_logic_unitsize(in);
+		if (n > 0) {
+			n = MIN(len, sr_input_logic_unitsize(in) - n);
+			g_string_append_len(in->buf, (const char *)data, n);
+			data += n;
+			len -= n;
+		}
+		ret = sr_input_send_logic(in, (const uint8_t *)in->buf->str,
+				in->buf->len, NULL, &used);
+		g_string_erase(in->buf, 0, used);
+		if (ret != SR_OK)
+			return ret;
+	}
+
+	ret = sr_input_send_logic(in, data, len, buf, &n);
+	g_string_append_len(in->buf, (const char *)data + n, len - n);
+
+	return ret;
+}
+
 /**
  * Return the input instance's (virtual) device instance. This can be
  * used to find out the number of channels and other information.
@@ -553,6 +685,111 @@ SR_API int sr_input_send(const struct sr_input *in, GString *buf)
 	return in->module->receive((struct sr_input *)in, buf);
 }
 
+/* Pass part of the mapped file to the module's receive(). */
+static int send_file_chunks(struct sr_input *in, gsize chunk_size,
+		gboolean until_ready)
+{
+	GString *buf;
+	gsize len;
+	int ret;
+
+	ret = SR_OK;
+	buf = g_string_sized_new(chunk_size);
+	while (in->file_offset < in->file_buf->size) {
+		if (until_ready && in->sdi_ready)
+			break;
+		len = MIN(chunk_size, in->file_buf->size - in->file_offset);
+		g_string_truncate(buf, 0);
+		g_string_append_len(buf, (const char *)in->file_buf->data
+				+ in->file_offset, len);
+		in->file_offset += len;
+		if ((ret = in->module->receive(in, buf)) != SR_OK)
+			break;
+	}
+	g_string_free(buf, TRUE);
+
+	return ret;
+}
+
+/**
+ * Send the contents of a file to the specified input instance.
+ *
+ * This works like reading the file and passing it to sr_input_send(),
+ * but the file is mapped into memory instead. Modules for fixed layout
+ * formats send packets which point straight into the mapping, so the
+ * file's contents aren't copied at all.
+ *
+ * Like sr_input_send(), this returns as soon as the device instance is
+ * ready, so the caller can examine it and add it to a session. Calling
+ * it again with the same file sends the rest. Once the whole file was
+ * sent, further calls do nothing. sr_input_end() must still be called.
+ *
+ * @param in The input instance. Must not be NULL.
+ * @param filename The file to send. Must not be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval SR_ERR The file couldn't be mapped.
+ * @retval other Error returned by the input module.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_input_send_file(const struct sr_input *in, const char *filename)
+{
+	struct sr_input *inst;
+	GMappedFile *file;
+	GError *error;
+	gsize offset;
+	int ret;
+
+	if (!in || !filename) {
+		sr_err("%s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	inst = (struct sr_input *)in;
+	if (inst->file_buf && strcmp(inst->file_name, filename)) {
+		sr_err("%s: already sending %s", __func__, inst->file_name);
+		return SR_ERR_ARG;
+	}
+
+	if (!inst->file_buf) {
+		error = NULL;
+		if (!(file = g_mapped_file_new(filename, FALSE, &error))) {
+			sr_err("Failed to map %s: %s.", filename, error->message);
+			g_error_free(error);
+			return SR_ERR;
+		}
+		inst->file_buf = sr_buffer_new_wrap(
+				g_mapped_file_get_contents(file),
+				g_mapped_file_get_length(file),
+				(GDestroyNotify)g_mapped_file_unref, file);
+		inst->file_name = g_strdup(filename);
+		inst->file_offset = 0;
+		sr_dbg("Mapped %s, %" G_GSIZE_FORMAT " bytes.", filename,
+				inst->file_buf->size);
+	}
+
+	if (!inst->sdi_ready) {
+		/* Small chunks, the header is all that's needed for now. */
+		return send_file_chunks(inst, FILE_HEADER_CHUNK_SIZE, TRUE);
+	}
+
+	if (!in->module->receive_mapped)
+		return send_file_chunks(inst, FILE_CHUNK_SIZE, FALSE);
+
+	offset = inst->file_offset;
+	if (offset == inst->file_buf->size)
+		return SR_OK;
+	inst->file_offset = inst->file_buf->size;
+	sr_spew("Sending %" G_GSIZE_FORMAT " mapped bytes to %s module.",
+			inst->file_buf->size - offset, in->module->id);
+	ret = in->module->receive_mapped(inst, inst->file_buf->data + offset,
+			inst->file_buf->size - offset, inst->file_buf);
+
+	return ret;
+}
+
 /**
  * Signal the input module no more data will come.
  *
@@ -586,6 +823,9 @@ SR_API void sr_input_free(const struct sr_input *in)
 		sr_warn("Found %d unprocessed bytes at free time.", in->buf->len);
 	}
 	g_string_free(in->buf, TRUE);
+	/* Packets still in flight keep the mapping alive. */
+	sr_buffer_unref(in->file_buf);
+	g_free(in->file_name);
 	g_free(in->priv);
 	g_free((gpointer)in);
 }
@@ -22,7 +22,9 @@
  *
  * numchannels: Maximum number of channels to use. The channels are
  *              detected in the same order as they are listed
- *              in the $var sections of the VCD file.
+ *              in the $var sections of the VCD file. Each bit of
+ *              a vector variable takes one channel. Default 0 uses
+ *              all channels in the file.
  *
  * skip:        Allows skipping until given timestamp in the file.
  *              This can speed up analyzing of long captures.
@@ -45,16 +47,15 @@
  * Based on Verilog standard IEEE Std 1364-2001 Version C
  *
  * Supported features:
- * - $var with 'wire' and 'reg' types of scalar variables
+ * - $var with 'wire' and 'reg' types of scalar and vector variables
  * - $timescale definition for samplerate
  * - multiple character variable identifiers
+ * - any number of channels
  *
  * Most important unsupported features:
- * - vector variables (bit vectors etc.)
  * - analog, integer and real number variables
  * - $dumpvars initial value declaration
  * - $scope namespaces
- * - more than 64 channels
  */
 
 #include <stdlib.h>
@@ -66,9 +67,6 @@
 
 #define LOG_PREFIX "input/vcd"
 
-#define DEFAULT_NUM_CHANNELS 8
-#define CHUNKSIZE 1024
-
 struct context {
 	gboolean started;
 	gboolean got_header;
@@ -80,11 +78,20 @@ struct context {
 	int64_t skip;
 	gboolean skip_until_end;
 	GSList *channels;
+	/* Maps identifiers to their struct vcd_channel. */
+	GHashTable *identifiers;
+	unsigned int unitsize;
+	uint64_t prev_timestamp;
+	/* Current value of all channels. */
+	uint8_t *prev_values;
 };
 
 struct vcd_channel {
 	gchar *name;
 	gchar *identifier;
+	/* Channel of the least significant bit, and number of bits. */
+	unsigned int index;
+	unsigned int width;
 };
 
 /*
@@ -121,10 +128,10 @@ static gboolean parse_section(GString *buf, gchar **name, gchar **contents)
 		pos++;
 
 	/* Read the content. */
-	while (pos < buf->len - 4 && strncmp(buf->str + pos, "$end", 4))
+	while (pos + 4 <= buf->len && strncmp(buf->str + pos, "$end", 4))
 		g_string_append_c(scontent, buf->str[pos++]);
 
-	if (sname->len && pos < buf->len - 4 && !strncmp(buf->str + pos, "$end", 4)) {
+	if (sname->len && pos + 4 <= buf->len && !strncmp(buf->str + pos, "$end", 4)) {
 		status = TRUE;
 		pos += 4;
 		while (pos < buf->len && g_ascii_isspace(buf->str[pos]))
@@ -162,6 +169,40 @@ static void remove_empty_parts(gchar **parts)
 	*dest = NULL;
 }
 
+/* Create one channel per bit of each variable, and size the samples. */
+static void create_channels(const struct sr_input *in)
+{
+	struct context *inc;
+	struct vcd_channel *vcd_ch;
+	GString *name;
+	GSList *l;
+	unsigned int i;
+	char *p;
+
+	inc = in->priv;
+	name = g_string_sized_new(64);
+	for (l = inc->channels; l; l = l->next) {
+		vcd_ch = l->data;
+		if (vcd_ch->width == 1) {
+			sr_channel_new(in->sdi, vcd_ch->index, SR_CHANNEL_LOGIC,
+					TRUE, vcd_ch->name);
+			continue;
+		}
+		/* Vector bits are named after their index, LSB first. */
+		if ((p = strchr(vcd_ch->name, '[')))
+			*p = '\0';
+		for (i = 0; i < vcd_ch->width; i++) {
+			g_string_printf(name, "%s[%u]", vcd_ch->name, i);
+			sr_channel_new(in->sdi, vcd_ch->index + i,
+					SR_CHANNEL_LOGIC, TRUE, name->str);
+		}
+	}
+	g_string_free(name, TRUE);
+
+	inc->unitsize = (inc->channelcount + 7) / 8;
+	inc->prev_values = g_malloc0(inc->unitsize);
+}
+
 /*
  * Parse VCD header to get values for context structure.
  * The context structure should be zeroed before calling this.
@@ -173,6 +214,8 @@ static gboolean parse_header(const struct sr_input *in, GString *buf)
 	struct context *inc;
 	gboolean status;
 	gchar *name, *contents, **parts;
+	unsigned int num_parts;
+	long width;
 
 	inc = in->priv;
 	name = contents = NULL;
@@ -201,27 +244,40 @@ static gboolean parse_header(const struct sr_input *in, GString *buf)
 				sr_err("Parsing timescale failed.");
 			}
 		} else if (g_strcmp0(name, "var") == 0) {
-			/* Format: $var type size identifier reference $end */
+			/* Format: $var type size identifier reference [range] $end */
 			parts = g_strsplit_set(contents, " \r\n\t", 0);
 			remove_empty_parts(parts);
+			num_parts = g_strv_length(parts);
+			width = num_parts > 1 ? strtol(parts[1], NULL, 10) : 0;
 
-			if (g_strv_length(parts) != 4)
-				sr_warn("$var section should have 4 items");
+			if (num_parts != 4 && num_parts != 5)
+				sr_warn("$var section should have 4 or 5 items");
 			else if (g_strcmp0(parts[0], "reg") != 0 && g_strcmp0(parts[0], "wire") != 0)
 				sr_info("Unsupported signal type: '%s'", parts[0]);
-			else if (strtol(parts[1], NULL, 10) != 1)
+			else if (width < 1)
 				sr_info("Unsupported signal size: '%s'", parts[1]);
-			else if (inc->channelcount >= inc->maxchannels)
+			else if (g_hash_table_lookup(inc->identifiers, parts[2]))
+				sr_info("Skipping '%s', its identifier '%s' is already used.",
+						parts[3], parts[2]);
+			else if (inc->maxchannels && inc->channelcount + width > inc->maxchannels)
 				sr_warn("Skipping '%s' because only %d channels requested.",
 						parts[3], inc->maxchannels);
 			else {
-				sr_info("Channel %d is '%s' identified by '%s'.",
-						inc->channelcount, parts[3], parts[2]);
+				if (width == 1)
+					sr_info("Channel %d is '%s' identified by '%s'.",
+							inc->channelcount, parts[3], parts[2]);
+				else
+					sr_info("Channels %d-%d are '%s' identified by '%s'.",
+							inc->channelcount, inc->channelcount + width - 1,
+							parts[3], parts[2]);
 				vcd_ch = g_malloc(sizeof(struct vcd_channel));
 				vcd_ch->identifier = g_strdup(parts[2]);
 				vcd_ch->name = g_strdup(parts[3]);
+				vcd_ch->index = inc->channelcount;
+				vcd_ch->width = width;
 				inc->channels = g_slist_append(inc->channels, vcd_ch);
-				inc->channelcount++;
+				g_hash_table_insert(inc->identifiers, vcd_ch->identifier, vcd_ch);
+				inc->channelcount += width;
 			}
 
 			g_strfreev(parts);
@@ -233,6 +289,13 @@ static gboolean parse_header(const struct sr_input *in, GString *buf)
 	g_free(name);
 	g_free(contents);
 
+	if (status && !inc->channelcount) {
+		sr_err("No supported channels found.");
+		status = FALSE;
+	}
+	if (status)
+		create_channels(in);
+
 	inc->got_header = status;
 
 	return status;
@@ -259,35 +322,48 @@ static int format_match(GHashTable *metadata)
 	return status ? SR_OK : SR_ERR;
 }
 
-/* Send N samples of the given value. */
-static void send_samples(const struct sr_dev_inst *sdi, uint64_t sample, uint64_t count)
+/*
+ * The channels keep their values until the next timestamp, which can be
+ * far off. Send that as a single sample with a repeat count, the session
+ * expands it for consumers which need every sample.
+ */
+static void send_samples(const struct sr_input *in, uint64_t count)
 {
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
-	uint64_t buffer[CHUNKSIZE];
-	uint64_t i;
-	unsigned chunksize = CHUNKSIZE;
-
-	if (count < chunksize)
-		chunksize = count;
-
-	for (i = 0; i < chunksize; i++)
-		buffer[i] = sample;
+	struct sr_datafeed_logic_repeat repeat;
+	struct context *inc;
 
-	packet.type = SR_DF_LOGIC;
-	packet.payload = &logic;
-	logic.unitsize = sizeof(uint64_t);
-	logic.data = buffer;
+	inc = in->priv;
+	packet.type = SR_DF_LOGIC_REPEAT;
+	packet.payload = &repeat;
+	repeat.count = count;
+	repeat.unitsize = inc->unitsize;
+	repeat.data = inc->prev_values;
+	sr_session_send(in->sdi, &packet);
+}
 
-	while (count) {
-		if (count < chunksize)
-			chunksize = count;
+static void set_bit(uint8_t *sample, unsigned int bit, gboolean value)
+{
+	if (value)
+		sample[bit / 8] |= 1 << (bit % 8);
+	else
+		sample[bit / 8] &= ~(1 << (bit % 8));
+}
 
-		logic.length = sizeof(uint64_t) * chunksize;
+/*
+ * Set the channels of a vector variable from a binary value, MSB first.
+ * Values shorter than the vector are extended with zeroes, x and z bits
+ * read as zero.
+ */
+static void set_vector(struct context *inc, const struct vcd_channel *vcd_ch,
+		const char *value)
+{
+	unsigned int i, len;
 
-		sr_session_send(sdi, &packet);
-		count -= chunksize;
-	}
+	len = strlen(value);
+	for (i = 0; i < vcd_ch->width; i++)
+		set_bit(inc->prev_values, vcd_ch->index + i,
+				i < len && value[len - i - 1] == '1');
 }
 
 /* Parse a set of lines from the data section. */
@@ -295,13 +371,12 @@ static void parse_contents(const struct sr_input *in, char *data)
 {
 	struct context *inc;
 	struct vcd_channel *vcd_ch;
-	GSList *l;
-	uint64_t timestamp, prev_timestamp, prev_values;
-	unsigned int bit, i, j;
-	char **tokens;
+	uint64_t timestamp;
+	unsigned int i;
+	gboolean bit;
+	char **tokens, *value, *identifier;
 
 	inc = in->priv;
-	prev_timestamp = prev_values = 0;
 
 	/* Read one space-delimited token at a time. */
 	tokens = g_strsplit_set(data, " \t\r\n", 0);
@@ -311,8 +386,8 @@ static void parse_contents(const struct sr_input *in, char *data)
 			if (!strcmp(tokens[i], "$end")) {
 				/* Done with unhandled/unknown section. */
 				inc->skip_until_end = FALSE;
-				break;
 			}
+			continue;
 		}
 		if (tokens[i][0] == '#' && g_ascii_isdigit(tokens[i][1])) {
 			/* Numeric value beginning with # is a new timestamp value */
@@ -328,22 +403,22 @@ static void parse_contents(const struct sr_input *in, char *data)
 			 */
 			if (inc->skip < 0) {
 				inc->skip = timestamp;
-				prev_timestamp = timestamp;
+				inc->prev_timestamp = timestamp;
 			} else if (inc->skip > 0 && timestamp < (uint64_t)inc->skip) {
-				prev_timestamp = inc->skip;
-			} else if (timestamp == prev_timestamp) {
+				inc->prev_timestamp = inc->skip;
+			} else if (timestamp == inc->prev_timestamp) {
 				/* Ignore repeated timestamps (e.g. sigrok outputs these) */
 			} else {
-				if (inc->compress != 0 && timestamp - prev_timestamp > inc->compress) {
+				if (inc->compress != 0 && timestamp - inc->prev_timestamp > inc->compress) {
 					/* Compress long idle periods */
-					prev_timestamp = timestamp - inc->compress;
+					inc->prev_timestamp = timestamp - inc->compress;
 				}
 
 				sr_dbg("New timestamp: %" PRIu64, timestamp);
 
 				/* Generate samples from prev_timestamp up to timestamp - 1. */
-				send_samples(in->sdi, prev_values, timestamp - prev_timestamp);
-				prev_timestamp = timestamp;
+				send_samples(in, timestamp - inc->prev_timestamp);
+				inc->prev_timestamp = timestamp;
 			}
 		} else if (tokens[i][0] == '$' && tokens[i][1] != '\0') {
 			/*
@@ -356,44 +431,37 @@ static void parse_contents(const struct sr_input *in, char *data)
 					|| g_strcmp0(tokens[i], "$end") == 0) {
 				/* Ignore, parse contents as normally. */
 			} else {
-				/* Ignore this and future lines until $end. */
+				/* Ignore this and future tokens until $end. */
 				inc->skip_until_end = TRUE;
-				break;
 			}
 		} else if (strchr("bBrR", tokens[i][0]) != NULL) {
-			/* A vector value, not supported yet. */
-			break;
+			/* A vector value, the identifier is the next token. */
+			value = tokens[i] + 1;
+			if (!(identifier = tokens[++i]))
+				/* Missing identifier */
+				break;
+			if (!(vcd_ch = g_hash_table_lookup(inc->identifiers, identifier)))
+				sr_dbg("Did not find channel for identifier '%s'.", identifier);
+			else if (g_ascii_tolower(value[-1]) == 'r')
+				/* Real numbers don't map to logic channels. */
+				sr_dbg("Skipping real value for identifier '%s'.", identifier);
+			else
+				set_vector(inc, vcd_ch, value);
 		} else if (strchr("01xXzZ", tokens[i][0]) != NULL) {
-			/* A new 1-bit sample value */
-			bit = (tokens[i][0] == '1');
-
 			/*
-			 * The identifier is either the next character, or, if
-			 * there was whitespace after the bit, the next token.
+			 * A new 1-bit sample value. The identifier is either the
+			 * next character, or, if there was whitespace after the
+			 * bit, the next token.
 			 */
-			if (tokens[i][1] == '\0') {
-				if (!tokens[++i])
-					/* Missing identifier */
-					continue;
-			} else {
-				for (j = 1; tokens[i][j]; j++)
-					tokens[i][j - 1] = tokens[i][j];
-				tokens[i][j - 1] = '\0';
-			}
-
-			for (j = 0, l = inc->channels; j < inc->channelcount && l; j++, l = l->next) {
-				vcd_ch = l->data;
-				if (g_strcmp0(tokens[i], vcd_ch->identifier) == 0) {
-					/* Found our channel */
-					if (bit)
-						prev_values |= (uint64_t)1 << j;
-					else
-						prev_values &= ~((uint64_t)1 << j);
-					break;
-				}
-			}
-			if (j == inc->channelcount)
-				sr_dbg("Did not find channel for identifier '%s'.", tokens[i]);
+			bit = tokens[i][0] == '1';
+			identifier = tokens[i] + 1;
+			if (identifier[0] == '\0' && !(identifier = tokens[++i]))
+				/* Missing identifier */
+				break;
+			if (!(vcd_ch = g_hash_table_lookup(inc->identifiers, identifier)))
+				sr_dbg("Did not find channel for identifier '%s'.", identifier);
+			else
+				set_vector(inc, vcd_ch, bit ? "1" : "0");
 		} else {
 			sr_warn("Skipping unknown token '%s'.", tokens[i]);
 		}
@@ -403,21 +471,17 @@ static void parse_contents(const struct sr_input *in, char *data)
 
 static int init(struct sr_input *in, GHashTable *options)
 {
-	int num_channels, i;
-	char name[16];
+	int num_channels;
 	struct context *inc;
 
 	num_channels = g_variant_get_int32(g_hash_table_lookup(options, "numchannels"));
-	if (num_channels < 1) {
-		sr_err("Invalid value for numchannels: must be at least 1.");
-		return SR_ERR_ARG;
-	}
-	if (num_channels > 64) {
-		sr_err("No more than 64 channels supported.");
+	if (num_channels < 0) {
+		sr_err("Invalid value for numchannels: must be at least 0.");
 		return SR_ERR_ARG;
 	}
 	inc = in->priv = g_malloc0(sizeof(struct context));
 	inc->maxchannels = num_channels;
+	inc->identifiers = g_hash_table_new(g_str_hash, g_str_equal);
 
 	inc->downsample = g_variant_get_int32(g_hash_table_lookup(options, "downsample"));
 	if (inc->downsample < 1)
@@ -430,11 +494,6 @@ static int init(struct sr_input *in, GHashTable *options)
 	in->sdi = g_malloc0(sizeof(struct sr_dev_inst));
 	in->priv = inc;
 
-	for (i = 0; i < num_channels; i++) {
-		snprintf(name, 16, "%d", i);
-		sr_channel_new(in->sdi, i, SR_CHANNEL_LOGIC, TRUE, name);
-	}
-
 	return SR_OK;
 }
 
@@ -539,7 +598,9 @@ static void cleanup(struct sr_input *in)
 	struct context *inc;
 
 	inc = in->priv;
+	g_hash_table_destroy(inc->identifiers);
 	g_slist_free_full(inc->channels, free_channel);
+	g_free(inc->prev_values);
 }
 
 static struct sr_option options[] = {
@@ -553,7 +614,7 @@ static struct sr_option options[] = {
 static struct sr_option *get_options(void)
 {
 	if (!options[0].def) {
-		options[0].def = g_variant_ref_sink(g_variant_new_int32(DEFAULT_NUM_CHANNELS));
+		options[0].def = g_variant_ref_sink(g_variant_new_int32(0));
 		options[1].def = g_variant_ref_sink(g_variant_new_int32(-1));
 		options[2].def = g_variant_ref_sink(g_variant_new_int32(1));
 		options[3].def = g_variant_ref_sink(g_variant_new_int32(0));
@@ -24,13 +24,16 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
 #define LOG_PREFIX "input/wav"
 
-/* How many bytes at a time to process and send to the session bus. */
-#define CHUNK_SIZE 4096
+/* Maximum amount of float data to send per packet, in bytes. */
+#define CHUNK_SIZE (256 * 1024)
 
 /* Minimum size of header + 1 8-bit mono PCM sample. */
 #define MIN_DATA_CHUNK_OFFSET    45
@@ -42,20 +45,116 @@
 #define WAVE_FORMAT_IEEE_FLOAT_  0x0003
 #define WAVE_FORMAT_EXTENSIBLE_  0xfffe
 
+/* Converts a block of count little endian samples to floats. */
+typedef void (*decode_func)(float *dst, const uint8_t *src, gsize count);
+
 struct context {
 	gboolean started;
 	int fmt_code;
 	uint64_t samplerate;
-	int samplesize;
 	int num_channels;
 	int unitsize;
+	decode_func decode;
 	gboolean found_data;
 };
 
+/*
+ * Sample conversion kernels. PCM samples are divided by the maximum of
+ * their type, 8-bit PCM samples are unsigned. The loops are kept simple
+ * enough for the compiler to vectorize, with hand written SSE2 versions
+ * of the common formats.
+ */
+
+static void decode_u8(float *dst, const uint8_t *src, gsize count)
+{
+	const float max = 255;
+	gsize i;
+
+	for (i = 0; i < count; i++)
+		dst[i] = src[i] / max;
+}
+
+static void decode_s16(float *dst, const uint8_t *src, gsize count)
+{
+	const float max = INT16_MAX;
+	gsize i;
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+	__m128 vmax;
+	__m128i v, zero;
+#endif
+
+	i = 0;
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+	vmax = _mm_set1_ps(max);
+	zero = _mm_setzero_si128();
+	for (; i + 8 <= count; i += 8) {
+		v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+		/* Sign extend by unpacking into the upper halves. */
+		_mm_storeu_ps(dst + i, _mm_div_ps(_mm_cvtepi32_ps(
+			_mm_srai_epi32(_mm_unpacklo_epi16(zero, v), 16)), vmax));
+		_mm_storeu_ps(dst + i + 4, _mm_div_ps(_mm_cvtepi32_ps(
+			_mm_srai_epi32(_mm_unpackhi_epi16(zero, v), 16)), vmax));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = RL16S(src + 2 * i) / max;
+}
+
+static void decode_s24(float *dst, const uint8_t *src, gsize count)
+{
+	const float max = 8388607;
+	gsize i;
+	int32_t v;
+
+	for (i = 0; i < count; i++) {
+		/* Put the sign bit in the top and shift back down. */
+		v = (int32_t)((unsigned)src[3 * i + 2] << 24
+				| (unsigned)src[3 * i + 1] << 16
+				| (unsigned)src[3 * i] << 8) >> 8;
+		dst[i] = v / max;
+	}
+}
+
+static void decode_s32(float *dst, const uint8_t *src, gsize count)
+{
+	const float max = INT32_MAX;
+	gsize i;
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+	__m128 vmax;
+#endif
+
+	i = 0;
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+	vmax = _mm_set1_ps(max);
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(dst + i, _mm_div_ps(_mm_cvtepi32_ps(
+			_mm_loadu_si128((const __m128i *)(src + 4 * i))), vmax));
+#endif
+	for (; i < count; i++)
+		dst[i] = RL32S(src + 4 * i) / max;
+}
+
+/* BINARY32 float */
+static void decode_f32(float *dst, const uint8_t *src, gsize count)
+{
+#ifdef WORDS_BIGENDIAN
+	uint32_t v;
+	gsize i;
+
+	for (i = 0; i < count; i++) {
+		v = RL32(src + 4 * i);
+		memcpy(dst + i, &v, sizeof(v));
+	}
+#else
+	memcpy(dst, src, count * sizeof(float));
+#endif
+}
+
 static int parse_wav_header(GString *buf, struct context *inc)
 {
 	uint64_t samplerate;
-	unsigned int fmt_code, samplesize, num_channels, unitsize;
+	unsigned int fmt_code, samplesize, num_channels, unitsize, bits;
+	decode_func decode;
 
 	if (buf->len < MIN_DATA_CHUNK_OFFSET)
 		return SR_ERR_NA;
@@ -68,8 +167,8 @@ static int parse_wav_header(GString *buf, struct context *inc)
 	if (num_channels == 0)
 		return SR_ERR;
 	unitsize = samplesize / num_channels;
-	if (unitsize != 1 && unitsize != 2 && unitsize != 4) {
-		sr_err("Only 8, 16 or 32 bits per sample supported.");
+	if (unitsize < 1 || unitsize > 4) {
+		sr_err("Only 8, 16, 24 or 32 bits per sample supported.");
 		return SR_ERR_DATA;
 	}
 
@@ -92,10 +191,6 @@ static int parse_wav_header(GString *buf, struct context *inc)
 			sr_err("WAV extension must be 22 bytes.");
 			return SR_ERR;
 		}
-		if (RL16(buf->str + 34) != RL16(buf->str + 38)) {
-			sr_err("Reduced valid bits per sample not supported.");
-			return SR_ERR_DATA;
-		}
 		/* Real format code is the first two bytes of the GUID. */
 		fmt_code = RL16(buf->str + 44);
 		if (fmt_code != WAVE_FORMAT_PCM_ && fmt_code != WAVE_FORMAT_IEEE_FLOAT_) {
@@ -106,17 +201,39 @@ static int parse_wav_header(GString *buf, struct context *inc)
 			sr_err("only 32-bit floats supported.");
 			return SR_ERR_DATA;
 		}
+		/*
+		 * PCM samples with fewer valid bits are aligned to the top
+		 * of their container, so they scale just the same.
+		 */
+		bits = RL16(buf->str + 38);
+		if (bits == 0 || bits > RL16(buf->str + 34)
+				|| (fmt_code != WAVE_FORMAT_PCM_
+					&& bits != RL16(buf->str + 34))) {
+			sr_err("Invalid number of valid bits per sample.");
+			return SR_ERR_DATA;
+		}
 	} else {
 		sr_err("Only PCM and floating point samples are supported.");
 		return SR_ERR_DATA;
 	}
 
+	if (fmt_code == WAVE_FORMAT_IEEE_FLOAT_)
+		decode = decode_f32;
+	else if (unitsize == 1)
+		decode = decode_u8;
+	else if (unitsize == 2)
+		decode = decode_s16;
+	else if (unitsize == 3)
+		decode = decode_s24;
+	else
+		decode = decode_s32;
+
 	if (inc) {
 		inc->fmt_code = fmt_code;
 		inc->samplerate = samplerate;
-		inc->samplesize = samplesize;
 		inc->num_channels = num_channels;
 		inc->unitsize = unitsize;
+		inc->decode = decode;
 		inc->found_data = FALSE;
 	}
 
@@ -155,12 +272,16 @@ static int init(struct sr_input *in, GHashTable *options)
 	return SR_OK;
 }
 
+/*
+ * Returns the offset of the samples in the "data" chunk, 0 if more data
+ * is needed to find it, or -1 if it isn't there.
+ */
 static int find_data_chunk(GString *buf, int initial_offset)
 {
 	unsigned int offset, i;
 
 	offset = initial_offset;
-	while (offset < MIN(MAX_DATA_CHUNK_OFFSET, buf->len)) {
+	while (offset < MAX_DATA_CHUNK_OFFSET && offset + 8 <= buf->len) {
 		if (!memcmp(buf->str + offset, "data", 4))
 			/* Skip into the samples. */
 			return offset + 8;
@@ -174,54 +295,21 @@ static int find_data_chunk(GString *buf, int initial_offset)
 		offset += 8 + RL32(buf->str + offset + 4);
 	}
 
-	return offset;
+	return offset < MAX_DATA_CHUNK_OFFSET ? 0 : -1;
 }
 
-static void send_chunk(const struct sr_input *in, int offset, int num_samples)
+/* Send num_samples frames from data. If src is not NULL, it holds data. */
+static int send_chunk(const struct sr_input *in, const uint8_t *data,
+		int num_samples, struct sr_buffer *src)
 {
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_analog analog;
 	struct context *inc;
-	float fdata[CHUNK_SIZE];
-	uint64_t sample;
-	int total_samples, samplenum;
-	char *s, *d;
+	struct sr_buffer *buf;
+	int ret;
 
 	inc = in->priv;
 
-	s = in->buf->str + offset;
-	d = (char *)fdata;
-	memset(fdata, 0, CHUNK_SIZE);
-	total_samples = num_samples * inc->num_channels;
-	for (samplenum = 0; samplenum < total_samples; samplenum++) {
-		if (inc->fmt_code == WAVE_FORMAT_PCM_) {
-			sample = 0;
-			memcpy(&sample, s, inc->unitsize);
-			switch (inc->samplesize) {
-			case 1:
-				/* 8-bit PCM samples are unsigned. */
-				fdata[samplenum] = (uint8_t)sample / (float)255;
-				break;
-			case 2:
-				fdata[samplenum] = RL16S(&sample) / (float)INT16_MAX;
-				break;
-			case 4:
-				fdata[samplenum] = RL32S(&sample) / (float)INT32_MAX;
-				break;
-			}
-		} else {
-			/* BINARY32 float */
-#ifdef WORDS_BIGENDIAN
-			int i;
-			for (i = 0; i < inc->unitsize; i++)
-				d[i] = s[inc->unitsize - 1 - i];
-#else
-			memcpy(d, s, inc->unitsize);
-#endif
-		}
-		s += inc->unitsize;
-		d += inc->unitsize;
-	}
 	packet.type = SR_DF_ANALOG;
 	packet.payload = &analog;
 	analog.channels = in->sdi->channels;
@@ -229,8 +317,54 @@ static void send_chunk(const struct sr_input *in, int offset, int num_samples)
 	analog.mq = 0;
 	analog.mqflags = 0;
 	analog.unit = 0;
-	analog.data = fdata;
-	sr_session_send(in->sdi, &packet);
+
+#ifndef WORDS_BIGENDIAN
+	/* Aligned float samples in a buffer can be sent as they are. */
+	if (src && inc->fmt_code == WAVE_FORMAT_IEEE_FLOAT_
+			&& (uintptr_t)data % sizeof(float) == 0) {
+		analog.data = (float *)data;
+		return sr_session_send_buffer(in->sdi, &packet, src);
+	}
+#endif
+
+	buf = sr_session_buffer_get(in->sdi->session,
+			(gsize)num_samples * inc->num_channels * sizeof(float));
+	inc->decode((float *)buf->data, data,
+			(gsize)num_samples * inc->num_channels);
+	analog.data = (float *)buf->data;
+	ret = sr_session_send_buffer(in->sdi, &packet, buf);
+	sr_buffer_unref(buf);
+
+	return ret;
+}
+
+/*
+ * Send all complete frames (one sample of every channel) in data. The
+ * number of bytes used is returned in used. If src is not NULL, it holds
+ * data.
+ */
+static int process_data(const struct sr_input *in, const uint8_t *data,
+		gsize len, struct sr_buffer *src, gsize *used)
+{
+	struct context *inc;
+	gsize framesize, max_samples, num_samples, offset;
+	int ret;
+
+	inc = in->priv;
+	framesize = inc->num_channels * inc->unitsize;
+	max_samples = MAX(CHUNK_SIZE / sizeof(float) / inc->num_channels, 1);
+	for (offset = 0; len - offset >= framesize;
+			offset += num_samples * framesize) {
+		num_samples = MIN((len - offset) / framesize, max_samples);
+		if ((ret = send_chunk(in, data + offset, num_samples,
+				src)) != SR_OK) {
+			*used = offset;
+			return ret;
+		}
+	}
+	*used = offset;
+
+	return SR_OK;
 }
 
 static int process_buffer(struct sr_input *in)
@@ -239,8 +373,8 @@ static int process_buffer(struct sr_input *in)
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_meta meta;
 	struct sr_config *src;
-	int offset, chunk_samples, total_samples, processed, max_chunk_samples;
-	int num_samples, i;
+	gsize used;
+	int offset, i, ret;
 	char channelname[8];
 
 	inc = in->priv;
@@ -267,41 +401,49 @@ static int process_buffer(struct sr_input *in)
 		i = 20 + RL32(in->buf->str + 16);
 		offset = find_data_chunk(in->buf, i);
 		if (offset < 0) {
-			if (in->buf->len > MAX_DATA_CHUNK_OFFSET) {
-				sr_err("Couldn't find data chunk.");
-				return SR_ERR;
-			}
+			sr_err("Couldn't find data chunk.");
+			return SR_ERR;
+		} else if (offset == 0) {
+			/* Not enough data yet. */
+			return SR_OK;
 		}
+		g_string_erase(in->buf, 0, offset);
 		inc->found_data = TRUE;
-	} else
-		offset = 0;
-
-	/* Round off up to the last channels * unitsize boundary. */
-	chunk_samples = (in->buf->len - offset) / inc->num_channels / inc->unitsize;
-	max_chunk_samples = CHUNK_SIZE / inc->num_channels / inc->unitsize;
-	processed = 0;
-	total_samples = chunk_samples;
-	while (processed < total_samples) {
-		if (chunk_samples > max_chunk_samples)
-			num_samples = max_chunk_samples;
-		else
-			num_samples = chunk_samples;
-		send_chunk(in, offset, num_samples);
-		offset += num_samples * inc->unitsize;
-		chunk_samples -= num_samples;
-		processed += num_samples;
 	}
 
-	if ((unsigned int)offset < in->buf->len) {
-		/*
-		 * The incoming buffer wasn't processed completely. Stash
-		 * the leftover data for next time.
-		 */
-		g_string_erase(in->buf, 0, offset);
-	} else
-		g_string_truncate(in->buf, 0);
+	/* Stash a trailing partial frame for next time. */
+	ret = process_data(in, (const uint8_t *)in->buf->str, in->buf->len,
+			NULL, &used);
+	g_string_erase(in->buf, 0, used);
 
-	return SR_OK;
+	return ret;
+}
+
+/*
+ * Decode straight from the given data, once the samples have started.
+ * Only a partial frame is ever carried over, complete that one first.
+ */
+static int receive_data(struct sr_input *in, const uint8_t *data, gsize len,
+		struct sr_buffer *src)
+{
+	struct context *inc;
+	gsize skip, used;
+	int ret;
+
+	inc = in->priv;
+	skip = 0;
+	if (in->buf->len > 0) {
+		skip = MIN(len, (gsize)(inc->num_channels * inc->unitsize)
+				- in->buf->len);
+		g_string_append_len(in->buf, (const char *)data, skip);
+		if ((ret = process_buffer(in)) != SR_OK)
+			return ret;
+	}
+	ret = process_data(in, data + skip, len - skip, src, &used);
+	g_string_append_len(in->buf, (const char *)data + skip + used,
+			len - skip - used);
+
+	return ret;
 }
 
 static int receive(struct sr_input *in, GString *buf)
@@ -309,6 +451,11 @@ static int receive(struct sr_input *in, GString *buf)
 	struct context *inc;
 	int ret;
 
+	inc = in->priv;
+	if (inc->found_data)
+		return receive_data(in, (const uint8_t *)buf->str, buf->len,
+				NULL);
+
 	g_string_append_len(in->buf, buf->str, buf->len);
 
 	if (in->buf->len < MIN_DATA_CHUNK_OFFSET) {
@@ -319,7 +466,6 @@ static int receive(struct sr_input *in, GString *buf)
 		return SR_OK;
 	}
 
-	inc = in->priv;
 	if (!in->sdi_ready) {
 		if ((ret = parse_wav_header(in->buf, inc)) == SR_ERR_NA)
 			/* Not enough data yet. */
@@ -337,18 +483,46 @@ static int receive(struct sr_input *in, GString *buf)
 	return ret;
 }
 
+static int receive_mapped(struct sr_input *in, const uint8_t *data,
+		gsize len, struct sr_buffer *buf)
+{
+	struct context *inc;
+	gsize n;
+	int ret;
+
+	/* The rest of the header goes through in->buf. */
+	inc = in->priv;
+	while (!inc->found_data && len > 0) {
+		n = MIN(len, MAX_DATA_CHUNK_OFFSET);
+		g_string_append_len(in->buf, (const char *)data, n);
+		data += n;
+		len -= n;
+		if ((ret = process_buffer(in)) != SR_OK)
+			return ret;
+	}
+	if (!inc->found_data)
+		return SR_OK;
+
+	return receive_data(in, data, len, buf);
+}
+
 static int end(struct sr_input *in)
 {
 	struct sr_datafeed_packet packet;
 	struct context *inc;
 	int ret;
 
+	inc = in->priv;
 	if (in->sdi_ready)
 		ret = process_buffer(in);
 	else
 		ret = SR_OK;
 
-	inc = in->priv;
+	if (ret == SR_OK && in->sdi_ready && !inc->found_data) {
+		sr_err("Couldn't find data chunk.");
+		ret = SR_ERR;
+	}
+
 	if (inc->started) {
 		packet.type = SR_DF_END;
 		sr_session_send(in->sdi, &packet);
@@ -366,5 +540,6 @@ SR_PRIV struct sr_input_module input_wav = {
 	.format_match = format_match,
 	.init = init,
 	.receive = receive,
+	.receive_mapped = receive_mapped,
 	.end = end,
 };
@@ -156,6 +156,17 @@
                          ((uint8_t*)(p))[2] = (uint8_t)((x)>>16); \
                          ((uint8_t*)(p))[3] = (uint8_t)((x)>>24); } while (0)
 
+/**
+ * Read 8 bits out of a bit row, as made by sr_output_logic_transpose().
+ * @param row a pointer to the bit row
+ * @param pos the index of the first bit, which ends up in the MSB
+ * @return the 8 bits starting at pos
+ */
+#define BITROW8(row, pos) ((uint8_t)( \
+                  (((unsigned)((const uint8_t*)(row))[(pos) / 8] << 8) | \
+                    (unsigned)((const uint8_t*)(row))[(pos) / 8 + 1]) >> \
+                  (8 - (pos) % 8)))
+
 #define PI 3.1415926535897932384626433832795
 
 /* Portability fixes for FreeBSD. */
@@ -216,6 +227,10 @@ struct sr_input {
 	GString *buf;
 	struct sr_dev_inst *sdi;
 	gboolean sdi_ready;
+	/** File mapped by sr_input_send_file(), and how much was sent. */
+	char *file_name;
+	struct sr_buffer *file_buf;
+	gsize file_offset;
 	void *priv;
 };
 
@@ -310,6 +325,21 @@ struct sr_input_module {
 	 */
 	int (*receive) (struct sr_input *in, GString *buf);
 
+	/**
+	 * Optional. Send the contents of a memory mapped file, see
+	 * sr_input_send_file().
+	 *
+	 * This is only called once the device instance is ready, and
+	 * gets the rest of the file in one go. Any data sent through
+	 * receive() before comes first. Packets can point straight into
+	 * the data, sent with sr_session_send_buffer() and @a buf.
+	 *
+	 * @retval SR_OK Success
+	 * @retval other Negative error code.
+	 */
+	int (*receive_mapped) (struct sr_input *in, const uint8_t *data,
+			gsize len, struct sr_buffer *buf);
+
 	/**
 	 * Signal the input module no more data will come.
 	 *
@@ -350,6 +380,9 @@ struct sr_output {
 	 * there, and only flush it when it reaches a certain size.
 	 */
 	void *priv;
+
+	/** Buffer collecting the output for file descriptor and callback sinks. */
+	GString *sink_buf;
 };
 
 /** Output module driver. */
@@ -425,6 +458,28 @@ struct sr_output_module {
 	int (*receive) (const struct sr_output *o,
 			const struct sr_datafeed_packet *packet, GString **out);
 
+	/**
+	 * Alternative to receive(), which modules should implement instead.
+	 * Any output generated in response to the packet is appended to
+	 * <code>out</code>, which belongs to the caller and may already
+	 * hold data. This saves allocating a new GString for every packet.
+	 *
+	 * @param o Pointer to the respective 'struct sr_output'.
+	 * @param packet The complete packet.
+	 * @param out The GString to append the output to.
+	 *
+	 * @retval SR_OK Success
+	 * @retval other Negative error code.
+	 */
+	int (*append) (const struct sr_output *o,
+			const struct sr_datafeed_packet *packet, GString *out);
+
+	/**
+	 * Set if receive() or append() handles SR_DF_LOGIC_REPEAT packets.
+	 * Modules which don't get them expanded to SR_DF_LOGIC packets.
+	 */
+	gboolean logic_repeat;
+
 	/**
 	 * This function is called after the caller is finished using
 	 * the output module, and can be used to free any internal
@@ -452,6 +507,21 @@ struct sr_transform {
 	 * state between calls into its callback functions.
 	 */
 	void *priv;
+
+	/**
+	 * Whether receive() may modify the payload data of the packet it is
+	 * passed. Set by the session before every call.
+	 *
+	 * Packets sent by drivers and input modules point into memory owned
+	 * by them, which must not be modified. The result then goes to a
+	 * buffer from sr_transform_buffer_get() instead. Packets the session
+	 * copied, or which a previous transform wrote to a buffer of its
+	 * own, are writable.
+	 */
+	gboolean packet_in_writable;
+
+	/** Buffer returned by sr_transform_buffer_get(). */
+	struct sr_buffer *buffer;
 };
 
 struct sr_transform_module {
@@ -499,6 +569,9 @@ struct sr_transform_module {
 	 * It can either return (in packet_out) a pointer to another packet
 	 * (possibly the exact same packet it got as input), or NULL.
 	 *
+	 * The payload data of packet_in may only be modified in place if
+	 * the packet_in_writable field of t is set.
+	 *
 	 * @param t Pointer to the respective 'struct sr_transform'.
 	 * @param packet_in Pointer to a datafeed packet.
 	 * @param packet_out Pointer to the resulting datafeed packet after
@@ -691,7 +764,6 @@ struct sr_session {
 	 */
 	struct source *sources;
 	GPollFD *pollfds;
-	int source_timeout;
 
 	/*
 	 * These are our synchronization primitives for stopping the session in
@@ -702,15 +774,68 @@ struct sr_session {
 	GMutex stop_mutex;
 	/** Abort current session. See sr_session_stop(). */
 	gboolean abort_session;
+
+	/**
+	 * Queue decoupling sr_session_send() from the datafeed consumers,
+	 * or NULL if packets are delivered synchronously.
+	 * See sr_session_datafeed_queue_set().
+	 */
+	struct datafeed_queue *queue;
+
+	/**
+	 * Whether SR_DF_LOGIC_REPEAT packets are passed to the datafeed
+	 * callbacks as they are. See sr_session_logic_repeat_set().
+	 */
+	gboolean logic_repeat;
+
+	/** Pool of payload buffers. See sr_session_buffer_get(). */
+	struct sr_buffer_pool *pool;
+
+#ifdef HAVE_SYS_EPOLL_H
+	/** epoll based event loop, or NULL if g_poll() is used (default). */
+	struct session_epoll *epoll;
+#endif
+};
+
+/** Refcounted memory holding datafeed payload data. */
+struct sr_buffer {
+	/** Reference count, only accessed atomically. */
+	gint refcount;
+	/** Size of the data area, in bytes. */
+	gsize size;
+	/** The data area. */
+	uint8_t *data;
+	/** Pool the buffer returns to when released, or NULL. */
+	struct sr_buffer_pool *pool;
+	/** Releases memory not owned by the buffer. See sr_buffer_new_wrap(). */
+	GDestroyNotify destroy;
+	gpointer destroy_data;
 };
 
 SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet);
+SR_PRIV int sr_session_send_buffer(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, struct sr_buffer *buf);
+SR_PRIV int sr_transform_send(const struct sr_transform *t,
+		const struct sr_datafeed_packet *packet);
 SR_PRIV int sr_session_stop_sync(struct sr_session *session);
 SR_PRIV int sr_sessionfile_check(const char *filename);
+SR_PRIV struct sr_buffer *sr_buffer_new(gsize size);
+SR_PRIV struct sr_buffer *sr_buffer_new_wrap(void *data, gsize size,
+		GDestroyNotify destroy, gpointer destroy_data);
+SR_PRIV struct sr_buffer *sr_buffer_ref(struct sr_buffer *buf);
+SR_PRIV void sr_buffer_unref(struct sr_buffer *buf);
+SR_PRIV struct sr_buffer *sr_session_buffer_get(struct sr_session *session,
+		gsize size);
 SR_PRIV int sr_packet_copy(const struct sr_datafeed_packet *packet,
 		struct sr_datafeed_packet **copy);
-SR_PRIV void sr_packet_free(struct sr_datafeed_packet *packet);
+SR_PRIV void sr_logic_repeat_fill(void *dst,
+		const struct sr_datafeed_logic_repeat *repeat, uint64_t count);
+typedef int (*sr_logic_repeat_cb)(const struct sr_datafeed_packet *packet,
+		struct sr_buffer *buf, void *cb_data);
+SR_PRIV int sr_logic_repeat_expand(struct sr_session *session,
+		const struct sr_datafeed_logic_repeat *repeat,
+		sr_logic_repeat_cb cb, void *cb_data);
 
 /*--- analog.c --------------------------------------------------------------*/
 
@@ -739,6 +864,28 @@ SR_PRIV int std_dev_clear(const struct sr_dev_driver *driver,
 		std_dev_clear_callback clear_private);
 SR_PRIV int std_serial_dev_close(struct sr_dev_inst *sdi);
 
+/*--- input/input.c ----------------------------------------------------------*/
+
+SR_PRIV unsigned int sr_input_logic_unitsize(const struct sr_input *in);
+SR_PRIV int sr_input_send_logic(const struct sr_input *in, const uint8_t *data,
+		gsize len, struct sr_buffer *buf, gsize *used);
+SR_PRIV int sr_input_send_logic_mapped(struct sr_input *in,
+		const uint8_t *data, gsize len, struct sr_buffer *buf);
+
+/*--- output/output.c --------------------------------------------------------*/
+
+SR_PRIV int sr_output_logic_bits(const struct sr_dev_inst *sdi,
+		uint64_t packed, int *channel_index);
+SR_PRIV void sr_output_logic_transpose(const uint8_t *data,
+		uint64_t num_samples, unsigned int unitsize,
+		const int *channel_index, unsigned int num_channels,
+		uint8_t *rows, gsize stride);
+
+/*--- transform/transform.c ------------------------------------------------*/
+
+SR_PRIV void *sr_transform_buffer_get(const struct sr_transform *t,
+		gsize size);
+
 /*--- strutil.c -------------------------------------------------------------*/
 
 SR_PRIV int sr_atol(const char *str, long *ret);
@@ -749,12 +896,32 @@ SR_PRIV int sr_atof_ascii(const char *str, float *ret);
 
 /*--- soft-trigger.c --------------------------------------------------------*/
 
+/* A trigger stage compiled to bit masks, see soft-trigger.c. */
+struct soft_trigger_stage {
+	uint8_t *mask;
+	uint8_t *value;
+	uint8_t *edges;
+	/* Copies of the above, valid if unitsize <= 8. */
+	uint64_t mask64;
+	uint64_t value64;
+	uint64_t edges64;
+	int num_matches;
+	gboolean has_edges;
+	gboolean empty;
+	gboolean never;
+};
+
 struct soft_trigger_logic {
 	const struct sr_dev_inst *sdi;
 	const struct sr_trigger *trigger;
-	int count;
+	struct soft_trigger_stage *stages;
+	int num_stages;
+	gboolean invalid;
+	/* Stage automaton state, one bit per stage. */
+	uint64_t *state;
+	int state_words;
+	gboolean have_prev;
 	int unitsize;
-	int cur_stage;
 	uint8_t *prev_sample;
 	uint8_t *pre_trigger_buffer;
 	uint8_t *pre_trigger_head;
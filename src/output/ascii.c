@@ -38,10 +38,14 @@ struct context {
 	int *channel_index;
 	char **channel_names;
 	char **line_values;
-	uint8_t *prev_sample;
+	uint8_t *prev_bits;
 	gboolean header_done;
 	GString **lines;
 	GString *header;
+	uint8_t *rows;
+	gsize rows_size;
+	char levels[256][8];
+	uint8_t masks[256][8];
 };
 
 static int init(struct sr_output *o, GHashTable *options)
@@ -59,6 +63,13 @@ static int init(struct sr_output *o, GHashTable *options)
 	ctx->trigger = -1;
 	ctx->spl = g_variant_get_uint32(g_hash_table_lookup(options, "width"));
 
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 8; j++) {
+			ctx->levels[i][j] = (i & (0x80 >> j)) ? '"' : '.';
+			ctx->masks[i][j] = (i & (0x80 >> j)) ? 0xff : 0x00;
+		}
+	}
+
 	for (l = o->sdi->channels; l; l = l->next) {
 		ch = l->data;
 		if (ch->type != SR_CHANNEL_LOGIC)
@@ -70,7 +81,7 @@ static int init(struct sr_output *o, GHashTable *options)
 	ctx->channel_index = g_malloc(sizeof(int) * ctx->num_enabled_channels);
 	ctx->channel_names = g_malloc(sizeof(char *) * ctx->num_enabled_channels);
 	ctx->lines = g_malloc(sizeof(GString *) * ctx->num_enabled_channels);
-	ctx->prev_sample = g_malloc(g_slist_length(o->sdi->channels));
+	ctx->prev_bits = g_malloc0(ctx->num_enabled_channels);
 
 	j = 0;
 	for (i = 0, l = o->sdi->channels; l; l = l->next, i++) {
@@ -89,11 +100,10 @@ static int init(struct sr_output *o, GHashTable *options)
 	return SR_OK;
 }
 
-static GString *gen_header(const struct sr_output *o)
+static void gen_header(const struct sr_output *o, GString *header)
 {
 	struct context *ctx;
 	GVariant *gvar;
-	GString *header;
 	int num_channels;
 	char *samplerate_s;
 
@@ -106,8 +116,7 @@ static GString *gen_header(const struct sr_output *o)
 		}
 	}
 
-	header = g_string_sized_new(512);
-	g_string_printf(header, "%s\n", PACKAGE_STRING);
+	g_string_append_printf(header, "%s\n", PACKAGE_STRING);
 	num_channels = g_slist_length(o->sdi->channels);
 	g_string_append_printf(header, "Acquisition with %d/%d channels",
 			ctx->num_enabled_channels, num_channels);
@@ -117,23 +126,72 @@ static GString *gen_header(const struct sr_output *o)
 		g_free(samplerate_s);
 	}
 	g_string_append_printf(header, "\n");
+}
+
+/* Append n samples from channel j's bit row, starting at sample i. */
+static void append_levels(const struct context *ctx, unsigned int j,
+		const uint8_t *row, uint64_t i, uint64_t n)
+{
+	uint64_t chars, rising, falling;
+	uint8_t cur, prev, edges;
+	int cnt;
+	gboolean line_start;
+
+	prev = ctx->prev_bits[j];
+	line_start = ctx->spl_cnt == 0;
+	while (n > 0) {
+		cnt = n < 8 ? n : 8;
+		cur = BITROW8(row, i);
+		edges = cur ^ ((cur >> 1) | (prev << 7));
+		if (line_start) {
+			/* No edge on the first sample of a line. */
+			edges &= 0x7f;
+			line_start = FALSE;
+		}
+		/* Overwrite the levels with '/' and '\\' where they change. */
+		memcpy(&chars, ctx->levels[cur], 8);
+		memcpy(&rising, ctx->masks[edges & cur], 8);
+		memcpy(&falling, ctx->masks[edges & ~cur], 8);
+		chars = (chars & ~(rising | falling))
+			| (rising & 0x2f2f2f2f2f2f2f2fULL)
+			| (falling & 0x5c5c5c5c5c5c5c5cULL);
+		g_string_append_len(ctx->lines[j], (const char *)&chars, cnt);
+		prev = (cur >> (8 - cnt)) & 1;
+		i += cnt;
+		n -= cnt;
+	}
+	ctx->prev_bits[j] = prev;
+}
 
-	return header;
+static void flush_lines(struct context *ctx, GString *out)
+{
+	unsigned int i;
+	int offset;
+
+	for (i = 0; i < ctx->num_enabled_channels; i++) {
+		g_string_append_len(out, ctx->lines[i]->str, ctx->lines[i]->len);
+		g_string_append_c(out, '\n');
+		g_string_printf(ctx->lines[i], "%s:", ctx->channel_names[i]);
+	}
+	if (ctx->num_enabled_channels && ctx->trigger > -1) {
+		offset = ctx->trigger + ctx->trigger / 8;
+		g_string_append_printf(out, "T:%*s^ %d\n", offset, "", ctx->trigger);
+		ctx->trigger = -1;
+	}
 }
 
-static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
-		GString **out)
+static int append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
 	const struct sr_config *src;
 	GSList *l;
 	struct context *ctx;
-	int idx, offset, curbit, prevbit;
-	uint64_t i, j;
-	gchar *p, c;
+	uint64_t i, j, n, num_samples;
+	gsize stride;
+	int ret;
 
-	*out = NULL;
 	if (!o || !o->sdi)
 		return SR_ERR_ARG;
 	if (!(ctx = o->priv))
@@ -144,9 +202,15 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		meta = packet->payload;
 		for (l = meta->config; l; l = l->next) {
 			src = l->data;
-			if (src->key != SR_CONF_SAMPLERATE)
-				continue;
-			ctx->samplerate = g_variant_get_uint64(src->data);
+			if (src->key == SR_CONF_SAMPLERATE) {
+				ctx->samplerate = g_variant_get_uint64(src->data);
+			} else if (src->key == SR_CONF_PACKED_CHANNELS) {
+				ret = sr_output_logic_bits(o->sdi,
+						g_variant_get_uint64(src->data),
+						ctx->channel_index);
+				if (ret != SR_OK)
+					return ret;
+			}
 		}
 		break;
 	case SR_DF_TRIGGER:
@@ -154,54 +218,42 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		break;
 	case SR_DF_LOGIC:
 		if (!ctx->header_done) {
-			*out = gen_header(o);
+			gen_header(o, out);
 			ctx->header_done = TRUE;
-		} else
-			*out = g_string_sized_new(512);
+		}
 
 		logic = packet->payload;
-		for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-			ctx->spl_cnt++;
-			for (j = 0; j < ctx->num_enabled_channels; j++) {
-				idx = ctx->channel_index[j];
-				p = logic->data + i + idx / 8;
-				curbit = *p & (1 << (idx % 8));
-				prevbit = (ctx->prev_sample[idx / 8] & ((uint8_t) 1 << (idx % 8)));
-
-				c = curbit ? '"' : '.';
-				if (ctx->spl_cnt > 1) {
-					if (curbit < prevbit)
-						c = '\\';
-					else if (curbit > prevbit)
-						c = '/';
-				}
-				g_string_append_c(ctx->lines[j], c);
-
-				if (ctx->spl_cnt == ctx->spl) {
-					/* Flush line buffers. */
-					g_string_append_len(*out, ctx->lines[j]->str, ctx->lines[j]->len);
-					g_string_append_c(*out, '\n');
-					if (j == ctx->num_enabled_channels  - 1 && ctx->trigger > -1) {
-						offset = ctx->trigger + ctx->trigger / 8;
-						g_string_append_printf(*out, "T:%*s^ %d\n", offset, "", ctx->trigger);
-						ctx->trigger = -1;
-					}
-					g_string_printf(ctx->lines[j], "%s:", ctx->channel_names[j]);
-				}
-			}
-			if (ctx->spl_cnt == ctx->spl)
-				/* Line buffers were already flushed. */
+		num_samples = logic->length / logic->unitsize;
+		stride = num_samples / 8 + 2;
+		if (ctx->rows_size < stride * ctx->num_enabled_channels) {
+			g_free(ctx->rows);
+			ctx->rows_size = stride * ctx->num_enabled_channels;
+			ctx->rows = g_malloc(ctx->rows_size);
+		}
+		sr_output_logic_transpose(logic->data, num_samples,
+				logic->unitsize, ctx->channel_index,
+				ctx->num_enabled_channels, ctx->rows, stride);
+
+		for (i = 0; i < num_samples; i += n) {
+			/* Up to the end of the packet or the line. */
+			n = num_samples - i;
+			if (ctx->spl > 0 && n > (uint64_t)(ctx->spl - ctx->spl_cnt))
+				n = ctx->spl - ctx->spl_cnt;
+			for (j = 0; j < ctx->num_enabled_channels; j++)
+				append_levels(ctx, j, ctx->rows + j * stride, i, n);
+			ctx->spl_cnt += n;
+			if (ctx->spl_cnt == ctx->spl) {
+				flush_lines(ctx, out);
 				ctx->spl_cnt = 0;
-			memcpy(ctx->prev_sample, logic->data + i, logic->unitsize);
+			}
 		}
 		break;
 	case SR_DF_END:
 		if (ctx->spl_cnt) {
 			/* Line buffers need flushing. */
-			*out = g_string_sized_new(512);
 			for (i = 0; i < ctx->num_enabled_channels; i++) {
-				g_string_append_len(*out, ctx->lines[i]->str, ctx->lines[i]->len);
-				g_string_append_c(*out, '\n');
+				g_string_append_len(out, ctx->lines[i]->str, ctx->lines[i]->len);
+				g_string_append_c(out, '\n');
 			}
 		}
 		break;
@@ -222,7 +274,8 @@ static int cleanup(struct sr_output *o)
 		return SR_OK;
 
 	g_free(ctx->channel_index);
-	g_free(ctx->prev_sample);
+	g_free(ctx->prev_bits);
+	g_free(ctx->rows);
 	g_free(ctx->channel_names);
 	for (i = 0; i < ctx->num_enabled_channels; i++)
 		g_string_free(ctx->lines[i], TRUE);
@@ -255,6 +308,6 @@ SR_PRIV struct sr_output_module output_ascii = {
 	.exts = (const char*[]){"txt", NULL},
 	.options = get_options,
 	.init = init,
-	.receive = receive,
+	.append = append,
 	.cleanup = cleanup,
 };
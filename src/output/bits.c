@@ -37,6 +37,9 @@ struct context {
 	char **channel_names;
 	gboolean header_done;
 	GString **lines;
+	uint8_t *rows;
+	gsize rows_size;
+	char digits[256][8];
 };
 
 static int init(struct sr_output *o, GHashTable *options)
@@ -54,6 +57,11 @@ static int init(struct sr_output *o, GHashTable *options)
 	ctx->trigger = -1;
 	ctx->spl = g_variant_get_uint32(g_hash_table_lookup(options, "width"));
 
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 8; j++)
+			ctx->digits[i][j] = (i & (0x80 >> j)) ? '1' : '0';
+	}
+
 	for (l = o->sdi->channels; l; l = l->next) {
 		ch = l->data;
 		if (ch->type != SR_CHANNEL_LOGIC)
@@ -83,11 +91,10 @@ static int init(struct sr_output *o, GHashTable *options)
 	return SR_OK;
 }
 
-static GString *gen_header(const struct sr_output *o)
+static void gen_header(const struct sr_output *o, GString *header)
 {
 	struct context *ctx;
 	GVariant *gvar;
-	GString *header;
 	int num_channels;
 	char *samplerate_s;
 
@@ -100,8 +107,7 @@ static GString *gen_header(const struct sr_output *o)
 		}
 	}
 
-	header = g_string_sized_new(512);
-	g_string_printf(header, "%s\n", PACKAGE_STRING);
+	g_string_append_printf(header, "%s\n", PACKAGE_STRING);
 	num_channels = g_slist_length(o->sdi->channels);
 	g_string_append_printf(header, "Acquisition with %d/%d channels",
 			ctx->num_enabled_channels, num_channels);
@@ -111,23 +117,59 @@ static GString *gen_header(const struct sr_output *o)
 		g_free(samplerate_s);
 	}
 	g_string_append_printf(header, "\n");
+}
+
+/* Append n samples from a bit row, starting at sample i. */
+static void append_bits(const struct context *ctx, GString *line,
+		const uint8_t *row, uint64_t i, uint64_t n)
+{
+	int pos, cnt;
 
-	return header;
+	pos = ctx->spl_cnt;
+	while (n > 0) {
+		/* Up to the next group of 8 samples. */
+		cnt = 8 - pos % 8;
+		if ((uint64_t)cnt > n)
+			cnt = n;
+		g_string_append_len(line, ctx->digits[BITROW8(row, i)], cnt);
+		i += cnt;
+		n -= cnt;
+		pos += cnt;
+		if (pos % 8 == 0 && pos != ctx->spl)
+			/* Add a space every 8th bit. */
+			g_string_append_c(line, ' ');
+	}
 }
 
-static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
-		GString **out)
+static void flush_lines(struct context *ctx, GString *out)
+{
+	unsigned int i;
+	int offset;
+
+	for (i = 0; i < ctx->num_enabled_channels; i++) {
+		g_string_append_len(out, ctx->lines[i]->str, ctx->lines[i]->len);
+		g_string_append_c(out, '\n');
+		g_string_printf(ctx->lines[i], "%s:", ctx->channel_names[i]);
+	}
+	if (ctx->num_enabled_channels && ctx->trigger > -1) {
+		offset = ctx->trigger + ctx->trigger / 8;
+		g_string_append_printf(out, "T:%*s^ %d\n", offset, "", ctx->trigger);
+		ctx->trigger = -1;
+	}
+}
+
+static int append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
 	const struct sr_config *src;
 	struct context *ctx;
 	GSList *l;
-	int idx, offset;
-	uint64_t i, j;
-	gchar *p, c;
+	uint64_t i, j, n, num_samples;
+	gsize stride;
+	int ret;
 
-	*out = NULL;
 	if (!o || !o->sdi)
 		return SR_ERR_ARG;
 	if (!(ctx = o->priv))
@@ -138,9 +180,15 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		meta = packet->payload;
 		for (l = meta->config; l; l = l->next) {
 			src = l->data;
-			if (src->key != SR_CONF_SAMPLERATE)
-				continue;
-			ctx->samplerate = g_variant_get_uint64(src->data);
+			if (src->key == SR_CONF_SAMPLERATE) {
+				ctx->samplerate = g_variant_get_uint64(src->data);
+			} else if (src->key == SR_CONF_PACKED_CHANNELS) {
+				ret = sr_output_logic_bits(o->sdi,
+						g_variant_get_uint64(src->data),
+						ctx->channel_index);
+				if (ret != SR_OK)
+					return ret;
+			}
 		}
 		break;
 	case SR_DF_TRIGGER:
@@ -148,47 +196,43 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		break;
 	case SR_DF_LOGIC:
 		if (!ctx->header_done) {
-			*out = gen_header(o);
+			gen_header(o, out);
 			ctx->header_done = TRUE;
-		} else
-			*out = g_string_sized_new(512);
+		}
 
 		logic = packet->payload;
-		for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-			ctx->spl_cnt++;
-			for (j = 0; j < ctx->num_enabled_channels; j++) {
-				idx = ctx->channel_index[j];
-				p = logic->data + i + idx / 8;
-				c = (*p & (1 << (idx % 8))) ? '1' : '0';
-				g_string_append_c(ctx->lines[j], c);
-
-				if (ctx->spl_cnt == ctx->spl) {
-					/* Flush line buffers. */
-					g_string_append_len(*out, ctx->lines[j]->str, ctx->lines[j]->len);
-					g_string_append_c(*out, '\n');
-					if (j == ctx->num_enabled_channels  - 1 && ctx->trigger > -1) {
-						offset = ctx->trigger + ctx->trigger / 8;
-						g_string_append_printf(*out, "T:%*s^ %d\n", offset, "", ctx->trigger);
-						ctx->trigger = -1;
-					}
-					g_string_printf(ctx->lines[j], "%s:", ctx->channel_names[j]);
-				} else if ((ctx->spl_cnt & 7) == 0) {
-					/* Add a space every 8th bit. */
-					g_string_append_c(ctx->lines[j], ' ');
-				}
-			}
-			if (ctx->spl_cnt == ctx->spl)
-				/* Line buffers were already flushed. */
+		num_samples = logic->length / logic->unitsize;
+		stride = num_samples / 8 + 2;
+		if (ctx->rows_size < stride * ctx->num_enabled_channels) {
+			g_free(ctx->rows);
+			ctx->rows_size = stride * ctx->num_enabled_channels;
+			ctx->rows = g_malloc(ctx->rows_size);
+		}
+		sr_output_logic_transpose(logic->data, num_samples,
+				logic->unitsize, ctx->channel_index,
+				ctx->num_enabled_channels, ctx->rows, stride);
+
+		for (i = 0; i < num_samples; i += n) {
+			/* Up to the end of the packet or the line. */
+			n = num_samples - i;
+			if (ctx->spl > 0 && n > (uint64_t)(ctx->spl - ctx->spl_cnt))
+				n = ctx->spl - ctx->spl_cnt;
+			for (j = 0; j < ctx->num_enabled_channels; j++)
+				append_bits(ctx, ctx->lines[j],
+						ctx->rows + j * stride, i, n);
+			ctx->spl_cnt += n;
+			if (ctx->spl_cnt == ctx->spl) {
+				flush_lines(ctx, out);
 				ctx->spl_cnt = 0;
+			}
 		}
 		break;
 	case SR_DF_END:
 		if (ctx->spl_cnt) {
 			/* Line buffers need flushing. */
-			*out = g_string_sized_new(512);
 			for (i = 0; i < ctx->num_enabled_channels; i++) {
-				g_string_append_len(*out, ctx->lines[i]->str, ctx->lines[i]->len);
-				g_string_append_c(*out, '\n');
+				g_string_append_len(out, ctx->lines[i]->str, ctx->lines[i]->len);
+				g_string_append_c(out, '\n');
 			}
 		}
 		break;
@@ -210,6 +254,7 @@ static int cleanup(struct sr_output *o)
 
 	g_free(ctx->channel_index);
 	g_free(ctx->channel_names);
+	g_free(ctx->rows);
 	for (i = 0; i < ctx->num_enabled_channels; i++)
 		g_string_free(ctx->lines[i], TRUE);
 	g_free(ctx->lines);
@@ -241,6 +286,6 @@ SR_PRIV struct sr_output_module output_bits = {
 	.exts = (const char*[]){"txt", NULL},
 	.options = get_options,
 	.init = init,
-	.receive = receive,
+	.append = append,
 	.cleanup = cleanup,
 };
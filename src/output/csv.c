@@ -33,6 +33,9 @@ struct context {
 	char separator;
 	gboolean header_done;
 	struct sr_channel **channels;
+	/* The bit of every enabled logic channel in a sample. */
+	int *channel_index;
+	unsigned int num_logic_channels;
 
 	/* For analog measurements split into frames, not packets. */
 	struct sr_channel **analog_channels;
@@ -76,6 +79,8 @@ static int init(struct sr_output *o, GHashTable *options)
 			if (ch->type == SR_CHANNEL_LOGIC ||
 			    ch->type == SR_CHANNEL_ANALOG)
 				ctx->num_enabled_channels++;
+			if (ch->type == SR_CHANNEL_LOGIC)
+				ctx->num_logic_channels++;
 			if (ch->type == SR_CHANNEL_ANALOG)
 				ctx->num_analog_channels++;
 		}
@@ -85,6 +90,8 @@ static int init(struct sr_output *o, GHashTable *options)
 	ctx->analog_channels = g_malloc(sizeof(struct sr_channel *)
 					* ctx->num_analog_channels);
 	ctx->analog_vals = g_malloc(sizeof(float) * ctx->num_analog_channels);
+	ctx->channel_index = g_malloc(sizeof(int) * ctx->num_logic_channels);
+	sr_output_logic_bits(o->sdi, 0, ctx->channel_index);
 
 	/* Once more to map the enabled channels. */
 	for (i = 0, l = o->sdi->channels, j = 0; l; l = l->next) {
@@ -102,19 +109,17 @@ static int init(struct sr_output *o, GHashTable *options)
 	return SR_OK;
 }
 
-static GString *gen_header(const struct sr_output *o)
+static void gen_header(const struct sr_output *o, GString *header)
 {
 	struct context *ctx;
 	struct sr_channel *ch;
 	GVariant *gvar;
-	GString *header;
 	GSList *l;
 	time_t t;
 	int num_channels, i;
 	char *samplerate_s;
 
 	ctx = o->priv;
-	header = g_string_sized_new(512);
 
 	/* Some metadata */
 	t = time(NULL);
@@ -149,18 +154,14 @@ static GString *gen_header(const struct sr_output *o)
 		g_string_append_printf(header, "; Samplerate: %s\n", samplerate_s);
 		g_free(samplerate_s);
 	}
-
-	return header;
 }
 
-static void init_output(GString **out, struct context *ctx,
+static void init_output(GString *out, struct context *ctx,
 			const struct sr_output *o)
 {
 	if (!ctx->header_done) {
-		*out = gen_header(o);
+		gen_header(o, out);
 		ctx->header_done = TRUE;
-	} else {
-		*out = g_string_sized_new(512);
 	}
 }
 
@@ -187,8 +188,8 @@ static void handle_analog_frame(struct context *ctx,
 	}
 }
 
-static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
-		GString **out)
+static int append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
@@ -201,7 +202,6 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 	gchar *p, c;
 	int ret = SR_OK;
 
-	*out = NULL;
 	if (!o || !o->sdi)
 		return SR_ERR_ARG;
 	if (!(ctx = o->priv))
@@ -212,9 +212,15 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		meta = packet->payload;
 		for (l = meta->config; l; l = l->next) {
 			src = l->data;
-			if (src->key != SR_CONF_SAMPLERATE)
-				continue;
-			ctx->samplerate = g_variant_get_uint64(src->data);
+			if (src->key == SR_CONF_SAMPLERATE) {
+				ctx->samplerate = g_variant_get_uint64(src->data);
+			} else if (src->key == SR_CONF_PACKED_CHANNELS) {
+				ret = sr_output_logic_bits(o->sdi,
+						g_variant_get_uint64(src->data),
+						ctx->channel_index);
+				if (ret != SR_OK)
+					return ret;
+			}
 		}
 		break;
 	case SR_DF_FRAME_BEGIN:
@@ -234,13 +240,13 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 
 		for (i = 0, j = 0; i < ctx->num_enabled_channels; i++) {
 			if (ctx->channels[i]->type == SR_CHANNEL_ANALOG) {
-				g_string_append_printf(*out, "%f",
+				g_string_append_printf(out, "%f",
 							ctx->analog_vals[j++]);
 			}
-			g_string_append_c(*out, ctx->separator);
+			g_string_append_c(out, ctx->separator);
 		}
-		g_string_truncate(*out, (*out)->len - 1);
-		g_string_append_printf(*out, "\n");
+		g_string_truncate(out, out->len - 1);
+		g_string_append_printf(out, "\n");
 
 		ctx->inframe = FALSE;
 		break;
@@ -249,20 +255,20 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		init_output(out, ctx, o);
 
 		for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-			for (j = 0; j < ctx->num_enabled_channels; j++) {
+			for (j = 0, k = 0; j < ctx->num_enabled_channels; j++) {
 				if (ctx->channels[j]->type == SR_CHANNEL_LOGIC) {
-					idx = ctx->channels[j]->index;
+					idx = ctx->channel_index[k++];
 					p = logic->data + i + idx / 8;
 					c = *p & (1 << (idx % 8));
-					g_string_append_c(*out, c ? '1' : '0');
+					g_string_append_c(out, c ? '1' : '0');
 				}
-				g_string_append_c(*out, ctx->separator);
+				g_string_append_c(out, ctx->separator);
 			}
 			if (j) {
 				/* Drop last separator. */
-				g_string_truncate(*out, (*out)->len - 1);
+				g_string_truncate(out, out->len - 1);
 			}
-			g_string_append_printf(*out, "\n");
+			g_string_append_printf(out, "\n");
 		}
 		break;
 	case SR_DF_ANALOG:
@@ -291,16 +297,16 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 						l = analog->channels;
 
 					if (ctx->channels[j] == l->data) {
-						g_string_append_printf(*out,
+						g_string_append_printf(out,
 							"%f", analog->data[k++]);
 					}
 
 					l = l->next;
 				}
-				g_string_append_c(*out, ctx->separator);
+				g_string_append_c(out, ctx->separator);
 			}
-			g_string_truncate(*out, (*out)->len - 1);
-			g_string_append_printf(*out, "\n");
+			g_string_truncate(out, out->len - 1);
+			g_string_append_printf(out, "\n");
 		}
 		break;
 	/* TODO case SR_DF_ANALOG2: */
@@ -319,6 +325,7 @@ static int cleanup(struct sr_output *o)
 	if (o->priv) {
 		ctx = o->priv;
 		g_free(ctx->channels);
+		g_free(ctx->channel_index);
 		g_free(ctx->analog_channels);
 		g_free(ctx->analog_vals);
 		g_free(o->priv);
@@ -335,6 +342,6 @@ SR_PRIV struct sr_output_module output_csv = {
 	.exts = (const char*[]){"csv", NULL},
 	.options = NULL,
 	.init = init,
-	.receive = receive,
+	.append = append,
 	.cleanup = cleanup,
 };
@@ -91,6 +91,7 @@ static GString *gen_header(const struct sr_output *o)
 	struct sr_channel *ch;
 	GVariant *gvar;
 	GString *header;
+	GSList *l;
 	time_t t;
 	unsigned int num_channels, i;
 	char *samplerate_s;
@@ -123,9 +124,13 @@ static GString *gen_header(const struct sr_output *o)
 	g_string_append_printf(header, "%s", gnuplot_header2);
 
 	/* Columns / channels */
-	for (i = 0; i < ctx->num_enabled_channels; i++) {
-		ch = g_slist_nth_data(o->sdi->channels, ctx->channel_index[i]);
-		g_string_append_printf(header, "# %d\t\t%s\n", i + 1, ch->name);
+	for (i = 0, l = o->sdi->channels; l; l = l->next) {
+		ch = l->data;
+		if (ch->type != SR_CHANNEL_LOGIC)
+			continue;
+		if (!ch->enabled)
+			continue;
+		g_string_append_printf(header, "# %d\t\t%s\n", ++i, ch->name);
 	}
 
 	return header;
@@ -141,6 +146,7 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 	struct context *ctx;
 	const uint8_t *sample;
 	unsigned int curbit, p, idx, i;
+	int ret;
 
 	*out = NULL;
 	if (!o || !o->priv)
@@ -151,9 +157,15 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		meta = packet->payload;
 		for (l = meta->config; l; l = l->next) {
 			src = l->data;
-			if (src->key != SR_CONF_SAMPLERATE)
-				continue;
-			ctx->samplerate = g_variant_get_uint64(src->data);
+			if (src->key == SR_CONF_SAMPLERATE) {
+				ctx->samplerate = g_variant_get_uint64(src->data);
+			} else if (src->key == SR_CONF_PACKED_CHANNELS) {
+				ret = sr_output_logic_bits(o->sdi,
+						g_variant_get_uint64(src->data),
+						ctx->channel_index);
+				if (ret != SR_OK)
+					return ret;
+			}
 		}
 	}
 
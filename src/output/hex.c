@@ -40,6 +40,8 @@ struct context {
 	uint8_t *sample_buf;
 	gboolean header_done;
 	GString **lines;
+	uint8_t *rows;
+	gsize rows_size;
 };
 
 static int init(struct sr_output *o, GHashTable *options)
@@ -88,11 +90,10 @@ static int init(struct sr_output *o, GHashTable *options)
 	return SR_OK;
 }
 
-static GString *gen_header(const struct sr_output *o)
+static void gen_header(const struct sr_output *o, GString *header)
 {
 	struct context *ctx;
 	GVariant *gvar;
-	GString *header;
 	int num_channels;
 	char *samplerate_s;
 
@@ -105,8 +106,7 @@ static GString *gen_header(const struct sr_output *o)
 		}
 	}
 
-	header = g_string_sized_new(512);
-	g_string_printf(header, "%s\n", PACKAGE_STRING);
+	g_string_append_printf(header, "%s\n", PACKAGE_STRING);
 	num_channels = g_slist_length(o->sdi->channels);
 	g_string_append_printf(header, "Acquisition with %d/%d channels",
 			ctx->num_enabled_channels, num_channels);
@@ -116,23 +116,67 @@ static GString *gen_header(const struct sr_output *o)
 		g_free(samplerate_s);
 	}
 	g_string_append_printf(header, "\n");
+}
+
+/* Append n samples from channel j's bit row, starting at sample i. */
+static void append_hex(const struct context *ctx, unsigned int j,
+		const uint8_t *row, uint64_t i, uint64_t n)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	char buf[3];
+	int pos, cnt;
+
+	pos = ctx->spl_cnt;
+	buf[2] = ' ';
+	while (n > 0) {
+		/* Up to the next byte's worth of samples. */
+		cnt = 8 - pos % 8;
+		if ((uint64_t)cnt > n)
+			cnt = n;
+		ctx->sample_buf[j] = (ctx->sample_buf[j] << cnt)
+				| (BITROW8(row, i) >> (8 - cnt));
+		i += cnt;
+		n -= cnt;
+		pos += cnt;
+		if (pos % 8 == 0) {
+			/* Buffered a byte's worth, output hex. */
+			buf[0] = hex_digits[ctx->sample_buf[j] >> 4];
+			buf[1] = hex_digits[ctx->sample_buf[j] & 0x0f];
+			g_string_append_len(ctx->lines[j], buf, 3);
+			ctx->sample_buf[j] = 0;
+		}
+	}
+}
+
+static void flush_lines(struct context *ctx, GString *out)
+{
+	unsigned int i;
+	int offset;
 
-	return header;
+	for (i = 0; i < ctx->num_enabled_channels; i++) {
+		g_string_append_len(out, ctx->lines[i]->str, ctx->lines[i]->len);
+		g_string_append_c(out, '\n');
+		g_string_printf(ctx->lines[i], "%s:", ctx->channel_names[i]);
+	}
+	if (ctx->num_enabled_channels && ctx->trigger > -1) {
+		offset = ctx->trigger + ctx->trigger / 8;
+		g_string_append_printf(out, "T:%*s^ %d\n", offset, "", ctx->trigger);
+		ctx->trigger = -1;
+	}
 }
 
-static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
-		GString **out)
+static int append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
 	const struct sr_config *src;
 	GSList *l;
 	struct context *ctx;
-	int idx, pos, offset;
-	uint64_t i, j;
-	gchar *p;
+	uint64_t i, j, n, num_samples;
+	gsize stride;
+	int ret;
 
-	*out = NULL;
 	if (!o || !o->sdi)
 		return SR_ERR_ARG;
 	if (!(ctx = o->priv))
@@ -143,9 +187,15 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		meta = packet->payload;
 		for (l = meta->config; l; l = l->next) {
 			src = l->data;
-			if (src->key != SR_CONF_SAMPLERATE)
-				continue;
-			ctx->samplerate = g_variant_get_uint64(src->data);
+			if (src->key == SR_CONF_SAMPLERATE) {
+				ctx->samplerate = g_variant_get_uint64(src->data);
+			} else if (src->key == SR_CONF_PACKED_CHANNELS) {
+				ret = sr_output_logic_bits(o->sdi,
+						g_variant_get_uint64(src->data),
+						ctx->channel_index);
+				if (ret != SR_OK)
+					return ret;
+			}
 		}
 		break;
 	case SR_DF_TRIGGER:
@@ -153,55 +203,45 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		break;
 	case SR_DF_LOGIC:
 		if (!ctx->header_done) {
-			*out = gen_header(o);
+			gen_header(o, out);
 			ctx->header_done = TRUE;
-		} else
-			*out = g_string_sized_new(512);
+		}
 
 		logic = packet->payload;
-		for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-			ctx->spl_cnt++;
-			pos = ctx->spl_cnt & 7;
-			for (j = 0; j < ctx->num_enabled_channels; j++) {
-				idx = ctx->channel_index[j];
-				p = logic->data + i + idx / 8;
-				ctx->sample_buf[j] <<= 1;
-				if (*p & (1 << (idx % 8)))
-					ctx->sample_buf[j] |= 1;
-				if (ctx->spl_cnt && pos == 0) {
-					/* Buffered a byte's worth, output hex. */
-					g_string_append_printf(ctx->lines[j], "%.2x ",
-							ctx->sample_buf[j]);
-					ctx->sample_buf[j] = 0;
-				}
-
-				if (ctx->spl_cnt == ctx->spl) {
-					/* Flush line buffers. */
-					g_string_append_len(*out, ctx->lines[j]->str, ctx->lines[j]->len);
-					g_string_append_c(*out, '\n');
-					if (j == ctx->num_enabled_channels  - 1 && ctx->trigger > -1) {
-						offset = ctx->trigger + ctx->trigger / 8;
-						g_string_append_printf(*out, "T:%*s^ %d\n", offset, "", ctx->trigger);
-						ctx->trigger = -1;
-					}
-					g_string_printf(ctx->lines[j], "%s:", ctx->channel_names[j]);
-				}
-			}
-			if (ctx->spl_cnt == ctx->spl)
-				/* Line buffers were already flushed. */
+		num_samples = logic->length / logic->unitsize;
+		stride = num_samples / 8 + 2;
+		if (ctx->rows_size < stride * ctx->num_enabled_channels) {
+			g_free(ctx->rows);
+			ctx->rows_size = stride * ctx->num_enabled_channels;
+			ctx->rows = g_malloc(ctx->rows_size);
+		}
+		sr_output_logic_transpose(logic->data, num_samples,
+				logic->unitsize, ctx->channel_index,
+				ctx->num_enabled_channels, ctx->rows, stride);
+
+		for (i = 0; i < num_samples; i += n) {
+			/* Up to the end of the packet or the line. */
+			n = num_samples - i;
+			if (ctx->spl > 0 && n > (uint64_t)(ctx->spl - ctx->spl_cnt))
+				n = ctx->spl - ctx->spl_cnt;
+			for (j = 0; j < ctx->num_enabled_channels; j++)
+				append_hex(ctx, j, ctx->rows + j * stride, i, n);
+			ctx->spl_cnt += n;
+			if (ctx->spl_cnt == ctx->spl) {
+				flush_lines(ctx, out);
 				ctx->spl_cnt = 0;
+			}
 		}
 		break;
 	case SR_DF_END:
 		if (ctx->spl_cnt) {
 			/* Line buffers need flushing. */
-			*out = g_string_sized_new(512);
 			for (i = 0; i < ctx->num_enabled_channels; i++) {
 				if (ctx->spl_cnt & 7)
 					g_string_append_printf(ctx->lines[i], "%.2x ",
 							ctx->sample_buf[i] << (8 - (ctx->spl_cnt & 7)));
-				g_string_append_len(*out, ctx->lines[i]->str, ctx->lines[i]->len);
-				g_string_append_c(*out, '\n');
+				g_string_append_len(out, ctx->lines[i]->str, ctx->lines[i]->len);
+				g_string_append_c(out, '\n');
 			}
 		}
 		break;
@@ -223,6 +263,7 @@ static int cleanup(struct sr_output *o)
 
 	g_free(ctx->channel_index);
 	g_free(ctx->sample_buf);
+	g_free(ctx->rows);
 	g_free(ctx->channel_names);
 	for (i = 0; i < ctx->num_enabled_channels; i++)
 		g_string_free(ctx->lines[i], TRUE);
@@ -255,6 +296,6 @@ SR_PRIV struct sr_output_module output_hex = {
 	.exts = (const char*[]){"txt", NULL},
 	.options = get_options,
 	.init = init,
-	.receive = receive,
+	.append = append,
 	.cleanup = cleanup,
 };
@@ -17,7 +17,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <string.h>
+#include <unistd.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
@@ -48,6 +50,11 @@
  * Output modules generate a newly allocated GString. The caller is then
  * expected to free this with g_string_free() when finished with it.
  *
+ * Alternatively, the output can be streamed into a sink supplied by the
+ * caller: a GString which is appended to, a file descriptor, or a callback.
+ * Modules which support it write into the sink without allocating a new
+ * string for every packet.
+ *
  * @{
  */
 
@@ -255,7 +262,7 @@ SR_API const struct sr_output *sr_output_new(const struct sr_output_module *omod
 	gpointer key, value;
 	int i;
 
-	op = g_malloc(sizeof(struct sr_output));
+	op = g_malloc0(sizeof(struct sr_output));
 	op->module = omod;
 	op->sdi = sdi;
 
@@ -306,18 +313,211 @@ SR_API const struct sr_output *sr_output_new(const struct sr_output_module *omod
 	return op;
 }
 
+/* Append the module's output for the packet to out. */
+static int module_append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
+{
+	GString *chunk;
+	int ret;
+
+	if (o->module->append)
+		return o->module->append(o, packet, out);
+
+	chunk = NULL;
+	ret = o->module->receive(o, packet, &chunk);
+	if (chunk) {
+		g_string_append_len(out, chunk->str, chunk->len);
+		g_string_free(chunk, TRUE);
+	}
+
+	return ret;
+}
+
+struct logic_repeat_append {
+	const struct sr_output *o;
+	GString *out;
+};
+
+static int logic_repeat_append(const struct sr_datafeed_packet *packet,
+		struct sr_buffer *buf, void *cb_data)
+{
+	struct logic_repeat_append *ctx;
+
+	(void)buf;
+
+	ctx = cb_data;
+
+	return module_append(ctx->o, packet, ctx->out);
+}
+
+static int output_append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
+{
+	struct logic_repeat_append ctx;
+
+	/*
+	 * Pass SR_DF_LOGIC_REPEAT packets to modules which don't handle
+	 * them as a series of SR_DF_LOGIC packets.
+	 */
+	if (packet->type == SR_DF_LOGIC_REPEAT && !o->module->logic_repeat) {
+		ctx.o = o;
+		ctx.out = out;
+		return sr_logic_repeat_expand(o->sdi ? o->sdi->session : NULL,
+				packet->payload, logic_repeat_append, &ctx);
+	}
+
+	return module_append(o, packet, out);
+}
+
 /**
  * Send a packet to the specified output instance.
  *
  * The instance's output is returned as a newly allocated GString,
  * which must be freed by the caller.
  *
+ * SR_DF_LOGIC_REPEAT packets are expanded to SR_DF_LOGIC packets for
+ * output modules which don't handle them.
+ *
+ * @see sr_output_send_buffer(), sr_output_send_fd(), sr_output_send_callback()
+ *
  * @since 0.4.0
  */
 SR_API int sr_output_send(const struct sr_output *o,
 		const struct sr_datafeed_packet *packet, GString **out)
 {
-	return o->module->receive(o, packet, out);
+	int ret;
+
+	if (o->module->receive && (packet->type != SR_DF_LOGIC_REPEAT
+			|| o->module->logic_repeat))
+		return o->module->receive(o, packet, out);
+
+	*out = g_string_sized_new(512);
+	ret = output_append(o, packet, *out);
+	if ((*out)->len == 0) {
+		g_string_free(*out, TRUE);
+		*out = NULL;
+	}
+
+	return ret;
+}
+
+/**
+ * Send a packet to the specified output instance, appending its output
+ * to a buffer.
+ *
+ * The buffer can be reused for any number of packets, it is only ever
+ * appended to. This avoids allocating a new string for every packet.
+ *
+ * @param o The output instance. Must not be NULL.
+ * @param packet The packet to send. Must not be NULL.
+ * @param buf The buffer to append the output to. Must not be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval other Error returned by the output module.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_output_send_buffer(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *buf)
+{
+	if (!o || !packet || !buf) {
+		sr_err("%s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	return output_append(o, packet, buf);
+}
+
+/**
+ * Send a packet to the specified output instance, passing its output
+ * to a callback.
+ *
+ * The output is collected in a buffer kept with the instance, so no
+ * memory is allocated for every packet. The callback is only called if
+ * there was any output. The data is only valid during the call.
+ *
+ * @param o The output instance. Must not be NULL.
+ * @param packet The packet to send. Must not be NULL.
+ * @param cb The callback to pass the output to. Must not be NULL.
+ * @param cb_data Opaque pointer passed to the callback.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval other Error returned by the output module or the callback.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_output_send_callback(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet,
+		sr_output_callback cb, void *cb_data)
+{
+	struct sr_output *op;
+	int ret, cb_ret;
+
+	if (!o || !packet || !cb) {
+		sr_err("%s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	op = (struct sr_output *)o;
+	if (!op->sink_buf)
+		op->sink_buf = g_string_sized_new(512);
+
+	ret = output_append(o, packet, op->sink_buf);
+	if (op->sink_buf->len > 0) {
+		cb_ret = cb(o, op->sink_buf->str, op->sink_buf->len, cb_data);
+		g_string_truncate(op->sink_buf, 0);
+		if (ret == SR_OK)
+			ret = cb_ret;
+	}
+
+	return ret;
+}
+
+static int write_fd(const struct sr_output *o, const char *data, gsize len,
+		void *cb_data)
+{
+	ssize_t n;
+	int fd;
+
+	fd = GPOINTER_TO_INT(cb_data);
+	while (len > 0) {
+		if ((n = write(fd, data, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			sr_err("%s: failed to write output: %s",
+				o->module->id, g_strerror(errno));
+			return SR_ERR_IO;
+		}
+		data += n;
+		len -= n;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Send a packet to the specified output instance, writing its output
+ * to a file descriptor.
+ *
+ * No memory is allocated for every packet.
+ *
+ * @param o The output instance. Must not be NULL.
+ * @param packet The packet to send. Must not be NULL.
+ * @param fd The file descriptor to write to.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval SR_ERR_IO Writing failed.
+ * @retval other Error returned by the output module.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_output_send_fd(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, int fd)
+{
+	return sr_output_send_callback(o, packet, write_fd, GINT_TO_POINTER(fd));
 }
 
 /**
@@ -335,9 +535,123 @@ SR_API int sr_output_free(const struct sr_output *o)
 	ret = SR_OK;
 	if (o->module->cleanup)
 		ret = o->module->cleanup((struct sr_output *)o);
+	if (o->sink_buf)
+		g_string_free(o->sink_buf, TRUE);
 	g_free((gpointer)o);
 
 	return ret;
 }
 
+/**
+ * Find the bit of every enabled logic channel in a sample.
+ *
+ * A channel's bit is at its index, unless a transform packed the samples
+ * down to the channels announced with SR_CONF_PACKED_CHANNELS.
+ *
+ * @param sdi The device instance.
+ * @param packed The mask of packed channels, or 0 if the samples aren't
+ *               packed.
+ * @param channel_index Filled with the bit of every enabled logic channel,
+ *                      in the order of the device's channel list.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_DATA An enabled channel isn't in the packed samples.
+ *
+ * @private
+ */
+SR_PRIV int sr_output_logic_bits(const struct sr_dev_inst *sdi,
+		uint64_t packed, int *channel_index)
+{
+	struct sr_channel *ch;
+	GSList *l;
+	uint64_t below;
+	int i, bit;
+
+	for (i = 0, l = sdi->channels; l; l = l->next) {
+		ch = l->data;
+		if (ch->type != SR_CHANNEL_LOGIC)
+			continue;
+		if (!ch->enabled)
+			continue;
+		if (!packed) {
+			channel_index[i++] = ch->index;
+			continue;
+		}
+		if (ch->index >= 64 || !(packed & (UINT64_C(1) << ch->index))) {
+			sr_err("Channel %s is missing from the packed samples.",
+					ch->name);
+			return SR_ERR_DATA;
+		}
+		/* Count the packed channels below this one. */
+		below = packed & ((UINT64_C(1) << ch->index) - 1);
+		for (bit = 0; below; bit++)
+			below &= below - 1;
+		channel_index[i++] = bit;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Transpose logic samples into one bit row per channel.
+ *
+ * Blocks of 8 samples are transposed 8x8 bits at a time, so the cost
+ * per channel and sample is a fraction of extracting every bit on its own.
+ * Bit 7 of the first byte of a row holds the channel's first sample,
+ * bit 6 the second, and so on. The bits following the last sample are
+ * zero, up to and including the byte after the last one.
+ *
+ * @param data The logic samples.
+ * @param num_samples The number of samples in @a data.
+ * @param unitsize The size of a sample in bytes.
+ * @param channel_index The indices of the channels to transpose.
+ * @param num_channels The number of entries in @a channel_index.
+ * @param rows The bit rows, @a stride bytes apart. Must hold at least
+ *             num_channels * stride bytes.
+ * @param stride The distance between rows in bytes, at least
+ *               num_samples / 8 + 2.
+ *
+ * @private
+ */
+SR_PRIV void sr_output_logic_transpose(const uint8_t *data,
+		uint64_t num_samples, unsigned int unitsize,
+		const int *channel_index, unsigned int num_channels,
+		uint8_t *rows, gsize stride)
+{
+	const uint8_t *p;
+	uint64_t i, num_blocks, x;
+	unsigned int j, k, n;
+	int col;
+
+	num_blocks = (num_samples + 7) / 8;
+	for (i = 0; i < num_blocks; i++) {
+		p = data + i * 8 * unitsize;
+		n = MIN(num_samples - i * 8, 8);
+		col = -1;
+		x = 0;
+		for (j = 0; j < num_channels; j++) {
+			if (channel_index[j] / 8 != col) {
+				/* Gather this byte of the 8 samples, first one on top. */
+				col = channel_index[j] / 8;
+				x = 0;
+				for (k = 0; k < n; k++)
+					x |= (uint64_t)p[k * unitsize + col] << (56 - 8 * k);
+				/* Transpose the 8x8 bit matrix. */
+				x = (x & 0xaa55aa55aa55aa55ULL)
+					| ((x & 0x00aa00aa00aa00aaULL) << 7)
+					| ((x >> 7) & 0x00aa00aa00aa00aaULL);
+				x = (x & 0xcccc3333cccc3333ULL)
+					| ((x & 0x0000cccc0000ccccULL) << 14)
+					| ((x >> 14) & 0x0000cccc0000ccccULL);
+				x = (x & 0xf0f0f0f00f0f0f0fULL)
+					| ((x & 0x00000000f0f0f0f0ULL) << 28)
+					| ((x >> 28) & 0x00000000f0f0f0f0ULL);
+			}
+			rows[j * stride + i] = x >> (8 * (channel_index[j] % 8));
+		}
+	}
+	for (j = 0; j < num_channels; j++)
+		rows[j * stride + num_blocks] = 0;
+}
+
 /** @} */
@@ -21,18 +21,93 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <glib.h>
-#include <glib/gstdio.h>
 #include <zip.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #define LOG_PREFIX "output/srzip"
 
+/* Default size of the logic-1-N chunks written to the archive. */
+#define DEFAULT_CHUNK_SIZE (4 * 1024 * 1024)
+#define MAX_CHUNK_SIZE (256 * 1024 * 1024)
+
+/* Each overview level has one block per this many of the level below. */
+#define OVERVIEW_FACTOR 256
+#define OVERVIEW_MAX_LEVELS 8
+
+/* A chunk waiting in the spool file to be added to the archive. */
+struct chunk_info {
+	uint64_t offset;
+	uint64_t size;
+	uint64_t comp_size;
+	uint32_t crc;
+	gboolean compressed;
+};
+
+/*
+ * One level of the overview pyramid. Each block is stored as the logic
+ * levels of its last sample, followed by a mask of the channels which
+ * changed anywhere in the block, including from the sample before it.
+ */
+struct overview_level {
+	GByteArray *blocks;
+	/* Block being built: last sample, then the change mask. */
+	uint8_t *cur;
+	unsigned int count;
+};
+
+#ifdef HAVE_ZLIB
+/* A chunk handed to the compression workers. */
+struct chunk_job {
+	uint8_t *data;
+	uint64_t size;
+	uint8_t *comp;
+	uint64_t comp_size;
+	uint32_t crc;
+	gboolean done;
+	gboolean failed;
+};
+#endif
+
 struct out_context {
 	gboolean zip_created;
 	uint64_t samplerate;
+	/* Channels the samples are packed down to, if any. */
+	uint64_t packed;
 	char *filename;
+	int num_workers;
+	uint64_t chunk_size;
+	/* The archive is kept open, and only written out at the end. */
+	struct zip *archive;
+	time_t mtime;
+	char *metadata;
+	int unitsize;
+	uint8_t *chunk_buf;
+	uint64_t chunk_fill;
+	/* Chunks are spooled to a temporary file until then. */
+	char *spool_name;
+	FILE *spool;
+	uint64_t spool_size;
+	GArray *chunks;
+	gboolean failed;
+	/* Overview pyramid, kept in memory until the end. */
+	gboolean overview;
+	struct overview_level levels[OVERVIEW_MAX_LEVELS];
+	int num_levels;
+	uint8_t *prev_sample;
+#ifdef HAVE_ZLIB
+	GThreadPool *workers;
+	/* Protects the fields below, and the spool while workers run. */
+	GMutex mutex;
+	GCond cond;
+	/* Jobs in submission order, so chunks are written in order. */
+	GQueue *jobs;
+#endif
 };
 
 static int init(struct sr_output *o, GHashTable *options)
@@ -45,20 +120,157 @@ static int init(struct sr_output *o, GHashTable *options)
 	if (strlen(outc->filename) == 0)
 		return SR_ERR_ARG;
 
+	outc->num_workers = g_variant_get_uint32(g_hash_table_lookup(options,
+			"workers"));
+	if (outc->num_workers == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		outc->num_workers = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+#else
+		outc->num_workers = 1;
+#endif
+	}
+	outc->chunk_size = g_variant_get_uint64(g_hash_table_lookup(options,
+			"chunksize"));
+	if (outc->chunk_size == 0 || outc->chunk_size > MAX_CHUNK_SIZE) {
+		sr_err("Chunk size must be between 1 and %d bytes.",
+				MAX_CHUNK_SIZE);
+		return SR_ERR_ARG;
+	}
+	outc->chunks = g_array_new(FALSE, FALSE, sizeof(struct chunk_info));
+	outc->overview = g_variant_get_boolean(g_hash_table_lookup(options,
+			"overview"));
+
+	return SR_OK;
+}
+
+static void spool_remove(struct out_context *outc)
+{
+	if (outc->spool) {
+		fclose(outc->spool);
+		outc->spool = NULL;
+	}
+	if (outc->spool_name) {
+		unlink(outc->spool_name);
+		g_free(outc->spool_name);
+		outc->spool_name = NULL;
+	}
+}
+
+/* Drop the archive which is being created, along with the spool file. */
+static void archive_discard(struct out_context *outc)
+{
+	zip_unchange_all(outc->archive);
+	zip_close(outc->archive);
+	outc->archive = NULL;
+	spool_remove(outc);
+}
+
+/* Called with the mutex held if workers are running. */
+static int spool_write(struct out_context *outc, const uint8_t *data,
+		uint64_t size, uint64_t comp_size, uint32_t crc,
+		gboolean compressed)
+{
+	struct chunk_info chunk;
+	uint64_t len;
+
+	len = compressed ? comp_size : size;
+	if (fwrite(data, 1, len, outc->spool) != len) {
+		sr_err("Failed to write spool file: %s.", strerror(errno));
+		return SR_ERR;
+	}
+
+	chunk.offset = outc->spool_size;
+	chunk.size = size;
+	chunk.comp_size = comp_size;
+	chunk.crc = crc;
+	chunk.compressed = compressed;
+	g_array_append_val(outc->chunks, chunk);
+	outc->spool_size += len;
+
 	return SR_OK;
 }
 
+#ifdef HAVE_ZLIB
+static void chunk_job_free(struct chunk_job *job)
+{
+	g_free(job->data);
+	g_free(job->comp);
+	g_free(job);
+}
+
+/* Compress one chunk to a raw deflate stream, as stored in the zip. */
+static void chunk_compress(gpointer data, gpointer user_data)
+{
+	struct out_context *outc;
+	struct chunk_job *job;
+	struct chunk_job *head;
+	z_stream zs;
+	uLong bound;
+
+	job = data;
+	outc = user_data;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+			8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		job->failed = TRUE;
+	} else {
+		bound = deflateBound(&zs, job->size);
+		job->comp = g_malloc(bound);
+		zs.next_in = job->data;
+		zs.avail_in = job->size;
+		zs.next_out = job->comp;
+		zs.avail_out = bound;
+		if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+			job->failed = TRUE;
+		job->comp_size = zs.total_out;
+		deflateEnd(&zs);
+		job->crc = crc32(crc32(0, Z_NULL, 0), job->data, job->size);
+	}
+	g_free(job->data);
+	job->data = NULL;
+
+	/* Write out whatever is now complete at the head of the queue. */
+	g_mutex_lock(&outc->mutex);
+	job->done = TRUE;
+	while ((head = g_queue_peek_head(outc->jobs)) && head->done) {
+		g_queue_pop_head(outc->jobs);
+		if (head->failed) {
+			sr_err("Failed to compress chunk.");
+			outc->failed = TRUE;
+		} else if (!outc->failed) {
+			if (spool_write(outc, head->comp, head->size,
+					head->comp_size, head->crc, TRUE) != SR_OK)
+				outc->failed = TRUE;
+		}
+		chunk_job_free(head);
+	}
+	g_cond_broadcast(&outc->cond);
+	g_mutex_unlock(&outc->mutex);
+}
+
+static void workers_stop(struct out_context *outc)
+{
+	if (!outc->workers)
+		return;
+
+	g_thread_pool_free(outc->workers, FALSE, TRUE);
+	outc->workers = NULL;
+	g_queue_free_full(outc->jobs, (GDestroyNotify)chunk_job_free);
+	outc->jobs = NULL;
+	g_cond_clear(&outc->cond);
+	g_mutex_clear(&outc->mutex);
+}
+#endif
+
 static int zip_create(const struct sr_output *o)
 {
+	static const char version[] = "2";
 	struct out_context *outc;
-	struct sr_channel *ch;
-	FILE *meta;
-	struct zip *zipfile;
-	struct zip_source *versrc, *metasrc;
+	struct zip_source *versrc;
 	GVariant *gvar;
-	GSList *l;
-	int tmpfile, ret;
-	char version[1], metafile[32], *s;
+	GError *error;
+	int fd, ret;
 
 	outc = o->priv;
 	if (outc->samplerate == 0) {
@@ -69,179 +281,529 @@ static int zip_create(const struct sr_output *o)
 		}
 	}
 
+	error = NULL;
+	if ((fd = g_file_open_tmp("sigrok-srzip-XXXXXX", &outc->spool_name,
+			&error)) == -1) {
+		sr_err("Failed to create spool file: %s.", error->message);
+		g_error_free(error);
+		return SR_ERR;
+	}
+	if (!(outc->spool = fdopen(fd, "w+b"))) {
+		sr_err("Failed to open spool file: %s.", strerror(errno));
+		close(fd);
+		spool_remove(outc);
+		return SR_ERR;
+	}
+
 	/* Quietly delete it first, libzip wants replace ops otherwise. */
 	unlink(outc->filename);
-	if (!(zipfile = zip_open(outc->filename, ZIP_CREATE, &ret)))
+	if (!(outc->archive = zip_open(outc->filename, ZIP_CREATE, &ret))) {
+		spool_remove(outc);
 		return SR_ERR;
+	}
+	outc->mtime = time(NULL);
 
 	/* "version" */
-	version[0] = '2';
-	if (!(versrc = zip_source_buffer(zipfile, version, 1, 0)))
+	if (!(versrc = zip_source_buffer(outc->archive, version, 1, 0))) {
+		archive_discard(outc);
 		return SR_ERR;
-	if (zip_add(zipfile, "version", versrc) == -1) {
+	}
+	if (zip_add(outc->archive, "version", versrc) == -1) {
 		sr_info("Error saving version into zipfile: %s.",
-			zip_strerror(zipfile));
+			zip_strerror(outc->archive));
+		zip_source_free(versrc);
+		archive_discard(outc);
 		return SR_ERR;
 	}
 
-	/* init "metadata" */
-	strcpy(metafile, "sigrok-meta-XXXXXX");
-	if ((tmpfile = g_mkstemp(metafile)) == -1)
-		return SR_ERR;
-	close(tmpfile);
-	meta = g_fopen(metafile, "wb");
-	fprintf(meta, "[global]\n");
-	fprintf(meta, "sigrok version = %s\n", PACKAGE_VERSION);
-	fprintf(meta, "[device 1]\ncapturefile = logic-1\n");
-	fprintf(meta, "total probes = %d\n", g_slist_length(o->sdi->channels));
+#ifdef HAVE_ZLIB
+	g_mutex_init(&outc->mutex);
+	g_cond_init(&outc->cond);
+	outc->jobs = g_queue_new();
+	error = NULL;
+	if (!(outc->workers = g_thread_pool_new(chunk_compress, outc,
+			outc->num_workers, TRUE, &error))) {
+		/* Not fatal, libzip compresses the chunks instead. */
+		sr_warn("Failed to start compression workers: %s.",
+				error->message);
+		g_error_free(error);
+		g_queue_free(outc->jobs);
+		outc->jobs = NULL;
+		g_cond_clear(&outc->cond);
+		g_mutex_clear(&outc->mutex);
+	}
+#endif
+
+	return SR_OK;
+}
+
+static struct overview_level *overview_level_get(struct out_context *outc,
+		int level)
+{
+	struct overview_level *ol;
+
+	ol = &outc->levels[level];
+	if (!ol->cur) {
+		ol->cur = g_malloc0(2 * outc->unitsize);
+		ol->blocks = g_byte_array_new();
+		outc->num_levels = MAX(outc->num_levels, level + 1);
+	}
+
+	return ol;
+}
+
+static void overview_block_done(struct out_context *outc, int level);
+
+/* Fold a finished block of the level below into this level. */
+static void overview_add(struct out_context *outc, int level,
+		const uint8_t *block)
+{
+	struct overview_level *ol;
+	int i;
+
+	ol = overview_level_get(outc, level);
+	memcpy(ol->cur, block, outc->unitsize);
+	for (i = 0; i < outc->unitsize; i++)
+		ol->cur[outc->unitsize + i] |= block[outc->unitsize + i];
+	if (++ol->count == OVERVIEW_FACTOR)
+		overview_block_done(outc, level);
+}
+
+static void overview_block_done(struct out_context *outc, int level)
+{
+	struct overview_level *ol;
+
+	ol = &outc->levels[level];
+	g_byte_array_append(ol->blocks, ol->cur, 2 * outc->unitsize);
+	if (level + 1 < OVERVIEW_MAX_LEVELS)
+		overview_add(outc, level + 1, ol->cur);
+	memset(ol->cur + outc->unitsize, 0, outc->unitsize);
+	ol->count = 0;
+}
+
+static void overview_samples(struct out_context *outc, const uint8_t *buf,
+		uint64_t length)
+{
+	struct overview_level *ol;
+	const uint8_t *prev;
+	uint8_t *changed;
+	uint64_t i;
+	int unitsize, j;
+
+	unitsize = outc->unitsize;
+	if (length < (uint64_t)unitsize)
+		return;
+
+	ol = overview_level_get(outc, 0);
+	if (!outc->prev_sample) {
+		outc->prev_sample = g_malloc(unitsize);
+		memcpy(outc->prev_sample, buf, unitsize);
+	}
+
+	changed = ol->cur + unitsize;
+	prev = outc->prev_sample;
+	for (i = 0; i + unitsize <= length; i += unitsize) {
+		for (j = 0; j < unitsize; j++)
+			changed[j] |= buf[i + j] ^ prev[j];
+		prev = buf + i;
+		if (++ol->count == OVERVIEW_FACTOR) {
+			memcpy(ol->cur, prev, unitsize);
+			overview_block_done(outc, 0);
+		}
+	}
+	memcpy(ol->cur, prev, unitsize);
+	memcpy(outc->prev_sample, prev, unitsize);
+}
+
+/* Count samples which are the same as the last one seen. */
+static void overview_repeat(struct out_context *outc, uint64_t count)
+{
+	struct overview_level *ol;
+	uint64_t n;
+
+	ol = overview_level_get(outc, 0);
+	while (count > 0) {
+		n = MIN(count, (uint64_t)(OVERVIEW_FACTOR - ol->count));
+		ol->count += n;
+		count -= n;
+		if (ol->count == OVERVIEW_FACTOR)
+			overview_block_done(outc, 0);
+	}
+}
+
+/*
+ * Finish the partial blocks. Levels above the first one to end up with
+ * a single block add nothing, and are dropped.
+ */
+static void overview_finish(struct out_context *outc)
+{
+	struct overview_level *ol;
+	int level;
+
+	for (level = 0; level < outc->num_levels; level++) {
+		ol = &outc->levels[level];
+		if (ol->count > 0)
+			overview_block_done(outc, level);
+		if (ol->blocks->len <= (guint)(2 * outc->unitsize)) {
+			outc->num_levels = level + 1;
+			break;
+		}
+	}
+}
+
+static int overview_add_to_zip(struct out_context *outc)
+{
+	struct zip_source *src;
+	GByteArray *blocks;
+	char name[16];
+	int level;
+
+	overview_finish(outc);
+	for (level = 0; level < outc->num_levels; level++) {
+		blocks = outc->levels[level].blocks;
+		if (!(src = zip_source_buffer(outc->archive, blocks->data,
+				blocks->len, 0)))
+			return SR_ERR;
+		snprintf(name, sizeof(name), "overview-1-%d", level + 1);
+		if (zip_add(outc->archive, name, src) == -1) {
+			sr_err("Failed to add %s: %s.", name,
+					zip_strerror(outc->archive));
+			zip_source_free(src);
+			return SR_ERR;
+		}
+	}
+
+	return SR_OK;
+}
+
+static void overview_free(struct out_context *outc)
+{
+	int level;
+
+	for (level = 0; level < OVERVIEW_MAX_LEVELS; level++) {
+		if (outc->levels[level].blocks)
+			g_byte_array_free(outc->levels[level].blocks, TRUE);
+		g_free(outc->levels[level].cur);
+	}
+	memset(outc->levels, 0, sizeof(outc->levels));
+	outc->num_levels = 0;
+	g_free(outc->prev_sample);
+	outc->prev_sample = NULL;
+}
+
+static char *metadata_new(const struct sr_output *o)
+{
+	struct out_context *outc;
+	struct sr_channel *ch;
+	GString *meta;
+	GSList *l;
+	char *s;
+	int *channel_index, i;
+
+	outc = o->priv;
+	meta = g_string_sized_new(256);
+	g_string_append_printf(meta, "[global]\n");
+	g_string_append_printf(meta, "sigrok version = %s\n", PACKAGE_VERSION);
+	g_string_append_printf(meta, "[device 1]\ncapturefile = logic-1\n");
+	g_string_append_printf(meta, "total probes = %d\n",
+			g_slist_length(o->sdi->channels));
 	s = sr_samplerate_string(outc->samplerate);
-	fprintf(meta, "samplerate = %s\n", s);
+	g_string_append_printf(meta, "samplerate = %s\n", s);
 	g_free(s);
+	g_string_append_printf(meta, "unitsize = %d\n", outc->unitsize);
+	if (outc->num_levels > 0) {
+		g_string_append_printf(meta, "overview levels = %d\n",
+				outc->num_levels);
+		g_string_append_printf(meta, "overview block = %d\n",
+				OVERVIEW_FACTOR);
+	}
 
-	for (l = o->sdi->channels; l; l = l->next) {
+	/* Probes are numbered by their bit in a sample. */
+	channel_index = g_malloc(sizeof(int) * g_slist_length(o->sdi->channels));
+	if (sr_output_logic_bits(o->sdi, outc->packed, channel_index) != SR_OK)
+		sr_output_logic_bits(o->sdi, 0, channel_index);
+	for (i = 0, l = o->sdi->channels; l; l = l->next) {
 		ch = l->data;
 		if (ch->type != SR_CHANNEL_LOGIC)
 			continue;
 		if (!ch->enabled)
 			continue;
-		fprintf(meta, "probe%d = %s\n", ch->index + 1, ch->name);
+		g_string_append_printf(meta, "probe%d = %s\n",
+				channel_index[i++] + 1, ch->name);
 	}
-	fclose(meta);
+	g_free(channel_index);
 
-	if (!(metasrc = zip_source_file(zipfile, metafile, 0, -1))) {
-		unlink(metafile);
-		return SR_ERR;
-	}
-	if (zip_add(zipfile, "metadata", metasrc) == -1) {
-		unlink(metafile);
-		return SR_ERR;
-	}
+	return g_string_free(meta, FALSE);
+}
 
-	if ((ret = zip_close(zipfile)) == -1) {
-		sr_info("Error saving zipfile: %s.", zip_strerror(zipfile));
-		unlink(metafile);
-		return SR_ERR;
+/* Hand the filled chunk buffer to the workers, or spool it as it is. */
+static int chunk_complete(const struct sr_output *o)
+{
+	struct out_context *outc;
+#ifdef HAVE_ZLIB
+	struct chunk_job *job;
+	gboolean failed;
+#endif
+	int ret;
+
+	outc = o->priv;
+	if (outc->chunk_fill == 0)
+		return SR_OK;
+
+#ifdef HAVE_ZLIB
+	if (outc->workers) {
+		job = g_malloc0(sizeof(struct chunk_job));
+		job->data = outc->chunk_buf;
+		job->size = outc->chunk_fill;
+		outc->chunk_buf = NULL;
+		outc->chunk_fill = 0;
+
+		/* Don't let the workers fall arbitrarily far behind. */
+		g_mutex_lock(&outc->mutex);
+		while (g_queue_get_length(outc->jobs)
+				>= 2 * (unsigned int)outc->num_workers)
+			g_cond_wait(&outc->cond, &outc->mutex);
+		g_queue_push_tail(outc->jobs, job);
+		failed = outc->failed;
+		g_mutex_unlock(&outc->mutex);
+		g_thread_pool_push(outc->workers, job, NULL);
+
+		return failed ? SR_ERR : SR_OK;
 	}
+#endif
 
-	unlink(metafile);
+	ret = spool_write(outc, outc->chunk_buf, outc->chunk_fill, 0, 0, FALSE);
+	outc->chunk_fill = 0;
 
-	return SR_OK;
+	return ret;
 }
 
 static int zip_append(const struct sr_output *o, unsigned char *buf,
 		int unitsize, int length)
 {
 	struct out_context *outc;
-	struct zip *archive;
-	struct zip_source *logicsrc;
-	zip_int64_t num_files;
-	struct zip_file *zf;
-	struct zip_stat zs;
-	struct zip_source *metasrc;
-	GKeyFile *kf;
-	GError *error;
-	gsize len;
-	int chunk_num, next_chunk_num, tmpfile, ret, i;
-	const char *entry_name;
-	char *metafile, tmpname[32], chunkname[16];
+	uint64_t chunk_size, size;
+	int ret;
 
 	outc = o->priv;
-	if (!(archive = zip_open(outc->filename, 0, &ret)))
-		return SR_ERR;
+	if (!outc->unitsize)
+		outc->unitsize = unitsize;
+
+	if (outc->overview)
+		overview_samples(outc, buf, length);
+
+	chunk_size = MAX(outc->chunk_size / outc->unitsize, 1) * outc->unitsize;
+	while (length > 0) {
+		if (!outc->chunk_buf)
+			outc->chunk_buf = g_malloc(chunk_size);
+		size = MIN((uint64_t)length, chunk_size - outc->chunk_fill);
+		memcpy(outc->chunk_buf + outc->chunk_fill, buf, size);
+		outc->chunk_fill += size;
+		buf += size;
+		length -= size;
+		if (outc->chunk_fill == chunk_size) {
+			if ((ret = chunk_complete(o)) != SR_OK)
+				return ret;
+		}
+	}
 
-	if (zip_stat(archive, "metadata", 0, &zs) == -1)
-		return SR_ERR;
+	return SR_OK;
+}
 
-	metafile = g_malloc(zs.size);
-	zf = zip_fopen_index(archive, zs.index, 0);
-	zip_fread(zf, metafile, zs.size);
-	zip_fclose(zf);
+/* Append a sample repeated count times, without expanding it first. */
+static int zip_append_repeat(const struct sr_output *o,
+		const struct sr_datafeed_logic_repeat *repeat)
+{
+	struct out_context *outc;
+	uint64_t chunk_size, count, n;
+	int ret;
 
-	/*
-	 * If the file was only initialized but doesn't yet have any
-	 * data it in, it won't have a unitsize field in metadata yet.
-	 */
-	error = NULL;
-	kf = g_key_file_new();
-	if (!g_key_file_load_from_data(kf, metafile, zs.size, 0, &error)) {
-		sr_err("Failed to parse metadata: %s.", error->message);
-		return SR_ERR;
+	outc = o->priv;
+	if (!outc->unitsize)
+		outc->unitsize = repeat->unitsize;
+
+	if (outc->overview) {
+		overview_samples(outc, repeat->data, repeat->unitsize);
+		overview_repeat(outc, repeat->count - 1);
 	}
-	g_free(metafile);
-	tmpname[0] = '\0';
-	if (!g_key_file_has_key(kf, "device 1", "unitsize", &error)) {
-		if (error && error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-			sr_err("Failed to check unitsize key: %s", error ? error->message : "?");
-			return SR_ERR;
-		}
-		/* Add unitsize field. */
-		g_key_file_set_integer(kf, "device 1", "unitsize", unitsize);
-		metafile = g_key_file_to_data(kf, &len, &error);
-		strcpy(tmpname, "sigrok-meta-XXXXXX");
-		if ((tmpfile = g_mkstemp(tmpname)) == -1)
-			return SR_ERR;
-		if (write(tmpfile, metafile, len) < 0) {
-			sr_dbg("Failed to create new metadata: %s", strerror(errno));
-			g_free(metafile);
-			unlink(tmpname);
-			return SR_ERR;
-		}
-		close(tmpfile);
-		if (!(metasrc = zip_source_file(archive, tmpname, 0, -1))) {
-			sr_err("Failed to create zip source for metadata.");
-			g_free(metafile);
-			unlink(tmpname);
-			return SR_ERR;
-		}
-		if (zip_replace(archive, zs.index, metasrc) == -1) {
-			sr_err("Failed to replace metadata file.");
-			g_free(metafile);
-			unlink(tmpname);
-			return SR_ERR;
+
+	chunk_size = MAX(outc->chunk_size / outc->unitsize, 1) * outc->unitsize;
+	for (count = repeat->count; count > 0; count -= n) {
+		if (!outc->chunk_buf)
+			outc->chunk_buf = g_malloc(chunk_size);
+		n = MIN(count, (chunk_size - outc->chunk_fill) / outc->unitsize);
+		sr_logic_repeat_fill(outc->chunk_buf + outc->chunk_fill,
+				repeat, n);
+		outc->chunk_fill += n * outc->unitsize;
+		if (outc->chunk_fill == chunk_size) {
+			if ((ret = chunk_complete(o)) != SR_OK)
+				return ret;
 		}
-		g_free(metafile);
 	}
-	g_key_file_free(kf);
 
-	next_chunk_num = 1;
-	num_files = zip_get_num_entries(archive, 0);
-	for (i = 0; i < num_files; i++) {
-		entry_name = zip_get_name(archive, i, 0);
-		if (strncmp(entry_name, "logic-1", 7))
-			continue;
-		if (strlen(entry_name) == 7) {
-			/* This file has no extra chunks, just a single "logic-1".
-			 * Rename it to "logic-1-1" * and continue with chunk 2. */
-			if (zip_rename(archive, i, "logic-1-1") == -1) {
-				sr_err("Failed to rename 'logic-1' to 'logic-1-1'.");
-				unlink(tmpname);
+	return SR_OK;
+}
+
+/* Serves a compressed chunk from the spool file to libzip as it is. */
+struct chunk_source {
+	FILE *spool;
+	struct chunk_info chunk;
+	uint64_t pos;
+	time_t mtime;
+};
+
+static zip_int64_t chunk_source_cb(void *state, void *data, zip_uint64_t len,
+		enum zip_source_cmd cmd)
+{
+	struct chunk_source *cs;
+	struct zip_stat *st;
+	uint64_t size;
+
+	cs = state;
+	switch (cmd) {
+	case ZIP_SOURCE_OPEN:
+		cs->pos = 0;
+		if (fseeko(cs->spool, cs->chunk.offset, SEEK_SET) != 0)
+			return -1;
+		return 0;
+	case ZIP_SOURCE_READ:
+		size = MIN(len, cs->chunk.comp_size - cs->pos);
+		if (size > 0 && fread(data, 1, size, cs->spool) != size)
+			return -1;
+		cs->pos += size;
+		return size;
+	case ZIP_SOURCE_CLOSE:
+		return 0;
+	case ZIP_SOURCE_STAT:
+		if (len < sizeof(struct zip_stat))
+			return -1;
+		st = data;
+		zip_stat_init(st);
+		st->valid = ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE
+				| ZIP_STAT_COMP_METHOD | ZIP_STAT_CRC
+				| ZIP_STAT_MTIME;
+		st->size = cs->chunk.size;
+		st->comp_size = cs->chunk.comp_size;
+		st->comp_method = ZIP_CM_DEFLATE;
+		st->crc = cs->chunk.crc;
+		st->mtime = cs->mtime;
+		return sizeof(struct zip_stat);
+	case ZIP_SOURCE_ERROR:
+		if (len < 2 * sizeof(int))
+			return -1;
+		((int *)data)[0] = ZIP_ER_READ;
+		((int *)data)[1] = errno;
+		return 2 * sizeof(int);
+	case ZIP_SOURCE_FREE:
+		g_free(cs);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* Add all spooled chunks as logic-1-N files. */
+static int chunks_add(const struct sr_output *o)
+{
+	struct out_context *outc;
+	struct chunk_info *chunk;
+	struct chunk_source *cs;
+	struct zip_source *logicsrc;
+	char chunkname[16];
+	unsigned int i;
+
+	outc = o->priv;
+	for (i = 0; i < outc->chunks->len; i++) {
+		chunk = &g_array_index(outc->chunks, struct chunk_info, i);
+		if (chunk->compressed) {
+			cs = g_malloc0(sizeof(struct chunk_source));
+			cs->spool = outc->spool;
+			cs->chunk = *chunk;
+			cs->mtime = outc->mtime;
+			if (!(logicsrc = zip_source_function(outc->archive,
+					chunk_source_cb, cs))) {
+				g_free(cs);
 				return SR_ERR;
 			}
-			next_chunk_num = 2;
-			break;
-		} else if (strlen(entry_name) > 8 && entry_name[7] == '-') {
-			chunk_num = strtoull(entry_name + 8, NULL, 10);
-			if (chunk_num >= next_chunk_num)
-				next_chunk_num = chunk_num + 1;
+		} else {
+			if (!(logicsrc = zip_source_file(outc->archive,
+					outc->spool_name, chunk->offset,
+					chunk->size)))
+				return SR_ERR;
+		}
+		snprintf(chunkname, 15, "logic-1-%u", i + 1);
+		if (zip_add(outc->archive, chunkname, logicsrc) == -1) {
+			sr_err("Failed to add %s: %s.", chunkname,
+					zip_strerror(outc->archive));
+			zip_source_free(logicsrc);
+			return SR_ERR;
 		}
 	}
-	snprintf(chunkname, 15, "logic-1-%d", next_chunk_num);
-	if (!(logicsrc = zip_source_buffer(archive, buf, length, FALSE))) {
-		unlink(tmpname);
-		return SR_ERR;
+
+	return SR_OK;
+}
+
+/* Write out the archive. */
+static int zip_finish(const struct sr_output *o)
+{
+	struct out_context *outc;
+	struct zip_source *metasrc;
+	int ret;
+
+	outc = o->priv;
+	if (!outc->archive)
+		return SR_OK;
+
+	ret = chunk_complete(o);
+#ifdef HAVE_ZLIB
+	if (outc->workers) {
+		g_mutex_lock(&outc->mutex);
+		while (!g_queue_is_empty(outc->jobs))
+			g_cond_wait(&outc->cond, &outc->mutex);
+		g_mutex_unlock(&outc->mutex);
+		workers_stop(outc);
 	}
-	if (zip_add(archive, chunkname, logicsrc) == -1) {
-		unlink(tmpname);
-		return SR_ERR;
+#endif
+	if (outc->failed)
+		ret = SR_ERR;
+	if (ret == SR_OK && fflush(outc->spool) != 0) {
+		sr_err("Failed to write spool file: %s.", strerror(errno));
+		ret = SR_ERR;
 	}
-	if ((ret = zip_close(archive)) == -1) {
-		sr_info("error saving session file: %s", zip_strerror(archive));
-		unlink(tmpname);
-		return SR_ERR;
+	if (ret == SR_OK)
+		ret = chunks_add(o);
+	if (ret == SR_OK && outc->num_levels > 0)
+		ret = overview_add_to_zip(outc);
+
+	if (ret == SR_OK) {
+		outc->metadata = metadata_new(o);
+		if (!(metasrc = zip_source_buffer(outc->archive, outc->metadata,
+				strlen(outc->metadata), 0))) {
+			ret = SR_ERR;
+		} else if (zip_add(outc->archive, "metadata", metasrc) == -1) {
+			zip_source_free(metasrc);
+			ret = SR_ERR;
+		}
 	}
-	unlink(tmpname);
 
-	return SR_OK;
+	if (ret != SR_OK)
+		zip_unchange_all(outc->archive);
+	if (zip_close(outc->archive) == -1) {
+		sr_info("Error saving zipfile: %s.", zip_strerror(outc->archive));
+		ret = SR_ERR;
+	}
+	outc->archive = NULL;
+
+	spool_remove(outc);
+	g_array_set_size(outc->chunks, 0);
+	g_free(outc->chunk_buf);
+	outc->chunk_buf = NULL;
+	outc->chunk_fill = 0;
+	g_free(outc->metadata);
+	outc->metadata = NULL;
+	overview_free(outc);
+
+	return ret;
 }
 
 static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
@@ -250,9 +812,9 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 	struct out_context *outc;
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_repeat *repeat;
 	const struct sr_config *src;
 	GSList *l;
-
 	int ret;
 
 	*out = NULL;
@@ -264,9 +826,10 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		meta = packet->payload;
 		for (l = meta->config; l; l = l->next) {
 			src = l->data;
-			if (src->key != SR_CONF_SAMPLERATE)
-				continue;
-			outc->samplerate = g_variant_get_uint64(src->data);
+			if (src->key == SR_CONF_SAMPLERATE)
+				outc->samplerate = g_variant_get_uint64(src->data);
+			else if (src->key == SR_CONF_PACKED_CHANNELS)
+				outc->packed = g_variant_get_uint64(src->data);
 		}
 		break;
 	case SR_DF_LOGIC:
@@ -276,8 +839,24 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 			outc->zip_created = TRUE;
 		}
 		logic = packet->payload;
-		ret = zip_append(o, logic->data, logic->unitsize, logic->length);
+		if ((ret = zip_append(o, logic->data, logic->unitsize,
+				logic->length)) != SR_OK)
+			return ret;
+		break;
+	case SR_DF_LOGIC_REPEAT:
+		repeat = packet->payload;
+		if (!repeat->count)
+			break;
+		if (!outc->zip_created) {
+			if ((ret = zip_create(o)) != SR_OK)
+				return ret;
+			outc->zip_created = TRUE;
+		}
+		if ((ret = zip_append_repeat(o, repeat)) != SR_OK)
+			return ret;
 		break;
+	case SR_DF_END:
+		return zip_finish(o);
 	}
 
 	return SR_OK;
@@ -288,6 +867,10 @@ static int cleanup(struct sr_output *o)
 	struct out_context *outc;
 
 	outc = o->priv;
+	/* In case the stream didn't get to the end. */
+	zip_finish(o);
+	if (outc->chunks)
+		g_array_free(outc->chunks, TRUE);
 	g_free(outc->filename);
 	g_free(outc);
 	o->priv = NULL;
@@ -297,13 +880,20 @@ static int cleanup(struct sr_output *o)
 
 static struct sr_option options[] = {
 	{ "filename", "Filename", "File to write", NULL, NULL },
+	{ "workers", "Workers", "Number of compression threads (0 = one per CPU)", NULL, NULL },
+	{ "chunksize", "Chunk size", "Size of the logic data chunks in bytes", NULL, NULL },
+	{ "overview", "Overview", "Store a zoomed out overview of the capture", NULL, NULL },
 	ALL_ZERO
 };
 
 static const struct sr_option *get_options(void)
 {
-	if (!options[0].def)
+	if (!options[0].def) {
 		options[0].def = g_variant_ref_sink(g_variant_new_string(""));
+		options[1].def = g_variant_ref_sink(g_variant_new_uint32(0));
+		options[2].def = g_variant_ref_sink(g_variant_new_uint64(DEFAULT_CHUNK_SIZE));
+		options[3].def = g_variant_ref_sink(g_variant_new_boolean(FALSE));
+	}
 
 	return options;
 }
@@ -316,5 +906,6 @@ SR_PRIV struct sr_output_module output_srzip = {
 	.options = get_options,
 	.init = init,
 	.receive = receive,
+	.logic_repeat = TRUE,
 	.cleanup = cleanup,
 };
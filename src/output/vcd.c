@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <glib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "config.h" /* Needed for PACKAGE and others. */
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
@@ -30,13 +33,19 @@
 
 struct context {
 	int num_enabled_channels;
-	GArray *channelindices;
 	uint8_t *prevsample;
+	/* The enabled channels' bits in a sample. */
+	uint8_t *channel_mask;
+	/* VCD identifier of each enabled channel, by channel index. */
+	char *identifiers;
 	gboolean header_done;
 	int period;
 	int *channel_index;
 	uint64_t samplerate;
 	uint64_t samplecount;
+	/* A sample's timestamp is its number * ts_num / ts_den. */
+	uint64_t ts_num;
+	uint64_t ts_den;
 };
 
 static int init(struct sr_output *o, GHashTable *options)
@@ -66,6 +75,7 @@ static int init(struct sr_output *o, GHashTable *options)
 	o->priv = ctx;
 	ctx->num_enabled_channels = num_enabled_channels;
 	ctx->channel_index = g_malloc(sizeof(int) * ctx->num_enabled_channels);
+	ctx->ts_num = ctx->ts_den = 1;
 
 	/* Once more to map the enabled channels. */
 	for (i = 0, l = o->sdi->channels; l; l = l->next) {
@@ -80,26 +90,37 @@ static int init(struct sr_output *o, GHashTable *options)
 	return SR_OK;
 }
 
-static GString *gen_header(const struct sr_output *o)
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	uint64_t t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static void gen_header(const struct sr_output *o, GString *header)
 {
 	struct context *ctx;
 	struct sr_channel *ch;
 	GVariant *gvar;
-	GString *header;
 	GSList *l;
 	time_t t;
 	int num_channels, i;
 	char *samplerate_s, *frequency_s, *timestamp;
 
 	ctx = o->priv;
-	header = g_string_sized_new(512);
 	num_channels = g_slist_length(o->sdi->channels);
 
 	/* timestamp */
 	t = time(NULL);
 	timestamp = g_strdup(ctime(&t));
 	timestamp[strlen(timestamp)-1] = 0;
-	g_string_printf(header, "$date %s $end\n", timestamp);
+	g_string_append_printf(header, "$date %s $end\n", timestamp);
 	g_free(timestamp);
 
 	/* generator */
@@ -134,39 +155,199 @@ static GString *gen_header(const struct sr_output *o)
 	g_string_append_printf(header, "$timescale %s $end\n", frequency_s);
 	g_free(frequency_s);
 
+	/*
+	 * Reduce period / samplerate, so computing timestamps in integers
+	 * can't overflow with any practical samplerate. Without one, the
+	 * timestamps are the sample numbers.
+	 */
+	if (ctx->samplerate != 0) {
+		ctx->ts_num = ctx->period / gcd(ctx->period, ctx->samplerate);
+		ctx->ts_den = ctx->samplerate / gcd(ctx->period, ctx->samplerate);
+	}
+
 	/* scope */
 	g_string_append_printf(header, "$scope module %s $end\n", PACKAGE);
 
-	/* Wires / channels */
-	for (i = 0, l = o->sdi->channels; l; l = l->next, i++) {
+	/* Wires / channels, numbered like the enabled channels in the data. */
+	for (i = 0, l = o->sdi->channels; l; l = l->next) {
 		ch = l->data;
 		if (ch->type != SR_CHANNEL_LOGIC)
 			continue;
 		if (!ch->enabled)
 			continue;
 		g_string_append_printf(header, "$var wire 1 %c %s $end\n",
-				(char)('!' + i), ch->name);
+				(char)('!' + i++), ch->name);
 	}
 
 	g_string_append(header, "$upscope $end\n$enddefinitions $end\n");
+}
+
+/*
+ * Append the timestamp of the given sample, rounded to the nearest unit.
+ * Halfway cases round to even, as they did when this was printed from a
+ * double with "%.0f".
+ */
+static void write_timestamp(const struct context *ctx, GString *out,
+		uint64_t samplenum)
+{
+	char buf[21], *p;
+	uint64_t t, rem;
+
+	rem = samplenum % ctx->ts_den * ctx->ts_num;
+	t = samplenum / ctx->ts_den * ctx->ts_num + rem / ctx->ts_den;
+	rem %= ctx->ts_den;
+	if (2 * rem > ctx->ts_den || (2 * rem == ctx->ts_den && t % 2))
+		t++;
+
+	p = buf + sizeof(buf);
+	do {
+		*--p = '0' + t % 10;
+		t /= 10;
+	} while (t);
+	g_string_append_c(out, '#');
+	g_string_append_len(out, p, buf + sizeof(buf) - p);
+}
+
+/*
+ * Write the enabled channels which differ between prev and sample, with
+ * the sample's timestamp. Nothing is written if none of them changed.
+ */
+static void write_changes(const struct context *ctx, GString *out,
+		const uint8_t *sample, const uint8_t *prev, uint16_t unitsize,
+		uint64_t samplenum)
+{
+	gboolean timestamp_written;
+	unsigned int i, changes;
+	int bit;
+
+	timestamp_written = FALSE;
+	for (i = 0; i < unitsize; i++) {
+		changes = (sample[i] ^ prev[i]) & ctx->channel_mask[i];
+		for (bit = -1; (bit = g_bit_nth_lsf(changes, bit)) >= 0; ) {
+			if (!timestamp_written)
+				write_timestamp(ctx, out, samplenum);
+			timestamp_written = TRUE;
+
+			/* Output which signal changed to which value. */
+			g_string_append_c(out, ' ');
+			g_string_append_c(out, '0' + ((sample[i] >> bit) & 1));
+			g_string_append_c(out, ctx->identifiers[i * 8 + bit]);
+		}
+	}
+
+	if (timestamp_written)
+		g_string_append_c(out, '\n');
+}
+
+/*
+ * Find the first byte at or after offset i (i >= unitsize) which differs
+ * from the byte one sample before it, i.e. the first sample in buf which
+ * may hold changes. Returns len if there is none.
+ */
+static gsize find_change(const uint8_t *buf, gsize i, gsize len,
+		uint16_t unitsize)
+{
+	uint64_t cur, prev;
+#ifdef __SSE2__
+	__m128i s, p;
+	int bits;
+#endif
+
+#ifdef __SSE2__
+	/* Bulk of the buffer, a vector at a time. */
+	for (; i + 16 <= len; i += 16) {
+		s = _mm_loadu_si128((const __m128i *)(buf + i));
+		p = _mm_loadu_si128((const __m128i *)(buf + i - unitsize));
+		bits = _mm_movemask_epi8(_mm_cmpeq_epi8(s, p)) ^ 0xffff;
+		if (bits)
+			return i + g_bit_nth_lsf(bits, -1);
+	}
+#endif
+
+	/* Then a word at a time, the changed byte is found below. */
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&cur, buf + i, sizeof(cur));
+		memcpy(&prev, buf + i - unitsize, sizeof(prev));
+		if (cur != prev)
+			break;
+	}
 
-	return header;
+	for (; i < len; i++) {
+		if (buf[i] != buf[i - unitsize])
+			return i;
+	}
+
+	return len;
 }
 
-static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
-		GString **out)
+static void write_logic(struct context *ctx, GString *out,
+		const uint8_t *data, uint64_t length, uint16_t unitsize)
+{
+	gsize i, len;
+
+	len = length / unitsize * unitsize;
+	if (len == 0)
+		return;
+
+	/* The first sample is compared to the last one of the previous packet. */
+	if (ctx->samplecount == 0) {
+		/* Write the initial values of all channels. */
+		for (i = 0; i < unitsize; i++)
+			ctx->prevsample[i] = ~data[i];
+	}
+	write_changes(ctx, out, data, ctx->prevsample, unitsize,
+			ctx->samplecount);
+
+	/* Skip over unchanged samples, comparing whole samples at a time. */
+	for (i = unitsize; (i = find_change(data, i, len, unitsize)) < len; ) {
+		i -= i % unitsize;
+		write_changes(ctx, out, data + i, data + i - unitsize, unitsize,
+				ctx->samplecount + i / unitsize);
+		i += unitsize;
+	}
+
+	memcpy(ctx->prevsample, data + len - unitsize, unitsize);
+	ctx->samplecount += len / unitsize;
+}
+
+static void init_output(const struct sr_output *o, GString *out,
+		uint16_t unitsize)
+{
+	struct context *ctx;
+	int p, index;
+
+	ctx = o->priv;
+	if (!ctx->header_done) {
+		gen_header(o, out);
+		ctx->header_done = TRUE;
+	}
+
+	if (!ctx->prevsample) {
+		/* Can't allocate these until we know the stream's unitsize. */
+		ctx->prevsample = g_malloc0(unitsize);
+		ctx->channel_mask = g_malloc0(unitsize);
+		ctx->identifiers = g_malloc0(unitsize * 8);
+		for (p = 0; p < ctx->num_enabled_channels; p++) {
+			index = ctx->channel_index[p];
+			if (index >= unitsize * 8)
+				continue;
+			ctx->channel_mask[index / 8] |= 1 << (index % 8);
+			ctx->identifiers[index] = '!' + p;
+		}
+	}
+}
+
+static int append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_repeat *repeat;
 	const struct sr_config *src;
 	GSList *l;
 	struct context *ctx;
-	unsigned int i;
-	int p, curbit, prevbit, index;
-	uint8_t *sample;
-	gboolean timestamp_written;
+	int ret;
 
-	*out = NULL;
 	if (!o || !o->priv)
 		return SR_ERR_BUG;
 	ctx = o->priv;
@@ -176,68 +357,42 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		meta = packet->payload;
 		for (l = meta->config; l; l = l->next) {
 			src = l->data;
-			if (src->key != SR_CONF_SAMPLERATE)
-				continue;
-			ctx->samplerate = g_variant_get_uint64(src->data);
+			if (src->key == SR_CONF_SAMPLERATE) {
+				ctx->samplerate = g_variant_get_uint64(src->data);
+			} else if (src->key == SR_CONF_PACKED_CHANNELS) {
+				ret = sr_output_logic_bits(o->sdi,
+						g_variant_get_uint64(src->data),
+						ctx->channel_index);
+				if (ret != SR_OK)
+					return ret;
+				/* Map the channels again with the next samples. */
+				g_free(ctx->prevsample);
+				g_free(ctx->channel_mask);
+				g_free(ctx->identifiers);
+				ctx->prevsample = NULL;
+			}
 		}
 		break;
 	case SR_DF_LOGIC:
 		logic = packet->payload;
-
-		if (!ctx->header_done) {
-			*out = gen_header(o);
-			ctx->header_done = TRUE;
-		} else {
-			*out = g_string_sized_new(512);
-		}
-
-		if (!ctx->prevsample) {
-			/* Can't allocate this until we know the stream's unitsize. */
-			ctx->prevsample = g_malloc0(logic->unitsize);
-		}
-
-		for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-			sample = logic->data + i;
-			timestamp_written = FALSE;
-
-			for (p = 0; p < ctx->num_enabled_channels; p++) {
-				index = ctx->channel_index[p];
-
-				curbit = ((unsigned)sample[index / 8]
-						>> (index % 8)) & 1;
-				prevbit = ((unsigned)ctx->prevsample[index / 8]
-						>> (index % 8)) & 1;
-
-				/* VCD only contains deltas/changes of signals. */
-				if (prevbit == curbit && ctx->samplecount > 0)
-					continue;
-
-				/* Output timestamp of subsequent signal changes. */
-				if (!timestamp_written)
-					g_string_append_printf(*out, "#%.0f",
-						(double)ctx->samplecount /
-							ctx->samplerate * ctx->period);
-
-				/* Output which signal changed to which value. */
-				g_string_append_c(*out, ' ');
-				g_string_append_c(*out, '0' + curbit);
-				g_string_append_c(*out, '!' + p);
-
-				timestamp_written = TRUE;
-			}
-
-			if (timestamp_written)
-				g_string_append_c(*out, '\n');
-
-			ctx->samplecount++;
-			memcpy(ctx->prevsample, sample, logic->unitsize);
-		}
+		init_output(o, out, logic->unitsize);
+		write_logic(ctx, out, logic->data, logic->length,
+				logic->unitsize);
+		break;
+	case SR_DF_LOGIC_REPEAT:
+		/* Only the first sample can hold changes. */
+		repeat = packet->payload;
+		if (!repeat->count)
+			break;
+		init_output(o, out, repeat->unitsize);
+		write_logic(ctx, out, repeat->data, repeat->unitsize,
+				repeat->unitsize);
+		ctx->samplecount += repeat->count - 1;
 		break;
 	case SR_DF_END:
 		/* Write final timestamp as length indicator. */
-		*out = g_string_sized_new(512);
-		g_string_printf(*out, "#%.0f\n",
-				(double)ctx->samplecount / ctx->samplerate * ctx->period);
+		write_timestamp(ctx, out, ctx->samplecount);
+		g_string_append_c(out, '\n');
 		break;
 	}
 
@@ -253,6 +408,8 @@ static int cleanup(struct sr_output *o)
 
 	ctx = o->priv;
 	g_free(ctx->prevsample);
+	g_free(ctx->channel_mask);
+	g_free(ctx->identifiers);
 	g_free(ctx->channel_index);
 	g_free(ctx);
 
@@ -266,6 +423,7 @@ struct sr_output_module output_vcd = {
 	.exts = (const char*[]){"vcd", NULL},
 	.options = NULL,
 	.init = init,
-	.receive = receive,
+	.append = append,
+	.logic_repeat = TRUE,
 	.cleanup = cleanup,
 };
@@ -18,6 +18,9 @@
  */
 
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
@@ -31,7 +34,11 @@ struct out_context {
 	gboolean header_done;
 	uint64_t samplerate;
 	int num_channels;
-	GSList *channels;
+	/* Position in the output of each channel, by channel index. */
+	int *chan_pos;
+	int num_chan_pos;
+	/* Positions of the channels in the current packet. */
+	int *chan_idx;
 	int chanbuf_size;
 	int *chanbuf_used;
 	uint8_t **chanbuf;
@@ -48,42 +55,41 @@ static int realloc_chanbufs(const struct sr_output *o, int size)
 			sr_err("Unable to allocate enough output buffer memory.");
 			return SR_ERR;
 		}
-		outc->chanbuf_used[i] = 0;
 	}
 	outc->chanbuf_size = size;
 
 	return SR_OK;
 }
 
-static int flush_chanbufs(const struct sr_output *o, GString *out)
+static void flush_chanbufs(const struct sr_output *o, GString *out)
 {
 	struct out_context *outc;
 	int num_samples, i, j;
-	char *buf, *bufp;
+	gsize len;
+	uint8_t *bufp;
 
 	outc = o->priv;
 
 	/* Any one of them will do. */
 	num_samples = outc->chanbuf_used[0];
-	if (!(buf = g_try_malloc(4 * num_samples * outc->num_channels))) {
-		sr_err("Unable to allocate enough interleaved output buffer memory.");
-		return SR_ERR;
-	}
 
-	bufp = buf;
-	for (i = 0; i < num_samples; i++) {
-		for (j = 0; j < outc->num_channels; j++) {
-			memcpy(bufp, outc->chanbuf[j] + i * 4, 4);
-			bufp += 4;
+	/* Interleave straight into the output. */
+	len = out->len;
+	g_string_set_size(out, len + 4 * num_samples * outc->num_channels);
+	bufp = (uint8_t *)out->str + len;
+	if (outc->num_channels == 1) {
+		memcpy(bufp, outc->chanbuf[0], 4 * num_samples);
+	} else {
+		for (i = 0; i < num_samples; i++) {
+			for (j = 0; j < outc->num_channels; j++) {
+				memcpy(bufp, outc->chanbuf[j] + i * 4, 4);
+				bufp += 4;
+			}
 		}
 	}
-	g_string_append_len(out, buf, 4 * num_samples * outc->num_channels);
-	g_free(buf);
 
 	for (i = 0; i < outc->num_channels; i++)
 		outc->chanbuf_used[i] = 0;
-
-	return SR_OK;
 }
 
 static int init(struct sr_output *o, GHashTable *options)
@@ -91,21 +97,30 @@ static int init(struct sr_output *o, GHashTable *options)
 	struct out_context *outc;
 	struct sr_channel *ch;
 	GSList *l;
+	int i;
 
 	outc = g_malloc0(sizeof(struct out_context));
 	o->priv = outc;
 	outc->scale = g_variant_get_double(g_hash_table_lookup(options, "scale"));
 
+	for (l = o->sdi->channels; l; l = l->next) {
+		ch = l->data;
+		outc->num_chan_pos = MAX(outc->num_chan_pos, ch->index + 1);
+	}
+	outc->chan_pos = g_malloc(sizeof(int) * outc->num_chan_pos);
+	for (i = 0; i < outc->num_chan_pos; i++)
+		outc->chan_pos[i] = -1;
+
 	for (l = o->sdi->channels; l; l = l->next) {
 		ch = l->data;
 		if (ch->type != SR_CHANNEL_ANALOG)
 			continue;
 		if (!ch->enabled)
 			continue;
-		outc->channels = g_slist_append(outc->channels, ch);
-		outc->num_channels++;
+		outc->chan_pos[ch->index] = outc->num_channels++;
 	}
 
+	outc->chan_idx = g_malloc0(sizeof(int) * outc->num_channels);
 	outc->chanbuf = g_malloc0(sizeof(float *) * outc->num_channels);
 	outc->chanbuf_used = g_malloc0(sizeof(int) * outc->num_channels);
 
@@ -152,11 +167,10 @@ static void add_data_chunk(const struct sr_output *o, GString *gs)
 	g_string_append_len(gs, tmp, 4);
 }
 
-static GString *gen_header(const struct sr_output *o)
+static void gen_header(const struct sr_output *o, GString *header)
 {
 	struct out_context *outc;
 	GVariant *gvar;
-	GString *header;
 	char tmp[4];
 
 	outc = o->priv;
@@ -168,15 +182,12 @@ static GString *gen_header(const struct sr_output *o)
 		}
 	}
 
-	header = g_string_sized_new(512);
 	g_string_append(header, "RIFF");
 	/* Total size. Max out the field. */
 	WL32(tmp, 0xffffffff);
 	g_string_append_len(header, tmp, 4);
 	g_string_append(header, "WAVE");
 	add_data_chunk(o, header);
-
-	return header;
 }
 
 /*
@@ -184,22 +195,61 @@ static GString *gen_header(const struct sr_output *o)
  */
 static void float_to_le(uint8_t *buf, float value)
 {
-	char *old;
-
-	old = (char *)&value;
 #ifdef WORDS_BIGENDIAN
-	buf[0] = old[3];
-	buf[1] = old[2];
-	buf[2] = old[1];
-	buf[3] = old[0];
+	uint32_t u;
+
+	memcpy(&u, &value, 4);
+	u = GUINT32_SWAP_LE_BE(u);
+	memcpy(buf, &u, 4);
 #else
-	buf[0] = old[0];
-	buf[1] = old[1];
-	buf[2] = old[2];
-	buf[3] = old[3];
+	memcpy(buf, &value, 4);
 #endif
 }
 
+/*
+ * Scales count floats, stride apart in src, and stores them in dst in
+ * little-endian format. A scale of 0 leaves the values as they are.
+ */
+static void store_samples(uint8_t *dst, const float *src, int stride,
+		int count, double scale)
+{
+	int i;
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+	__m128d vscale;
+	__m128 v;
+#endif
+
+	if (scale == 0.0) {
+#ifndef WORDS_BIGENDIAN
+		if (stride == 1) {
+			memcpy(dst, src, 4 * count);
+			return;
+		}
+#endif
+		for (i = 0; i < count; i++)
+			float_to_le(dst + 4 * i, src[i * stride]);
+		return;
+	}
+
+	i = 0;
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+	if (stride == 1) {
+		/* Divide in double precision, like the scalar code does. */
+		vscale = _mm_set1_pd(scale);
+		for (; i + 4 <= count; i += 4) {
+			v = _mm_loadu_ps(src + i);
+			v = _mm_movelh_ps(
+				_mm_cvtpd_ps(_mm_div_pd(_mm_cvtps_pd(v), vscale)),
+				_mm_cvtpd_ps(_mm_div_pd(_mm_cvtps_pd(
+					_mm_movehl_ps(v, v)), vscale)));
+			_mm_storeu_ps((float *)(dst + 4 * i), v);
+		}
+	}
+#endif
+	for (; i < count; i++)
+		float_to_le(dst + 4 * i, src[i * stride] / scale);
+}
+
 /*
  * Returns the number of samples used in the current channel buffers,
  * or -1 if they're not all the same.
@@ -230,8 +280,8 @@ static int check_chanbuf_size(const struct sr_output *o)
 	return size;
 }
 
-static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
-		GString **out)
+static int append(const struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	struct out_context *outc;
 	const struct sr_datafeed_meta *meta;
@@ -239,11 +289,10 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 	const struct sr_config *src;
 	struct sr_channel *ch;
 	GSList *l;
-	float f;
-	int num_channels, size, *chan_idx, idx, i, j;
-	uint8_t *buf;
+	gboolean direct;
+	int num_channels, size, idx, i;
+	gsize len;
 
-	*out = NULL;
 	if (!o || !o->sdi || !(outc = o->priv))
 		return SR_ERR_ARG;
 
@@ -259,10 +308,9 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 		break;
 	case SR_DF_ANALOG:
 		if (!outc->header_done) {
-			*out = gen_header(o);
+			gen_header(o, out);
 			outc->header_done = TRUE;
-		} else
-			*out = g_string_sized_new(512);
+		}
 
 		analog = packet->payload;
 		if (analog->num_samples == 0)
@@ -275,42 +323,59 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 			return SR_ERR;
 		}
 
-		if (analog->num_samples > outc->chanbuf_size) {
-			if (realloc_chanbufs(o, analog->num_samples) != SR_OK)
-				return SR_ERR_MALLOC;
+		/*
+		 * Find the channels in this packet, so we can interleave
+		 * quicker, and how much buffer space they need.
+		 */
+		direct = num_channels == outc->num_channels
+				&& analog->num_samples > MIN_DATA_CHUNK_SAMPLES;
+		size = 0;
+		for (i = 0, l = analog->channels; l; l = l->next, i++) {
+			ch = l->data;
+			if (ch->index >= outc->num_chan_pos
+					|| (idx = outc->chan_pos[ch->index]) < 0) {
+				sr_err("Packet has channel %s, which is not enabled.",
+						ch->name);
+				return SR_ERR;
+			}
+			outc->chan_idx[i] = idx;
+			size = MAX(size, outc->chanbuf_used[idx]);
+			if (idx != i || outc->chanbuf_used[idx])
+				direct = FALSE;
 		}
 
-		/* Index the channels in this packet, so we can interleave quicker. */
-		chan_idx = g_malloc(sizeof(int) * outc->num_channels);
-		for (i = 0; i < num_channels; i++) {
-			ch = g_slist_nth_data(analog->channels, i);
-			chan_idx[i] = g_slist_index(outc->channels, ch);
+		if (direct) {
+			/* All channels in order, and nothing buffered. */
+			len = out->len;
+			g_string_set_size(out, len + 4 * analog->num_samples
+					* num_channels);
+			store_samples((uint8_t *)out->str + len, analog->data, 1,
+					analog->num_samples * num_channels, outc->scale);
+			break;
 		}
 
-		for (i = 0; i < analog->num_samples; i++) {
-			for (j = 0; j < num_channels; j++) {
-				idx = chan_idx[j];
-				buf = outc->chanbuf[idx] + outc->chanbuf_used[idx]++ * 4;
-				f = analog->data[i * num_channels + j];
-				if (outc->scale != 0.0)
-					f /= outc->scale;
-				float_to_le(buf, f);
-			}
+		size += analog->num_samples;
+		if (size > outc->chanbuf_size) {
+			if (realloc_chanbufs(o, size) != SR_OK)
+				return SR_ERR_MALLOC;
+		}
+
+		for (i = 0; i < num_channels; i++) {
+			idx = outc->chan_idx[i];
+			store_samples(outc->chanbuf[idx] + 4 * outc->chanbuf_used[idx],
+					analog->data + i, num_channels,
+					analog->num_samples, outc->scale);
+			outc->chanbuf_used[idx] += analog->num_samples;
 		}
-		g_free(chan_idx);
 
 		size = check_chanbuf_size(o);
 		if (size > MIN_DATA_CHUNK_SAMPLES)
-			if (flush_chanbufs(o, *out) != SR_OK)
-				return SR_ERR;
+			flush_chanbufs(o, out);
 		break;
 	case SR_DF_END:
 		size = check_chanbuf_size(o);
-		if (size > 0) {
-			*out = g_string_sized_new(4 * size * outc->num_channels);
-			if (flush_chanbufs(o, *out) != SR_OK)
-				return SR_ERR;
-		}
+		if (size > 0)
+			flush_chanbufs(o, out);
 		break;
 	}
 
@@ -323,7 +388,8 @@ static int cleanup(struct sr_output *o)
 	int i;
 
 	outc = o->priv;
-	g_slist_free(outc->channels);
+	g_free(outc->chan_pos);
+	g_free(outc->chan_idx);
 	for (i = 0; i < outc->num_channels; i++)
 		g_free(outc->chanbuf[i]);
 	g_free(outc->chanbuf_used);
@@ -354,6 +420,6 @@ SR_PRIV struct sr_output_module output_wav = {
 	.exts = (const char*[]){"wav", NULL},
 	.options = get_options,
 	.init = init,
-	.receive = receive,
+	.append = append,
 	.cleanup = cleanup,
 };
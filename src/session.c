@@ -24,6 +24,10 @@
 #include <glib.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
+#ifdef HAVE_SYS_EPOLL_H
+#include <errno.h>
+#include <sys/epoll.h>
+#endif
 
 /** @cond PRIVATE */
 #define LOG_PREFIX "session"
@@ -45,6 +49,8 @@
 
 struct source {
 	int timeout;
+	/* Monotonic time at which the timeout expires, in microseconds. */
+	gint64 due;
 	sr_receive_data_callback cb;
 	void *cb_data;
 
@@ -52,13 +58,184 @@ struct source {
 	 * being polled and will be used to match the source when removing it again.
 	 */
 	gintptr poll_object;
+
+#ifdef HAVE_SYS_EPOLL_H
+	/* State of this source in the epoll loop, if that is used. */
+	struct epoll_source *es;
+#endif
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Maximum number of ready sources handled per sr_session_iteration(). */
+#define EPOLL_MAX_EVENTS 64
+
+/*
+ * A source in the epoll loop. This is allocated separately from the
+ * sources array, so that epoll and the timer heap can point to it.
+ */
+struct epoll_source {
+	/* Index in session->sources, or -1 once the source was removed. */
+	int index;
+	/* Position in the timer heap, or -1 if the source has no timeout. */
+	int heap_index;
+	/* Monotonic time at which the source times out, in microseconds. */
+	gint64 due;
+	/* Descriptor registered with epoll, or -1. */
+	int fd;
+	/* The descriptor is a dup() of the source's, to be closed by us. */
+	gboolean dup_fd;
+	/* epoll doesn't support the descriptor, poll() would always fire. */
+	gboolean always_ready;
 };
 
+/*
+ * Event loop based on epoll, used instead of g_poll() where available.
+ * Only ready descriptors are visited, and the sources' timeouts are
+ * kept in a min-heap ordered by due time.
+ */
+struct session_epoll {
+	int fd;
+	struct epoll_source **heap;
+	unsigned int heap_size;
+	unsigned int heap_alloc;
+	/* Sources with a descriptor epoll can't handle. */
+	GSList *always_ready;
+	/* Removed sources, freed at the end of the iteration. */
+	GSList *dead;
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+};
+
+static struct session_epoll *session_epoll_new(void);
+static void session_epoll_free(struct sr_session *session);
+static int session_epoll_iteration(struct sr_session *session,
+		gboolean block);
+static int epoll_source_add(struct sr_session *session, unsigned int index);
+static void epoll_source_remove(struct sr_session *session,
+		struct epoll_source *es);
+#endif
+
+static int _sr_session_source_remove(struct sr_session *session,
+		gintptr poll_object);
+
 struct datafeed_callback {
 	sr_datafeed_callback cb;
 	void *cb_data;
 };
 
+/*
+ * A packet created by libsigrok itself, rather than by a driver. The
+ * packet and its payload struct are allocated in one block, the payload
+ * data is held in a refcounted struct sr_buffer. See sr_packet_ref().
+ */
+struct packet_ref {
+	/* Must be the first member, see packet_ref_get(). */
+	struct sr_datafeed_packet packet;
+	gint refcount;
+	/* Memory backing the payload data, if the packet carries any. */
+	struct sr_buffer *buffer;
+	union {
+		struct sr_datafeed_header header;
+		struct sr_datafeed_meta meta;
+		struct sr_datafeed_logic logic;
+		struct sr_datafeed_logic_repeat repeat;
+		struct sr_datafeed_analog analog;
+		struct {
+			struct sr_datafeed_analog2 analog2;
+			struct sr_analog_encoding encoding;
+			struct sr_analog_meaning meaning;
+			struct sr_analog_spec spec;
+		} a2;
+	} payload;
+};
+
+/* The packet currently being passed to the datafeed callbacks. */
+struct packet_dispatch {
+	const struct sr_datafeed_packet *packet;
+	/* Memory backing the packet's payload data, if known. */
+	struct sr_buffer *buffer;
+	/* Refcounted version of the packet, created on demand. */
+	struct sr_datafeed_packet *ref;
+	gboolean own_ref;
+};
+
+static GPrivate packet_dispatch_key = G_PRIVATE_INIT(NULL);
+
+static inline struct packet_ref *packet_ref_get(
+		const struct sr_datafeed_packet *packet)
+{
+	return (struct packet_ref *)packet;
+}
+
+static int packet_copy(const struct sr_datafeed_packet *packet,
+		struct sr_buffer *buf, struct sr_buffer_pool *pool,
+		struct sr_datafeed_packet **copy);
+
+/*
+ * Buffers are pooled in power-of-two size classes from 4 KiB up to
+ * 16 MiB. Larger requests bypass the pool.
+ */
+#define BUFFER_POOL_MIN_SHIFT 12
+#define BUFFER_POOL_NUM_CLASSES 13
+/* Maximum number of idle buffers kept per size class. */
+#define BUFFER_POOL_MAX_IDLE 32
+
+/* SR_DF_LOGIC_REPEAT packets are expanded into packets of up to this size. */
+#define LOGIC_REPEAT_CHUNK_SIZE (64 * 1024)
+
+struct sr_buffer_pool {
+	/* Held by the session, and by every buffer taken from the pool. */
+	gint refcount;
+	GMutex mutex;
+	GSList *idle[BUFFER_POOL_NUM_CLASSES];
+	unsigned int num_idle[BUFFER_POOL_NUM_CLASSES];
+	uint64_t hits;
+	uint64_t misses;
+	/* Bytes allocated through the pool, in use or idle. */
+	uint64_t bytes;
+	uint64_t peak_bytes;
+};
+
+static struct sr_buffer_pool *buffer_pool_new(void);
+static void buffer_pool_unref(struct sr_buffer_pool *pool);
+
+struct datafeed_queue_slot {
+	/* Sequence number, used to hand the slot between producer/consumer. */
+	gint seq;
+	const struct sr_dev_inst *sdi;
+	struct sr_datafeed_packet *packet;
+};
+
+/*
+ * Bounded lock-free queue between the threads calling sr_session_send()
+ * and the thread running transforms and datafeed callbacks. This is a
+ * multi-producer ring buffer with a per-slot sequence number; producers
+ * never take a lock unless the ring is full.
+ */
+struct datafeed_queue {
+	struct sr_session *session;
+	struct datafeed_queue_slot *slots;
+	guint mask;
+	/* Next slot to write to / read from, only accessed atomically. */
+	gint head;
+	gint tail;
+	/* Packets pushed but not completely processed yet. */
+	gint pending;
+	/* Statistics, only accessed atomically. */
+	gint max_depth;
+	gint overruns;
+	/* Used to put the consumer thread, and waiting producers, to sleep. */
+	GThread *thread;
+	GMutex mutex;
+	GCond data_cond;
+	GCond drain_cond;
+	gint consumer_sleeping;
+	gint producers_waiting;
+	gboolean quit;
+};
+
+static void datafeed_queue_flush(struct datafeed_queue *queue);
+static void datafeed_queue_free(struct datafeed_queue *queue);
+
 /**
  * Create a new session.
  *
@@ -83,10 +260,10 @@ SR_API int sr_session_new(struct sr_context *ctx,
 	session = g_malloc0(sizeof(struct sr_session));
 
 	session->ctx = ctx;
-	session->source_timeout = -1;
 	session->running = FALSE;
 	session->abort_session = FALSE;
 	g_mutex_init(&session->stop_mutex);
+	session->pool = buffer_pool_new();
 
 	*new_session = session;
 
@@ -111,7 +288,21 @@ SR_API int sr_session_destroy(struct sr_session *session)
 		return SR_ERR_ARG;
 	}
 
+	/*
+	 * Deliver the queued packets and stop the consumer thread while the
+	 * devices still belong to the session.
+	 */
+	if (session->queue) {
+		datafeed_queue_free(session->queue);
+		session->queue = NULL;
+	}
 	sr_session_dev_remove_all(session);
+	/* Buffers still held by consumers keep the pool alive. */
+	buffer_pool_unref(session->pool);
+#ifdef HAVE_SYS_EPOLL_H
+	if (session->epoll)
+		session_epoll_free(session);
+#endif
 	g_mutex_clear(&session->stop_mutex);
 	if (session->trigger)
 		sr_trigger_free(session->trigger);
@@ -127,7 +318,8 @@ SR_API int sr_session_destroy(struct sr_session *session)
  * Remove all the devices from a session.
  *
  * The session itself (i.e., the struct sr_session) is not free'd and still
- * exists after this function returns.
+ * exists after this function returns. Packets still in the datafeed queue
+ * are delivered before the devices are removed.
  *
  * @param session The session to use. Must not be NULL.
  *
@@ -146,6 +338,10 @@ SR_API int sr_session_dev_remove_all(struct sr_session *session)
 		return SR_ERR_ARG;
 	}
 
+	/* Queued packets from these devices still need their session. */
+	if (session->queue)
+		datafeed_queue_flush(session->queue);
+
 	for (l = session->devs; l; l = l->next) {
 		sdi = (struct sr_dev_inst *) l->data;
 		sdi->session = NULL;
@@ -358,6 +554,24 @@ SR_API int sr_session_trigger_set(struct sr_session *session, struct sr_trigger
 	return SR_OK;
 }
 
+/*
+ * Stop the session if sr_session_stop() was called. The flag is read
+ * atomically first, so the common case doesn't take the mutex.
+ */
+static void session_check_abort(struct sr_session *session)
+{
+	if (!g_atomic_int_get(&session->abort_session))
+		return;
+
+	g_mutex_lock(&session->stop_mutex);
+	if (session->abort_session) {
+		sr_session_stop_sync(session);
+		/* But once is enough. */
+		session->abort_session = FALSE;
+	}
+	g_mutex_unlock(&session->stop_mutex);
+}
+
 /**
  * Call every device in the current session's callback.
  *
@@ -378,18 +592,37 @@ SR_API int sr_session_trigger_set(struct sr_session *session, struct sr_trigger
  */
 static int sr_session_iteration(struct sr_session *session, gboolean block)
 {
+	struct source *s;
 	unsigned int i;
-	int ret, timeout;
+	int ret, timeout, source_timeout;
+	gint64 now, wait;
 #ifdef HAVE_LIBUSB_1_0
 	int usb_timeout;
 	struct timeval tv;
 #endif
 
-	timeout = block ? session->source_timeout : 0;
+#ifdef HAVE_SYS_EPOLL_H
+	if (session->epoll)
+		return session_epoll_iteration(session, block);
+#endif
+
+	/* Wait until the first source's timeout expires. */
+	now = g_get_monotonic_time();
+	source_timeout = -1;
+	for (i = 0; i < session->num_sources; i++) {
+		s = &session->sources[i];
+		if (s->timeout <= 0)
+			continue;
+		wait = (s->due - now + 999) / G_TIME_SPAN_MILLISECOND;
+		wait = MAX(wait, 0);
+		if (source_timeout < 0 || wait < source_timeout)
+			source_timeout = wait;
+	}
+	timeout = block ? source_timeout : 0;
 
 #ifdef HAVE_LIBUSB_1_0
 	if (session->ctx->usb_source_present) {
-		timeout = block ? 0 : session->source_timeout;
+		timeout = block ? 0 : source_timeout;
 		ret = libusb_get_next_timeout(session->ctx->libusb_ctx, &tv);
 		if (ret < 0) {
 			sr_err("Error getting libusb timeout: %s",
@@ -402,19 +635,21 @@ static int sr_session_iteration(struct sr_session *session, gboolean block)
 	}
 #endif
 
-	ret = g_poll(session->pollfds, session->num_sources, timeout);
+	g_poll(session->pollfds, session->num_sources, timeout);
+	now = g_get_monotonic_time();
 	for (i = 0; i < session->num_sources; i++) {
-		if (session->pollfds[i].revents > 0 || (ret == 0
-			&& session->source_timeout == session->sources[i].timeout)) {
+		s = &session->sources[i];
+		if (session->pollfds[i].revents > 0
+				|| (s->timeout > 0 && s->due <= now)) {
 			/*
-			 * Invoke the source's callback on an event,
-			 * or if the poll timed out and this source
-			 * asked for that timeout.
+			 * Invoke the source's callback on an event, or if
+			 * its timeout expired. The timeout counts from here.
 			 */
-			if (!session->sources[i].cb(session->pollfds[i].fd,
-					session->pollfds[i].revents,
-					session->sources[i].cb_data))
-				sr_session_source_remove(session,
+			if (s->timeout > 0)
+				s->due = now + s->timeout * G_TIME_SPAN_MILLISECOND;
+			if (!s->cb(session->pollfds[i].fd,
+					session->pollfds[i].revents, s->cb_data))
+				_sr_session_source_remove(session,
 						session->sources[i].poll_object);
 		}
 		/*
@@ -423,16 +658,371 @@ static int sr_session_iteration(struct sr_session *session, gboolean block)
 		 * we check the flag after processing every source, not
 		 * just once per main event loop.
 		 */
-		g_mutex_lock(&session->stop_mutex);
-		if (session->abort_session) {
-			sr_session_stop_sync(session);
-			/* But once is enough. */
-			session->abort_session = FALSE;
+		session_check_abort(session);
+	}
+
+	return SR_OK;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static void timer_heap_swap(struct session_epoll *ep, unsigned int a,
+		unsigned int b)
+{
+	struct epoll_source *tmp;
+
+	tmp = ep->heap[a];
+	ep->heap[a] = ep->heap[b];
+	ep->heap[b] = tmp;
+	ep->heap[a]->heap_index = a;
+	ep->heap[b]->heap_index = b;
+}
+
+/* Restore the heap property after the entry at pos changed. */
+static void timer_heap_fix(struct session_epoll *ep, unsigned int pos)
+{
+	unsigned int parent, child;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (ep->heap[parent]->due <= ep->heap[pos]->due)
+			break;
+		timer_heap_swap(ep, parent, pos);
+		pos = parent;
+	}
+
+	while ((child = 2 * pos + 1) < ep->heap_size) {
+		if (child + 1 < ep->heap_size
+				&& ep->heap[child + 1]->due < ep->heap[child]->due)
+			child++;
+		if (ep->heap[pos]->due <= ep->heap[child]->due)
+			break;
+		timer_heap_swap(ep, pos, child);
+		pos = child;
+	}
+}
+
+static void timer_heap_push(struct session_epoll *ep, struct epoll_source *es)
+{
+	if (ep->heap_size == ep->heap_alloc) {
+		ep->heap_alloc = ep->heap_alloc ? ep->heap_alloc * 2 : 16;
+		ep->heap = g_realloc(ep->heap,
+				sizeof(struct epoll_source *) * ep->heap_alloc);
+	}
+	es->heap_index = ep->heap_size;
+	ep->heap[ep->heap_size++] = es;
+	timer_heap_fix(ep, es->heap_index);
+}
+
+static void timer_heap_remove(struct session_epoll *ep, struct epoll_source *es)
+{
+	unsigned int pos;
+
+	pos = es->heap_index;
+	es->heap_index = -1;
+	if (pos != --ep->heap_size) {
+		ep->heap[pos] = ep->heap[ep->heap_size];
+		ep->heap[pos]->heap_index = pos;
+		timer_heap_fix(ep, pos);
+	}
+}
+
+static struct session_epoll *session_epoll_new(void)
+{
+	struct session_epoll *ep;
+	int fd;
+
+	if ((fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		sr_err("Failed to create epoll instance: %s.",
+			g_strerror(errno));
+		return NULL;
+	}
+
+	ep = g_malloc0(sizeof(struct session_epoll));
+	ep->fd = fd;
+
+	return ep;
+}
+
+static void session_epoll_free(struct sr_session *session)
+{
+	struct session_epoll *ep;
+	unsigned int i;
+
+	ep = session->epoll;
+	for (i = 0; i < session->num_sources; i++) {
+		if (!session->sources[i].es)
+			continue;
+		epoll_source_remove(session, session->sources[i].es);
+		session->sources[i].es = NULL;
+	}
+	g_slist_free_full(ep->dead, g_free);
+	g_free(ep->heap);
+	close(ep->fd);
+	g_free(ep);
+	session->epoll = NULL;
+}
+
+static int epoll_source_add(struct sr_session *session, unsigned int index)
+{
+	struct session_epoll *ep;
+	struct source *s;
+	struct epoll_source *es;
+	struct epoll_event ev;
+	int fd;
+
+	ep = session->epoll;
+	s = &session->sources[index];
+	fd = session->pollfds[index].fd;
+
+	es = g_malloc0(sizeof(struct epoll_source));
+	es->index = index;
+	es->heap_index = -1;
+	es->fd = -1;
+
+	if (fd >= 0) {
+		/* G_IO_* and EPOLL* flags share their values on Linux. */
+		ev.events = session->pollfds[index].events
+				& (EPOLLIN | EPOLLPRI | EPOLLOUT);
+		ev.data.ptr = es;
+		es->fd = fd;
+		if (epoll_ctl(ep->fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			if (errno == EEXIST) {
+				/* Another source polls the same descriptor. */
+				es->fd = dup(fd);
+				es->dup_fd = TRUE;
+				if (es->fd < 0 || epoll_ctl(ep->fd, EPOLL_CTL_ADD,
+						es->fd, &ev) < 0) {
+					sr_err("Failed to add fd %d to epoll: %s.",
+						fd, g_strerror(errno));
+					if (es->fd >= 0)
+						close(es->fd);
+					g_free(es);
+					return SR_ERR;
+				}
+			} else if (errno == EPERM) {
+				/* E.g. a regular file, which is always ready. */
+				es->fd = -1;
+				es->always_ready = TRUE;
+				ep->always_ready = g_slist_append(ep->always_ready, es);
+			} else {
+				sr_err("Failed to add fd %d to epoll: %s.",
+					fd, g_strerror(errno));
+				g_free(es);
+				return SR_ERR;
+			}
+		}
+	}
+
+	if (s->timeout > 0) {
+		es->due = g_get_monotonic_time()
+				+ s->timeout * G_TIME_SPAN_MILLISECOND;
+		timer_heap_push(ep, es);
+	}
+	s->es = es;
+
+	return SR_OK;
+}
+
+static void epoll_source_remove(struct sr_session *session,
+		struct epoll_source *es)
+{
+	struct session_epoll *ep;
+
+	ep = session->epoll;
+	if (es->fd >= 0) {
+		/* This fails harmlessly if the descriptor was closed already. */
+		epoll_ctl(ep->fd, EPOLL_CTL_DEL, es->fd, NULL);
+		if (es->dup_fd)
+			close(es->fd);
+	}
+	if (es->always_ready)
+		ep->always_ready = g_slist_remove(ep->always_ready, es);
+	if (es->heap_index >= 0)
+		timer_heap_remove(ep, es);
+
+	/* Events for this source may still be pending in this iteration. */
+	es->index = -1;
+	ep->dead = g_slist_prepend(ep->dead, es);
+}
+
+static void epoll_source_dispatch(struct sr_session *session,
+		struct epoll_source *es, int revents)
+{
+	struct source *s;
+	gintptr poll_object;
+	int timeout;
+	gboolean keep;
+
+	s = &session->sources[es->index];
+	poll_object = s->poll_object;
+	timeout = s->timeout;
+	keep = s->cb(session->pollfds[es->index].fd, revents, s->cb_data);
+
+	/* The callback may have removed the source itself. */
+	if (es->index < 0)
+		return;
+
+	if (!keep) {
+		_sr_session_source_remove(session, poll_object);
+		return;
+	}
+
+	if (es->heap_index >= 0) {
+		es->due = g_get_monotonic_time() + timeout * G_TIME_SPAN_MILLISECOND;
+		timer_heap_fix(session->epoll, es->heap_index);
+	}
+}
+
+static int session_epoll_iteration(struct sr_session *session, gboolean block)
+{
+	struct session_epoll *ep;
+	struct epoll_source *es;
+	GSList *l, *always_ready;
+	gint64 now, wait;
+	int ret, i, timeout;
+#ifdef HAVE_LIBUSB_1_0
+	int usb_timeout;
+	struct timeval tv;
+#endif
+
+	ep = session->epoll;
+	timeout = block ? -1 : 0;
+
+	now = g_get_monotonic_time();
+	if (ep->heap_size > 0) {
+		wait = (ep->heap[0]->due - now + 999) / G_TIME_SPAN_MILLISECOND;
+		wait = MAX(wait, 0);
+		if (timeout < 0 || wait < timeout)
+			timeout = wait;
+	}
+	if (ep->always_ready)
+		timeout = 0;
+
+#ifdef HAVE_LIBUSB_1_0
+	if (session->ctx->usb_source_present) {
+		ret = libusb_get_next_timeout(session->ctx->libusb_ctx, &tv);
+		if (ret < 0) {
+			sr_err("Error getting libusb timeout: %s",
+				libusb_error_name(ret));
+			return SR_ERR;
+		} else if (ret == 1) {
+			usb_timeout = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+			if (timeout < 0 || usb_timeout < timeout)
+				timeout = usb_timeout;
+		}
+	}
+#endif
+
+	ret = epoll_wait(ep->fd, ep->events, EPOLL_MAX_EVENTS, timeout);
+	if (ret < 0) {
+		if (errno == EINTR)
+			return SR_OK;
+		sr_err("epoll_wait() failed: %s.", g_strerror(errno));
+		return SR_ERR;
+	}
+
+	for (i = 0; i < ret; i++) {
+		es = ep->events[i].data.ptr;
+		/* Skip sources removed by an earlier callback. */
+		if (es->index < 0)
+			continue;
+		epoll_source_dispatch(session, es, ep->events[i].events);
+		session_check_abort(session);
+	}
+
+	if (ep->always_ready) {
+		always_ready = g_slist_copy(ep->always_ready);
+		for (l = always_ready; l; l = l->next) {
+			es = l->data;
+			if (es->index < 0)
+				continue;
+			epoll_source_dispatch(session, es,
+					session->pollfds[es->index].events);
+			session_check_abort(session);
+		}
+		g_slist_free(always_ready);
+	}
+
+	/*
+	 * Fire the timeouts which are due. Dispatching moves a source's
+	 * due time past now, so each one fires at most once here.
+	 */
+	now = g_get_monotonic_time();
+	while (ep->heap_size > 0 && ep->heap[0]->due <= now) {
+		epoll_source_dispatch(session, ep->heap[0], 0);
+		session_check_abort(session);
+	}
+
+	g_slist_free_full(ep->dead, g_free);
+	ep->dead = NULL;
+
+	return SR_OK;
+}
+#endif
+
+/**
+ * Enable or disable the epoll based event loop of a session.
+ *
+ * By default, every iteration of the session's event loop polls all
+ * sources with g_poll(), and then looks at each of them. The epoll based
+ * loop only visits the sources which are ready, which pays off with many
+ * sources, e.g. a large number of serial or SCPI instruments. It is only
+ * available where the platform has epoll (Linux).
+ *
+ * @param session The session to use. Must not be NULL.
+ * @param enable TRUE to use epoll, FALSE to use g_poll().
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval SR_ERR_NA epoll is not available on this platform.
+ * @retval SR_ERR Session is running, or epoll could not be set up.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_session_epoll_set(struct sr_session *session, gboolean enable)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	unsigned int i;
+#endif
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (session->running) {
+		sr_err("%s: can't change a running session", __func__);
+		return SR_ERR;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (!enable) {
+		if (session->epoll)
+			session_epoll_free(session);
+		return SR_OK;
+	}
+
+	if (session->epoll)
+		return SR_OK;
+	if (!(session->epoll = session_epoll_new()))
+		return SR_ERR;
+	/* Register the sources which were added before. */
+	for (i = 0; i < session->num_sources; i++) {
+		if (epoll_source_add(session, i) != SR_OK) {
+			session_epoll_free(session);
+			return SR_ERR;
 		}
-		g_mutex_unlock(&session->stop_mutex);
 	}
+	sr_dbg("Using the epoll event loop.");
 
 	return SR_OK;
+#else
+	if (!enable)
+		return SR_OK;
+	sr_err("%s: epoll is not available on this platform", __func__);
+
+	return SR_ERR_NA;
+#endif
 }
 
 static int verify_trigger(struct sr_trigger *trigger)
@@ -577,6 +1167,10 @@ SR_API int sr_session_run(struct sr_session *session)
 			sr_session_iteration(session, TRUE);
 	}
 
+	/* Make sure all queued packets reached the datafeed callbacks. */
+	if (session->queue)
+		datafeed_queue_flush(session->queue);
+
 	return SR_OK;
 }
 
@@ -703,41 +1297,70 @@ static void datafeed_dump(const struct sr_datafeed_packet *packet)
 	}
 }
 
-/**
- * Send a packet to whatever is listening on the datafeed bus.
- *
- * Hardware drivers use this to send a data packet to the frontend.
- *
- * @param sdi TODO.
- * @param packet The datafeed packet to send to the session bus.
- *
- * @retval SR_OK Success.
- * @retval SR_ERR_ARG Invalid argument.
- *
- * @private
+/* Whether the packet's payload data is held by the buffer. */
+static gboolean packet_data_in(const struct sr_datafeed_packet *packet,
+		const struct sr_buffer *buf)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_analog *analog;
+	const uint8_t *p;
+	gsize size;
+
+	if (!buf)
+		return FALSE;
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		p = logic->data;
+		size = logic->length;
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		p = (const uint8_t *)analog->data;
+		size = analog->num_samples * g_slist_length(analog->channels)
+				* sizeof(float);
+		break;
+	default:
+		return FALSE;
+	}
+
+	return p >= buf->data && p + size <= buf->data + buf->size;
+}
+
+/*
+ * Run a packet through the session's transform chain, starting at the
+ * given link, and pass the result to all datafeed callbacks.
  */
-SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
-		const struct sr_datafeed_packet *packet)
+static int session_send_packet(struct sr_session *session,
+		const struct sr_dev_inst *sdi, GSList *transforms,
+		const struct sr_datafeed_packet *packet, struct sr_buffer *buf,
+		struct sr_datafeed_packet *ref)
 {
 	GSList *l;
 	struct datafeed_callback *cb_struct;
 	struct sr_datafeed_packet *packet_in, *packet_out;
 	struct sr_transform *t;
+	struct packet_dispatch dispatch, *prev_dispatch;
+	struct packet_ref *r;
+	struct sr_buffer *packet_buf;
+	gboolean writable;
 	int ret;
 
-	if (!sdi) {
-		sr_err("%s: sdi was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	if (!packet) {
-		sr_err("%s: packet was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	if (!sdi->session) {
-		sr_err("%s: session was NULL", __func__);
-		return SR_ERR_BUG;
+	/*
+	 * Only a copy made by the datafeed queue, which nothing else holds
+	 * on to, may be modified by the transforms. The driver's own memory
+	 * can be reused by it, or even be a read-only mapping, so a wrapped
+	 * buffer doesn't count.
+	 */
+	packet_buf = buf;
+	writable = FALSE;
+	if (ref) {
+		r = packet_ref_get(ref);
+		packet_buf = r->buffer;
+		writable = g_atomic_int_get(&r->refcount) == 1 && packet_buf
+				&& g_atomic_int_get(&packet_buf->refcount) == 1
+				&& packet_buf->data == (uint8_t *)(packet_buf + 1);
 	}
 
 	/*
@@ -746,9 +1369,10 @@ SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
 	 * transform module in the list, and so on.
 	 */
 	packet_in = (struct sr_datafeed_packet *)packet;
-	for (l = sdi->session->transforms; l; l = l->next) {
+	for (l = transforms; l; l = l->next) {
 		t = l->data;
 		sr_spew("Running transform module '%s'.", t->module->id);
+		t->packet_in_writable = writable;
 		ret = t->module->receive(t, packet_in, &packet_out);
 		if (ret < 0) {
 			sr_err("Error while running transform module: %d.", ret);
@@ -764,30 +1388,594 @@ SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
 		} else {
 			/*
 			 * Use this transform module's output packet as input
-			 * for the next transform module.
+			 * for the next transform module. A new packet is
+			 * writable if it is in the transform's own buffer.
 			 */
+			if (packet_out != packet_in) {
+				packet_buf = NULL;
+				if (packet_data_in(packet_out, t->buffer))
+					packet_buf = t->buffer;
+				writable = packet_buf != NULL;
+			}
 			packet_in = packet_out;
 		}
 	}
 
+	/*
+	 * Remember which packet the callbacks are looking at, so that
+	 * sr_packet_ref() can retain it without copying the payload data.
+	 */
+	dispatch.packet = packet_in;
+	dispatch.buffer = packet_in == packet ? buf : packet_buf;
+	dispatch.ref = packet_in == packet ? ref : NULL;
+	dispatch.own_ref = FALSE;
+	prev_dispatch = g_private_get(&packet_dispatch_key);
+	g_private_set(&packet_dispatch_key, &dispatch);
+
 	/*
 	 * If the last transform did output a packet, pass it to all datafeed
 	 * callbacks.
 	 */
-	for (l = sdi->session->datafeed_callbacks; l; l = l->next) {
+	for (l = session->datafeed_callbacks; l; l = l->next) {
 		if (sr_log_loglevel_get() >= SR_LOG_DBG)
-			datafeed_dump(packet);
+			datafeed_dump(packet_in);
 		cb_struct = l->data;
-		cb_struct->cb(sdi, packet, cb_struct->cb_data);
+		cb_struct->cb(sdi, packet_in, cb_struct->cb_data);
 	}
 
+	g_private_set(&packet_dispatch_key, prev_dispatch);
+	if (dispatch.own_ref)
+		sr_packet_free(dispatch.ref);
+
 	return SR_OK;
 }
 
-/**
- * Add an event source for a file descriptor.
- *
- * @param session The session to use. Must not be NULL.
+static gboolean datafeed_queue_push(struct datafeed_queue *queue,
+		const struct sr_dev_inst *sdi, struct sr_datafeed_packet *packet)
+{
+	struct datafeed_queue_slot *slot;
+	guint pos;
+	gint diff;
+
+	pos = g_atomic_int_get(&queue->head);
+	while (TRUE) {
+		slot = &queue->slots[pos & queue->mask];
+		diff = (gint)((guint)g_atomic_int_get(&slot->seq) - pos);
+		if (diff == 0) {
+			/* Slot is free, try to claim it. */
+			if (g_atomic_int_compare_and_exchange(&queue->head,
+					pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			/* The consumer hasn't released this slot yet: full. */
+			return FALSE;
+		}
+		pos = g_atomic_int_get(&queue->head);
+	}
+
+	slot->sdi = sdi;
+	slot->packet = packet;
+	g_atomic_int_set(&slot->seq, pos + 1);
+
+	return TRUE;
+}
+
+static gboolean datafeed_queue_pop(struct datafeed_queue *queue,
+		const struct sr_dev_inst **sdi, struct sr_datafeed_packet **packet)
+{
+	struct datafeed_queue_slot *slot;
+	guint pos;
+	gint diff;
+
+	pos = g_atomic_int_get(&queue->tail);
+	while (TRUE) {
+		slot = &queue->slots[pos & queue->mask];
+		diff = (gint)((guint)g_atomic_int_get(&slot->seq) - (pos + 1));
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange(&queue->tail,
+					pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			/* No producer has filled this slot yet: empty. */
+			return FALSE;
+		}
+		pos = g_atomic_int_get(&queue->tail);
+	}
+
+	*sdi = slot->sdi;
+	*packet = slot->packet;
+	/* Hand the slot back to the producers, one lap ahead. */
+	g_atomic_int_set(&slot->seq, pos + queue->mask + 1);
+
+	return TRUE;
+}
+
+static unsigned int datafeed_queue_depth(struct datafeed_queue *queue)
+{
+	return (guint)g_atomic_int_get(&queue->head)
+			- (guint)g_atomic_int_get(&queue->tail);
+}
+
+static void datafeed_queue_wake_producers(struct datafeed_queue *queue)
+{
+	if (!g_atomic_int_get(&queue->producers_waiting))
+		return;
+	g_mutex_lock(&queue->mutex);
+	g_cond_broadcast(&queue->drain_cond);
+	g_mutex_unlock(&queue->mutex);
+}
+
+static gpointer datafeed_queue_thread(gpointer data)
+{
+	struct datafeed_queue *queue;
+	const struct sr_dev_inst *sdi;
+	struct sr_datafeed_packet *packet;
+	gboolean quit;
+
+	queue = data;
+	while (TRUE) {
+		while (datafeed_queue_pop(queue, &sdi, &packet)) {
+			datafeed_queue_wake_producers(queue);
+			session_send_packet(queue->session, sdi,
+					queue->session->transforms, packet,
+					NULL, packet);
+			sr_packet_free(packet);
+			if (g_atomic_int_dec_and_test(&queue->pending))
+				datafeed_queue_wake_producers(queue);
+		}
+
+		g_mutex_lock(&queue->mutex);
+		g_atomic_int_set(&queue->consumer_sleeping, 1);
+		while (datafeed_queue_depth(queue) == 0 && !queue->quit)
+			g_cond_wait(&queue->data_cond, &queue->mutex);
+		g_atomic_int_set(&queue->consumer_sleeping, 0);
+		quit = queue->quit && datafeed_queue_depth(queue) == 0;
+		g_mutex_unlock(&queue->mutex);
+		if (quit)
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Put the calling thread to sleep until the consumer has made progress.
+ * The timeout guards against a wakeup which happened just before we
+ * registered as a waiter.
+ */
+static void datafeed_queue_wait(struct datafeed_queue *queue)
+{
+	g_atomic_int_inc(&queue->producers_waiting);
+	g_mutex_lock(&queue->mutex);
+	g_cond_wait_until(&queue->drain_cond, &queue->mutex,
+			g_get_monotonic_time() + 10 * G_TIME_SPAN_MILLISECOND);
+	g_mutex_unlock(&queue->mutex);
+	g_atomic_int_add(&queue->producers_waiting, -1);
+}
+
+static int datafeed_queue_send(struct datafeed_queue *queue,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, struct sr_buffer *buf)
+{
+	struct sr_datafeed_packet *copy;
+	unsigned int depth;
+	gint max_depth;
+	int ret;
+
+	/*
+	 * The producer may reuse the packet's memory once we return, unless
+	 * the payload data is in a refcounted buffer.
+	 */
+	if ((ret = packet_copy(packet, buf, queue->session->pool,
+			&copy)) != SR_OK)
+		return ret;
+
+	g_atomic_int_inc(&queue->pending);
+	if (!datafeed_queue_push(queue, sdi, copy)) {
+		/*
+		 * The consumer can't keep up. Don't drop the packet, but
+		 * make the producer wait, and record the overrun so the
+		 * queue can be sized accordingly.
+		 */
+		g_atomic_int_inc(&queue->overruns);
+		while (!datafeed_queue_push(queue, sdi, copy))
+			datafeed_queue_wait(queue);
+	}
+
+	depth = datafeed_queue_depth(queue);
+	max_depth = g_atomic_int_get(&queue->max_depth);
+	while ((gint)depth > max_depth) {
+		if (g_atomic_int_compare_and_exchange(&queue->max_depth,
+				max_depth, depth))
+			break;
+		max_depth = g_atomic_int_get(&queue->max_depth);
+	}
+
+	if (g_atomic_int_get(&queue->consumer_sleeping)) {
+		g_mutex_lock(&queue->mutex);
+		g_cond_signal(&queue->data_cond);
+		g_mutex_unlock(&queue->mutex);
+	}
+
+	return SR_OK;
+}
+
+/*
+ * Block until every packet in the queue went through the callbacks.
+ * Does nothing when called from a callback, which would wait for itself.
+ */
+static void datafeed_queue_flush(struct datafeed_queue *queue)
+{
+	if (g_thread_self() == queue->thread)
+		return;
+	while (g_atomic_int_get(&queue->pending) > 0)
+		datafeed_queue_wait(queue);
+}
+
+static struct datafeed_queue *datafeed_queue_new(struct sr_session *session,
+		unsigned int size)
+{
+	struct datafeed_queue *queue;
+	unsigned int i;
+
+	queue = g_malloc0(sizeof(struct datafeed_queue));
+	queue->session = session;
+	queue->slots = g_malloc0(sizeof(struct datafeed_queue_slot) * size);
+	queue->mask = size - 1;
+	for (i = 0; i < size; i++)
+		queue->slots[i].seq = i;
+	g_mutex_init(&queue->mutex);
+	g_cond_init(&queue->data_cond);
+	g_cond_init(&queue->drain_cond);
+	queue->thread = g_thread_new("sr-datafeed", datafeed_queue_thread, queue);
+
+	return queue;
+}
+
+static void datafeed_queue_free(struct datafeed_queue *queue)
+{
+	g_mutex_lock(&queue->mutex);
+	queue->quit = TRUE;
+	g_cond_signal(&queue->data_cond);
+	g_mutex_unlock(&queue->mutex);
+	g_thread_join(queue->thread);
+
+	g_cond_clear(&queue->drain_cond);
+	g_cond_clear(&queue->data_cond);
+	g_mutex_clear(&queue->mutex);
+	g_free(queue->slots);
+	g_free(queue);
+}
+
+/**
+ * Enable or disable the asynchronous datafeed queue of a session.
+ *
+ * By default, sr_session_send() runs all transforms and datafeed callbacks
+ * in the thread which sent the packet, typically from within a driver's
+ * USB or serial event handler. A slow consumer then delays the driver.
+ *
+ * With the queue enabled, a copy of every packet is put into a bounded
+ * lock-free queue instead, and a separate consumer thread runs the
+ * transforms and datafeed callbacks, in the order the packets were sent.
+ * If the queue is full, the sending thread waits until there is room
+ * again, and the overrun is counted (see sr_session_datafeed_queue_stats()).
+ *
+ * Datafeed callbacks are then called from the consumer thread. When
+ * sr_session_run() returns, all packets have been delivered.
+ *
+ * @param session The session to use. Must not be NULL.
+ * @param size Number of packets the queue can hold, rounded up to the
+ *             next power of two. 0 disables the queue.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval SR_ERR Session is running.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_session_datafeed_queue_set(struct sr_session *session,
+		unsigned int size)
+{
+	unsigned int ring_size;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (session->running) {
+		sr_err("%s: can't change the queue of a running session", __func__);
+		return SR_ERR;
+	}
+
+	if (size > G_MAXINT / 2) {
+		sr_err("%s: queue size %u too large", __func__, size);
+		return SR_ERR_ARG;
+	}
+
+	if (session->queue) {
+		datafeed_queue_free(session->queue);
+		session->queue = NULL;
+	}
+
+	if (size == 0)
+		return SR_OK;
+
+	for (ring_size = 1; ring_size < size; ring_size <<= 1);
+	session->queue = datafeed_queue_new(session, ring_size);
+	sr_dbg("Using datafeed queue with %u slots.", ring_size);
+
+	return SR_OK;
+}
+
+/**
+ * Get statistics of the session's datafeed queue.
+ *
+ * @param session The session to use. Must not be NULL.
+ * @param depth Number of packets currently in the queue. Can be NULL.
+ * @param max_depth Highest number of packets which were in the queue at
+ *                  the same time. Can be NULL.
+ * @param overruns Number of times a packet was sent while the queue was
+ *                 full. Can be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument, or the queue is not enabled.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_session_datafeed_queue_stats(struct sr_session *session,
+		unsigned int *depth, unsigned int *max_depth,
+		unsigned int *overruns)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!session->queue)
+		return SR_ERR_ARG;
+
+	if (depth)
+		*depth = datafeed_queue_depth(session->queue);
+	if (max_depth)
+		*max_depth = g_atomic_int_get(&session->queue->max_depth);
+	if (overruns)
+		*overruns = g_atomic_int_get(&session->queue->overruns);
+
+	return SR_OK;
+}
+
+/**
+ * Enable or disable passing SR_DF_LOGIC_REPEAT packets to the datafeed
+ * callbacks as they are.
+ *
+ * Input modules and drivers can send a sample which stays the same for a
+ * long time as a single SR_DF_LOGIC_REPEAT packet. By default, and while
+ * any transforms are active, the session expands these into SR_DF_LOGIC
+ * packets. Frontends which handle the repeat packets, e.g. by passing
+ * them on to sr_output_send(), can enable this to avoid the expansion.
+ *
+ * @param session The session to use. Must not be NULL.
+ * @param enable TRUE to pass repeat packets on, FALSE to expand them.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval SR_ERR Session is running.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_session_logic_repeat_set(struct sr_session *session,
+		gboolean enable)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (session->running) {
+		sr_err("%s: can't change a running session", __func__);
+		return SR_ERR;
+	}
+
+	session->logic_repeat = enable;
+
+	return SR_OK;
+}
+
+/**
+ * Fill memory with a repeated sample.
+ *
+ * @param dst The memory to fill, count * repeat->unitsize bytes.
+ * @param repeat The sample to repeat. Its count is not used.
+ * @param count Number of times to write the sample.
+ *
+ * @private
+ */
+SR_PRIV void sr_logic_repeat_fill(void *dst,
+		const struct sr_datafeed_logic_repeat *repeat, uint64_t count)
+{
+	uint8_t *p;
+	uint64_t size, done, n;
+
+	if (!count)
+		return;
+
+	/* Copy the sample once, then keep doubling what's there. */
+	p = dst;
+	size = count * repeat->unitsize;
+	memcpy(p, repeat->data, repeat->unitsize);
+	for (done = repeat->unitsize; done < size; done += n) {
+		n = MIN(done, size - done);
+		memcpy(p + done, p, n);
+	}
+}
+
+/**
+ * Expand an SR_DF_LOGIC_REPEAT packet into a series of SR_DF_LOGIC packets.
+ *
+ * A single buffer of up to LOGIC_REPEAT_CHUNK_SIZE bytes is filled with
+ * the sample once, and handed to the callback as often as needed.
+ *
+ * @param session The session whose buffer pool to use. Can be NULL.
+ * @param repeat The packet to expand.
+ * @param cb Called for every SR_DF_LOGIC packet, with the buffer holding
+ *           its data. Expansion stops at the first error it returns.
+ * @param cb_data Passed to the callback.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid repeat packet.
+ * @return Otherwise, the error returned by the callback.
+ *
+ * @private
+ */
+SR_PRIV int sr_logic_repeat_expand(struct sr_session *session,
+		const struct sr_datafeed_logic_repeat *repeat,
+		sr_logic_repeat_cb cb, void *cb_data)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_buffer *buf;
+	uint64_t count, max, n;
+	int ret;
+
+	if (!repeat->unitsize || !repeat->data) {
+		sr_err("%s: invalid repeat packet", __func__);
+		return SR_ERR_ARG;
+	}
+
+	max = MAX(LOGIC_REPEAT_CHUNK_SIZE / repeat->unitsize, 1);
+	n = MIN(repeat->count, max);
+	buf = sr_session_buffer_get(session, n * repeat->unitsize);
+	sr_logic_repeat_fill(buf->data, repeat, n);
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.unitsize = repeat->unitsize;
+	logic.data = buf->data;
+	ret = SR_OK;
+	for (count = repeat->count; count > 0 && ret == SR_OK; count -= n) {
+		n = MIN(count, max);
+		logic.length = n * repeat->unitsize;
+		ret = cb(&packet, buf, cb_data);
+	}
+	sr_buffer_unref(buf);
+
+	return ret;
+}
+
+static int logic_repeat_send(const struct sr_datafeed_packet *packet,
+		struct sr_buffer *buf, void *cb_data)
+{
+	return sr_session_send_buffer(cb_data, packet, buf);
+}
+
+/**
+ * Send a packet to whatever is listening on the datafeed bus.
+ *
+ * Hardware drivers use this to send a data packet to the frontend.
+ *
+ * If the session's datafeed queue is enabled, the packet is copied and
+ * delivered asynchronously; see sr_session_datafeed_queue_set().
+ *
+ * @param sdi TODO.
+ * @param packet The datafeed packet to send to the session bus.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	return sr_session_send_buffer(sdi, packet, NULL);
+}
+
+/**
+ * Send a packet whose payload data is held in a refcounted buffer.
+ *
+ * This works like sr_session_send(), but lets the datafeed queue and any
+ * consumer retaining the packet take a reference to @a buf rather than
+ * copying the payload data. The caller keeps its own reference, and must
+ * not modify the buffer's contents after this call.
+ *
+ * @param sdi The device instance sending the packet.
+ * @param packet The datafeed packet to send to the session bus.
+ * @param buf The buffer holding the packet's payload data. Can be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_send_buffer(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, struct sr_buffer *buf)
+{
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!packet) {
+		sr_err("%s: packet was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!sdi->session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	/* Transforms only deal with SR_DF_LOGIC. */
+	if (packet->type == SR_DF_LOGIC_REPEAT && (!sdi->session->logic_repeat
+			|| sdi->session->transforms))
+		return sr_logic_repeat_expand(sdi->session, packet->payload,
+				logic_repeat_send, (void *)sdi);
+
+	if (sdi->session->queue)
+		return datafeed_queue_send(sdi->session->queue, sdi, packet, buf);
+
+	return session_send_packet(sdi->session, sdi, sdi->session->transforms,
+			packet, buf, NULL);
+}
+
+/**
+ * Send an extra packet from a transform.
+ *
+ * A transform's receive() can only pass on a single packet. This sends
+ * another one right away, through the transforms after @a t and on to
+ * the datafeed callbacks, ahead of the one receive() returns. It must
+ * only be called from receive().
+ *
+ * @param t The transform sending the packet.
+ * @param packet The datafeed packet to send.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval SR_ERR Error in a following transform.
+ *
+ * @private
+ */
+SR_PRIV int sr_transform_send(const struct sr_transform *t,
+		const struct sr_datafeed_packet *packet)
+{
+	struct sr_session *session;
+	GSList *l;
+
+	if (!t || !t->sdi || !t->sdi->session || !packet)
+		return SR_ERR_ARG;
+
+	session = t->sdi->session;
+	if (!(l = g_slist_find(session->transforms, t)))
+		return SR_ERR_ARG;
+
+	return session_send_packet(session, t->sdi, l->next, packet, NULL, NULL);
+}
+
+/**
+ * Add an event source for a file descriptor.
+ *
+ * @param session The session to use. Must not be NULL.
  * @param pollfd The GPollFD.
  * @param[in] timeout Max time to wait before the callback is called,
  *              ignored if 0.
@@ -822,12 +2010,23 @@ static int _sr_session_source_add(struct sr_session *session, GPollFD *pollfd,
 	s->cb = cb;
 	s->cb_data = cb_data;
 	s->poll_object = poll_object;
+#ifdef HAVE_SYS_EPOLL_H
+	s->es = NULL;
+#endif
 	session->pollfds = new_pollfds;
 	session->sources = new_sources;
 
-	if (timeout != session->source_timeout && timeout > 0
-	    && (session->source_timeout == -1 || timeout < session->source_timeout))
-		session->source_timeout = timeout;
+	if (timeout > 0)
+		s->due = g_get_monotonic_time()
+				+ timeout * G_TIME_SPAN_MILLISECOND;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (session->epoll
+	    && epoll_source_add(session, session->num_sources - 1) != SR_OK) {
+		session->num_sources--;
+		return SR_ERR;
+	}
+#endif
 
 	return SR_OK;
 }
@@ -921,7 +2120,8 @@ SR_API int sr_session_source_add_channel(struct sr_session *session,
  * @retval SR_ERR_ARG Invalid arguments
  * @retval SR_ERR_BUG Internal error
  */
-static int _sr_session_source_remove(struct sr_session *session, gintptr poll_object)
+static int _sr_session_source_remove(struct sr_session *session,
+		gintptr poll_object)
 {
 	unsigned int old;
 
@@ -939,6 +2139,11 @@ static int _sr_session_source_remove(struct sr_session *session, gintptr poll_ob
 	if (old == session->num_sources)
 		return SR_OK;
 
+#ifdef HAVE_SYS_EPOLL_H
+	if (session->epoll)
+		epoll_source_remove(session, session->sources[old].es);
+#endif
+
 	session->num_sources--;
 
 	if (old != session->num_sources) {
@@ -946,6 +2151,12 @@ static int _sr_session_source_remove(struct sr_session *session, gintptr poll_ob
 			(session->num_sources - old) * sizeof(GPollFD));
 		memmove(&session->sources[old], &session->sources[old + 1],
 			(session->num_sources - old) * sizeof(struct source));
+#ifdef HAVE_SYS_EPOLL_H
+		if (session->epoll) {
+			for (; old < session->num_sources; old++)
+				session->sources[old].es->index = old;
+		}
+#endif
 	}
 
 	session->pollfds = g_realloc(session->pollfds, sizeof(GPollFD) * session->num_sources);
@@ -1007,6 +2218,274 @@ SR_API int sr_session_source_remove_channel(struct sr_session *session,
 	return _sr_session_source_remove(session, (gintptr)channel);
 }
 
+/* Size class of a buffer, or -1 if it is too large to be pooled. */
+static int buffer_pool_class(gsize size)
+{
+	int c;
+
+	for (c = 0; c < BUFFER_POOL_NUM_CLASSES; c++) {
+		if (size <= (gsize)1 << (BUFFER_POOL_MIN_SHIFT + c))
+			return c;
+	}
+
+	return -1;
+}
+
+/**
+ * Allocate a refcounted buffer.
+ *
+ * The buffer starts out with a reference count of 1, and is freed when the
+ * last reference is dropped with sr_buffer_unref().
+ *
+ * @param size Size of the buffer's data area, in bytes.
+ *
+ * @return The new buffer. Its data pointer is suitably aligned for any
+ *         sample type.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_buffer_new(gsize size)
+{
+	struct sr_buffer *buf;
+
+	buf = g_malloc(sizeof(struct sr_buffer) + size);
+	buf->refcount = 1;
+	buf->size = size;
+	buf->data = (uint8_t *)(buf + 1);
+	buf->pool = NULL;
+	buf->destroy = NULL;
+	buf->destroy_data = NULL;
+
+	return buf;
+}
+
+/**
+ * Wrap memory which is owned elsewhere, such as a file mapping, in a
+ * refcounted buffer.
+ *
+ * The buffer starts out with a reference count of 1. When the last
+ * reference is dropped with sr_buffer_unref(), @a destroy is called
+ * to release the memory.
+ *
+ * @param data The memory to wrap.
+ * @param size Size of the memory, in bytes.
+ * @param destroy Function releasing the memory. Can be NULL.
+ * @param destroy_data Argument passed to @a destroy.
+ *
+ * @return The new buffer.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_buffer_new_wrap(void *data, gsize size,
+		GDestroyNotify destroy, gpointer destroy_data)
+{
+	struct sr_buffer *buf;
+
+	buf = g_malloc(sizeof(struct sr_buffer));
+	buf->refcount = 1;
+	buf->size = size;
+	buf->data = data;
+	buf->pool = NULL;
+	buf->destroy = destroy;
+	buf->destroy_data = destroy_data;
+
+	return buf;
+}
+
+/**
+ * Take a reference to a buffer.
+ *
+ * @param buf The buffer. Must not be NULL.
+ *
+ * @return The same buffer.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_buffer_ref(struct sr_buffer *buf)
+{
+	g_atomic_int_inc(&buf->refcount);
+
+	return buf;
+}
+
+/**
+ * Drop a reference to a buffer, freeing it if it was the last one.
+ *
+ * @param buf The buffer. Can be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_buffer_unref(struct sr_buffer *buf)
+{
+	struct sr_buffer_pool *pool;
+	int c;
+
+	if (!buf || !g_atomic_int_dec_and_test(&buf->refcount))
+		return;
+
+	if (!(pool = buf->pool)) {
+		if (buf->destroy)
+			buf->destroy(buf->destroy_data);
+		g_free(buf);
+		return;
+	}
+
+	/* Hand the buffer back to its pool, or free it if that's full. */
+	c = buffer_pool_class(buf->size);
+	g_mutex_lock(&pool->mutex);
+	if (pool->num_idle[c] < BUFFER_POOL_MAX_IDLE) {
+		pool->idle[c] = g_slist_prepend(pool->idle[c], buf);
+		pool->num_idle[c]++;
+		buf = NULL;
+	} else {
+		pool->bytes -= buf->size;
+	}
+	g_mutex_unlock(&pool->mutex);
+	g_free(buf);
+
+	buffer_pool_unref(pool);
+}
+
+static struct sr_buffer_pool *buffer_pool_new(void)
+{
+	struct sr_buffer_pool *pool;
+
+	pool = g_malloc0(sizeof(struct sr_buffer_pool));
+	pool->refcount = 1;
+	g_mutex_init(&pool->mutex);
+
+	return pool;
+}
+
+static void buffer_pool_unref(struct sr_buffer_pool *pool)
+{
+	int c;
+
+	if (!g_atomic_int_dec_and_test(&pool->refcount))
+		return;
+
+	for (c = 0; c < BUFFER_POOL_NUM_CLASSES; c++)
+		g_slist_free_full(pool->idle[c], g_free);
+	g_mutex_clear(&pool->mutex);
+	g_free(pool);
+}
+
+static struct sr_buffer *buffer_pool_get(struct sr_buffer_pool *pool,
+		gsize size)
+{
+	struct sr_buffer *buf;
+	GSList *l;
+	int c;
+
+	if (!pool || (c = buffer_pool_class(size)) < 0)
+		return sr_buffer_new(size);
+
+	buf = NULL;
+	g_mutex_lock(&pool->mutex);
+	if ((l = pool->idle[c])) {
+		buf = l->data;
+		pool->idle[c] = g_slist_delete_link(l, l);
+		pool->num_idle[c]--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+		pool->bytes += (gsize)1 << (BUFFER_POOL_MIN_SHIFT + c);
+		pool->peak_bytes = MAX(pool->peak_bytes, pool->bytes);
+	}
+	g_mutex_unlock(&pool->mutex);
+
+	if (!buf) {
+		buf = sr_buffer_new((gsize)1 << (BUFFER_POOL_MIN_SHIFT + c));
+		buf->pool = pool;
+	}
+	buf->refcount = 1;
+	g_atomic_int_inc(&pool->refcount);
+
+	return buf;
+}
+
+/**
+ * Get a refcounted buffer from the session's buffer pool.
+ *
+ * Drivers, input modules and transforms should use this for payload
+ * data they allocate per packet. When the last reference is dropped with
+ * sr_buffer_unref(), the buffer goes back to the pool instead of being
+ * freed, so a long acquisition reuses the same few buffers.
+ *
+ * The buffer's size can be larger than requested.
+ *
+ * @param session The session to use. If NULL, a buffer which doesn't
+ *                belong to any pool is allocated.
+ * @param size Minimum size of the buffer's data area, in bytes.
+ *
+ * @return The new buffer.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_session_buffer_get(struct sr_session *session,
+		gsize size)
+{
+	return buffer_pool_get(session ? session->pool : NULL, size);
+}
+
+/**
+ * Get statistics of the session's buffer pool.
+ *
+ * @param session The session to use. Must not be NULL.
+ * @param hits Number of buffers served from the pool. Can be NULL.
+ * @param misses Number of buffers which had to be allocated. Can be NULL.
+ * @param peak_bytes Highest number of bytes allocated through the pool
+ *                   at the same time, in use or idle. Can be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_session_buffer_pool_stats(struct sr_session *session,
+		uint64_t *hits, uint64_t *misses, uint64_t *peak_bytes)
+{
+	struct sr_buffer_pool *pool;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	pool = session->pool;
+	g_mutex_lock(&pool->mutex);
+	if (hits)
+		*hits = pool->hits;
+	if (misses)
+		*misses = pool->misses;
+	if (peak_bytes)
+		*peak_bytes = pool->peak_bytes;
+	g_mutex_unlock(&pool->mutex);
+
+	return SR_OK;
+}
+
+/*
+ * Point the copy's payload data at the given memory. If it is held by
+ * buf, just take a reference, otherwise copy it into a new buffer.
+ */
+static void *packet_ref_data(struct packet_ref *ref, struct sr_buffer *buf,
+		struct sr_buffer_pool *pool, const void *data, gsize size)
+{
+	const uint8_t *p;
+
+	p = data;
+	if (buf && p >= buf->data && p + size <= buf->data + buf->size) {
+		ref->buffer = sr_buffer_ref(buf);
+		return (void *)data;
+	}
+
+	ref->buffer = buffer_pool_get(pool, size);
+	memcpy(ref->buffer->data, data, size);
+
+	return ref->buffer->data;
+}
+
 static void copy_src(struct sr_config *src, struct sr_datafeed_meta *meta_copy)
 {
 	g_variant_ref(src->data);
@@ -1014,107 +2493,195 @@ static void copy_src(struct sr_config *src, struct sr_datafeed_meta *meta_copy)
 	                                   g_memdup(src, sizeof(struct sr_config)));
 }
 
-SR_PRIV int sr_packet_copy(const struct sr_datafeed_packet *packet,
+static int packet_copy(const struct sr_datafeed_packet *packet,
+		struct sr_buffer *buf, struct sr_buffer_pool *pool,
 		struct sr_datafeed_packet **copy)
 {
 	const struct sr_datafeed_meta *meta;
-	struct sr_datafeed_meta *meta_copy;
 	const struct sr_datafeed_logic *logic;
-	struct sr_datafeed_logic *logic_copy;
+	const struct sr_datafeed_logic_repeat *repeat;
 	const struct sr_datafeed_analog *analog;
-	struct sr_datafeed_analog *analog_copy;
-	uint8_t *payload;
+	const struct sr_datafeed_analog2 *analog2;
+	struct packet_ref *ref;
 
-	*copy = g_malloc0(sizeof(struct sr_datafeed_packet));
-	(*copy)->type = packet->type;
+	ref = g_malloc0(sizeof(struct packet_ref));
+	ref->refcount = 1;
+	ref->packet.type = packet->type;
 
 	switch (packet->type) {
 	case SR_DF_TRIGGER:
 	case SR_DF_END:
+	case SR_DF_FRAME_BEGIN:
+	case SR_DF_FRAME_END:
 		/* No payload. */
 		break;
 	case SR_DF_HEADER:
-		payload = g_malloc(sizeof(struct sr_datafeed_header));
-		memcpy(payload, packet->payload, sizeof(struct sr_datafeed_header));
-		(*copy)->payload = payload;
+		ref->payload.header = *(const struct sr_datafeed_header *)packet->payload;
+		ref->packet.payload = &ref->payload.header;
 		break;
 	case SR_DF_META:
 		meta = packet->payload;
-		meta_copy = g_malloc0(sizeof(struct sr_datafeed_meta));
-		g_slist_foreach(meta->config, (GFunc)copy_src, meta_copy->config);
-		(*copy)->payload = meta_copy;
+		g_slist_foreach(meta->config, (GFunc)copy_src, &ref->payload.meta);
+		ref->packet.payload = &ref->payload.meta;
 		break;
 	case SR_DF_LOGIC:
 		logic = packet->payload;
-		logic_copy = g_malloc(sizeof(logic));
-		logic_copy->length = logic->length;
-		logic_copy->unitsize = logic->unitsize;
-		memcpy(logic_copy->data, logic->data, logic->length * logic->unitsize);
-		(*copy)->payload = logic_copy;
+		ref->payload.logic = *logic;
+		ref->payload.logic.data = packet_ref_data(ref, buf, pool,
+				logic->data, logic->length);
+		ref->packet.payload = &ref->payload.logic;
+		break;
+	case SR_DF_LOGIC_REPEAT:
+		repeat = packet->payload;
+		ref->payload.repeat = *repeat;
+		ref->payload.repeat.data = packet_ref_data(ref, buf, pool,
+				repeat->data, repeat->unitsize);
+		ref->packet.payload = &ref->payload.repeat;
 		break;
 	case SR_DF_ANALOG:
 		analog = packet->payload;
-		analog_copy = g_malloc(sizeof(analog));
-		analog_copy->channels = g_slist_copy(analog->channels);
-		analog_copy->num_samples = analog->num_samples;
-		analog_copy->mq = analog->mq;
-		analog_copy->unit = analog->unit;
-		analog_copy->mqflags = analog->mqflags;
-		memcpy(analog_copy->data, analog->data,
-				analog->num_samples * sizeof(float));
-		(*copy)->payload = analog_copy;
+		ref->payload.analog = *analog;
+		ref->payload.analog.channels = g_slist_copy(analog->channels);
+		ref->payload.analog.data = packet_ref_data(ref, buf, pool,
+				analog->data, analog->num_samples * g_slist_length(analog->channels)
+				* sizeof(float));
+		ref->packet.payload = &ref->payload.analog;
+		break;
+	case SR_DF_ANALOG2:
+		analog2 = packet->payload;
+		ref->payload.a2.analog2 = *analog2;
+		ref->payload.a2.encoding = *analog2->encoding;
+		ref->payload.a2.meaning = *analog2->meaning;
+		ref->payload.a2.meaning.channels = g_slist_copy(
+				analog2->meaning->channels);
+		ref->payload.a2.spec = *analog2->spec;
+		ref->payload.a2.analog2.encoding = &ref->payload.a2.encoding;
+		ref->payload.a2.analog2.meaning = &ref->payload.a2.meaning;
+		ref->payload.a2.analog2.spec = &ref->payload.a2.spec;
+		ref->payload.a2.analog2.data = packet_ref_data(ref, buf, pool,
+				analog2->data,
+				analog2->num_samples * analog2->encoding->unitsize);
+		ref->packet.payload = &ref->payload.a2.analog2;
 		break;
 	default:
 		sr_err("Unknown packet type %d", packet->type);
+		g_free(ref);
+		*copy = NULL;
 		return SR_ERR;
 	}
 
+	*copy = &ref->packet;
+
 	return SR_OK;
 }
 
-void sr_packet_free(struct sr_datafeed_packet *packet)
+/**
+ * Copy a datafeed packet.
+ *
+ * The copy is refcounted, see sr_packet_ref() and sr_packet_free().
+ *
+ * @param packet The packet to copy. Must not be NULL.
+ * @param copy Will contain the copy on success.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR Unknown packet type.
+ *
+ * @private
+ */
+SR_PRIV int sr_packet_copy(const struct sr_datafeed_packet *packet,
+		struct sr_datafeed_packet **copy)
+{
+	return packet_copy(packet, NULL, NULL, copy);
+}
+
+/**
+ * Retain a datafeed packet beyond the datafeed callback it was passed to.
+ *
+ * If the packet's payload data is held in a refcounted buffer (e.g. with
+ * the datafeed queue enabled, or if the driver allocated it that way),
+ * this only takes a reference. Otherwise the payload is copied once, and
+ * further calls share that copy.
+ *
+ * Release the returned packet with sr_packet_free().
+ *
+ * @param packet The packet passed to the currently running datafeed
+ *               callback, or a packet previously returned by this
+ *               function. Must not be NULL.
+ *
+ * @return The retained packet, or NULL on error.
+ *
+ * @since 0.4.0
+ */
+SR_API struct sr_datafeed_packet *sr_packet_ref(
+		const struct sr_datafeed_packet *packet)
 {
-	const struct sr_datafeed_meta *meta;
-	const struct sr_datafeed_logic *logic;
-	const struct sr_datafeed_analog *analog;
+	struct packet_dispatch *dispatch;
+	struct packet_ref *ref;
+
+	if (!packet)
+		return NULL;
+
+	dispatch = g_private_get(&packet_dispatch_key);
+	if (dispatch && dispatch->packet == packet) {
+		if (!dispatch->ref) {
+			if (packet_copy(packet, dispatch->buffer, NULL,
+					&dispatch->ref) != SR_OK)
+				return NULL;
+			dispatch->own_ref = TRUE;
+		}
+		packet = dispatch->ref;
+	}
+
+	ref = packet_ref_get(packet);
+	g_atomic_int_inc(&ref->refcount);
+
+	return &ref->packet;
+}
+
+/**
+ * Release a datafeed packet.
+ *
+ * The packet and its payload are freed when the last reference is
+ * dropped.
+ *
+ * @param packet A packet returned by sr_packet_ref(). Can be NULL.
+ *
+ * @since 0.4.0
+ */
+SR_API void sr_packet_free(struct sr_datafeed_packet *packet)
+{
+	struct packet_ref *ref;
 	struct sr_config *src;
 	GSList *l;
 
+	if (!packet)
+		return;
+
+	ref = packet_ref_get(packet);
+	if (!g_atomic_int_dec_and_test(&ref->refcount))
+		return;
+
 	switch (packet->type) {
-	case SR_DF_TRIGGER:
-	case SR_DF_END:
-		/* No payload. */
-		break;
-	case SR_DF_HEADER:
-		/* Payload is a simple struct. */
-		g_free((void *)packet->payload);
-		break;
 	case SR_DF_META:
-		meta = packet->payload;
-		for (l = meta->config; l; l = l->next) {
+		for (l = ref->payload.meta.config; l; l = l->next) {
 			src = l->data;
 			g_variant_unref(src->data);
 			g_free(src);
 		}
-		g_slist_free(meta->config);
-		g_free((void *)packet->payload);
-		break;
-	case SR_DF_LOGIC:
-		logic = packet->payload;
-		g_free(logic->data);
-		g_free((void *)packet->payload);
+		g_slist_free(ref->payload.meta.config);
 		break;
 	case SR_DF_ANALOG:
-		analog = packet->payload;
-		g_slist_free(analog->channels);
-		g_free(analog->data);
-		g_free((void *)packet->payload);
+		g_slist_free(ref->payload.analog.channels);
+		break;
+	case SR_DF_ANALOG2:
+		g_slist_free(ref->payload.a2.meaning.channels);
 		break;
 	default:
-		sr_err("Unknown packet type %d", packet->type);
+		/* Nothing allocated besides the payload data. */
+		break;
 	}
-	g_free(packet);
-
+	sr_buffer_unref(ref->buffer);
+	g_free(ref);
 }
 
 /** @} */
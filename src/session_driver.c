@@ -46,24 +46,112 @@ struct session_vdev {
 	int num_channels;
 	int cur_chunk;
 	gboolean finished;
+	/* Chunk index: chunk i holds samples chunk_start[i] up to chunk_start[i + 1]. */
+	gboolean chunked;
+	int num_chunks;
+	uint64_t *chunk_start;
+	/* Replay range. */
+	uint64_t start_sample;
+	uint64_t limit_samples;
+	uint64_t skip_bytes;
+	uint64_t samples_left;
 };
 
 static const uint32_t devopts[] = {
 	SR_CONF_CAPTUREFILE | SR_CONF_SET,
 	SR_CONF_CAPTURE_UNITSIZE | SR_CONF_GET | SR_CONF_SET,
 	SR_CONF_SAMPLERATE | SR_CONF_GET | SR_CONF_SET,
+	SR_CONF_CAPTURE_START | SR_CONF_GET | SR_CONF_SET,
+	SR_CONF_LIMIT_SAMPLES | SR_CONF_GET | SR_CONF_SET,
 };
 
+/* Name of the capture file holding chunk i, counting from 0. */
+static void chunk_name(const struct session_vdev *vdev, int i,
+		char *name, size_t len)
+{
+	if (vdev->chunked)
+		snprintf(name, len, "%s-%d", vdev->capturefile, i + 1);
+	else
+		snprintf(name, len, "%s", vdev->capturefile);
+}
+
+/*
+ * Build the chunk index from the sizes in the zip central directory,
+ * so no chunk has to be decompressed to find out where it starts.
+ */
+static int chunk_index_build(struct session_vdev *vdev)
+{
+	struct zip_stat zs;
+	GArray *starts;
+	uint64_t start;
+	char capturefile[32];
+
+	g_free(vdev->chunk_start);
+	vdev->chunk_start = NULL;
+	vdev->num_chunks = 0;
+
+	if (vdev->unitsize <= 0) {
+		sr_err("Invalid unit size %d.", vdev->unitsize);
+		return SR_ERR;
+	}
+
+	/* capturefile is always the unchunked base name. */
+	vdev->chunked = zip_stat(vdev->archive, vdev->capturefile, 0, &zs) == -1;
+
+	starts = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+	start = 0;
+	g_array_append_val(starts, start);
+	for (;;) {
+		chunk_name(vdev, starts->len - 1, capturefile, sizeof(capturefile));
+		if (zip_stat(vdev->archive, capturefile, 0, &zs) == -1)
+			break;
+		start += zs.size / vdev->unitsize;
+		g_array_append_val(starts, start);
+		if (!vdev->chunked)
+			break;
+	}
+
+	vdev->num_chunks = starts->len - 1;
+	vdev->chunk_start = (uint64_t *)g_array_free(starts, FALSE);
+	if (vdev->num_chunks == 0) {
+		sr_err("No capture file '%s' in session file '%s'.",
+				vdev->capturefile, vdev->sessionfile);
+		return SR_ERR;
+	}
+	sr_dbg("Indexed %d chunk(s), %" PRIu64 " samples.", vdev->num_chunks,
+			vdev->chunk_start[vdev->num_chunks]);
+
+	return SR_OK;
+}
+
+/* Find the chunk holding the given sample. */
+static int chunk_find(const struct session_vdev *vdev, uint64_t sample)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = vdev->num_chunks - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (vdev->chunk_start[mid] <= sample)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
 static int receive_data(int fd, int revents, void *cb_data)
 {
 	struct sr_dev_inst *sdi;
 	struct session_vdev *vdev;
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
-	struct zip_stat zs;
+	uint64_t size;
 	int ret, got_data;
-	char capturefile[16];
-	void *buf;
+	char capturefile[32];
+	struct sr_buffer *buf;
 
 	(void)fd;
 	(void)revents;
@@ -71,57 +159,43 @@ static int receive_data(int fd, int revents, void *cb_data)
 	sdi = cb_data;
 	got_data = FALSE;
 	vdev = sdi->priv;
-	if (!vdev->finished) {
-		if (!vdev->capfile) {
-			/* No capture file opened yet, or finished with the last
-			 * chunked one. */
-			if (vdev->cur_chunk == 0) {
-				/* capturefile is always the unchunked base name. */
-				if (zip_stat(vdev->archive, vdev->capturefile, 0, &zs) != -1) {
-					/* No chunks, just a single capture file. */
-					vdev->cur_chunk = 0;
-					if (!(vdev->capfile = zip_fopen(vdev->archive,
-							vdev->capturefile, 0)))
-						return FALSE;
-						sr_dbg("Opened %s.", vdev->capturefile);
-				} else {
-					/* Try as first chunk filename. */
-					snprintf(capturefile, 15, "%s-1", vdev->capturefile);
-					if (zip_stat(vdev->archive, capturefile, 0, &zs) != -1) {
-						vdev->cur_chunk = 1;
-						if (!(vdev->capfile = zip_fopen(vdev->archive,
-								capturefile, 0)))
-							return FALSE;
-						sr_dbg("Opened %s.", capturefile);
-					} else {
-						sr_err("No capture file '%s' in " "session file '%s'.",
-								vdev->capturefile, vdev->sessionfile);
-						return FALSE;
-					}
-				}
-			} else {
-				/* Capture data is chunked, advance to the next chunk. */
-				vdev->cur_chunk++;
-				snprintf(capturefile, 15, "%s-%d", vdev->capturefile,
-						vdev->cur_chunk);
-				if (zip_stat(vdev->archive, capturefile, 0, &zs) != -1) {
-					if (!(vdev->capfile = zip_fopen(vdev->archive,
-							capturefile, 0)))
-						return FALSE;
-					sr_dbg("Opened %s.", capturefile);
-				} else {
-					/* We got all the chunks, finish up. */
-					vdev->finished = TRUE;
-					return TRUE;
-				}
-			}
+	if (!vdev->finished && !vdev->capfile) {
+		/* No capture file opened yet, or finished with the last one. */
+		if (vdev->cur_chunk >= vdev->num_chunks) {
+			/* We got all the chunks, finish up. */
+			vdev->finished = TRUE;
+		} else {
+			chunk_name(vdev, vdev->cur_chunk, capturefile,
+					sizeof(capturefile));
+			if (!(vdev->capfile = zip_fopen(vdev->archive,
+					capturefile, 0)))
+				return FALSE;
+			sr_dbg("Opened %s.", capturefile);
 		}
+	}
 
-		buf = g_malloc(CHUNKSIZE);
-
-		ret = zip_fread(vdev->capfile, buf,
-				CHUNKSIZE / vdev->unitsize * vdev->unitsize);
-		if (ret > 0) {
+	if (!vdev->finished) {
+		buf = sr_session_buffer_get(sdi->session, CHUNKSIZE);
+
+		size = CHUNKSIZE / vdev->unitsize * vdev->unitsize;
+		if (vdev->skip_bytes > 0)
+			/* Deflate can't seek, read up to the start sample. */
+			size = MIN(size, vdev->skip_bytes);
+		else
+			size = MIN(size, vdev->samples_left * vdev->unitsize);
+		ret = zip_fread(vdev->capfile, buf->data, size);
+		if (ret < 0 || (ret == 0 && vdev->skip_bytes > 0)) {
+			/* Don't carry on from the wrong place in the capture. */
+			sr_err("Failed to read from %s chunk %d.",
+					vdev->capturefile, vdev->cur_chunk + 1);
+			zip_fclose(vdev->capfile);
+			vdev->capfile = NULL;
+			vdev->finished = TRUE;
+		} else if (ret > 0 && vdev->skip_bytes > 0) {
+			vdev->skip_bytes -= ret;
+			sr_buffer_unref(buf);
+			return TRUE;
+		} else if (ret > 0) {
 			if (ret % vdev->unitsize != 0)
 				sr_warn("Read size %d not a multiple of the"
 					" unit size %d.", ret, vdev->unitsize);
@@ -130,24 +204,27 @@ static int receive_data(int fd, int revents, void *cb_data)
 			packet.payload = &logic;
 			logic.length = ret;
 			logic.unitsize = vdev->unitsize;
-			logic.data = buf;
+			logic.data = buf->data;
 			vdev->bytes_read += ret;
-			sr_session_send(sdi, &packet);
+			vdev->samples_left -= MIN(vdev->samples_left,
+					(uint64_t)ret / vdev->unitsize);
+			sr_session_send_buffer(sdi, &packet, buf);
+			if (vdev->samples_left == 0) {
+				/* End of the requested range. */
+				zip_fclose(vdev->capfile);
+				vdev->capfile = NULL;
+				vdev->finished = TRUE;
+			}
 		} else {
-			/* done with this capture file */
+			/* Done with this capture file, there might be more
+			 * chunks, so don't fall through to the SR_DF_END. */
 			zip_fclose(vdev->capfile);
 			vdev->capfile = NULL;
-			if (vdev->cur_chunk == 0) {
-				/* It was the only file. */
-				vdev->finished = TRUE;
-			} else {
-				/* There might be more chunks, so don't fall through
-				 * to the SR_DF_END here. */
-				g_free(buf);
-				return TRUE;
-			}
+			vdev->cur_chunk++;
+			sr_buffer_unref(buf);
+			return TRUE;
 		}
-		g_free(buf);
+		sr_buffer_unref(buf);
 	}
 
 	if (!got_data) {
@@ -200,6 +277,7 @@ static int dev_close(struct sr_dev_inst *sdi)
 	const struct session_vdev *const vdev = sdi->priv;
 	g_free(vdev->sessionfile);
 	g_free(vdev->capturefile);
+	g_free(vdev->chunk_start);
 
 	g_free(sdi->priv);
 	sdi->priv = NULL;
@@ -226,6 +304,12 @@ static int config_get(uint32_t key, GVariant **data, const struct sr_dev_inst *s
 	case SR_CONF_CAPTURE_UNITSIZE:
 		*data = g_variant_new_uint64(vdev->unitsize);
 		break;
+	case SR_CONF_CAPTURE_START:
+		*data = g_variant_new_uint64(vdev->start_sample);
+		break;
+	case SR_CONF_LIMIT_SAMPLES:
+		*data = g_variant_new_uint64(vdev->limit_samples);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -263,6 +347,12 @@ static int config_set(uint32_t key, GVariant *data, const struct sr_dev_inst *sd
 	case SR_CONF_NUM_LOGIC_CHANNELS:
 		vdev->num_channels = g_variant_get_uint64(data);
 		break;
+	case SR_CONF_CAPTURE_START:
+		vdev->start_sample = g_variant_get_uint64(data);
+		break;
+	case SR_CONF_LIMIT_SAMPLES:
+		vdev->limit_samples = g_variant_get_uint64(data);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -291,6 +381,7 @@ static int config_list(uint32_t key, GVariant **data, const struct sr_dev_inst *
 static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 {
 	struct session_vdev *vdev;
+	uint64_t total, start;
 	int ret;
 
 	(void)cb_data;
@@ -309,6 +400,27 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		return SR_ERR;
 	}
 
+	if (chunk_index_build(vdev) != SR_OK) {
+		zip_close(vdev->archive);
+		vdev->archive = NULL;
+		return SR_ERR;
+	}
+
+	/* Seek to the chunk holding the start sample. */
+	total = vdev->chunk_start[vdev->num_chunks];
+	start = MIN(vdev->start_sample, total);
+	vdev->cur_chunk = chunk_find(vdev, start);
+	vdev->skip_bytes = (start - vdev->chunk_start[vdev->cur_chunk])
+			* vdev->unitsize;
+	vdev->samples_left = total - start;
+	if (vdev->limit_samples)
+		vdev->samples_left = MIN(vdev->samples_left, vdev->limit_samples);
+	if (vdev->samples_left == 0)
+		vdev->finished = TRUE;
+	if (start > 0)
+		sr_dbg("Starting at sample %" PRIu64 " in chunk %d.",
+				start, vdev->cur_chunk + 1);
+
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(sdi, LOG_PREFIX);
 
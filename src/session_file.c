@@ -237,6 +237,145 @@ SR_API int sr_session_load(struct sr_context *ctx, const char *filename,
 	return ret;
 }
 
+/**
+ * Read part of the overview stored in a session file.
+ *
+ * Session files saved with the srzip output's "overview" option carry a
+ * pyramid of zoomed out views of the logic data. Level n has one block per
+ * B^n samples, where B is the "overview block" value in the metadata.
+ * Each block consists of 2 * unitsize bytes: the logic levels of the last
+ * sample in the block, followed by a mask of the channels that changed
+ * anywhere in the block.
+ *
+ * @param filename The name of the session file. Must not be NULL.
+ * @param level The overview level, starting at 1.
+ * @param start The first sample of the range to read.
+ * @param num_samples The number of samples in the range.
+ * @param data Returns the blocks overlapping the range. The caller must
+ *             free this with g_free(). Must not be NULL.
+ * @param num_blocks Returns the number of blocks in data. Must not be NULL.
+ * @param unitsize Returns the unit size of the capture. Must not be NULL.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR_ARG Invalid arguments
+ * @retval SR_ERR_NA The file has no overview at this level
+ * @retval SR_ERR_DATA Malformed session file
+ * @retval SR_ERR Other errors
+ *
+ * @since 0.4.0
+ */
+SR_API int sr_session_overview_get(const char *filename, int level,
+		uint64_t start, uint64_t num_samples, uint8_t **data,
+		uint64_t *num_blocks, int *unitsize)
+{
+	GKeyFile *kf;
+	struct zip *archive;
+	struct zip_file *zf;
+	struct zip_stat zs;
+	uint64_t block_samples, first, last, blocks, skip, size;
+	int ret, i, levels, factor;
+	char *metafile, name[16];
+	uint8_t *tmp;
+
+	if (!filename || !data || !num_blocks || !unitsize || level < 1)
+		return SR_ERR_ARG;
+
+	*data = NULL;
+	*num_blocks = 0;
+
+	if ((ret = sr_sessionfile_check(filename)) != SR_OK)
+		return ret;
+
+	if (!(archive = zip_open(filename, 0, &ret)))
+		return SR_ERR;
+
+	if (zip_stat(archive, "metadata", 0, &zs) == -1) {
+		zip_close(archive);
+		return SR_ERR;
+	}
+	metafile = g_malloc(zs.size);
+	zf = zip_fopen_index(archive, zs.index, 0);
+	zip_fread(zf, metafile, zs.size);
+	zip_fclose(zf);
+
+	kf = g_key_file_new();
+	if (!g_key_file_load_from_data(kf, metafile, zs.size, 0, NULL)) {
+		sr_dbg("Failed to parse metadata.");
+		g_key_file_free(kf);
+		g_free(metafile);
+		zip_close(archive);
+		return SR_ERR_DATA;
+	}
+	g_free(metafile);
+	*unitsize = g_key_file_get_integer(kf, "device 1", "unitsize", NULL);
+	levels = g_key_file_get_integer(kf, "device 1", "overview levels", NULL);
+	factor = g_key_file_get_integer(kf, "device 1", "overview block", NULL);
+	g_key_file_free(kf);
+
+	if (level > levels || factor < 2 || *unitsize < 1) {
+		zip_close(archive);
+		return SR_ERR_NA;
+	}
+
+	block_samples = 1;
+	for (i = 0; i < level; i++) {
+		if (block_samples > G_MAXUINT64 / factor) {
+			zip_close(archive);
+			return SR_ERR_NA;
+		}
+		block_samples *= factor;
+	}
+
+	snprintf(name, sizeof(name), "overview-1-%d", level);
+	if (zip_stat(archive, name, 0, &zs) == -1) {
+		zip_close(archive);
+		return SR_ERR_DATA;
+	}
+	blocks = zs.size / (2 * *unitsize);
+
+	/* Blocks overlapping [start, start + num_samples). */
+	first = start / block_samples;
+	last = num_samples ? (start + num_samples - 1) / block_samples + 1 : first;
+	last = MIN(last, blocks);
+	if (first >= last) {
+		zip_close(archive);
+		return SR_OK;
+	}
+
+	if (!(zf = zip_fopen(archive, name, 0))) {
+		zip_close(archive);
+		return SR_ERR;
+	}
+
+	/* Skip to the first block. */
+	ret = SR_OK;
+	skip = first * 2 * *unitsize;
+	tmp = g_malloc(MIN(skip, 64 * 1024) + 1);
+	while (skip > 0 && ret == SR_OK) {
+		size = MIN(skip, 64 * 1024);
+		if (zip_fread(zf, tmp, size) != (zip_int64_t)size)
+			ret = SR_ERR_DATA;
+		skip -= size;
+	}
+	g_free(tmp);
+
+	size = (last - first) * 2 * *unitsize;
+	if (ret == SR_OK) {
+		*data = g_malloc(size);
+		if (zip_fread(zf, *data, size) != (zip_int64_t)size) {
+			g_free(*data);
+			*data = NULL;
+			ret = SR_ERR_DATA;
+		} else {
+			*num_blocks = last - first;
+		}
+	}
+	zip_fclose(zf);
+	zip_close(archive);
+
+	return ret;
+}
+
 /**
  * Save a session to the specified file.
  *
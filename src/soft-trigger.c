@@ -18,6 +18,9 @@
  */
 
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
@@ -25,16 +28,106 @@
 #define LOG_PREFIX "soft-trigger"
 /* @endcond */
 
+/*
+ * Each trigger stage is compiled into three bit masks, laid out like a
+ * sample of unitsize bytes:
+ *
+ *  - mask/value: bits which must have a fixed level. Besides the ZERO and
+ *    ONE matches this also covers the level a RISING or FALLING match
+ *    ends up at.
+ *  - edges: bits which must differ from the previous sample.
+ *
+ * A stage then matches a sample s with previous sample p if
+ * ((s ^ value) & mask) == 0 and ((s ^ p) & edges) == edges, which can be
+ * checked a whole word (or vector) at a time.
+ */
+static void stage_compile(struct soft_trigger_stage *cs,
+		const struct sr_trigger_stage *stage, int unitsize)
+{
+	const struct sr_trigger_match *match;
+	const GSList *l;
+	uint8_t *ones, *zeros;
+	int byte, bit, i;
+
+	cs->mask = g_malloc0(unitsize * 3);
+	cs->value = cs->mask + unitsize;
+	cs->edges = cs->value + unitsize;
+	ones = g_malloc0(unitsize * 2);
+	zeros = ones + unitsize;
+
+	cs->empty = stage->matches == NULL;
+	for (l = stage->matches; l; l = l->next) {
+		match = l->data;
+		if (!match->channel->enabled)
+			/* Ignore disabled channels with a trigger. */
+			continue;
+		cs->num_matches++;
+		byte = match->channel->index / 8;
+		bit = 1 << (match->channel->index % 8);
+		switch (match->match) {
+		case SR_TRIGGER_ZERO:
+			zeros[byte] |= bit;
+			break;
+		case SR_TRIGGER_ONE:
+			ones[byte] |= bit;
+			break;
+		case SR_TRIGGER_RISING:
+			ones[byte] |= bit;
+			cs->edges[byte] |= bit;
+			break;
+		case SR_TRIGGER_FALLING:
+			zeros[byte] |= bit;
+			cs->edges[byte] |= bit;
+			break;
+		case SR_TRIGGER_EDGE:
+			cs->edges[byte] |= bit;
+			break;
+		default:
+			/* Analog matches never fire on logic data. */
+			cs->never = TRUE;
+			break;
+		}
+	}
+
+	for (i = 0; i < unitsize; i++) {
+		if (cs->edges[i])
+			cs->has_edges = TRUE;
+		if (ones[i] & zeros[i])
+			/* Conflicting levels on the same channel. */
+			cs->never = TRUE;
+		cs->mask[i] = ones[i] | zeros[i];
+		cs->value[i] = ones[i];
+	}
+	g_free(ones);
+
+	if (unitsize <= 8) {
+		memcpy(&cs->mask64, cs->mask, unitsize);
+		memcpy(&cs->value64, cs->value, unitsize);
+		memcpy(&cs->edges64, cs->edges, unitsize);
+	}
+}
+
 SR_PRIV struct soft_trigger_logic *soft_trigger_logic_new(
 		const struct sr_dev_inst *sdi, struct sr_trigger *trigger,
 		int pre_trigger_samples)
 {
 	struct soft_trigger_logic *stl;
+	struct sr_channel *ch;
+	GSList *l;
+	int num_logic_channels, i;
+
+	/* Samples only hold the logic channels. */
+	num_logic_channels = 0;
+	for (l = sdi->channels; l; l = l->next) {
+		ch = l->data;
+		if (ch->type == SR_CHANNEL_LOGIC)
+			num_logic_channels++;
+	}
 
 	stl = g_malloc0(sizeof(struct soft_trigger_logic));
 	stl->sdi = sdi;
 	stl->trigger = trigger;
-	stl->unitsize = (g_slist_length(sdi->channels) + 7) / 8;
+	stl->unitsize = (num_logic_channels + 7) / 8;
 	stl->prev_sample = g_malloc0(stl->unitsize);
 	stl->pre_trigger_size = stl->unitsize * pre_trigger_samples;
 	stl->pre_trigger_buffer = g_malloc(stl->pre_trigger_size);
@@ -45,11 +138,27 @@ SR_PRIV struct soft_trigger_logic *soft_trigger_logic_new(
 		return NULL;
 	}
 
+	stl->num_stages = g_slist_length(trigger->stages);
+	stl->stages = g_malloc0(stl->num_stages * sizeof(*stl->stages));
+	for (l = trigger->stages, i = 0; l; l = l->next, i++) {
+		stage_compile(&stl->stages[i], l->data, stl->unitsize);
+		if (stl->stages[i].empty)
+			stl->invalid = TRUE;
+	}
+	stl->state_words = (stl->num_stages + 63) / 64;
+	stl->state = g_malloc0(stl->state_words * sizeof(*stl->state));
+
 	return stl;
 }
 
 SR_PRIV void soft_trigger_logic_free(struct soft_trigger_logic *stl)
 {
+	int i;
+
+	for (i = 0; i < stl->num_stages; i++)
+		g_free(stl->stages[i].mask);
+	g_free(stl->stages);
+	g_free(stl->state);
 	g_free(stl->pre_trigger_buffer);
 	g_free(stl->prev_sample);
 	g_free(stl);
@@ -113,109 +222,289 @@ static void pre_trigger_send(struct soft_trigger_logic *stl,
 	}
 }
 
-static gboolean logic_check_match(struct soft_trigger_logic *stl,
-		uint8_t *sample, struct sr_trigger_match *match)
+
+static inline uint64_t sample_load(const uint8_t *sample, int unitsize)
+{
+	uint64_t word;
+
+	/* Masks are loaded the same way, so byte order doesn't matter. */
+	word = 0;
+	memcpy(&word, sample, unitsize);
+
+	return word;
+}
+
+static inline gboolean stage_match_word(const struct soft_trigger_stage *cs,
+		uint64_t sample, uint64_t prev)
 {
-	int bit, prev_bit;
-	gboolean result;
+	return ((sample ^ cs->value64) & cs->mask64) == 0
+			&& ((sample ^ prev) & cs->edges64) == cs->edges64;
+}
+
+static gboolean stage_match(const struct soft_trigger_logic *stl,
+		const struct soft_trigger_stage *cs,
+		const uint8_t *sample, const uint8_t *prev)
+{
+	int i;
 
-	stl->count++;
-	result = FALSE;
-	bit = *(sample + match->channel->index / 8)
-			& (1 << (match->channel->index % 8));
-	if (match->match == SR_TRIGGER_ZERO)
-		result = bit == 0;
-	else if (match->match == SR_TRIGGER_ONE)
-		result = bit != 0;
-	else {
-		/* Edge matches. */
-		if (stl->count == 1)
-			/* First sample, don't have enough for an edge match yet. */
+	if (stl->unitsize <= 8)
+		return stage_match_word(cs, sample_load(sample, stl->unitsize),
+				sample_load(prev, stl->unitsize));
+
+	for (i = 0; i < stl->unitsize; i++) {
+		if ((sample[i] ^ cs->value[i]) & cs->mask[i])
+			return FALSE;
+		if (((sample[i] ^ prev[i]) & cs->edges[i]) != cs->edges[i])
 			return FALSE;
-		prev_bit = *(stl->prev_sample + match->channel->index / 8)
-				& (1 << (match->channel->index % 8));
-		if (match->match == SR_TRIGGER_RISING)
-			result = prev_bit == 0 && bit != 0;
-		else if (match->match == SR_TRIGGER_FALLING)
-			result = prev_bit != 0 && bit == 0;
-		else if (match->match == SR_TRIGGER_EDGE)
-			result = prev_bit != bit;
 	}
 
-	return result;
+	return TRUE;
+}
+
+/*
+ * Check one sample against a stage. There is no previous sample to
+ * compare against for the very first sample, so edge matches can't fire
+ * there.
+ */
+static gboolean stage_check(const struct soft_trigger_logic *stl,
+		const struct soft_trigger_stage *cs,
+		const uint8_t *sample, const uint8_t *prev, gboolean first)
+{
+	if (cs->num_matches == 0)
+		return TRUE;
+
+	if (cs->never || (first && cs->has_edges))
+		return FALSE;
+
+	return stage_match(stl, cs, sample, prev);
+}
+
+#ifdef __SSE2__
+static int stage_scan_sse2_u8(const struct soft_trigger_stage *cs,
+		const uint8_t *buf, int i, int len)
+{
+	__m128i mask, value, edges, zero, s, p, lvl, edg;
+	int bits;
+
+	mask = _mm_set1_epi8(cs->mask[0]);
+	value = _mm_set1_epi8(cs->value[0]);
+	edges = _mm_set1_epi8(cs->edges[0]);
+	zero = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		s = _mm_loadu_si128((const __m128i *)(buf + i));
+		p = _mm_loadu_si128((const __m128i *)(buf + i - 1));
+		lvl = _mm_cmpeq_epi8(_mm_and_si128(_mm_xor_si128(s, value),
+				mask), zero);
+		edg = _mm_cmpeq_epi8(_mm_and_si128(_mm_xor_si128(s, p),
+				edges), edges);
+		bits = _mm_movemask_epi8(_mm_and_si128(lvl, edg));
+		if (bits)
+			return i + g_bit_nth_lsf(bits, -1);
+	}
+
+	return i;
+}
+
+static int stage_scan_sse2_u16(const struct soft_trigger_stage *cs,
+		const uint8_t *buf, int i, int len)
+{
+	__m128i mask, value, edges, zero, s, p, lvl, edg;
+	uint16_t m, v, e;
+	int bits;
+
+	memcpy(&m, cs->mask, 2);
+	memcpy(&v, cs->value, 2);
+	memcpy(&e, cs->edges, 2);
+	mask = _mm_set1_epi16(m);
+	value = _mm_set1_epi16(v);
+	edges = _mm_set1_epi16(e);
+	zero = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		s = _mm_loadu_si128((const __m128i *)(buf + i));
+		p = _mm_loadu_si128((const __m128i *)(buf + i - 2));
+		lvl = _mm_cmpeq_epi16(_mm_and_si128(_mm_xor_si128(s, value),
+				mask), zero);
+		edg = _mm_cmpeq_epi16(_mm_and_si128(_mm_xor_si128(s, p),
+				edges), edges);
+		bits = _mm_movemask_epi8(_mm_and_si128(lvl, edg));
+		if (bits)
+			/* Two mask bits per 16-bit sample. */
+			return i + (g_bit_nth_lsf(bits, -1) & ~1);
+	}
+
+	return i;
 }
+#endif
 
-/* Returns the offset (in samples) within buf of where the trigger
- * occurred, or -1 if not triggered. */
+/*
+ * Find the first sample at or after byte offset i (i > 0) which matches
+ * the stage, comparing each sample to the one before it in buf. Returns
+ * its byte offset, or len if there is none.
+ */
+static int stage_scan(const struct soft_trigger_logic *stl,
+		const struct soft_trigger_stage *cs,
+		const uint8_t *buf, int i, int len)
+{
+	uint64_t sample, prev;
+	int unitsize;
+
+	unitsize = stl->unitsize;
+	if (cs->num_matches == 0)
+		return i < len ? i : len;
+	if (cs->never)
+		return len;
+
+#ifdef __SSE2__
+	/* Bulk of the buffer, a vector at a time. */
+	if (unitsize == 1)
+		i = stage_scan_sse2_u8(cs, buf, i, len);
+	else if (unitsize == 2)
+		i = stage_scan_sse2_u16(cs, buf, i, len);
+#endif
+
+	if (unitsize <= 8) {
+		prev = sample_load(buf + i - unitsize, unitsize);
+		for (; i + unitsize <= len; i += unitsize) {
+			sample = sample_load(buf + i, unitsize);
+			if (stage_match_word(cs, sample, prev))
+				return i;
+			prev = sample;
+		}
+		return len;
+	}
+
+	for (; i + unitsize <= len; i += unitsize) {
+		if (stage_match(stl, cs, buf + i, buf + i - unitsize))
+			return i;
+	}
+
+	return len;
+}
+
+static inline int lowest_bit(uint64_t v)
+{
+	uint32_t lo;
+
+	lo = (uint32_t)v;
+	if (lo)
+		return g_bit_nth_lsf(lo, -1);
+
+	return 32 + g_bit_nth_lsf((uint32_t)(v >> 32), -1);
+}
+
+/*
+ * Advance the stage automaton by one sample. Bit j of the state is set if
+ * the last j + 1 samples matched stages 0..j in order. A stage can only
+ * match if the stage before it matched on the previous sample, so only
+ * those are evaluated. Returns TRUE if the last stage matched.
+ */
+static gboolean trigger_step(struct soft_trigger_logic *stl,
+		const uint8_t *sample, const uint8_t *prev, gboolean first)
+{
+	uint64_t cur, next, carry, matched;
+	int w, bit, stage, last;
+
+	carry = 1;
+	for (w = 0; w < stl->state_words; w++) {
+		cur = stl->state[w];
+		next = (cur << 1) | carry;
+		carry = cur >> 63;
+		matched = 0;
+		while (next) {
+			bit = lowest_bit(next);
+			next &= next - 1;
+			stage = w * 64 + bit;
+			if (stage >= stl->num_stages)
+				break;
+			if (stage_check(stl, &stl->stages[stage], sample, prev, first))
+				matched |= (uint64_t)1 << bit;
+		}
+		stl->state[w] = matched;
+	}
+
+	last = stl->num_stages - 1;
+
+	return (stl->state[last / 64] >> (last % 64)) & 1;
+}
+
+static gboolean trigger_idle(const struct soft_trigger_logic *stl)
+{
+	int w;
+
+	for (w = 0; w < stl->state_words; w++) {
+		if (stl->state[w])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int trigger_fire(struct soft_trigger_logic *stl,
+		uint8_t *buf, int i, int *pre_trigger_samples)
+{
+	struct sr_datafeed_packet packet;
+
+	/* Matched on last stage, send pre-trigger data. */
+	pre_trigger_append(stl, buf, i);
+	pre_trigger_send(stl, pre_trigger_samples);
+
+	/* Fire trigger. */
+	packet.type = SR_DF_TRIGGER;
+	packet.payload = NULL;
+	sr_session_send(stl->sdi, &packet);
+
+	memset(stl->state, 0, stl->state_words * sizeof(*stl->state));
+
+	return i / stl->unitsize;
+}
+
+/*
+ * Returns the offset (in samples) within buf of where the trigger
+ * occurred, or -1 if not triggered.
+ *
+ * Every sample is looked at once, and partial matches carry over into
+ * the next call, so a stage sequence may span several buffers. While no
+ * stage sequence is in progress, the buffer is scanned for the first
+ * stage in bulk.
+ */
 SR_PRIV int soft_trigger_logic_check(struct soft_trigger_logic *stl,
 		uint8_t *buf, int len, int *pre_trigger_samples)
 {
-	struct sr_datafeed_packet packet;
-	struct sr_trigger_stage *stage;
-	struct sr_trigger_match *match;
-	GSList *l, *l_stage;
-	int offset;
-	int i;
-	gboolean match_found;
-
-	offset = -1;
-	for (i = 0; i < len; i += stl->unitsize) {
-		l_stage = g_slist_nth(stl->trigger->stages, stl->cur_stage);
-		stage = l_stage->data;
-		if (!stage->matches)
-			/* No matches supplied, client error. */
-			return SR_ERR_ARG;
-
-		match_found = TRUE;
-		for (l = stage->matches; l; l = l->next) {
-			match = l->data;
-			if (!match->channel->enabled)
-				/* Ignore disabled channels with a trigger. */
-				continue;
-			if (!logic_check_match(stl, buf + i, match)) {
-				match_found = FALSE;
+	const uint8_t *prev;
+	int unitsize, i;
+	gboolean first;
+
+	if (stl->num_stages == 0 || stl->invalid)
+		/* No matches supplied, client error. */
+		return SR_ERR_ARG;
+
+	unitsize = stl->unitsize;
+	prev = stl->prev_sample;
+	first = !stl->have_prev;
+	for (i = 0; i + unitsize <= len; i += unitsize) {
+		if (i > 0 && trigger_idle(stl)) {
+			i = stage_scan(stl, &stl->stages[0], buf, i, len);
+			if (i + unitsize > len)
 				break;
-			}
+			prev = buf + i - unitsize;
 		}
-		memcpy(stl->prev_sample, buf + i, stl->unitsize);
-		if (match_found) {
-			/* Matched on the current stage. */
-			if (l_stage->next) {
-				/* Advance to next stage. */
-				stl->cur_stage++;
-			} else {
-				/* Matched on last stage, send pre-trigger data. */
-				pre_trigger_append(stl, buf, i);
-				pre_trigger_send(stl, pre_trigger_samples);
-
-				/* Fire trigger. */
-				offset = i / stl->unitsize;
-
-				packet.type = SR_DF_TRIGGER;
-				packet.payload = NULL;
-				sr_session_send(stl->sdi, &packet);
-				break;
-			}
-		} else if (stl->cur_stage > 0) {
-			/*
-			 * We had a match at an earlier stage, but failed on the
-			 * current stage. However, we may have a match on this
-			 * stage in the next bit -- trigger on 0001 will fail on
-			 * seeing 00001, so we need to go back to stage 0 -- but
-			 * at the next sample from the one that matched originally,
-			 * which the counter increment at the end of the loop
-			 * takes care of.
-			 */
-			i -= stl->cur_stage * stl->unitsize;
-			if (i < -1)
-				i = -1; /* Oops, went back past this buffer. */
-			/* Reset trigger stage. */
-			stl->cur_stage = 0;
+		if (trigger_step(stl, buf + i, prev, first)) {
+			memcpy(stl->prev_sample, buf + i, unitsize);
+			stl->have_prev = TRUE;
+			return trigger_fire(stl, buf, i, pre_trigger_samples);
 		}
+		prev = buf + i;
+		first = FALSE;
 	}
 
-	if (offset == -1)
-		pre_trigger_append(stl, buf, len);
+	if (len >= unitsize) {
+		memcpy(stl->prev_sample, buf + (len / unitsize - 1) * unitsize,
+				unitsize);
+		stl->have_prev = TRUE;
+	}
+	pre_trigger_append(stl, buf, len);
 
-	return offset;
+	return -1;
 }
@@ -0,0 +1,488 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reduces the data to a summary per bucket of N samples, for displays
+ * which can't show more detail than that anyway.
+ *
+ * Every bucket becomes two samples, see SR_CONF_BUCKET_SIZE.
+ *
+ * Analog: the minimum and maximum of each channel. If the "mean" option
+ * is set, every such packet is preceded by one holding the mean of each
+ * bucket twice, so both have the same samplerate.
+ *
+ * Logic: the value of the bucket's last sample followed by a mask of the
+ * channels which toggled since the previous bucket's last sample. So a
+ * pulse shorter than a bucket isn't lost.
+ *
+ * N is the "factor" option, or derived from the "rate" option, the
+ * number of buckets per second wanted, once the samplerate is known.
+ * Samplerate meta packets are rewritten to the rate of the output
+ * samples, with SR_CONF_BUCKET_SIZE holding N. A partial bucket at the
+ * end of the acquisition is dropped.
+ */
+
+#include <string.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+#define LOG_PREFIX "transform/decimate"
+
+#define DEFAULT_FACTOR 1000
+
+/* Output samples per bucket. */
+#define BUCKET_SAMPLES 2
+
+struct analog_bucket {
+	float min;
+	float max;
+	double sum;
+	uint64_t fill;
+};
+
+struct context {
+	uint64_t factor;
+	uint64_t rate;
+	gboolean mean;
+	uint64_t samplerate;
+	/* Samples per bucket in use. */
+	uint64_t n;
+
+	/* Logic bucket. */
+	unsigned int unitsize;
+	uint64_t logic_fill;
+	gboolean have_prev;
+	uint8_t *prev;
+	uint8_t *toggled;
+
+	/* Analog buckets, by channel index. */
+	struct analog_bucket *buckets;
+	int num_buckets;
+
+	/* Output packet. */
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_analog analog;
+	struct sr_datafeed_meta meta;
+	struct sr_config samplerate_src;
+	struct sr_config bucket_src;
+};
+
+static void reset_buckets(struct context *ctx)
+{
+	int i;
+
+	ctx->logic_fill = 0;
+	ctx->have_prev = FALSE;
+	if (ctx->toggled)
+		memset(ctx->toggled, 0, ctx->unitsize);
+	for (i = 0; i < ctx->num_buckets; i++)
+		ctx->buckets[i].fill = 0;
+}
+
+static void update_factor(struct context *ctx)
+{
+	uint64_t n;
+
+	n = ctx->factor;
+	if (ctx->rate && ctx->samplerate)
+		n = ctx->samplerate / ctx->rate;
+	n = MAX(n, 1);
+	if (n != ctx->n) {
+		sr_dbg("Decimating by %" PRIu64 ".", n);
+		ctx->n = n;
+		reset_buckets(ctx);
+	}
+}
+
+static int init(struct sr_transform *t, GHashTable *options)
+{
+	struct context *ctx;
+	struct sr_channel *ch;
+	GVariant *gvar;
+	GSList *l;
+
+	if (!t || !t->sdi || !options)
+		return SR_ERR_ARG;
+
+	t->priv = ctx = g_malloc0(sizeof(struct context));
+
+	ctx->factor = g_variant_get_uint64(g_hash_table_lookup(options, "factor"));
+	ctx->rate = g_variant_get_uint64(g_hash_table_lookup(options, "rate"));
+	ctx->mean = g_variant_get_boolean(g_hash_table_lookup(options, "mean"));
+
+	if (sr_config_get(t->sdi->driver, t->sdi, NULL, SR_CONF_SAMPLERATE,
+			&gvar) == SR_OK) {
+		ctx->samplerate = g_variant_get_uint64(gvar);
+		g_variant_unref(gvar);
+	}
+
+	for (l = t->sdi->channels; l; l = l->next) {
+		ch = l->data;
+		ctx->num_buckets = MAX(ctx->num_buckets, ch->index + 1);
+	}
+	ctx->buckets = g_malloc0(sizeof(struct analog_bucket) * ctx->num_buckets);
+
+	ctx->samplerate_src.key = SR_CONF_SAMPLERATE;
+	ctx->bucket_src.key = SR_CONF_BUCKET_SIZE;
+
+	update_factor(ctx);
+
+	return SR_OK;
+}
+
+/*
+ * OR the bits which differ between consecutive samples into toggled,
+ * starting with prev and the first sample. Then make the last sample
+ * the new prev.
+ */
+static void find_toggles(uint8_t *toggled, uint8_t *prev,
+		const uint8_t *data, uint64_t count, unsigned int unitsize)
+{
+	uint64_t i, len, w, a, b;
+	unsigned int j;
+
+	for (j = 0; j < unitsize; j++)
+		toggled[j] |= prev[j] ^ data[j];
+
+	len = count * unitsize;
+	i = unitsize;
+	if (8 % unitsize == 0) {
+		/* Byte k of a word always belongs to byte k % unitsize. */
+		w = 0;
+		for (; i + 8 <= len; i += 8) {
+			memcpy(&a, data + i, 8);
+			memcpy(&b, data + i - unitsize, 8);
+			w |= a ^ b;
+		}
+		for (j = 0; j < 8; j++)
+			toggled[j % unitsize] |= ((uint8_t *)&w)[j];
+	}
+	for (; i < len; i++)
+		toggled[i % unitsize] |= data[i] ^ data[i - unitsize];
+
+	memcpy(prev, data + len - unitsize, unitsize);
+}
+
+static int decimate_logic(const struct sr_transform *t,
+		const struct sr_datafeed_logic *logic,
+		struct sr_datafeed_packet **packet_out)
+{
+	struct context *ctx;
+	const uint8_t *data;
+	uint8_t *out;
+	uint64_t count, num_out, i, n;
+	unsigned int unitsize;
+
+	ctx = t->priv;
+	unitsize = logic->unitsize;
+	if (!unitsize)
+		return SR_ERR_ARG;
+	if (unitsize != ctx->unitsize) {
+		ctx->unitsize = unitsize;
+		ctx->prev = g_realloc(ctx->prev, unitsize);
+		ctx->toggled = g_realloc(ctx->toggled, unitsize);
+		reset_buckets(ctx);
+	}
+
+	data = logic->data;
+	count = logic->length / unitsize;
+	if (count == 0) {
+		*packet_out = NULL;
+		return SR_OK;
+	}
+	if (!ctx->have_prev) {
+		memcpy(ctx->prev, data, unitsize);
+		ctx->have_prev = TRUE;
+	}
+
+	num_out = (ctx->logic_fill + count) / ctx->n;
+	out = NULL;
+	if (num_out)
+		out = sr_transform_buffer_get(t,
+				num_out * BUCKET_SAMPLES * unitsize);
+	ctx->logic.length = num_out * BUCKET_SAMPLES * unitsize;
+	ctx->logic.unitsize = unitsize;
+	ctx->logic.data = out;
+
+	for (i = 0; i < count; i += n) {
+		n = MIN(ctx->n - ctx->logic_fill, count - i);
+		find_toggles(ctx->toggled, ctx->prev, data + i * unitsize, n,
+				unitsize);
+		ctx->logic_fill += n;
+		if (ctx->logic_fill == ctx->n) {
+			memcpy(out, ctx->prev, unitsize);
+			memcpy(out + unitsize, ctx->toggled, unitsize);
+			out += BUCKET_SAMPLES * unitsize;
+			memset(ctx->toggled, 0, unitsize);
+			ctx->logic_fill = 0;
+		}
+	}
+
+	ctx->packet.type = SR_DF_LOGIC;
+	ctx->packet.payload = &ctx->logic;
+	*packet_out = num_out ? &ctx->packet : NULL;
+
+	return SR_OK;
+}
+
+static int decimate_analog(const struct sr_transform *t,
+		const struct sr_datafeed_analog *analog,
+		struct sr_datafeed_packet **packet_out)
+{
+	struct context *ctx;
+	struct analog_bucket *bucket;
+	struct sr_channel *ch;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog mean_analog;
+	struct sr_buffer *mean_buf;
+	GSList *l;
+	const float *data;
+	float *out, *mean, v, min, max;
+	double sum;
+	uint64_t num_out, count, i, j, n, o, size;
+	int num_channels, c, ret;
+
+	ctx = t->priv;
+	if (analog->num_samples < 0)
+		return SR_ERR_ARG;
+	num_channels = g_slist_length(analog->channels);
+	count = analog->num_samples;
+
+	/* All channels in a packet need to complete their buckets together. */
+	num_out = 0;
+	for (l = analog->channels, c = 0; l; l = l->next, c++) {
+		ch = l->data;
+		if (ch->index < 0)
+			return SR_ERR_ARG;
+		if (ch->index >= ctx->num_buckets) {
+			/* Input modules can add channels once data arrives. */
+			ctx->buckets = g_realloc(ctx->buckets,
+					sizeof(struct analog_bucket) * (ch->index + 1));
+			memset(ctx->buckets + ctx->num_buckets, 0,
+					sizeof(struct analog_bucket)
+					* (ch->index + 1 - ctx->num_buckets));
+			ctx->num_buckets = ch->index + 1;
+		}
+		bucket = &ctx->buckets[ch->index];
+		if (c == 0)
+			num_out = (bucket->fill + count) / ctx->n;
+		else if ((bucket->fill + count) / ctx->n != num_out) {
+			sr_err("Channel %s is out of step with the others.",
+					ch->name);
+			return SR_ERR;
+		}
+	}
+
+	out = mean = NULL;
+	mean_buf = NULL;
+	size = num_out * BUCKET_SAMPLES * num_channels * sizeof(float);
+	if (num_out)
+		out = sr_transform_buffer_get(t, size);
+	if (num_out && ctx->mean) {
+		mean_buf = sr_session_buffer_get(t->sdi->session, size);
+		mean = (float *)mean_buf->data;
+	}
+
+	data = analog->data;
+	for (l = analog->channels, c = 0; l; l = l->next, c++) {
+		ch = l->data;
+		bucket = &ctx->buckets[ch->index];
+		o = c;
+		for (i = 0; i < count; i += n) {
+			n = MIN(ctx->n - bucket->fill, count - i);
+			if (bucket->fill == 0) {
+				bucket->min = bucket->max = data[i * num_channels + c];
+				bucket->sum = 0;
+			}
+			min = bucket->min;
+			max = bucket->max;
+			sum = bucket->sum;
+			for (j = i; j < i + n; j++) {
+				v = data[j * num_channels + c];
+				if (v < min)
+					min = v;
+				if (v > max)
+					max = v;
+				sum += v;
+			}
+			bucket->min = min;
+			bucket->max = max;
+			bucket->sum = sum;
+			bucket->fill += n;
+			if (bucket->fill == ctx->n) {
+				out[o] = min;
+				out[o + num_channels] = max;
+				if (mean)
+					mean[o] = mean[o + num_channels] = sum / ctx->n;
+				o += BUCKET_SAMPLES * num_channels;
+				bucket->fill = 0;
+			}
+		}
+	}
+
+	if (mean) {
+		mean_analog = *analog;
+		mean_analog.num_samples = num_out * BUCKET_SAMPLES;
+		mean_analog.mqflags |= SR_MQFLAG_AVG;
+		mean_analog.data = mean;
+		packet.type = SR_DF_ANALOG;
+		packet.payload = &mean_analog;
+		ret = sr_transform_send(t, &packet);
+		sr_buffer_unref(mean_buf);
+		if (ret != SR_OK)
+			return ret;
+	}
+
+	ctx->analog = *analog;
+	ctx->analog.num_samples = num_out * BUCKET_SAMPLES;
+	ctx->analog.mqflags |= SR_MQFLAG_MIN | SR_MQFLAG_MAX;
+	ctx->analog.data = out;
+	ctx->packet.type = SR_DF_ANALOG;
+	ctx->packet.payload = &ctx->analog;
+	*packet_out = num_out ? &ctx->packet : NULL;
+
+	return SR_OK;
+}
+
+/* Pass the meta packet on with the samplerate of the buckets' samples. */
+static void decimate_meta(const struct sr_transform *t,
+		struct sr_datafeed_packet *packet_in,
+		struct sr_datafeed_packet **packet_out)
+{
+	struct context *ctx;
+	const struct sr_datafeed_meta *meta;
+	struct sr_config *src;
+	GSList *l;
+
+	ctx = t->priv;
+	meta = packet_in->payload;
+	*packet_out = packet_in;
+
+	for (l = meta->config; l; l = l->next) {
+		src = l->data;
+		if (src->key == SR_CONF_SAMPLERATE)
+			break;
+	}
+	if (!l)
+		return;
+
+	ctx->samplerate = g_variant_get_uint64(src->data);
+	update_factor(ctx);
+
+	if (ctx->samplerate_src.data)
+		g_variant_unref(ctx->samplerate_src.data);
+	ctx->samplerate_src.data = g_variant_ref_sink(g_variant_new_uint64(
+			ctx->samplerate * BUCKET_SAMPLES / ctx->n));
+	if (ctx->bucket_src.data)
+		g_variant_unref(ctx->bucket_src.data);
+	ctx->bucket_src.data = g_variant_ref_sink(g_variant_new_uint64(ctx->n));
+
+	g_slist_free(ctx->meta.config);
+	ctx->meta.config = NULL;
+	for (l = meta->config; l; l = l->next) {
+		src = l->data;
+		if (src->key == SR_CONF_SAMPLERATE)
+			src = &ctx->samplerate_src;
+		ctx->meta.config = g_slist_append(ctx->meta.config, src);
+	}
+	ctx->meta.config = g_slist_append(ctx->meta.config, &ctx->bucket_src);
+
+	ctx->packet.type = SR_DF_META;
+	ctx->packet.payload = &ctx->meta;
+	*packet_out = &ctx->packet;
+}
+
+static int receive(const struct sr_transform *t,
+		struct sr_datafeed_packet *packet_in,
+		struct sr_datafeed_packet **packet_out)
+{
+	struct context *ctx;
+
+	if (!t || !t->sdi || !packet_in || !packet_out)
+		return SR_ERR_ARG;
+	ctx = t->priv;
+
+	*packet_out = packet_in;
+
+	switch (packet_in->type) {
+	case SR_DF_HEADER:
+		reset_buckets(ctx);
+		break;
+	case SR_DF_META:
+		decimate_meta(t, packet_in, packet_out);
+		break;
+	case SR_DF_LOGIC:
+		return decimate_logic(t, packet_in->payload, packet_out);
+	case SR_DF_ANALOG:
+		return decimate_analog(t, packet_in->payload, packet_out);
+	default:
+		break;
+	}
+
+	return SR_OK;
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	if (!t || !t->sdi)
+		return SR_ERR_ARG;
+	ctx = t->priv;
+
+	g_free(ctx->prev);
+	g_free(ctx->toggled);
+	g_free(ctx->buckets);
+	g_slist_free(ctx->meta.config);
+	if (ctx->samplerate_src.data)
+		g_variant_unref(ctx->samplerate_src.data);
+	if (ctx->bucket_src.data)
+		g_variant_unref(ctx->bucket_src.data);
+	g_free(ctx);
+	t->priv = NULL;
+
+	return SR_OK;
+}
+
+static struct sr_option options[] = {
+	{ "factor", "Factor", "Number of samples per bucket", NULL, NULL },
+	{ "rate", "Rate", "Number of buckets per second, instead of a factor", NULL, NULL },
+	{ "mean", "Mean", "Also send the mean of every analog bucket", NULL, NULL },
+	ALL_ZERO
+};
+
+static const struct sr_option *get_options(void)
+{
+	if (!options[0].def) {
+		options[0].def = g_variant_ref_sink(g_variant_new_uint64(DEFAULT_FACTOR));
+		options[1].def = g_variant_ref_sink(g_variant_new_uint64(0));
+		options[2].def = g_variant_ref_sink(g_variant_new_boolean(FALSE));
+	}
+
+	return options;
+}
+
+SR_PRIV struct sr_transform_module transform_decimate = {
+	.id = "decimate",
+	.name = "Decimate",
+	.desc = "Reduce data to its minimum/maximum per number of samples",
+	.options = get_options,
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -17,61 +17,152 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
-
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
 #define LOG_PREFIX "transform/invert"
 
+struct context {
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_analog analog;
+};
+
+static int init(struct sr_transform *t, GHashTable *options)
+{
+	(void)options;
+
+	if (!t || !t->sdi)
+		return SR_ERR_ARG;
+
+	t->priv = g_malloc0(sizeof(struct context));
+
+	return SR_OK;
+}
+
+/* Invert every bit in count bytes. dst may be the same as src. */
+static void invert_bytes(uint8_t *dst, const uint8_t *src, uint64_t count)
+{
+	uint64_t i, w;
+#ifdef __SSE2__
+	__m128i ones;
+#endif
+
+	i = 0;
+#ifdef __SSE2__
+	ones = _mm_set1_epi8(-1);
+	for (; i + 16 <= count; i += 16)
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(ones,
+			_mm_loadu_si128((const __m128i *)(src + i))));
+#endif
+	for (; i + 8 <= count; i += 8) {
+		memcpy(&w, src + i, 8);
+		w = ~w;
+		memcpy(dst + i, &w, 8);
+	}
+	for (; i < count; i++)
+		dst[i] = ~src[i];
+}
+
+/* Replace count values by their reciprocal. dst may be the same as src. */
+static void invert_floats(float *dst, const float *src, uint64_t count)
+{
+	uint64_t i;
+#ifdef __SSE2__
+	__m128d one;
+	__m128 v;
+#endif
+
+	i = 0;
+#ifdef __SSE2__
+	/* Divide in double precision, like the scalar code does. */
+	one = _mm_set1_pd(1.0);
+	for (; i + 4 <= count; i += 4) {
+		v = _mm_loadu_ps(src + i);
+		v = _mm_movelh_ps(
+			_mm_cvtpd_ps(_mm_div_pd(one, _mm_cvtps_pd(v))),
+			_mm_cvtpd_ps(_mm_div_pd(one, _mm_cvtps_pd(
+				_mm_movehl_ps(v, v)))));
+		_mm_storeu_ps(dst + i, v);
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = 1.0 / src[i];
+}
+
 static int receive(const struct sr_transform *t,
 		struct sr_datafeed_packet *packet_in,
 		struct sr_datafeed_packet **packet_out)
 {
+	struct context *ctx;
 	const struct sr_datafeed_logic *logic;
 	const struct sr_datafeed_analog *analog;
-	struct sr_channel *ch;
-	GSList *l;
-	float *fdata, *f;
-	int si, num_channels, c;
-	uint8_t *b;
-	uint64_t i, j;
+	uint8_t *data;
+	float *fdata;
+	uint64_t len, count;
 
 	if (!t || !t->sdi || !packet_in || !packet_out)
 		return SR_ERR_ARG;
+	ctx = t->priv;
+
+	/* Return the in-place-modified packet, unless that's not allowed. */
+	*packet_out = packet_in;
 
 	switch (packet_in->type) {
 	case SR_DF_LOGIC:
 		logic = packet_in->payload;
-		for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-			for (j = 0; j < logic->unitsize; j++) {
-				/* For now invert every bit in every byte. */
-				b = (uint8_t *)logic->data + i + logic->unitsize - 1 - j;
-				*b = ~(*b);
-			}
+		/* For now invert every bit in every whole sample. */
+		len = 0;
+		if (logic->unitsize)
+			len = logic->length - logic->length % logic->unitsize;
+		data = logic->data;
+		if (!t->packet_in_writable) {
+			ctx->logic = *logic;
+			ctx->logic.data = data = sr_transform_buffer_get(t,
+					logic->length);
+			memcpy(data + len, (uint8_t *)logic->data + len,
+					logic->length - len);
+			ctx->packet.type = SR_DF_LOGIC;
+			ctx->packet.payload = &ctx->logic;
+			*packet_out = &ctx->packet;
 		}
+		invert_bytes(data, logic->data, len);
 		break;
 	case SR_DF_ANALOG:
 		analog = packet_in->payload;
-		fdata = (float *)analog->data;
-		num_channels = g_slist_length(analog->channels);
-		for (si = 0; si < analog->num_samples; si++) {
-			/* For now invert all values in all channels. */
-			for (l = analog->channels, c = 0; l; l = l->next, c++) {
-				ch = l->data;
-				(void)ch;
-				f = &fdata[si * num_channels + c];
-				*f = 1.0 / *f;
-			}
+		/* For now invert all values in all channels. */
+		count = (uint64_t)analog->num_samples
+				* g_slist_length(analog->channels);
+		fdata = analog->data;
+		if (!t->packet_in_writable) {
+			ctx->analog = *analog;
+			ctx->analog.data = fdata = sr_transform_buffer_get(t,
+					count * sizeof(float));
+			ctx->packet.type = SR_DF_ANALOG;
+			ctx->packet.payload = &ctx->analog;
+			*packet_out = &ctx->packet;
 		}
+		invert_floats(fdata, analog->data, count);
 		break;
 	default:
 		sr_spew("Unsupported packet type %d, ignoring.", packet_in->type);
 		break;
 	}
 
-	/* Return the in-place-modified packet. */
-	*packet_out = packet_in;
+	return SR_OK;
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	if (!t || !t->sdi)
+		return SR_ERR_ARG;
+
+	g_free(t->priv);
+	t->priv = NULL;
 
 	return SR_OK;
 }
@@ -81,7 +172,7 @@ SR_PRIV struct sr_transform_module transform_invert = {
 	.name = "Invert",
 	.desc = "Invert values",
 	.options = NULL,
-	.init = NULL,
+	.init = init,
 	.receive = receive,
-	.cleanup = NULL,
+	.cleanup = cleanup,
 };
@@ -0,0 +1,271 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Packs logic samples down to the enabled channels. Many devices send
+ * all of their channels no matter how many are enabled, so with 8 out
+ * of 36 channels enabled this makes samples 1 byte instead of 5.
+ *
+ * The enabled channels follow each other from bit 0 up, in order of
+ * their index. Ahead of the first packed samples, a meta packet with
+ * SR_CONF_PACKED_CHANNELS tells the transforms and datafeed callbacks
+ * which channels they are.
+ */
+
+#include <string.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+#define LOG_PREFIX "transform/repack"
+
+struct context {
+	/* The enabled logic channels, by index. */
+	uint64_t mask;
+	unsigned int unitsize;
+	/* Number of sample bytes holding enabled channels. */
+	unsigned int in_bytes;
+	/* Whether the enabled channels are the lowest ones. */
+	gboolean in_order;
+	gboolean announced;
+#ifndef __BMI2__
+	/* The sample bytes holding enabled channels, and their packed bits. */
+	unsigned int num_bytes;
+	unsigned int bytes[8];
+	uint64_t gather[8][256];
+#endif
+
+	/* Output packets. */
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_packet meta_packet;
+	struct sr_datafeed_meta meta;
+	struct sr_config src;
+};
+
+static int init(struct sr_transform *t, GHashTable *options)
+{
+	struct context *ctx;
+	struct sr_channel *ch;
+	GSList *l;
+	uint64_t mask;
+	unsigned int num_channels, max_index;
+#ifndef __BMI2__
+	unsigned int b, i, v, n, pos, bits;
+#endif
+
+	(void)options;
+
+	if (!t || !t->sdi)
+		return SR_ERR_ARG;
+
+	mask = 0;
+	num_channels = max_index = 0;
+	for (l = t->sdi->channels; l; l = l->next) {
+		ch = l->data;
+		if (ch->type != SR_CHANNEL_LOGIC || !ch->enabled)
+			continue;
+		if (ch->index >= 64) {
+			sr_err("Can only pack channels with an index below 64.");
+			return SR_ERR_ARG;
+		}
+		mask |= UINT64_C(1) << ch->index;
+		num_channels++;
+		max_index = MAX(max_index, (unsigned int)ch->index);
+	}
+
+	t->priv = ctx = g_malloc0(sizeof(struct context));
+	ctx->mask = mask;
+	if (!mask)
+		return SR_OK;
+	ctx->unitsize = (num_channels + 7) / 8;
+	ctx->in_bytes = max_index / 8 + 1;
+	ctx->in_order = max_index + 1 == num_channels;
+	sr_dbg("Packing channels 0x%" PRIx64 " into %u bytes.",
+			mask, ctx->unitsize);
+
+#ifndef __BMI2__
+	/* Where each value of a sample byte ends up in the packed sample. */
+	pos = n = 0;
+	for (b = 0; b < ctx->in_bytes; b++) {
+		bits = (mask >> (8 * b)) & 0xff;
+		if (!bits)
+			continue;
+		ctx->bytes[ctx->num_bytes] = b;
+		for (v = 0; v < 256; v++) {
+			n = pos;
+			for (i = 0; i < 8; i++) {
+				if (!(bits & (1 << i)))
+					continue;
+				if (v & (1 << i))
+					ctx->gather[ctx->num_bytes][v] |= UINT64_C(1) << n;
+				n++;
+			}
+		}
+		pos = n;
+		ctx->num_bytes++;
+	}
+#endif
+
+	ctx->src.key = SR_CONF_PACKED_CHANNELS;
+	ctx->src.data = g_variant_ref_sink(g_variant_new_uint64(mask));
+	ctx->meta.config = g_slist_append(NULL, &ctx->src);
+	ctx->meta_packet.type = SR_DF_META;
+	ctx->meta_packet.payload = &ctx->meta;
+
+	return SR_OK;
+}
+
+/*
+ * Gather the enabled channels' bits of count samples. dst may be the
+ * same as src, as the packed samples are never larger.
+ */
+static void pack_samples(const struct context *ctx, uint8_t *dst,
+		const uint8_t *src, uint64_t count, unsigned int unitsize)
+{
+	uint64_t i, v;
+	unsigned int n;
+#ifdef __BMI2__
+	uint64_t wide, mask;
+#else
+	unsigned int k;
+#endif
+
+	n = MIN(ctx->in_bytes, unitsize);
+#ifdef __BMI2__
+	/* Samples which can be read with a whole word. */
+	wide = 0;
+	if (count * unitsize >= 8)
+		wide = (count * unitsize - 8) / unitsize + 1;
+	/* Leave out what a whole word reads of the next samples. */
+	mask = ctx->mask;
+	if (n < 8)
+		mask &= (UINT64_C(1) << (8 * n)) - 1;
+#endif
+	for (i = 0; i < count; i++) {
+#ifdef __BMI2__
+		v = 0;
+		if (i < wide)
+			memcpy(&v, src, 8);
+		else
+			memcpy(&v, src, n);
+		v = _pext_u64(GUINT64_FROM_LE(v), mask);
+#else
+		v = 0;
+		for (k = 0; k < ctx->num_bytes && ctx->bytes[k] < n; k++)
+			v |= ctx->gather[k][src[ctx->bytes[k]]];
+#endif
+		v = GUINT64_TO_LE(v);
+		switch (ctx->unitsize) {
+		case 1:
+			memcpy(dst, &v, 1);
+			break;
+		case 2:
+			memcpy(dst, &v, 2);
+			break;
+		case 4:
+			memcpy(dst, &v, 4);
+			break;
+		default:
+			memcpy(dst, &v, ctx->unitsize);
+		}
+		src += unitsize;
+		dst += ctx->unitsize;
+	}
+}
+
+static int receive(const struct sr_transform *t,
+		struct sr_datafeed_packet *packet_in,
+		struct sr_datafeed_packet **packet_out)
+{
+	struct context *ctx;
+	const struct sr_datafeed_logic *logic;
+	uint64_t count;
+	uint8_t *dst;
+	int ret;
+
+	if (!t || !t->sdi || !packet_in || !packet_out)
+		return SR_ERR_ARG;
+	ctx = t->priv;
+
+	*packet_out = packet_in;
+	if (!ctx->mask)
+		return SR_OK;
+
+	switch (packet_in->type) {
+	case SR_DF_HEADER:
+		ctx->announced = FALSE;
+		break;
+	case SR_DF_LOGIC:
+		logic = packet_in->payload;
+		if (!logic->unitsize)
+			return SR_ERR_ARG;
+		if (!ctx->announced) {
+			if ((ret = sr_transform_send(t, &ctx->meta_packet)) != SR_OK)
+				return ret;
+			ctx->announced = TRUE;
+		}
+		if (ctx->in_order && logic->unitsize == ctx->unitsize)
+			break;
+		count = logic->length / logic->unitsize;
+		if (t->packet_in_writable && logic->unitsize >= ctx->unitsize)
+			dst = logic->data;
+		else
+			dst = sr_transform_buffer_get(t, count * ctx->unitsize);
+		pack_samples(ctx, dst, logic->data, count, logic->unitsize);
+		ctx->logic.length = count * ctx->unitsize;
+		ctx->logic.unitsize = ctx->unitsize;
+		ctx->logic.data = dst;
+		ctx->packet.type = SR_DF_LOGIC;
+		ctx->packet.payload = &ctx->logic;
+		*packet_out = &ctx->packet;
+		break;
+	default:
+		break;
+	}
+
+	return SR_OK;
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	if (!t || !t->sdi)
+		return SR_ERR_ARG;
+	ctx = t->priv;
+
+	g_slist_free(ctx->meta.config);
+	if (ctx->src.data)
+		g_variant_unref(ctx->src.data);
+	g_free(ctx);
+	t->priv = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_transform_module transform_repack = {
+	.id = "repack",
+	.name = "Repack",
+	.desc = "Pack logic samples down to the enabled channels",
+	.options = NULL,
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
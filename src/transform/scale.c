@@ -19,6 +19,9 @@
  */
 
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
@@ -26,6 +29,8 @@
 
 struct context {
 	double factor;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
 };
 
 static int init(struct sr_transform *t, GHashTable *options)
@@ -42,43 +47,71 @@ static int init(struct sr_transform *t, GHashTable *options)
 	return SR_OK;
 }
 
+/* Multiply count values by factor. dst may be the same as src. */
+static void scale_floats(float *dst, const float *src, uint64_t count,
+		double factor)
+{
+	uint64_t i;
+#ifdef __SSE2__
+	__m128d vfactor;
+	__m128 v;
+#endif
+
+	i = 0;
+#ifdef __SSE2__
+	/* Multiply in double precision, like the scalar code does. */
+	vfactor = _mm_set1_pd(factor);
+	for (; i + 4 <= count; i += 4) {
+		v = _mm_loadu_ps(src + i);
+		v = _mm_movelh_ps(
+			_mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(v), vfactor)),
+			_mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(
+				_mm_movehl_ps(v, v)), vfactor)));
+		_mm_storeu_ps(dst + i, v);
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = src[i] * factor;
+}
+
 static int receive(const struct sr_transform *t,
 		struct sr_datafeed_packet *packet_in,
 		struct sr_datafeed_packet **packet_out)
 {
 	struct context *ctx;
 	const struct sr_datafeed_analog *analog;
-	struct sr_channel *ch;
-	GSList *l;
 	float *fdata;
-	int i, num_channels, c;
+	uint64_t count;
 
 	if (!t || !t->sdi || !packet_in || !packet_out)
 		return SR_ERR_ARG;
 	ctx = t->priv;
 
+	/* Return the in-place-modified packet, unless that's not allowed. */
+	*packet_out = packet_in;
+
 	switch (packet_in->type) {
 	case SR_DF_ANALOG:
 		analog = packet_in->payload;
-		fdata = (float *)analog->data;
-		num_channels = g_slist_length(analog->channels);
-		for (i = 0; i < analog->num_samples; i++) {
-			/* For now scale all values in all channels. */
-			for (l = analog->channels, c = 0; l; l = l->next, c++) {
-				ch = l->data;
-				(void)ch;
-				fdata[i * num_channels + c] *= ctx->factor;
-			}
+		/* For now scale all values in all channels. */
+		count = (uint64_t)analog->num_samples
+				* g_slist_length(analog->channels);
+		fdata = analog->data;
+		if (!t->packet_in_writable) {
+			ctx->analog = *analog;
+			ctx->analog.data = fdata = sr_transform_buffer_get(t,
+					count * sizeof(float));
+			ctx->packet.type = SR_DF_ANALOG;
+			ctx->packet.payload = &ctx->analog;
+			*packet_out = &ctx->packet;
 		}
+		scale_floats(fdata, analog->data, count, ctx->factor);
 		break;
 	default:
 		sr_spew("Unsupported packet type %d, ignoring.", packet_in->type);
 		break;
 	}
 
-	/* Return the in-place-modified packet. */
-	*packet_out = packet_in;
-
 	return SR_OK;
 }
 
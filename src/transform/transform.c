@@ -44,12 +44,16 @@
 extern SR_PRIV struct sr_transform_module transform_nop;
 extern SR_PRIV struct sr_transform_module transform_scale;
 extern SR_PRIV struct sr_transform_module transform_invert;
+extern SR_PRIV struct sr_transform_module transform_decimate;
+extern SR_PRIV struct sr_transform_module transform_repack;
 /* @endcond */
 
 static const struct sr_transform_module *transform_module_list[] = {
 	&transform_nop,
 	&transform_scale,
 	&transform_invert,
+	&transform_decimate,
+	&transform_repack,
 	NULL,
 };
 
@@ -207,7 +211,7 @@ SR_API const struct sr_transform *sr_transform_new(const struct sr_transform_mod
 	gpointer key, value;
 	int i;
 
-	t = g_malloc(sizeof(struct sr_transform));
+	t = g_malloc0(sizeof(struct sr_transform));
 	t->module = tmod;
 	t->sdi = sdi;
 
@@ -276,9 +280,43 @@ SR_API int sr_transform_free(const struct sr_transform *t)
 	ret = SR_OK;
 	if (t->module->cleanup)
 		ret = t->module->cleanup((struct sr_transform *)t);
+	sr_buffer_unref(t->buffer);
 	g_free((gpointer)t);
 
 	return ret;
 }
 
+/**
+ * Get memory for the payload data of a transform's output packet.
+ *
+ * Transforms use this when they may not modify the packet they were
+ * passed, see the packet_in_writable field of struct sr_transform. The
+ * memory comes from the session's buffer pool, and is reused by the
+ * next call unless a datafeed callback retained the packet.
+ *
+ * @param t The transform instance. Must not be NULL.
+ * @param size Minimum size of the memory, in bytes.
+ *
+ * @return The memory, valid until the next call, or until the transform
+ *         is freed.
+ *
+ * @private
+ */
+SR_PRIV void *sr_transform_buffer_get(const struct sr_transform *t,
+		gsize size)
+{
+	struct sr_transform *tr;
+
+	tr = (struct sr_transform *)t;
+	if (tr->buffer && (tr->buffer->size < size
+			|| g_atomic_int_get(&tr->buffer->refcount) > 1)) {
+		sr_buffer_unref(tr->buffer);
+		tr->buffer = NULL;
+	}
+	if (!tr->buffer)
+		tr->buffer = sr_session_buffer_get(t->sdi->session, size);
+
+	return tr->buffer->data;
+}
+
 /** @} */
@@ -0,0 +1,614 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput benchmark for the input, output and transform modules.
+ *
+ * Run with "make bench", or as "tests/bench [samples]". No hardware is
+ * needed: the transforms are run on an acquisition from the demo driver,
+ * the input and output modules are fed synthetic logic and analog
+ * streams. The results are written to stdout as JSON.
+ *
+ * A logic sample is one unit of all logic channels, an analog sample is
+ * a single value. The byte counts are those of the data fed into the
+ * module, or for the demo driver and transforms, of the payloads which
+ * reached the datafeed callback. Pool misses are the buffers the session's
+ * pool had to allocate, output strings those returned by output modules.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "../include/libsigrok/libsigrok.h"
+
+#define DEFAULT_SAMPLES (4 * 1024 * 1024)
+#define NUM_LOGIC_CHANNELS 8
+#define NUM_ANALOG_CHANNELS 4
+#define SAMPLERATE SR_MHZ(1)
+#define CHUNK_SIZE (1024 * 1024)
+
+/* The synthetic streams every module is fed. */
+struct streams {
+	uint64_t samples;
+	/* One byte per sample, a single channel changes at a time. */
+	uint8_t *logic;
+	/* NUM_ANALOG_CHANNELS interleaved triangle waves. */
+	float *analog;
+};
+
+struct counter {
+	uint64_t bytes;
+	uint64_t samples;
+	uint64_t packets;
+};
+
+struct result {
+	const char *stage;
+	const char *module;
+	const char *stream;
+	struct counter count;
+	uint64_t pool_misses;
+	uint64_t output_strings;
+	int64_t usecs;
+	int ret;
+};
+
+static gboolean first_result = TRUE;
+
+static void streams_init(struct streams *s, uint64_t samples)
+{
+	GRand *r;
+	uint64_t i;
+	unsigned int j, period;
+	uint8_t value;
+
+	s->samples = samples;
+	s->logic = g_malloc(samples);
+	s->analog = g_malloc(samples * NUM_ANALOG_CHANNELS * sizeof(float));
+
+	r = g_rand_new_with_seed(1);
+	value = 0;
+	for (i = 0; i < samples; i++) {
+		if (g_rand_int_range(r, 0, 8) == 0)
+			value ^= 1 << g_rand_int_range(r, 0, NUM_LOGIC_CHANNELS);
+		s->logic[i] = value;
+	}
+	g_rand_free(r);
+
+	for (i = 0; i < samples; i++) {
+		for (j = 0; j < NUM_ANALOG_CHANNELS; j++) {
+			period = 100 << j;
+			s->analog[i * NUM_ANALOG_CHANNELS + j] =
+				2.0 * abs((int)(i % period) - (int)period / 2)
+				/ (period / 2) - 1.0;
+		}
+	}
+}
+
+static void streams_free(struct streams *s)
+{
+	g_free(s->logic);
+	g_free(s->analog);
+}
+
+static GString *render_raw(const struct streams *s)
+{
+	return g_string_new_len((const char *)s->logic, s->samples);
+}
+
+static GString *render_csv(const struct streams *s)
+{
+	GString *csv;
+	uint64_t i;
+	unsigned int j;
+
+	csv = g_string_sized_new(s->samples * NUM_LOGIC_CHANNELS * 2);
+	for (i = 0; i < s->samples; i++) {
+		for (j = 0; j < NUM_LOGIC_CHANNELS; j++) {
+			g_string_append_c(csv, s->logic[i] & (1 << j) ? '1' : '0');
+			g_string_append_c(csv, j < NUM_LOGIC_CHANNELS - 1 ? ',' : '\n');
+		}
+	}
+
+	return csv;
+}
+
+static GString *render_vcd(const struct streams *s)
+{
+	GString *vcd;
+	uint64_t i;
+	unsigned int j;
+	uint8_t prev;
+
+	vcd = g_string_new("$timescale 1 us $end\n$scope module bench $end\n");
+	for (j = 0; j < NUM_LOGIC_CHANNELS; j++)
+		g_string_append_printf(vcd, "$var wire 1 %c D%u $end\n", '!' + j, j);
+	g_string_append(vcd, "$upscope $end\n$enddefinitions $end\n");
+
+	prev = ~s->logic[0];
+	for (i = 0; i < s->samples; i++) {
+		if (s->logic[i] == prev)
+			continue;
+		g_string_append_printf(vcd, "#%" PRIu64 "\n", i);
+		for (j = 0; j < NUM_LOGIC_CHANNELS; j++) {
+			if (!((s->logic[i] ^ prev) & (1 << j)))
+				continue;
+			g_string_append_c(vcd, s->logic[i] & (1 << j) ? '1' : '0');
+			g_string_append_c(vcd, '!' + j);
+			g_string_append_c(vcd, '\n');
+		}
+		prev = s->logic[i];
+	}
+	g_string_append_printf(vcd, "#%" PRIu64 "\n", s->samples);
+
+	return vcd;
+}
+
+static void append_le16(GString *s, uint16_t v)
+{
+	g_string_append_c(s, v & 0xff);
+	g_string_append_c(s, v >> 8);
+}
+
+static void append_le32(GString *s, uint32_t v)
+{
+	append_le16(s, v & 0xffff);
+	append_le16(s, v >> 16);
+}
+
+/* 32-bit float WAV file. */
+static GString *render_wav(const struct streams *s)
+{
+	GString *wav;
+	uint64_t i;
+	uint32_t size, v;
+
+	size = s->samples * NUM_ANALOG_CHANNELS * sizeof(float);
+	wav = g_string_sized_new(44 + size);
+	g_string_append(wav, "RIFF");
+	append_le32(wav, 36 + size);
+	g_string_append(wav, "WAVEfmt ");
+	append_le32(wav, 16);
+	append_le16(wav, 3);
+	append_le16(wav, NUM_ANALOG_CHANNELS);
+	append_le32(wav, SAMPLERATE);
+	append_le32(wav, SAMPLERATE * NUM_ANALOG_CHANNELS * sizeof(float));
+	append_le16(wav, NUM_ANALOG_CHANNELS * sizeof(float));
+	append_le16(wav, 32);
+	g_string_append(wav, "data");
+	append_le32(wav, size);
+	for (i = 0; i < s->samples * NUM_ANALOG_CHANNELS; i++) {
+		memcpy(&v, &s->analog[i], sizeof(v));
+		append_le32(wav, v);
+	}
+
+	return wav;
+}
+
+static const struct {
+	const char *id;
+	const char *stream;
+	GString *(*render)(const struct streams *s);
+} input_formats[] = {
+	{ "binary", "logic", render_raw },
+	{ "chronovu-la8", "logic", render_raw },
+	{ "csv", "logic", render_csv },
+	{ "vcd", "logic", render_vcd },
+	{ "wav", "analog", render_wav },
+};
+
+static void result_print(const struct result *res)
+{
+	double secs;
+
+	secs = MAX(res->usecs, 1) / 1000000.0;
+	printf("%s\n    {\"stage\": \"%s\", \"module\": \"%s\", "
+		"\"stream\": \"%s\", \"ok\": %s, \"bytes\": %" PRIu64 ", "
+		"\"samples\": %" PRIu64 ", \"packets\": %" PRIu64 ", "
+		"\"seconds\": %.6f, \"mb_per_s\": %.2f, "
+		"\"samples_per_s\": %.0f, \"pool_misses_per_packet\": %.3f, "
+		"\"output_strings_per_packet\": %.3f}",
+		first_result ? "" : ",", res->stage, res->module, res->stream,
+		res->ret == SR_OK ? "true" : "false", res->count.bytes,
+		res->count.samples, res->count.packets, secs,
+		res->count.bytes / secs / (1024 * 1024),
+		res->count.samples / secs,
+		res->count.packets
+			? (double)res->pool_misses / res->count.packets : 0,
+		res->count.packets
+			? (double)res->output_strings / res->count.packets : 0);
+	first_result = FALSE;
+}
+
+static void datafeed_in(const struct sr_dev_inst *sdi,
+	const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_analog *analog;
+	struct counter *count;
+	uint64_t n;
+
+	(void)sdi;
+
+	count = cb_data;
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		count->bytes += logic->length;
+		count->samples += logic->length / logic->unitsize;
+		count->packets++;
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		n = (uint64_t)analog->num_samples * g_slist_length(analog->channels);
+		count->bytes += n * sizeof(float);
+		count->samples += n;
+		count->packets++;
+		break;
+	}
+}
+
+static void pool_stats(struct sr_session *session, struct result *res)
+{
+	sr_session_buffer_pool_stats(session, NULL, &res->pool_misses, NULL);
+}
+
+static void bench_input(struct sr_context *ctx,
+		const struct sr_input_module *imod, const char *stream,
+		GString *data)
+{
+	struct result res;
+	struct sr_session *session;
+	struct sr_input *in;
+	struct sr_dev_inst *sdi;
+	GString *chunk;
+	gsize i, len;
+	int64_t start;
+
+	memset(&res, 0, sizeof(res));
+	res.stage = "input";
+	res.module = sr_input_id_get(imod);
+	res.stream = stream;
+
+	chunk = g_string_sized_new(CHUNK_SIZE);
+	sr_session_new(ctx, &session);
+	sr_session_datafeed_callback_add(session, datafeed_in, &res.count);
+
+	start = g_get_monotonic_time();
+	if (!(in = sr_input_new(imod, NULL))) {
+		res.ret = SR_ERR;
+	} else {
+		sdi = NULL;
+		for (i = 0; i < data->len && res.ret == SR_OK; i += len) {
+			len = MIN(CHUNK_SIZE, data->len - i);
+			g_string_truncate(chunk, 0);
+			g_string_append_len(chunk, data->str + i, len);
+			res.ret = sr_input_send(in, chunk);
+			/* The device is ready once the module saw enough data. */
+			if (!sdi && (sdi = sr_input_dev_inst_get(in)))
+				sr_session_dev_add(session, sdi);
+		}
+		if (res.ret == SR_OK)
+			res.ret = sr_input_end(in);
+	}
+	res.usecs = g_get_monotonic_time() - start;
+
+	/* The modules' own throughput is that of the data fed into them. */
+	res.count.bytes = data->len;
+	pool_stats(session, &res);
+	result_print(&res);
+
+	sr_session_destroy(session);
+	if (in)
+		sr_input_free(in);
+	g_string_free(chunk, TRUE);
+}
+
+static void bench_inputs(struct sr_context *ctx, const struct streams *s)
+{
+	const struct sr_input_module *imod;
+	GString *data;
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(input_formats); i++) {
+		if (!(imod = sr_input_find((char *)input_formats[i].id)))
+			continue;
+		data = input_formats[i].render(s);
+		bench_input(ctx, imod, input_formats[i].stream, data);
+		g_string_free(data, TRUE);
+	}
+}
+
+static int output_send(const struct sr_output *o, int type,
+		const void *payload, struct result *res)
+{
+	struct sr_datafeed_packet packet;
+	GString *out;
+	int ret;
+
+	packet.type = type;
+	packet.payload = payload;
+	out = NULL;
+	ret = sr_output_send(o, &packet, &out);
+	if (out) {
+		res->output_strings++;
+		g_string_free(out, TRUE);
+	}
+
+	return ret;
+}
+
+static int output_send_logic(const struct sr_output *o,
+		const struct streams *s, struct result *res)
+{
+	struct sr_datafeed_logic logic;
+	uint64_t i;
+	int ret;
+
+	ret = SR_OK;
+	logic.unitsize = 1;
+	for (i = 0; i < s->samples && ret == SR_OK; i += logic.length) {
+		logic.length = MIN(CHUNK_SIZE, s->samples - i);
+		logic.data = s->logic + i;
+		ret = output_send(o, SR_DF_LOGIC, &logic, res);
+		res->count.bytes += logic.length;
+		res->count.samples += logic.length;
+		res->count.packets++;
+	}
+
+	return ret;
+}
+
+/* Send each analog channel in its own packets, as the drivers do. */
+static int output_send_analog(const struct sr_output *o,
+		const struct sr_dev_inst *sdi, const struct streams *s,
+		struct result *res)
+{
+	struct sr_datafeed_analog analog;
+	struct sr_channel *ch;
+	GSList *l;
+	uint64_t i;
+	int ret;
+
+	ret = SR_OK;
+	memset(&analog, 0, sizeof(analog));
+	analog.mq = SR_MQ_VOLTAGE;
+	analog.unit = SR_UNIT_VOLT;
+	for (i = 0; i < s->samples && ret == SR_OK; i += analog.num_samples) {
+		analog.num_samples = MIN(CHUNK_SIZE / sizeof(float), s->samples - i);
+		for (l = sr_dev_inst_channels_get(sdi); l && ret == SR_OK; l = l->next) {
+			ch = l->data;
+			if (ch->type != SR_CHANNEL_ANALOG)
+				continue;
+			analog.channels = g_slist_append(NULL, ch);
+			analog.data = s->analog + i;
+			ret = output_send(o, SR_DF_ANALOG, &analog, res);
+			g_slist_free(analog.channels);
+			res->count.bytes += analog.num_samples * sizeof(float);
+			res->count.samples += analog.num_samples;
+			res->count.packets++;
+		}
+	}
+
+	return ret;
+}
+
+static void bench_output(const struct sr_output_module *omod,
+		const struct sr_dev_inst *sdi, const struct streams *s,
+		gboolean analog)
+{
+	struct result res;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_meta meta;
+	struct sr_config src;
+	const struct sr_option **opts;
+	const struct sr_output *o;
+	GHashTable *params;
+	char *filename;
+	int64_t start;
+	int i;
+
+	memset(&res, 0, sizeof(res));
+	res.stage = "output";
+	res.module = sr_output_id_get(omod);
+	res.stream = analog ? "analog" : "logic";
+
+	/* Modules writing files themselves get a temporary one. */
+	filename = NULL;
+	params = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)g_variant_unref);
+	if ((opts = sr_output_options_get(omod))) {
+		for (i = 0; opts[i]; i++) {
+			if (strcmp(opts[i]->id, "filename"))
+				continue;
+			filename = g_build_filename(g_get_tmp_dir(),
+					"sigrok-bench.out", NULL);
+			g_hash_table_insert(params, g_strdup("filename"),
+				g_variant_ref_sink(g_variant_new_string(filename)));
+		}
+		sr_output_options_free(opts);
+	}
+
+	header.feed_version = 1;
+	gettimeofday(&header.starttime, NULL);
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_ref_sink(g_variant_new_uint64(SAMPLERATE));
+	meta.config = g_slist_append(NULL, &src);
+
+	start = g_get_monotonic_time();
+	if (!(o = sr_output_new(omod, params, sdi))) {
+		res.ret = SR_ERR;
+	} else {
+		res.ret = output_send(o, SR_DF_HEADER, &header, &res);
+		if (res.ret == SR_OK)
+			res.ret = output_send(o, SR_DF_META, &meta, &res);
+		if (res.ret == SR_OK && analog)
+			res.ret = output_send_analog(o, sdi, s, &res);
+		else if (res.ret == SR_OK)
+			res.ret = output_send_logic(o, s, &res);
+		if (res.ret == SR_OK)
+			res.ret = output_send(o, SR_DF_END, NULL, &res);
+		sr_output_free(o);
+	}
+	res.usecs = g_get_monotonic_time() - start;
+	result_print(&res);
+
+	g_slist_free(meta.config);
+	g_variant_unref(src.data);
+	g_hash_table_destroy(params);
+	if (filename) {
+		g_unlink(filename);
+		g_free(filename);
+	}
+}
+
+static void bench_outputs(const struct sr_dev_inst *sdi,
+		const struct streams *s)
+{
+	const struct sr_output_module **outputs;
+	int i;
+
+	outputs = sr_output_list();
+	for (i = 0; outputs[i]; i++) {
+		bench_output(outputs[i], sdi, s, FALSE);
+		bench_output(outputs[i], sdi, s, TRUE);
+	}
+}
+
+/* Run an acquisition from the demo device, optionally through a transform. */
+static void bench_acquisition(struct sr_context *ctx, struct sr_dev_inst *sdi,
+		const struct sr_transform_module *tmod, uint64_t samples)
+{
+	struct result res;
+	struct sr_session *session;
+	const struct sr_transform *t;
+	int64_t start;
+
+	memset(&res, 0, sizeof(res));
+	res.stage = tmod ? "transform" : "driver";
+	res.module = tmod ? sr_transform_id_get(tmod) : "demo";
+	res.stream = "mixed";
+
+	sr_session_new(ctx, &session);
+	sr_session_datafeed_callback_add(session, datafeed_in, &res.count);
+	sr_session_dev_add(session, sdi);
+	sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+		g_variant_new_uint64(samples));
+	/* The demo device is paced by its samplerate, make it freewheel. */
+	sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+		g_variant_new_uint64(SR_GHZ(1)));
+
+	t = NULL;
+	if (tmod && !(t = sr_transform_new(tmod, NULL, sdi)))
+		res.ret = SR_ERR;
+
+	start = g_get_monotonic_time();
+	if (res.ret == SR_OK && (res.ret = sr_session_start(session)) == SR_OK)
+		res.ret = sr_session_run(session);
+	res.usecs = g_get_monotonic_time() - start;
+
+	pool_stats(session, &res);
+	result_print(&res);
+
+	sr_session_destroy(session);
+	if (t)
+		sr_transform_free(t);
+}
+
+static struct sr_dev_inst *demo_open(struct sr_context *ctx)
+{
+	struct sr_dev_driver **drivers, *driver;
+	struct sr_config src[2];
+	struct sr_dev_inst *sdi;
+	GSList *options, *devices;
+	int i;
+
+	driver = NULL;
+	drivers = sr_driver_list(ctx);
+	for (i = 0; drivers && drivers[i]; i++) {
+		if (!strcmp(drivers[i]->name, "demo"))
+			driver = drivers[i];
+	}
+	if (!driver || sr_driver_init(ctx, driver) != SR_OK)
+		return NULL;
+
+	src[0].key = SR_CONF_NUM_LOGIC_CHANNELS;
+	src[0].data = g_variant_new_int32(NUM_LOGIC_CHANNELS);
+	src[1].key = SR_CONF_NUM_ANALOG_CHANNELS;
+	src[1].data = g_variant_new_int32(NUM_ANALOG_CHANNELS);
+	options = g_slist_append(g_slist_append(NULL, &src[0]), &src[1]);
+	devices = sr_driver_scan(driver, options);
+	g_slist_free(options);
+	g_variant_unref(g_variant_ref_sink(src[0].data));
+	g_variant_unref(g_variant_ref_sink(src[1].data));
+
+	if (!devices)
+		return NULL;
+	sdi = devices->data;
+	g_slist_free(devices);
+
+	if (sr_dev_open(sdi) != SR_OK)
+		return NULL;
+
+	return sdi;
+}
+
+int main(int argc, char **argv)
+{
+	struct sr_context *ctx;
+	struct sr_dev_inst *sdi;
+	const struct sr_transform_module **transforms;
+	struct streams s;
+	uint64_t samples;
+	int i;
+
+	samples = DEFAULT_SAMPLES;
+	if (argc > 1 && !(samples = g_ascii_strtoull(argv[1], NULL, 10))) {
+		fprintf(stderr, "Usage: %s [samples]\n", argv[0]);
+		return 1;
+	}
+
+	if (sr_init(&ctx) != SR_OK)
+		return 1;
+	if (!(sdi = demo_open(ctx))) {
+		fprintf(stderr, "The demo driver is not available.\n");
+		sr_exit(ctx);
+		return 1;
+	}
+
+	streams_init(&s, samples);
+
+	printf("{\n  \"package_version\": \"%s\",\n  \"samples\": %" PRIu64
+		",\n  \"results\": [", sr_package_version_string_get(), samples);
+
+	bench_acquisition(ctx, sdi, NULL, samples);
+	transforms = sr_transform_list();
+	for (i = 0; transforms[i]; i++)
+		bench_acquisition(ctx, sdi, transforms[i], samples);
+	bench_inputs(ctx, &s);
+	bench_outputs(sdi, &s);
+
+	printf("\n  ]\n}\n");
+
+	streams_free(&s);
+	sr_dev_close(sdi);
+	sr_exit(ctx);
+
+	return 0;
+}
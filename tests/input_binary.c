@@ -18,6 +18,8 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <string.h>
+#include <unistd.h>
 #include <check.h>
 #include <glib/gstdio.h>
 #include "../include/libsigrok/libsigrok.h"
@@ -308,6 +310,94 @@ START_TEST(test_input_binary_hello_world)
 }
 END_TEST
 
+/*
+ * Send an all-high file, which is memory mapped read-only, optionally
+ * through a transform.
+ */
+static void check_file(const char *transform_id, int check)
+{
+	const struct sr_input_module *imod;
+	const struct sr_transform *t;
+	struct sr_session *session;
+	struct sr_input *in;
+	GError *error;
+	gchar *filename, *contents;
+	gsize length;
+	uint8_t *buf;
+	int fd, ret;
+
+	buf = g_malloc(BUFSIZE);
+	memset(buf, 0xff, BUFSIZE);
+
+	error = NULL;
+	fd = g_file_open_tmp("sigrok-test-XXXXXX", &filename, &error);
+	fail_unless(fd >= 0, "Failed to create temporary file.");
+	close(fd);
+	fail_unless(g_file_set_contents(filename, (gchar *)buf, BUFSIZE,
+			&error), "Failed to write temporary file.");
+
+	df_packet_counter = sample_counter = 0;
+	have_seen_df_end = FALSE;
+	logic_channellist = NULL;
+	check_to_perform = check;
+	expected_samples = BUFSIZE;
+	expected_samplerate = NULL;
+
+	imod = sr_input_find("binary");
+	fail_unless(imod != NULL, "Failed to find input module.");
+	in = sr_input_new(imod, NULL);
+	fail_unless(in != NULL, "Failed to create input instance.");
+
+	sr_session_new(srtest_ctx, &session);
+	sr_session_datafeed_callback_add(session, datafeed_in, NULL);
+
+	/* The first call returns as soon as the device is ready. */
+	ret = sr_input_send_file(in, filename);
+	fail_unless(ret == SR_OK, "sr_input_send_file() error: %d", ret);
+	fail_unless(sr_input_dev_inst_get(in) != NULL, "Device not ready.");
+	sr_session_dev_add(session, sr_input_dev_inst_get(in));
+
+	t = NULL;
+	if (transform_id) {
+		t = sr_transform_new(sr_transform_find(transform_id), NULL,
+				sr_input_dev_inst_get(in));
+		fail_unless(t != NULL, "Failed to create transform instance.");
+	}
+
+	ret = sr_input_send_file(in, filename);
+	fail_unless(ret == SR_OK, "sr_input_send_file() error: %d", ret);
+	ret = sr_input_end(in);
+	fail_unless(ret == SR_OK, "sr_input_end() error: %d", ret);
+	fail_unless(have_seen_df_end, "No SR_DF_END packet was sent.");
+
+	sr_session_destroy(session);
+	sr_transform_free(t);
+	sr_input_free(in);
+
+	/* Transforms must not have written to the file's memory. */
+	fail_unless(g_file_get_contents(filename, &contents, &length, &error),
+			"Failed to read temporary file.");
+	fail_unless(length == BUFSIZE && !memcmp(contents, buf, BUFSIZE),
+			"The file was modified.");
+	g_free(contents);
+
+	g_unlink(filename);
+	g_free(filename);
+	g_free(buf);
+}
+
+START_TEST(test_input_binary_file)
+{
+	check_file(NULL, CHECK_ALL_HIGH);
+}
+END_TEST
+
+START_TEST(test_input_binary_file_invert)
+{
+	check_file("invert", CHECK_ALL_LOW);
+}
+END_TEST
+
 Suite *suite_input_binary(void)
 {
 	Suite *s;
@@ -321,6 +411,8 @@ Suite *suite_input_binary(void)
 	tcase_add_test(tc, test_input_binary_all_high);
 	tcase_add_loop_test(tc, test_input_binary_all_high_loop, 1, 10);
 	tcase_add_test(tc, test_input_binary_hello_world);
+	tcase_add_test(tc, test_input_binary_file);
+	tcase_add_test(tc, test_input_binary_file_invert);
 	suite_add_tcase(s, tc);
 
 	return s;
@@ -0,0 +1,350 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <check.h>
+#include "../include/libsigrok/libsigrok.h"
+#include "lib.h"
+
+#define NUM_LINES 200000
+#define CHUNK_SIZE (1024 * 1024)
+
+static void datafeed_in(const struct sr_dev_inst *sdi,
+	const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	GByteArray *samples;
+
+	(void)sdi;
+
+	samples = cb_data;
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		fail_unless(logic->length % logic->unitsize == 0);
+		g_byte_array_append(samples, logic->data, logic->length);
+	}
+}
+
+/* A multi column CSV file with a header, blank lines and comments. */
+static GString *multi_column_csv(void)
+{
+	GString *csv;
+	GRand *r;
+	int i, j;
+
+	r = g_rand_new_with_seed(1);
+	csv = g_string_new("; Generated test data\nA,B,C,D,E,F,G,H,I\n");
+	for (i = 0; i < NUM_LINES; i++) {
+		if (i % 1000 == 0)
+			g_string_append(csv, "\n; Comment line\n");
+		for (j = 0; j < 9; j++) {
+			g_string_append(csv, g_rand_boolean(r) ? "1" : "0");
+			g_string_append(csv, j < 8 ? "," : "");
+		}
+		g_string_append(csv, i % 7 ? "\r\n" : " ; Comment\r\n");
+	}
+	g_rand_free(r);
+
+	return csv;
+}
+
+/* A single column CSV file with hexadecimal samples. */
+static GString *single_column_csv(void)
+{
+	GString *csv;
+	GRand *r;
+	int i;
+
+	r = g_rand_new_with_seed(2);
+	csv = g_string_new("");
+	for (i = 0; i < NUM_LINES; i++)
+		g_string_append_printf(csv, "%d, %06x\n", i,
+			g_rand_int(r) & 0xffffff);
+	g_rand_free(r);
+
+	return csv;
+}
+
+/* Import the CSV data in chunks and return the sample data. */
+static GByteArray *import(const GString *csv, GHashTable *options,
+		gsize chunk_size)
+{
+	const struct sr_input_module *imod;
+	struct sr_session *session;
+	struct sr_input *in;
+	struct sr_dev_inst *sdi;
+	GByteArray *samples;
+	GString *buf;
+	gsize i, len;
+	int ret;
+
+	imod = sr_input_find("csv");
+	fail_unless(imod != NULL, "Failed to find input module.");
+
+	in = sr_input_new(imod, options);
+	fail_unless(in != NULL, "Failed to create input instance.");
+
+	samples = g_byte_array_new();
+	sr_session_new(srtest_ctx, &session);
+	sr_session_datafeed_callback_add(session, datafeed_in, samples);
+
+	buf = g_string_sized_new(MIN(chunk_size, csv->len));
+	sdi = NULL;
+	for (i = 0; i < csv->len; i += len) {
+		len = MIN(chunk_size, csv->len - i);
+		g_string_truncate(buf, 0);
+		g_string_append_len(buf, csv->str + i, len);
+		ret = sr_input_send(in, buf);
+		fail_unless(ret == SR_OK, "sr_input_send() error: %d", ret);
+		/* The device is ready once the first lines were seen. */
+		if (!sdi && (sdi = sr_input_dev_inst_get(in)))
+			sr_session_dev_add(session, sdi);
+	}
+	ret = sr_input_end(in);
+	fail_unless(ret == SR_OK, "sr_input_end() error: %d", ret);
+	fail_unless(sdi != NULL, "Device not ready.");
+
+	g_string_free(buf, TRUE);
+	sr_session_destroy(session);
+	sr_input_free(in);
+
+	return samples;
+}
+
+/* Check that parsing with several workers yields the serial result. */
+static void check_workers(const GString *csv, GHashTable *options,
+		gsize unitsize)
+{
+	GByteArray *serial, *parallel;
+	uint32_t workers[] = { 2, 3, 8 };
+	unsigned int i;
+
+	g_hash_table_insert(options, g_strdup("workers"),
+		g_variant_ref_sink(g_variant_new_uint32(1)));
+	serial = import(csv, options, CHUNK_SIZE);
+	fail_unless(serial->len == NUM_LINES * unitsize,
+		"Expected %d samples, got %u.", NUM_LINES,
+		serial->len / unitsize);
+
+	for (i = 0; i < G_N_ELEMENTS(workers); i++) {
+		g_hash_table_insert(options, g_strdup("workers"),
+			g_variant_ref_sink(g_variant_new_uint32(workers[i])));
+		parallel = import(csv, options, CHUNK_SIZE);
+		fail_unless(parallel->len == serial->len,
+			"%u workers: got %u bytes instead of %u.",
+			workers[i], parallel->len, serial->len);
+		fail_unless(!memcmp(parallel->data, serial->data, serial->len),
+			"%u workers: sample data differs.", workers[i]);
+		g_byte_array_free(parallel, TRUE);
+	}
+
+	g_byte_array_free(serial, TRUE);
+}
+
+static GHashTable *new_options(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)g_variant_unref);
+}
+
+START_TEST(test_input_csv_parallel_multi_column)
+{
+	GHashTable *options;
+	GString *csv;
+
+	csv = multi_column_csv();
+	options = new_options();
+	g_hash_table_insert(options, g_strdup("header"),
+		g_variant_ref_sink(g_variant_new_boolean(TRUE)));
+
+	check_workers(csv, options, 2);
+
+	g_hash_table_destroy(options);
+	g_string_free(csv, TRUE);
+}
+END_TEST
+
+START_TEST(test_input_csv_parallel_single_column)
+{
+	GHashTable *options;
+	GString *csv;
+
+	csv = single_column_csv();
+	options = new_options();
+	g_hash_table_insert(options, g_strdup("single-column"),
+		g_variant_ref_sink(g_variant_new_int32(1)));
+	g_hash_table_insert(options, g_strdup("numchannels"),
+		g_variant_ref_sink(g_variant_new_int32(20)));
+	g_hash_table_insert(options, g_strdup("format"),
+		g_variant_ref_sink(g_variant_new_string("hex")));
+
+	check_workers(csv, options, 3);
+
+	g_hash_table_destroy(options);
+	g_string_free(csv, TRUE);
+}
+END_TEST
+
+/*
+ * Import the CSV text whole, and split into chunks of 1 to 4 bytes, and
+ * check it yields the expected samples.
+ */
+static void check_samples(const char *text, GHashTable *options,
+		const uint8_t *expected, gsize len)
+{
+	GByteArray *samples;
+	GString *csv;
+	gsize chunk_sizes[] = { G_MAXSIZE, 1, 2, 3, 4 };
+	unsigned int i;
+	gsize j;
+
+	csv = g_string_new(text);
+	for (i = 0; i < G_N_ELEMENTS(chunk_sizes); i++) {
+		samples = import(csv, options, chunk_sizes[i]);
+		fail_unless(samples->len == len,
+			"Chunks of %" G_GSIZE_FORMAT ": got %u bytes instead "
+			"of %" G_GSIZE_FORMAT ".", chunk_sizes[i],
+			samples->len, len);
+		for (j = 0; j < len; j++)
+			fail_unless(samples->data[j] == expected[j],
+				"Chunks of %" G_GSIZE_FORMAT ": sample %"
+				G_GSIZE_FORMAT " is 0x%02x, expected 0x%02x.",
+				chunk_sizes[i], j, samples->data[j],
+				expected[j]);
+		g_byte_array_free(samples, TRUE);
+	}
+	g_string_free(csv, TRUE);
+}
+
+/* Columns map to channels, the first column to the lowest bit. */
+START_TEST(test_input_csv_multi_column)
+{
+	static const uint8_t expected[] = { 0x05, 0x06, 0x03, 0x00, 0x07 };
+	GHashTable *options;
+
+	options = new_options();
+	check_samples("1,0,1\n0,1,1\n1,1,0\n0,0,0\n1,1,1\n",
+		options, expected, sizeof(expected));
+	check_samples(" 1, 0 ,1 ; comment\n; comment line\n\n0 ,1,1\n"
+		"1,1, 0\n0,0,0\n1 ,1 ,1\n", options, expected,
+		sizeof(expected));
+	g_hash_table_destroy(options);
+}
+END_TEST
+
+/* Samples in a single column, in hex and binary. */
+START_TEST(test_input_csv_single_column)
+{
+	static const uint8_t expected[] = { 0x1a, 0xff, 0x00, 0x81 };
+	GHashTable *options;
+
+	options = new_options();
+	g_hash_table_insert(options, g_strdup("single-column"),
+		g_variant_ref_sink(g_variant_new_int32(1)));
+	g_hash_table_insert(options, g_strdup("numchannels"),
+		g_variant_ref_sink(g_variant_new_int32(8)));
+	g_hash_table_insert(options, g_strdup("format"),
+		g_variant_ref_sink(g_variant_new_string("hex")));
+	check_samples("0,1a\n1, ff\n2,0\n3,81\n",
+		options, expected, sizeof(expected));
+	g_hash_table_insert(options, g_strdup("format"),
+		g_variant_ref_sink(g_variant_new_string("bin")));
+	check_samples("0,11010\n1,11111111\n2,0\n3,10000001\n",
+		options, expected, sizeof(expected));
+	g_hash_table_destroy(options);
+}
+END_TEST
+
+/* Lines before the start line are skipped, data lines too. */
+START_TEST(test_input_csv_startline)
+{
+	static const uint8_t expected[] = { 0x01, 0x02, 0x03 };
+	GHashTable *options;
+
+	options = new_options();
+	g_hash_table_insert(options, g_strdup("startline"),
+		g_variant_ref_sink(g_variant_new_int32(3)));
+	check_samples("not,a,sample\n0,0\n1,0\n0,1\n1,1\n",
+		options, expected, sizeof(expected));
+
+	/* The header is the first line processed. */
+	g_hash_table_insert(options, g_strdup("header"),
+		g_variant_ref_sink(g_variant_new_boolean(TRUE)));
+	g_hash_table_insert(options, g_strdup("startline"),
+		g_variant_ref_sink(g_variant_new_int32(2)));
+	check_samples("not,a,sample\nA,B\n1,0\n0,1\n1,1\n",
+		options, expected, sizeof(expected));
+	g_hash_table_destroy(options);
+}
+END_TEST
+
+/* CRLF terminates a single line, for the samples and the start line. */
+START_TEST(test_input_csv_crlf)
+{
+	static const uint8_t expected[] = { 0x01, 0x02, 0x03 };
+	GHashTable *options;
+
+	options = new_options();
+	check_samples("1,0\r\n0,1\r\n\r\n1,1\r\n",
+		options, expected, sizeof(expected));
+	g_hash_table_insert(options, g_strdup("startline"),
+		g_variant_ref_sink(g_variant_new_int32(3)));
+	check_samples("x,x\r\ny,y\r\n1,0\r\n0,1\r\n1,1\r\n",
+		options, expected, sizeof(expected));
+	g_hash_table_destroy(options);
+}
+END_TEST
+
+/* The last line is processed without a line ending. */
+START_TEST(test_input_csv_final_line)
+{
+	static const uint8_t expected[] = { 0x01, 0x02, 0x03 };
+	GHashTable *options;
+
+	options = new_options();
+	check_samples("1,0\n0,1\n1,1", options, expected, sizeof(expected));
+	check_samples("1,0\r\n0,1\r\n1,1", options, expected,
+		sizeof(expected));
+	g_hash_table_destroy(options);
+}
+END_TEST
+
+Suite *suite_input_csv(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("input-csv");
+
+	tc = tcase_create("samples");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_input_csv_multi_column);
+	tcase_add_test(tc, test_input_csv_single_column);
+	tcase_add_test(tc, test_input_csv_startline);
+	tcase_add_test(tc, test_input_csv_crlf);
+	tcase_add_test(tc, test_input_csv_final_line);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("parallel");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_set_timeout(tc, 60);
+	tcase_add_test(tc, test_input_csv_parallel_multi_column);
+	tcase_add_test(tc, test_input_csv_parallel_single_column);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
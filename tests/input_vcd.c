@@ -0,0 +1,308 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <check.h>
+#include "../include/libsigrok/libsigrok.h"
+#include "lib.h"
+
+#define MANY_CHANNELS 70
+
+struct vcd_check {
+	GByteArray *samples;
+	unsigned int unitsize;
+	uint64_t samplerate;
+	/* Names of the device's channels, in order. */
+	GPtrArray *names;
+};
+
+static void vcd_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_meta *meta;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_config *src;
+	struct vcd_check *vc;
+	GSList *l;
+
+	(void)sdi;
+
+	vc = cb_data;
+	switch (packet->type) {
+	case SR_DF_META:
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			if (src->key == SR_CONF_SAMPLERATE)
+				vc->samplerate = g_variant_get_uint64(src->data);
+		}
+		break;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		fail_unless(!vc->unitsize || logic->unitsize == vc->unitsize,
+				"Unitsize changed from %u to %u.", vc->unitsize,
+				logic->unitsize);
+		vc->unitsize = logic->unitsize;
+		g_byte_array_append(vc->samples, logic->data, logic->length);
+		break;
+	}
+}
+
+/* Import the VCD text in pieces of chunk_size bytes. */
+static void vcd_import(const GString *vcd, GHashTable *options,
+		gsize chunk_size, struct vcd_check *vc)
+{
+	struct sr_session *session;
+	const struct sr_input *in;
+	struct sr_dev_inst *sdi;
+	struct sr_channel *ch;
+	GString *buf;
+	GSList *l;
+	gsize i, len;
+	int ret;
+
+	in = sr_input_new(sr_input_find("vcd"), options);
+	fail_unless(in != NULL, "Failed to create input instance.");
+	sr_session_new(srtest_ctx, &session);
+	sr_session_datafeed_callback_add(session, vcd_datafeed_in, vc);
+
+	buf = g_string_new(NULL);
+	sdi = NULL;
+	for (i = 0; i < vcd->len; i += len) {
+		len = MIN(chunk_size, vcd->len - i);
+		g_string_assign(buf, "");
+		g_string_append_len(buf, vcd->str + i, len);
+		ret = sr_input_send(in, buf);
+		fail_unless(ret == SR_OK, "sr_input_send() error: %d", ret);
+		if (!sdi && (sdi = sr_input_dev_inst_get(in)))
+			sr_session_dev_add(session, sdi);
+	}
+	ret = sr_input_end(in);
+	fail_unless(ret == SR_OK, "sr_input_end() error: %d", ret);
+	fail_unless(sdi != NULL, "Device not ready.");
+
+	for (l = sr_dev_inst_channels_get(sdi); l; l = l->next) {
+		ch = l->data;
+		fail_unless(ch->index == (int)vc->names->len,
+				"Channel '%s' has index %d.", ch->name, ch->index);
+		g_ptr_array_add(vc->names, g_strdup(ch->name));
+	}
+
+	g_string_free(buf, TRUE);
+	sr_session_destroy(session);
+	sr_input_free(in);
+}
+
+/*
+ * Import the VCD text whole and in small pieces, and check the channel
+ * names, the unitsize and the samples.
+ */
+static void vcd_check(const char *text, GHashTable *options,
+		const char *const *names, unsigned int num_names,
+		unsigned int unitsize, const uint8_t *samples, gsize len)
+{
+	const gsize chunk_sizes[] = { G_MAXSIZE, 7, 1 };
+	struct vcd_check vc;
+	GString *vcd;
+	unsigned int i, j;
+
+	vcd = g_string_new(text);
+	for (i = 0; i < G_N_ELEMENTS(chunk_sizes); i++) {
+		memset(&vc, 0, sizeof(vc));
+		vc.samples = g_byte_array_new();
+		vc.names = g_ptr_array_new_with_free_func(g_free);
+		vcd_import(vcd, options, chunk_sizes[i], &vc);
+
+		fail_unless(vc.names->len == num_names,
+				"Got %u channels, expected %u.",
+				vc.names->len, num_names);
+		for (j = 0; j < num_names; j++)
+			fail_unless(!strcmp(vc.names->pdata[j], names[j]),
+					"Channel %u is '%s', expected '%s'.", j,
+					(char *)vc.names->pdata[j], names[j]);
+		fail_unless(vc.samplerate == SR_MHZ(1),
+				"Got samplerate %" PRIu64 ".", vc.samplerate);
+		fail_unless(vc.unitsize == unitsize,
+				"Got unitsize %u, expected %u.",
+				vc.unitsize, unitsize);
+		fail_unless(vc.samples->len == len,
+				"Got %u bytes of samples, expected %" G_GSIZE_FORMAT
+				".", vc.samples->len, len);
+		for (j = 0; j < len; j++)
+			fail_unless(vc.samples->data[j] == samples[j],
+					"Byte %u is 0x%02x, expected 0x%02x.", j,
+					vc.samples->data[j], samples[j]);
+
+		g_ptr_array_free(vc.names, TRUE);
+		g_byte_array_free(vc.samples, TRUE);
+	}
+	g_string_free(vcd, TRUE);
+}
+
+static GHashTable *vcd_options(int numchannels)
+{
+	GHashTable *options;
+
+	options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)g_variant_unref);
+	g_hash_table_insert(options, g_strdup("numchannels"),
+			g_variant_ref_sink(g_variant_new_int32(numchannels)));
+
+	return options;
+}
+
+/*
+ * Check vector values are read MSB first, zero-extended, with x and z
+ * bits as zero, and real values are skipped. Channel 0 is a scalar,
+ * channels 1-4 and 5-7 are vectors.
+ */
+START_TEST(test_input_vcd_vector)
+{
+	static const char vcd[] =
+		"$timescale 1 us $end\n"
+		"$var wire 1 ! clk $end\n"
+		"$var wire 4 \" data [3:0] $end\n"
+		"$var reg 3 # cnt[2:0] $end\n"
+		"$enddefinitions $end\n"
+		"#0\n"
+		"1!\n"
+		"b1010 \"\n"
+		"b11 #\n"
+		"#2\n"
+		"0!\n"
+		"b1x1 \"\n"
+		"r0.5 \"\n"
+		"b111 #\n"
+		"#3\n"
+		"1!\n"
+		"b0 \"\n"
+		"B1z0 #\n"
+		"#5\n";
+	static const char *const names[] = {
+		"clk", "data[0]", "data[1]", "data[2]", "data[3]",
+		"cnt[0]", "cnt[1]", "cnt[2]",
+	};
+	static const uint8_t samples[] = { 0x75, 0x75, 0xea, 0x81, 0x81 };
+
+	/* Default options, numchannels 0 uses all channels. */
+	vcd_check(vcd, NULL, names, G_N_ELEMENTS(names), 1,
+			samples, sizeof(samples));
+}
+END_TEST
+
+/*
+ * Check a variable reusing an identifier is skipped, as is one which
+ * doesn't fit within numchannels.
+ */
+START_TEST(test_input_vcd_skipped_vars)
+{
+	static const char vcd[] =
+		"$timescale 1 us $end\n"
+		"$var wire 1 ! a $end\n"
+		"$var wire 1 ! b $end\n"
+		"$var wire 4 \" wide [3:0] $end\n"
+		"$var wire 1 # c $end\n"
+		"$enddefinitions $end\n"
+		"#0\n"
+		"1!\n"
+		"b1111 \"\n"
+		"0#\n"
+		"#1\n"
+		"0!\n"
+		"1#\n"
+		"#2\n";
+	static const char *const names[] = { "a", "c" };
+	static const uint8_t samples[] = { 0x01, 0x02 };
+	GHashTable *options;
+
+	options = vcd_options(3);
+	vcd_check(vcd, options, names, G_N_ELEMENTS(names), 1,
+			samples, sizeof(samples));
+	g_hash_table_destroy(options);
+}
+END_TEST
+
+/*
+ * Check more than 64 channels with multi-character identifiers, and
+ * numchannels limiting them, with the unitsize following the count.
+ */
+START_TEST(test_input_vcd_many_channels)
+{
+	static const unsigned int limits[] = { 0, 65, 64, 9 };
+	const char **names;
+	GHashTable *options;
+	GString *vcd;
+	uint8_t *samples;
+	unsigned int i, n, t, c, unitsize;
+
+	vcd = g_string_new("$timescale 1 us $end\n");
+	names = g_malloc(sizeof(char *) * MANY_CHANNELS);
+	for (i = 0; i < MANY_CHANNELS; i++) {
+		g_string_append_printf(vcd, "$var wire 1 v%u ch%u $end\n", i, i);
+		names[i] = g_strdup_printf("ch%u", i);
+	}
+	g_string_append(vcd, "$enddefinitions $end\n");
+	/* Channel i is high at time t if it is a multiple of t + 2. */
+	for (t = 0; t < 3; t++) {
+		g_string_append_printf(vcd, "#%u\n", t);
+		for (i = 0; i < MANY_CHANNELS; i++)
+			g_string_append_printf(vcd, "%c v%u\n",
+					i % (t + 2) ? '0' : '1', i);
+	}
+	g_string_append(vcd, "#3\n");
+
+	for (i = 0; i < G_N_ELEMENTS(limits); i++) {
+		n = limits[i] ? limits[i] : MANY_CHANNELS;
+		unitsize = (n + 7) / 8;
+		samples = g_malloc0(3 * unitsize);
+		for (t = 0; t < 3; t++) {
+			for (c = 0; c < n; c++) {
+				if (c % (t + 2) == 0)
+					samples[t * unitsize + c / 8] |= 1 << (c % 8);
+			}
+		}
+		options = vcd_options(limits[i]);
+		vcd_check(vcd->str, options, names, n, unitsize,
+				samples, 3 * unitsize);
+		g_hash_table_destroy(options);
+		g_free(samples);
+	}
+
+	for (i = 0; i < MANY_CHANNELS; i++)
+		g_free((char *)names[i]);
+	g_free(names);
+	g_string_free(vcd, TRUE);
+}
+END_TEST
+
+Suite *suite_input_vcd(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("input-vcd");
+
+	tc = tcase_create("channels");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_input_vcd_vector);
+	tcase_add_test(tc, test_input_vcd_skipped_vars);
+	tcase_add_test(tc, test_input_vcd_many_channels);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
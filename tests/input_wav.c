@@ -0,0 +1,284 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <check.h>
+#include "../include/libsigrok/libsigrok.h"
+#include "lib.h"
+
+#define NUM_FRAMES 1001
+#define SAMPLERATE 48000
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+
+struct wav_format {
+	uint16_t fmt_code;
+	uint16_t bits;
+	uint16_t num_channels;
+};
+
+static const struct wav_format wav_formats[] = {
+	{ WAVE_FORMAT_PCM, 8, 1 },
+	{ WAVE_FORMAT_PCM, 16, 1 },
+	{ WAVE_FORMAT_PCM, 24, 1 },
+	{ WAVE_FORMAT_PCM, 32, 1 },
+	{ WAVE_FORMAT_IEEE_FLOAT, 32, 1 },
+	{ WAVE_FORMAT_PCM, 8, 2 },
+	{ WAVE_FORMAT_PCM, 16, 2 },
+	{ WAVE_FORMAT_PCM, 24, 2 },
+	{ WAVE_FORMAT_PCM, 32, 2 },
+	{ WAVE_FORMAT_IEEE_FLOAT, 32, 2 },
+};
+
+struct wav_check {
+	GArray *samples;
+	uint64_t samplerate;
+	int num_channels;
+	gboolean got_end;
+};
+
+static void wav_le(GString *s, uint32_t value, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		g_string_append_c(s, (value >> (8 * i)) & 0xff);
+}
+
+/*
+ * Generate a WAV file in the given format, with an extra chunk between
+ * the "fmt " and "data" chunks. The samples it should decode to are
+ * returned in expected.
+ */
+static GString *wav_new(const struct wav_format *fmt, GArray *expected)
+{
+	GString *wav;
+	GRand *r;
+	unsigned int i, size, framesize;
+	int32_t v;
+	float f;
+	uint32_t u;
+
+	framesize = fmt->bits / 8 * fmt->num_channels;
+	size = NUM_FRAMES * framesize;
+
+	wav = g_string_new("RIFF");
+	wav_le(wav, 4 + 24 + 12 + 8 + size, 4);
+	g_string_append(wav, "WAVEfmt ");
+	wav_le(wav, 16, 4);
+	wav_le(wav, fmt->fmt_code, 2);
+	wav_le(wav, fmt->num_channels, 2);
+	wav_le(wav, SAMPLERATE, 4);
+	wav_le(wav, SAMPLERATE * framesize, 4);
+	wav_le(wav, framesize, 2);
+	wav_le(wav, fmt->bits, 2);
+	g_string_append(wav, "LIST");
+	wav_le(wav, 4, 4);
+	g_string_append(wav, "INFO");
+	g_string_append(wav, "data");
+	wav_le(wav, size, 4);
+
+	r = g_rand_new_with_seed(fmt->bits * 16 + fmt->fmt_code
+			+ fmt->num_channels);
+	for (i = 0; i < NUM_FRAMES * fmt->num_channels; i++) {
+		/* Start with the extremes of the range. */
+		if (fmt->fmt_code == WAVE_FORMAT_IEEE_FLOAT) {
+			f = i == 0 ? -1 : i == 1 ? 1
+				: g_rand_int_range(r, -1000000, 1000001) / 1e6f;
+			memcpy(&u, &f, sizeof(u));
+			wav_le(wav, u, 4);
+		} else if (fmt->bits == 8) {
+			v = i == 0 ? 0 : i == 1 ? 255 : g_rand_int_range(r, 0, 256);
+			wav_le(wav, v, 1);
+			f = v / 255.0f;
+		} else if (fmt->bits == 16) {
+			v = i == 0 ? INT16_MIN : i == 1 ? INT16_MAX
+				: g_rand_int_range(r, INT16_MIN, INT16_MAX + 1);
+			wav_le(wav, v, 2);
+			f = v / (float)INT16_MAX;
+		} else if (fmt->bits == 24) {
+			v = i == 0 ? -8388608 : i == 1 ? 8388607
+				: g_rand_int_range(r, -8388608, 8388608);
+			wav_le(wav, v, 3);
+			f = v / 8388607.0f;
+		} else {
+			v = i == 0 ? INT32_MIN : i == 1 ? INT32_MAX
+				: (int32_t)g_rand_int(r);
+			wav_le(wav, v, 4);
+			f = v / (float)INT32_MAX;
+		}
+		g_array_append_val(expected, f);
+	}
+	g_rand_free(r);
+
+	return wav;
+}
+
+static void wav_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_meta *meta;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_config *src;
+	struct wav_check *wc;
+	GSList *l;
+
+	(void)sdi;
+
+	wc = cb_data;
+	switch (packet->type) {
+	case SR_DF_META:
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			if (src->key == SR_CONF_SAMPLERATE)
+				wc->samplerate = g_variant_get_uint64(src->data);
+		}
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		fail_unless(analog->num_samples > 0);
+		fail_unless((int)g_slist_length(analog->channels)
+				== wc->num_channels, "Got %u channels.",
+				g_slist_length(analog->channels));
+		g_array_append_vals(wc->samples, analog->data,
+				analog->num_samples * wc->num_channels);
+		break;
+	case SR_DF_END:
+		wc->got_end = TRUE;
+		break;
+	}
+}
+
+/*
+ * Import the WAV file, passing the first header_chunks bytes one at a
+ * time and the rest in pieces of chunk_size bytes.
+ */
+static void wav_import(const GString *wav, gsize header_chunks,
+		gsize chunk_size, struct wav_check *wc)
+{
+	struct sr_session *session;
+	const struct sr_input *in;
+	struct sr_dev_inst *sdi;
+	GString *buf;
+	gsize i, len;
+	int ret;
+
+	in = sr_input_new(sr_input_find("wav"), NULL);
+	fail_unless(in != NULL, "Failed to create input instance.");
+	sr_session_new(srtest_ctx, &session);
+	sr_session_datafeed_callback_add(session, wav_datafeed_in, wc);
+
+	buf = g_string_new(NULL);
+	sdi = NULL;
+	for (i = 0; i < wav->len; i += len) {
+		len = MIN(i < header_chunks ? 1 : chunk_size, wav->len - i);
+		g_string_assign(buf, "");
+		g_string_append_len(buf, wav->str + i, len);
+		ret = sr_input_send(in, buf);
+		fail_unless(ret == SR_OK, "sr_input_send() error: %d", ret);
+		if (!sdi && (sdi = sr_input_dev_inst_get(in)))
+			sr_session_dev_add(session, sdi);
+	}
+	ret = sr_input_end(in);
+	fail_unless(ret == SR_OK, "sr_input_end() error: %d", ret);
+	fail_unless(sdi != NULL, "Device not ready.");
+
+	g_string_free(buf, TRUE);
+	sr_session_destroy(session);
+	sr_input_free(in);
+}
+
+static void wav_check_format(const struct wav_format *fmt,
+		gsize header_chunks, gsize chunk_size)
+{
+	struct wav_check wc;
+	GArray *expected;
+	GString *wav;
+	unsigned int i;
+	float got, exp;
+
+	expected = g_array_new(FALSE, FALSE, sizeof(float));
+	wav = wav_new(fmt, expected);
+
+	memset(&wc, 0, sizeof(wc));
+	wc.samples = g_array_new(FALSE, FALSE, sizeof(float));
+	wc.num_channels = fmt->num_channels;
+	wav_import(wav, header_chunks, chunk_size, &wc);
+
+	fail_unless(wc.samplerate == SAMPLERATE, "Got samplerate %" PRIu64 ".",
+			wc.samplerate);
+	fail_unless(wc.got_end, "No end packet.");
+	fail_unless(wc.samples->len == expected->len,
+			"%u-bit format %u, %u channels: got %u samples, "
+			"expected %u.", fmt->bits, fmt->fmt_code,
+			fmt->num_channels, wc.samples->len, expected->len);
+	for (i = 0; i < expected->len; i++) {
+		got = g_array_index(wc.samples, float, i);
+		exp = g_array_index(expected, float, i);
+		fail_unless(got == exp, "%u-bit format %u, %u channels: "
+				"sample %u is %f, expected %f.", fmt->bits,
+				fmt->fmt_code, fmt->num_channels, i, got, exp);
+	}
+
+	g_array_free(wc.samples, TRUE);
+	g_array_free(expected, TRUE);
+	g_string_free(wav, TRUE);
+}
+
+/* Check every sample format when the whole file arrives at once. */
+START_TEST(test_input_wav_formats)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(wav_formats); i++)
+		wav_check_format(&wav_formats[i], 0, G_MAXSIZE);
+}
+END_TEST
+
+/*
+ * Check every sample format with the header split across many
+ * sr_input_send() calls, and frames split across the following ones.
+ */
+START_TEST(test_input_wav_split)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(wav_formats); i++) {
+		wav_check_format(&wav_formats[i], 60, 7);
+		wav_check_format(&wav_formats[i], 60, 1001);
+	}
+}
+END_TEST
+
+Suite *suite_input_wav(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("input-wav");
+
+	tc = tcase_create("formats");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_input_wav_formats);
+	tcase_add_test(tc, test_input_wav_split);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
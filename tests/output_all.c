@@ -19,6 +19,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "../include/libsigrok/libsigrok.h"
 #include "lib.h"
@@ -96,6 +97,937 @@ START_TEST(test_output_options)
 }
 END_TEST
 
+static int append_output(const struct sr_output *o, const char *data,
+		gsize len, void *cb_data)
+{
+	(void)o;
+
+	g_string_append_len(cb_data, data, len);
+
+	return SR_OK;
+}
+
+/* Check that the output sinks get the same output as sr_output_send(). */
+START_TEST(test_output_sinks)
+{
+	const char *ids[] = { "bits", "csv", "vcd", "binary" };
+	const struct sr_output *o[3];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_dev_inst *sdi;
+	GString *out, *expected, *buf, *cb_buf;
+	uint8_t data[1000];
+	char name[8];
+	unsigned int i, j;
+
+	sdi = sr_dev_inst_user_new("Vendor", "Model", "Version");
+	fail_unless(sdi != NULL, "sr_dev_inst_user_new() failed.");
+	for (i = 0; i < 8; i++) {
+		g_snprintf(name, sizeof(name), "D%u", i);
+		fail_unless(sr_dev_inst_channel_add(sdi, i,
+				SR_CHANNEL_LOGIC, name) == SR_OK);
+	}
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7 / 13;
+	logic.length = sizeof(data);
+	logic.unitsize = 1;
+	logic.data = data;
+
+	for (i = 0; i < G_N_ELEMENTS(ids); i++) {
+		for (j = 0; j < G_N_ELEMENTS(o); j++) {
+			o[j] = sr_output_new(sr_output_find((char *)ids[i]),
+					NULL, sdi);
+			fail_unless(o[j] != NULL, "Failed to create '%s' output.",
+					ids[i]);
+		}
+		expected = g_string_new(NULL);
+		buf = g_string_new(NULL);
+		cb_buf = g_string_new(NULL);
+
+		packet.type = SR_DF_LOGIC;
+		packet.payload = &logic;
+		for (j = 0; j < 3; j++) {
+			if (j == 2) {
+				packet.type = SR_DF_END;
+				packet.payload = NULL;
+			}
+			fail_unless(sr_output_send(o[0], &packet, &out) == SR_OK);
+			if (out) {
+				g_string_append_len(expected, out->str, out->len);
+				g_string_free(out, TRUE);
+			}
+			fail_unless(sr_output_send_buffer(o[1], &packet,
+					buf) == SR_OK);
+			fail_unless(sr_output_send_callback(o[2], &packet,
+					append_output, cb_buf) == SR_OK);
+		}
+
+		fail_unless(expected->len > 0, "No '%s' output.", ids[i]);
+		/* The CSV and VCD headers start with the current time. */
+		j = 0;
+		if (!strcmp(ids[i], "csv") || !strcmp(ids[i], "vcd"))
+			j = strchr(expected->str, '\n') - expected->str;
+		fail_unless(buf->len == expected->len && !memcmp(buf->str + j,
+				expected->str + j, buf->len - j),
+				"Buffer sink got different '%s' output.", ids[i]);
+		fail_unless(cb_buf->len == expected->len && !memcmp(
+				cb_buf->str + j, expected->str + j, cb_buf->len - j),
+				"Callback sink got different '%s' output.", ids[i]);
+
+		for (j = 0; j < G_N_ELEMENTS(o); j++)
+			sr_output_free(o[j]);
+		g_string_free(expected, TRUE);
+		g_string_free(buf, TRUE);
+		g_string_free(cb_buf, TRUE);
+	}
+}
+END_TEST
+
+/*
+ * Check SR_DF_LOGIC_REPEAT packets are expanded for an output module
+ * which doesn't handle them, through every sink.
+ */
+START_TEST(test_output_logic_repeat)
+{
+	const struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic_repeat repeat;
+	struct sr_dev_inst *sdi;
+	GString *out, *buf, *cb_buf;
+	const uint8_t sample[] = { 0x5a, 0x03 };
+	char name[8];
+	unsigned int i, j;
+
+	sdi = sr_dev_inst_user_new("Vendor", "Model", "Version");
+	fail_unless(sdi != NULL, "sr_dev_inst_user_new() failed.");
+	for (i = 0; i < 10; i++) {
+		g_snprintf(name, sizeof(name), "D%u", i);
+		fail_unless(sr_dev_inst_channel_add(sdi, i,
+				SR_CHANNEL_LOGIC, name) == SR_OK);
+	}
+
+	/* More samples than fit into a single expanded packet. */
+	packet.type = SR_DF_LOGIC_REPEAT;
+	packet.payload = &repeat;
+	repeat.count = 100003;
+	repeat.unitsize = sizeof(sample);
+	repeat.data = (void *)sample;
+
+	o = sr_output_new(sr_output_find("binary"), NULL, sdi);
+	fail_unless(o != NULL, "Failed to create 'binary' output.");
+	fail_unless(sr_output_send(o, &packet, &out) == SR_OK);
+	buf = g_string_new(NULL);
+	fail_unless(sr_output_send_buffer(o, &packet, buf) == SR_OK);
+	cb_buf = g_string_new(NULL);
+	fail_unless(sr_output_send_callback(o, &packet, append_output,
+			cb_buf) == SR_OK);
+	sr_output_free(o);
+
+	fail_unless(out != NULL, "No 'binary' output.");
+	fail_unless(buf->len == out->len && !memcmp(buf->str, out->str,
+			out->len), "Buffer sink got different output.");
+	fail_unless(cb_buf->len == out->len && !memcmp(cb_buf->str, out->str,
+			out->len), "Callback sink got different output.");
+	fail_unless(out->len == repeat.count * repeat.unitsize,
+			"Got %zu bytes of output.", out->len);
+	for (i = 0; i < repeat.count; i++) {
+		for (j = 0; j < repeat.unitsize; j++)
+			fail_unless((uint8_t)out->str[i * repeat.unitsize + j]
+					== sample[j], "Sample %u is wrong.", i);
+	}
+
+	g_string_free(out, TRUE);
+	g_string_free(buf, TRUE);
+	g_string_free(cb_buf, TRUE);
+}
+END_TEST
+
+static void vcd_send(const struct sr_output *o, int type,
+		const void *payload, GString *vcd)
+{
+	struct sr_datafeed_packet packet;
+
+	packet.type = type;
+	packet.payload = payload;
+	fail_unless(sr_output_send_buffer(o, &packet, vcd) == SR_OK);
+}
+
+/*
+ * Check the VCD output only writes the enabled channels, rounds halfway
+ * timestamps to even, and keeps timestamps beyond 2^53 exact.
+ */
+START_TEST(test_output_vcd)
+{
+	/* D0 rises, D1 (disabled) rises, D2 rises, D8 (disabled), D9. */
+	const uint8_t samples[] = {
+		0x00, 0x00, 0x01, 0x00, 0x03, 0x00,
+		0x07, 0x00, 0x07, 0x01, 0x07, 0x03,
+	};
+	const uint8_t last[] = { 0x06, 0x03 };
+	/* 2.5 us per sample: (2^53 + 2) * 2.5 needs more than 53 bits. */
+	const uint64_t n = (UINT64_C(1) << 53) + 2;
+	const char *expected_header =
+		"$timescale 1 us $end\n"
+		"$scope module libsigrok $end\n"
+		"$var wire 1 ! D0 $end\n"
+		"$var wire 1 \" D2 $end\n"
+		"$var wire 1 # D3 $end\n"
+		"$var wire 1 $ D4 $end\n"
+		"$var wire 1 % D5 $end\n"
+		"$var wire 1 & D6 $end\n"
+		"$var wire 1 ' D7 $end\n"
+		"$var wire 1 ( D9 $end\n"
+		"$upscope $end\n"
+		"$enddefinitions $end\n";
+	const struct sr_output *o;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_logic_repeat repeat;
+	struct sr_config src;
+	struct sr_dev_inst *sdi;
+	struct sr_channel *ch;
+	GString *vcd;
+	GSList *l;
+	GString *expected;
+	const char *data;
+	char name[8];
+	unsigned int i;
+
+	sdi = sr_dev_inst_user_new("Vendor", "Model", "Version");
+	fail_unless(sdi != NULL, "sr_dev_inst_user_new() failed.");
+	for (i = 0; i < 10; i++) {
+		g_snprintf(name, sizeof(name), "D%u", i);
+		fail_unless(sr_dev_inst_channel_add(sdi, i,
+				SR_CHANNEL_LOGIC, name) == SR_OK);
+	}
+	for (l = sr_dev_inst_channels_get(sdi); l; l = l->next) {
+		ch = l->data;
+		if (ch->index == 1 || ch->index == 8)
+			sr_dev_channel_enable(ch, FALSE);
+	}
+
+	o = sr_output_new(sr_output_find("vcd"), NULL, sdi);
+	fail_unless(o != NULL, "Failed to create 'vcd' output.");
+	vcd = g_string_new(NULL);
+
+	header.feed_version = 1;
+	gettimeofday(&header.starttime, NULL);
+	vcd_send(o, SR_DF_HEADER, &header, vcd);
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_new_uint64(SR_KHZ(400));
+	meta.config = g_slist_append(NULL, &src);
+	vcd_send(o, SR_DF_META, &meta, vcd);
+	g_slist_free(meta.config);
+	g_variant_unref(g_variant_ref_sink(src.data));
+
+	logic.length = sizeof(samples);
+	logic.unitsize = 2;
+	logic.data = (void *)samples;
+	vcd_send(o, SR_DF_LOGIC, &logic, vcd);
+	repeat.count = n - sizeof(samples) / 2;
+	repeat.unitsize = 2;
+	repeat.data = (void *)(samples + sizeof(samples) - 2);
+	vcd_send(o, SR_DF_LOGIC_REPEAT, &repeat, vcd);
+	logic.length = sizeof(last);
+	logic.data = (void *)last;
+	vcd_send(o, SR_DF_LOGIC, &logic, vcd);
+	vcd_send(o, SR_DF_END, NULL, vcd);
+	sr_output_free(o);
+
+	/* Sample 1 is at 2.5 us, sample 3 at 7.5 us, sample 5 at 12.5 us. */
+	expected = g_string_new(expected_header);
+	g_string_append(expected,
+		"#0 0! 0\" 0# 0$ 0% 0& 0' 0(\n"
+		"#2 1!\n"
+		"#8 1\"\n"
+		"#12 1(\n");
+	g_string_append_printf(expected, "#%" PRIu64 " 0!\n", n * 5 / 2);
+	/* (n + 1) * 2.5 is 22517998136852487.5, and rounds up to even. */
+	g_string_append_printf(expected, "#%" PRIu64 "\n", (n + 1) * 5 / 2 + 1);
+
+	data = strstr(vcd->str, "$timescale");
+	fail_unless(data != NULL, "No timescale in VCD output.");
+	fail_unless(!strcmp(data, expected->str),
+			"Got VCD output:\n%s\nexpected:\n%s", data, expected->str);
+
+	g_string_free(vcd, TRUE);
+	g_string_free(expected, TRUE);
+}
+END_TEST
+
+#define TEXT_SAMPLES 61
+
+/*
+ * Output of the bits, hex and ascii modules as of libsigrok 0.4.0 for
+ * text_sample(), less the line with the package version. There are 12
+ * channels with D3 and D9 disabled, and a trigger at sample 25.
+ */
+static const struct {
+	const char *id;
+	uint32_t width;
+	const char *output;
+} text_goldens[] = {
+	{ "bits", 13,
+		"Acquisition with 10/12 channels at 1 MHz\n"
+		"D0:01001100 11001\n"
+		"D1:01110000 11110\n"
+		"D2:00101010 01010\n"
+		"D4:00000111 11000\n"
+		"D5:01010101 01101\n"
+		"D6:01100110 01110\n"
+		"D7:01111000 01111\n"
+		"D8:01111111 10000\n"
+		"D10:00011001 10011\n"
+		"D11:01010010 11010\n"
+		"D0:10010011 00110\n"
+		"D1:00011100 00111\n"
+		"D2:10110101 01101\n"
+		"D4:01111100 00011\n"
+		"D5:01010110 10101\n"
+		"D6:01100111 00110\n"
+		"D7:10000111 11000\n"
+		"D8:00000111 11111\n"
+		"D10:00110001 10011\n"
+		"D11:01011010 11010\n"
+		"T:             ^ 12\n"
+		"D0:01100100 11001\n"
+		"D1:10000111 00001\n"
+		"D2:01010010 10100\n"
+		"D4:11000001 11100\n"
+		"D5:01101010 10110\n"
+		"D6:01110011 00111\n"
+		"D7:01111100 00111\n"
+		"D8:10000000 00111\n"
+		"D10:00110011 00011\n"
+		"D11:01011010 01010\n"
+		"D0:10011001 00110\n"
+		"D1:11100001 11000\n"
+		"D2:10101011 01010\n"
+		"D4:00011111 00001\n"
+		"D5:10101010 01010\n"
+		"D6:00110011 10011\n"
+		"D7:11000011 11100\n"
+		"D8:11111100 00000\n"
+		"D10:00110011 00110\n"
+		"D11:01011010 01011\n"
+		"D0:01100110 0\n"
+		"D1:01111000 0\n"
+		"D2:11010101 0\n"
+		"D4:11110000 1\n"
+		"D5:10100101 0\n"
+		"D6:00111001 1\n"
+		"D7:00111110 0\n"
+		"D8:00111111 1\n"
+		"D10:01110011 0\n"
+		"D11:01011010 0\n" },
+	{ "bits", 16,
+		"Acquisition with 10/12 channels at 1 MHz\n"
+		"D0:01001100 11001100\n"
+		"D1:01110000 11110000\n"
+		"D2:00101010 01010101\n"
+		"D4:00000111 11000011\n"
+		"D5:01010101 01101010\n"
+		"D6:01100110 01110011\n"
+		"D7:01111000 01111100\n"
+		"D8:01111111 10000000\n"
+		"D10:00011001 10011001\n"
+		"D11:01010010 11010010\n"
+		"D0:10011001 10011001\n"
+		"D1:11100001 11100001\n"
+		"D2:10101011 01010100\n"
+		"D4:11100000 11110000\n"
+		"D5:10110101 01011010\n"
+		"D6:00111001 10011100\n"
+		"D7:00111110 00011111\n"
+		"D8:00111111 11100000\n"
+		"D10:10001100 11001100\n"
+		"D11:11010110 10010110\n"
+		"T:          ^ 9\n"
+		"D0:00110011 00110010\n"
+		"D1:11000011 11000011\n"
+		"D2:10101001 01010110\n"
+		"D4:01111000 00111110\n"
+		"D5:10101101 01010100\n"
+		"D6:11001110 01100111\n"
+		"D7:00001111 10000111\n"
+		"D8:00001111 11111000\n"
+		"D10:11000110 01100110\n"
+		"D11:10010100 10110100\n"
+		"D0:01100110 01100\n"
+		"D1:10000111 10000\n"
+		"D2:10101101 01010\n"
+		"D4:00011111 00001\n"
+		"D5:10101010 01010\n"
+		"D6:00110011 10011\n"
+		"D7:11000011 11100\n"
+		"D8:00000011 11111\n"
+		"D10:01100111 00110\n"
+		"D11:10110101 10100\n" },
+	{ "hex", 13,
+		"Acquisition with 10/12 channels at 1 MHz\n"
+		"D0:4c \n"
+		"D1:70 \n"
+		"D2:2a \n"
+		"D4:07 \n"
+		"D5:55 \n"
+		"D6:66 \n"
+		"D7:78 \n"
+		"D8:7f \n"
+		"D10:19 \n"
+		"D11:52 \n"
+		"D0:93 \n"
+		"D1:1c \n"
+		"D2:b5 \n"
+		"D4:7c \n"
+		"D5:56 \n"
+		"D6:67 \n"
+		"D7:87 \n"
+		"D8:07 \n"
+		"D10:31 \n"
+		"D11:5a \n"
+		"T:             ^ 12\n"
+		"D0:64 \n"
+		"D1:87 \n"
+		"D2:52 \n"
+		"D4:c1 \n"
+		"D5:6a \n"
+		"D6:73 \n"
+		"D7:7c \n"
+		"D8:80 \n"
+		"D10:33 \n"
+		"D11:5a \n"
+		"D0:99 \n"
+		"D1:e1 \n"
+		"D2:ab \n"
+		"D4:1f \n"
+		"D5:aa \n"
+		"D6:33 \n"
+		"D7:c3 \n"
+		"D8:fc \n"
+		"D10:33 \n"
+		"D11:5a \n"
+		"D0:66 00 \n"
+		"D1:78 00 \n"
+		"D2:d5 00 \n"
+		"D4:f0 80 \n"
+		"D5:a5 00 \n"
+		"D6:39 80 \n"
+		"D7:3e 00 \n"
+		"D8:3f 80 \n"
+		"D10:73 00 \n"
+		"D11:5a 00 \n" },
+	{ "hex", 16,
+		"Acquisition with 10/12 channels at 1 MHz\n"
+		"D0:4c cc \n"
+		"D1:70 f0 \n"
+		"D2:2a 55 \n"
+		"D4:07 c3 \n"
+		"D5:55 6a \n"
+		"D6:66 73 \n"
+		"D7:78 7c \n"
+		"D8:7f 80 \n"
+		"D10:19 99 \n"
+		"D11:52 d2 \n"
+		"D0:99 99 \n"
+		"D1:e1 e1 \n"
+		"D2:ab 54 \n"
+		"D4:e0 f0 \n"
+		"D5:b5 5a \n"
+		"D6:39 9c \n"
+		"D7:3e 1f \n"
+		"D8:3f e0 \n"
+		"D10:8c cc \n"
+		"D11:d6 96 \n"
+		"T:          ^ 9\n"
+		"D0:33 32 \n"
+		"D1:c3 c3 \n"
+		"D2:a9 56 \n"
+		"D4:78 3e \n"
+		"D5:ad 54 \n"
+		"D6:ce 67 \n"
+		"D7:0f 87 \n"
+		"D8:0f f8 \n"
+		"D10:c6 66 \n"
+		"D11:94 b4 \n"
+		"D0:66 60 \n"
+		"D1:87 80 \n"
+		"D2:ad 50 \n"
+		"D4:1f 08 \n"
+		"D5:aa 50 \n"
+		"D6:33 98 \n"
+		"D7:c3 e0 \n"
+		"D8:03 f8 \n"
+		"D10:67 30 \n"
+		"D11:b5 a0 \n" },
+	{ "ascii", 13,
+		"Acquisition with 10/12 channels at 1 MHz\n"
+		"D0:./\\./\"\\./\"\\./\n"
+		"D1:./\"\"\\.../\"\"\"\\\n"
+		"D2:../\\/\\/\\./\\/\\\n"
+		"D4:...../\"\"\"\"\\..\n"
+		"D5:./\\/\\/\\/\\/\"\\/\n"
+		"D6:./\"\\./\"\\./\"\"\\\n"
+		"D7:./\"\"\"\\.../\"\"\"\n"
+		"D8:./\"\"\"\"\"\"\"\\...\n"
+		"D10:.../\"\\./\"\\./\"\n"
+		"D11:./\\/\\./\\/\"\\/\\\n"
+		"D0:\"\\./\\./\"\\./\"\\\n"
+		"D1:.../\"\"\\.../\"\"\n"
+		"D2:\"\\/\"\\/\\/\\/\"\\/\n"
+		"D4:./\"\"\"\"\\..../\"\n"
+		"D5:./\\/\\/\"\\/\\/\\/\n"
+		"D6:./\"\\./\"\"\\./\"\\\n"
+		"D7:\"\\.../\"\"\"\"\\..\n"
+		"D8:...../\"\"\"\"\"\"\"\n"
+		"D10:../\"\\../\"\\./\"\n"
+		"D11:./\\/\"\\/\\/\"\\/\\\n"
+		"T:             ^ 12\n"
+		"D0:./\"\\./\\./\"\\./\n"
+		"D1:\"\\.../\"\"\\.../\n"
+		"D2:./\\/\\./\\/\\/\\.\n"
+		"D4:\"\"\\..../\"\"\"\\.\n"
+		"D5:./\"\\/\\/\\/\\/\"\\\n"
+		"D6:./\"\"\\./\"\\./\"\"\n"
+		"D7:./\"\"\"\"\\.../\"\"\n"
+		"D8:\"\\......../\"\"\n"
+		"D10:../\"\\./\"\\../\"\n"
+		"D11:./\\/\"\\/\\./\\/\\\n"
+		"D0:\"\\./\"\\./\\./\"\\\n"
+		"D1:\"\"\"\\.../\"\"\\..\n"
+		"D2:\"\\/\\/\\/\"\\/\\/\\\n"
+		"D4:.../\"\"\"\"\\.../\n"
+		"D5:\"\\/\\/\\/\\./\\/\\\n"
+		"D6:../\"\\./\"\"\\./\"\n"
+		"D7:\"\"\\.../\"\"\"\"\\.\n"
+		"D8:\"\"\"\"\"\"\\......\n"
+		"D10:../\"\\./\"\\./\"\\\n"
+		"D11:./\\/\"\\/\\./\\/\"\n"
+		"D0:./\"\\./\"\\.\n"
+		"D1:./\"\"\"\\...\n"
+		"D2:\"\"\\/\\/\\/\\\n"
+		"D4:\"\"\"\"\\.../\n"
+		"D5:\"\\/\\./\\/\\\n"
+		"D6:../\"\"\\./\"\n"
+		"D7:../\"\"\"\"\\.\n"
+		"D8:../\"\"\"\"\"\"\n"
+		"D10:./\"\"\\./\"\\\n"
+		"D11:./\\/\"\\/\\.\n" },
+	{ "ascii", 16,
+		"Acquisition with 10/12 channels at 1 MHz\n"
+		"D0:./\\./\"\\./\"\\./\"\\.\n"
+		"D1:./\"\"\\.../\"\"\"\\...\n"
+		"D2:../\\/\\/\\./\\/\\/\\/\n"
+		"D4:...../\"\"\"\"\\.../\"\n"
+		"D5:./\\/\\/\\/\\/\"\\/\\/\\\n"
+		"D6:./\"\\./\"\\./\"\"\\./\"\n"
+		"D7:./\"\"\"\\.../\"\"\"\"\\.\n"
+		"D8:./\"\"\"\"\"\"\"\\......\n"
+		"D10:.../\"\\./\"\\./\"\\./\n"
+		"D11:./\\/\\./\\/\"\\/\\./\\\n"
+		"D0:\"\\./\"\\./\"\\./\"\\./\n"
+		"D1:\"\"\"\\.../\"\"\"\\.../\n"
+		"D2:\"\\/\\/\\/\"\\/\\/\\/\\.\n"
+		"D4:\"\"\"\\..../\"\"\"\\...\n"
+		"D5:\"\\/\"\\/\\/\\/\\/\"\\/\\\n"
+		"D6:../\"\"\\./\"\\./\"\"\\.\n"
+		"D7:../\"\"\"\"\\.../\"\"\"\"\n"
+		"D8:../\"\"\"\"\"\"\"\"\\....\n"
+		"D10:\"\\../\"\\./\"\\./\"\\.\n"
+		"D11:\"\"\\/\\/\"\\/\\./\\/\"\\\n"
+		"T:          ^ 9\n"
+		"D0:../\"\\./\"\\./\"\\./\\\n"
+		"D1:\"\"\\.../\"\"\"\\.../\"\n"
+		"D2:\"\\/\\/\\./\\/\\/\\/\"\\\n"
+		"D4:./\"\"\"\\..../\"\"\"\"\\\n"
+		"D5:\"\\/\\/\"\\/\\/\\/\\/\\.\n"
+		"D6:\"\"\\./\"\"\\./\"\\./\"\"\n"
+		"D7:..../\"\"\"\"\\.../\"\"\n"
+		"D8:..../\"\"\"\"\"\"\"\"\\..\n"
+		"D10:\"\"\\../\"\\./\"\\./\"\\\n"
+		"D11:\"\\./\\/\\./\\/\"\\/\\.\n"
+		"D0:./\"\\./\"\\./\"\\.\n"
+		"D1:\"\\.../\"\"\"\\...\n"
+		"D2:\"\\/\\/\"\\/\\/\\/\\\n"
+		"D4:.../\"\"\"\"\\.../\n"
+		"D5:\"\\/\\/\\/\\./\\/\\\n"
+		"D6:../\"\\./\"\"\\./\"\n"
+		"D7:\"\"\\.../\"\"\"\"\\.\n"
+		"D8:....../\"\"\"\"\"\"\n"
+		"D10:./\"\\./\"\"\\./\"\\\n"
+		"D11:\"\\/\"\\/\\/\"\\/\\.\n" },
+};
+
+static uint16_t text_sample(unsigned int i)
+{
+	return (i * 2654435761u) >> 20 & 0x0fff;
+}
+
+/*
+ * Check the text output modules against their output from before they
+ * were optimized, with line widths that aren't multiples of 8, a partial
+ * final byte and a trigger.
+ */
+START_TEST(test_output_text_golden)
+{
+	const unsigned int packets[] = { 25, 30, 6 };
+	const struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_logic logic;
+	struct sr_config src;
+	struct sr_dev_inst *sdi;
+	struct sr_channel *ch;
+	GHashTable *params;
+	GString *text, *out;
+	GSList *l;
+	uint8_t data[TEXT_SAMPLES * 2];
+	char name[8];
+	const char *body;
+	unsigned int i, j, start;
+
+	sdi = sr_dev_inst_user_new("Vendor", "Model", "Version");
+	fail_unless(sdi != NULL, "sr_dev_inst_user_new() failed.");
+	for (i = 0; i < 12; i++) {
+		g_snprintf(name, sizeof(name), "D%u", i);
+		fail_unless(sr_dev_inst_channel_add(sdi, i,
+				SR_CHANNEL_LOGIC, name) == SR_OK);
+	}
+	for (l = sr_dev_inst_channels_get(sdi); l; l = l->next) {
+		ch = l->data;
+		if (ch->index == 3 || ch->index == 9)
+			sr_dev_channel_enable(ch, FALSE);
+	}
+	for (i = 0; i < TEXT_SAMPLES; i++) {
+		data[2 * i] = text_sample(i) & 0xff;
+		data[2 * i + 1] = text_sample(i) >> 8;
+	}
+
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_ref_sink(g_variant_new_uint64(SR_MHZ(1)));
+	meta.config = g_slist_append(NULL, &src);
+
+	for (i = 0; i < G_N_ELEMENTS(text_goldens); i++) {
+		params = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				(GDestroyNotify)g_variant_unref);
+		g_hash_table_insert(params, g_strdup("width"), g_variant_ref_sink(
+				g_variant_new_uint32(text_goldens[i].width)));
+		o = sr_output_new(sr_output_find((char *)text_goldens[i].id),
+				params, sdi);
+		fail_unless(o != NULL, "Failed to create '%s' output.",
+				text_goldens[i].id);
+		g_hash_table_destroy(params);
+
+		text = g_string_new(NULL);
+		packet.type = SR_DF_META;
+		packet.payload = &meta;
+		fail_unless(sr_output_send_buffer(o, &packet, text) == SR_OK);
+		for (j = 0, start = 0; j < G_N_ELEMENTS(packets); j++) {
+			if (j == 1) {
+				packet.type = SR_DF_TRIGGER;
+				packet.payload = NULL;
+				fail_unless(sr_output_send_buffer(o, &packet,
+						text) == SR_OK);
+			}
+			packet.type = SR_DF_LOGIC;
+			packet.payload = &logic;
+			logic.length = packets[j] * 2;
+			logic.unitsize = 2;
+			logic.data = data + start * 2;
+			start += packets[j];
+			fail_unless(sr_output_send(o, &packet, &out) == SR_OK);
+			if (out) {
+				g_string_append_len(text, out->str, out->len);
+				g_string_free(out, TRUE);
+			}
+		}
+		packet.type = SR_DF_END;
+		packet.payload = NULL;
+		fail_unless(sr_output_send_buffer(o, &packet, text) == SR_OK);
+		sr_output_free(o);
+
+		body = strchr(text->str, '\n');
+		fail_unless(body != NULL, "No '%s' output.", text_goldens[i].id);
+		fail_unless(!strcmp(body + 1, text_goldens[i].output),
+				"'%s' output with width %u differs:\n%s\nexpected:\n%s",
+				text_goldens[i].id, text_goldens[i].width, body + 1,
+				text_goldens[i].output);
+		g_string_free(text, TRUE);
+	}
+
+	g_slist_free(meta.config);
+	g_variant_unref(src.data);
+}
+END_TEST
+
+#define WAV_HEADER_SIZE 46
+#define WAV_CHANNELS 4
+/* A2 is disabled. */
+#define WAV_ENABLED 3
+#define WAV_ALL 0x0b
+
+struct wav_packet {
+	/* Channel indices in the packet, in order; -1 ends the list. */
+	int channels[WAV_CHANNELS + 1];
+	int num_samples;
+};
+
+/* Sample n of the channel with the given index. */
+static float wav_sample(int index, int n)
+{
+	return (index * 1000 + n) / 4.0 - 100;
+}
+
+static void wav_store(GString *s, float value)
+{
+	uint32_t u;
+
+	memcpy(&u, &value, 4);
+	u = GUINT32_TO_LE(u);
+	g_string_append_len(s, (const char *)&u, 4);
+}
+
+/*
+ * Send the packets to a 'wav' output for a device with four analog
+ * channels, of which A2 is disabled, and check the header and the
+ * interleaved samples of A0, A1 and A3 in the output.
+ */
+static void wav_check(const struct wav_packet *packets,
+		unsigned int num_packets, double scale)
+{
+	const int enabled[WAV_ENABLED] = { 0, 1, 3 };
+	const struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_analog analog;
+	struct sr_config src;
+	struct sr_dev_inst *sdi;
+	struct sr_channel *ch, *chans[WAV_CHANNELS];
+	GHashTable *params;
+	GString *wav, *expected;
+	GSList *l;
+	float *data;
+	char name[8];
+	int sent[WAV_CHANNELS], num_samples, i, j, k, c;
+	unsigned int p;
+
+	sdi = sr_dev_inst_user_new("Vendor", "Model", "Version");
+	fail_unless(sdi != NULL, "sr_dev_inst_user_new() failed.");
+	for (i = 0; i < WAV_CHANNELS; i++) {
+		g_snprintf(name, sizeof(name), "A%d", i);
+		fail_unless(sr_dev_inst_channel_add(sdi, i,
+				SR_CHANNEL_ANALOG, name) == SR_OK);
+	}
+	for (l = sr_dev_inst_channels_get(sdi); l; l = l->next) {
+		ch = l->data;
+		chans[ch->index] = ch;
+		if (ch->index == 2)
+			sr_dev_channel_enable(ch, FALSE);
+	}
+
+	params = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)g_variant_unref);
+	g_hash_table_insert(params, g_strdup("scale"),
+			g_variant_ref_sink(g_variant_new_double(scale)));
+	o = sr_output_new(sr_output_find("wav"), params, sdi);
+	fail_unless(o != NULL, "Failed to create 'wav' output.");
+	g_hash_table_destroy(params);
+
+	wav = g_string_new(NULL);
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_ref_sink(g_variant_new_uint64(SR_KHZ(48)));
+	meta.config = g_slist_append(NULL, &src);
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	fail_unless(sr_output_send_buffer(o, &packet, wav) == SR_OK);
+	g_slist_free(meta.config);
+	g_variant_unref(src.data);
+
+	memset(sent, 0, sizeof(sent));
+	memset(&analog, 0, sizeof(analog));
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	for (p = 0; p < num_packets; p++) {
+		analog.channels = NULL;
+		for (c = 0; packets[p].channels[c] >= 0; c++)
+			analog.channels = g_slist_append(analog.channels,
+					chans[packets[p].channels[c]]);
+		analog.num_samples = packets[p].num_samples;
+		data = g_malloc(sizeof(float) * c * analog.num_samples);
+		for (i = 0; i < analog.num_samples; i++) {
+			for (j = 0; j < c; j++) {
+				k = packets[p].channels[j];
+				data[i * c + j] = wav_sample(k, sent[k] + i);
+			}
+		}
+		for (j = 0; j < c; j++)
+			sent[packets[p].channels[j]] += analog.num_samples;
+		analog.data = data;
+		fail_unless(sr_output_send_buffer(o, &packet, wav) == SR_OK,
+				"Packet %u was rejected.", p);
+		g_slist_free(analog.channels);
+		g_free(data);
+	}
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	fail_unless(sr_output_send_buffer(o, &packet, wav) == SR_OK);
+	sr_output_free(o);
+
+	num_samples = sent[0];
+	for (i = 0; i < WAV_ENABLED; i++)
+		fail_unless(sent[enabled[i]] == num_samples,
+				"Sent %d samples on A%d, but %d on A0.",
+				sent[enabled[i]], enabled[i], num_samples);
+
+	expected = g_string_new(NULL);
+	g_string_append_len(expected, "RIFF\xff\xff\xff\xffWAVE"
+			"fmt \x12\0\0\0\x03\0\x03\0\x80\xbb\0\0\0\xca\x08\0"
+			"\x0c\0\x20\0\0\0data\xff\xff\xff\xff", WAV_HEADER_SIZE);
+	for (i = 0; i < num_samples; i++) {
+		for (j = 0; j < WAV_ENABLED; j++) {
+			if (scale == 0.0)
+				wav_store(expected, wav_sample(enabled[j], i));
+			else
+				wav_store(expected,
+						wav_sample(enabled[j], i) / scale);
+		}
+	}
+
+	fail_unless(wav->len == expected->len,
+			"Got %" G_GSIZE_FORMAT " bytes of WAV output, expected %"
+			G_GSIZE_FORMAT ".", wav->len, expected->len);
+	fail_unless(!memcmp(wav->str, expected->str, WAV_HEADER_SIZE),
+			"WAV header differs.");
+	for (i = WAV_HEADER_SIZE; i < (int)wav->len; i += 4)
+		fail_unless(!memcmp(wav->str + i, expected->str + i, 4),
+				"Sample %d of A%d differs.",
+				(i - WAV_HEADER_SIZE) / 4 / WAV_ENABLED,
+				enabled[(i - WAV_HEADER_SIZE) / 4 % WAV_ENABLED]);
+
+	g_string_free(wav, TRUE);
+	g_string_free(expected, TRUE);
+}
+
+/*
+ * Check interleaved packets, written out directly when there are more
+ * than MIN_DATA_CHUNK_SAMPLES (10) samples, and buffered otherwise or
+ * when samples are already buffered.
+ */
+START_TEST(test_output_wav_interleaved)
+{
+	const struct wav_packet packets[] = {
+		{ { 0, 1, 3, -1 }, 40 },
+		{ { 0, 1, 3, -1 }, 5 },
+		{ { 0, 1, 3, -1 }, 50 },
+		{ { 0, 1, 3, -1 }, 3 },
+		{ { 0, 1, 3, -1 }, 11 },
+		{ { 3, 0, 1, -1 }, 20 },
+		{ { 0, 1, 3, -1 }, 10 },
+	};
+
+	wav_check(packets, G_N_ELEMENTS(packets), 0.0);
+}
+END_TEST
+
+/*
+ * Check one channel per packet, with the channel buffers growing past
+ * their initial 100 samples while other channels have samples buffered.
+ */
+START_TEST(test_output_wav_per_channel)
+{
+	const struct wav_packet packets[] = {
+		{ { 0, -1 }, 150 },
+		{ { 1, -1 }, 30 },
+		{ { 3, -1 }, 30 },
+		{ { 1, -1 }, 120 },
+		{ { 3, -1 }, 200 },
+		{ { 0, -1 }, 80 },
+		{ { 1, -1 }, 80 },
+		{ { 1, 3, -1 }, 7 },
+		{ { 0, -1 }, 7 },
+		{ { 3, -1 }, 2 },
+		{ { 1, 0, -1 }, 2 },
+	};
+
+	wav_check(packets, G_N_ELEMENTS(packets), 0.0);
+}
+END_TEST
+
+/* Check the samples are divided by a non-zero scale. */
+START_TEST(test_output_wav_scale)
+{
+	const struct wav_packet packets[] = {
+		{ { 0, 1, 3, -1 }, 21 },
+		{ { 0, -1 }, 5 },
+		{ { 3, 1, -1 }, 5 },
+		{ { 0, 1, 3, -1 }, 4 },
+	};
+
+	wav_check(packets, G_N_ELEMENTS(packets), 3.0);
+	wav_check(packets, G_N_ELEMENTS(packets), -0.5);
+}
+END_TEST
+
+/* Check a packet with a disabled channel, or too many, is rejected. */
+START_TEST(test_output_wav_disabled)
+{
+	const int packets[][WAV_CHANNELS + 1] = {
+		{ 2, -1 },
+		{ 0, 2, -1 },
+		{ 0, 1, 2, 3, -1 },
+	};
+	const struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	struct sr_dev_inst *sdi;
+	struct sr_channel *ch, *chans[WAV_CHANNELS];
+	GString *wav;
+	GSList *l;
+	float data[WAV_CHANNELS * 20];
+	char name[8];
+	unsigned int i, c;
+
+	sdi = sr_dev_inst_user_new("Vendor", "Model", "Version");
+	fail_unless(sdi != NULL, "sr_dev_inst_user_new() failed.");
+	for (i = 0; i < WAV_CHANNELS; i++) {
+		g_snprintf(name, sizeof(name), "A%u", i);
+		fail_unless(sr_dev_inst_channel_add(sdi, i,
+				SR_CHANNEL_ANALOG, name) == SR_OK);
+	}
+	for (l = sr_dev_inst_channels_get(sdi); l; l = l->next) {
+		ch = l->data;
+		chans[ch->index] = ch;
+		if (ch->index == 2)
+			sr_dev_channel_enable(ch, FALSE);
+	}
+	memset(data, 0, sizeof(data));
+
+	o = sr_output_new(sr_output_find("wav"), NULL, sdi);
+	fail_unless(o != NULL, "Failed to create 'wav' output.");
+	wav = g_string_new(NULL);
+	memset(&analog, 0, sizeof(analog));
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	analog.data = data;
+	analog.num_samples = 20;
+	for (i = 0; i < G_N_ELEMENTS(packets); i++) {
+		analog.channels = NULL;
+		for (c = 0; packets[i][c] >= 0; c++)
+			analog.channels = g_slist_append(analog.channels,
+					chans[packets[i][c]]);
+		fail_unless(sr_output_send_buffer(o, &packet, wav) != SR_OK,
+				"Packet %u wasn't rejected.", i);
+		g_slist_free(analog.channels);
+	}
+	/* Nothing but the header got written. */
+	fail_unless(wav->len == WAV_HEADER_SIZE,
+			"Got %" G_GSIZE_FORMAT " bytes of WAV output.", wav->len);
+	sr_output_free(o);
+	g_string_free(wav, TRUE);
+}
+END_TEST
+
 Suite *suite_output_all(void)
 {
 	Suite *s;
@@ -110,6 +1042,17 @@ Suite *suite_output_all(void)
 	tcase_add_test(tc, test_output_desc);
 	tcase_add_test(tc, test_output_find);
 	tcase_add_test(tc, test_output_options);
+	tcase_add_test(tc, test_output_sinks);
+	tcase_add_test(tc, test_output_logic_repeat);
+	tcase_add_test(tc, test_output_vcd);
+	tcase_add_test(tc, test_output_text_golden);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("wav");
+	tcase_add_test(tc, test_output_wav_interleaved);
+	tcase_add_test(tc, test_output_wav_per_channel);
+	tcase_add_test(tc, test_output_wav_scale);
+	tcase_add_test(tc, test_output_wav_disabled);
 	suite_add_tcase(s, tc);
 
 	return s;
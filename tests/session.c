@@ -19,6 +19,9 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
 #include <check.h>
 #include "../include/libsigrok/libsigrok.h"
 #include "lib.h"
@@ -185,6 +188,794 @@ START_TEST(test_session_trigger_get_null)
 }
 END_TEST
 
+/*
+ * Check whether the datafeed queue can be enabled, queried and disabled.
+ * If any call fails (or segfaults) this test will fail.
+ */
+START_TEST(test_session_datafeed_queue)
+{
+	int ret;
+	unsigned int depth, max_depth, overruns;
+	struct sr_session *sess;
+
+	sr_session_new(srtest_ctx, &sess);
+
+	/* No stats without a queue. */
+	ret = sr_session_datafeed_queue_stats(sess, &depth, NULL, NULL);
+	fail_unless(ret == SR_ERR_ARG);
+
+	ret = sr_session_datafeed_queue_set(sess, 100);
+	fail_unless(ret == SR_OK, "sr_session_datafeed_queue_set() failed: %d.", ret);
+	ret = sr_session_datafeed_queue_stats(sess, &depth, &max_depth, &overruns);
+	fail_unless(ret == SR_OK);
+	fail_unless(depth == 0 && max_depth == 0 && overruns == 0);
+
+	/* Resizing an existing queue must work. */
+	ret = sr_session_datafeed_queue_set(sess, 1000);
+	fail_unless(ret == SR_OK);
+
+	ret = sr_session_datafeed_queue_set(sess, 0);
+	fail_unless(ret == SR_OK);
+	ret = sr_session_datafeed_queue_stats(sess, &depth, NULL, NULL);
+	fail_unless(ret == SR_ERR_ARG);
+
+	/* Destroying a session with a queue must work. */
+	sr_session_datafeed_queue_set(sess, 16);
+	ret = sr_session_destroy(sess);
+	fail_unless(ret == SR_OK, "sr_session_destroy() failed: %d.", ret);
+}
+END_TEST
+
+#define QUEUE_PACKETS 64
+#define QUEUE_PACKET_SIZE 256
+
+struct queue_check {
+	struct sr_session *session;
+	int num_packets;
+	gboolean seen_header;
+	gboolean seen_end;
+	gboolean in_order;
+	GByteArray *data;
+	GSList *retained;
+};
+
+/* Slow consumer, so the producer overruns the small queue. */
+static void queue_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct queue_check *qc;
+	const struct sr_datafeed_logic *logic;
+
+	(void)sdi;
+
+	qc = cb_data;
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		qc->in_order &= !qc->seen_header && qc->data->len == 0;
+		qc->seen_header = TRUE;
+		break;
+	case SR_DF_LOGIC:
+		qc->in_order &= qc->seen_header && !qc->seen_end;
+		logic = packet->payload;
+		g_byte_array_append(qc->data, logic->data, logic->length);
+		/* Keep every packet, its data must outlive the session. */
+		qc->retained = g_slist_prepend(qc->retained,
+				sr_packet_ref(packet));
+		qc->num_packets++;
+		g_usleep(1000);
+		break;
+	case SR_DF_END:
+		qc->seen_end = TRUE;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Send numbered samples through the binary input module. */
+static gpointer queue_producer(gpointer data)
+{
+	struct queue_check *qc;
+	const struct sr_input *in;
+	GString *buf;
+	int ret, i, j, n;
+
+	qc = data;
+	in = sr_input_new(sr_input_find("binary"), NULL);
+	fail_unless(in != NULL, "Failed to create input instance.");
+
+	buf = g_string_sized_new(QUEUE_PACKET_SIZE);
+	n = 0;
+	for (i = 0; i < QUEUE_PACKETS; i++) {
+		g_string_truncate(buf, 0);
+		for (j = 0; j < QUEUE_PACKET_SIZE; j++)
+			g_string_append_c(buf, n++);
+		ret = sr_input_send(in, buf);
+		fail_unless(ret == SR_OK, "sr_input_send() error: %d", ret);
+		if (i == 0) {
+			/* The device is ready, the data is sent later. */
+			sr_session_dev_add(qc->session,
+					sr_input_dev_inst_get(in));
+		}
+		/* The queue must have copied what it needs. */
+		memset(buf->str, 0xaa, buf->len);
+	}
+	g_string_free(buf, TRUE);
+	ret = sr_input_end(in);
+	fail_unless(ret == SR_OK, "sr_input_end() error: %d", ret);
+
+	return (gpointer)in;
+}
+
+/*
+ * Check packets sent from another thread go through the datafeed queue
+ * in order, with their data copied, and that the queue counts overruns.
+ * If any check fails (or the test segfaults) this test will fail.
+ */
+START_TEST(test_session_datafeed_queue_send)
+{
+	struct queue_check qc;
+	const struct sr_input *in;
+	const struct sr_datafeed_logic *logic;
+	struct sr_datafeed_packet *packet;
+	unsigned int depth, max_depth, overruns;
+	GThread *thread;
+	GSList *l;
+	guint i;
+	int ret;
+
+	memset(&qc, 0, sizeof(qc));
+	qc.in_order = TRUE;
+	qc.data = g_byte_array_new();
+	sr_session_new(srtest_ctx, &qc.session);
+	sr_session_datafeed_callback_add(qc.session, queue_datafeed_in, &qc);
+	ret = sr_session_datafeed_queue_set(qc.session, 4);
+	fail_unless(ret == SR_OK, "sr_session_datafeed_queue_set() failed: %d.", ret);
+
+	thread = g_thread_new("producer", queue_producer, &qc);
+	in = g_thread_join(thread);
+
+	/* Removing the devices delivers all packets still queued. */
+	sr_session_dev_remove_all(qc.session);
+	fail_unless(qc.seen_header && qc.seen_end, "Packets missing.");
+	fail_unless(qc.in_order, "Packets out of order.");
+	fail_unless(qc.data->len == QUEUE_PACKETS * QUEUE_PACKET_SIZE,
+			"Got %u bytes of samples.", qc.data->len);
+	for (i = 0; i < qc.data->len; i++)
+		fail_unless(qc.data->data[i] == (uint8_t)i,
+				"Wrong sample %u: 0x%02x.", i, qc.data->data[i]);
+
+	ret = sr_session_datafeed_queue_stats(qc.session,
+			&depth, &max_depth, &overruns);
+	fail_unless(ret == SR_OK);
+	fail_unless(depth == 0, "Queue not empty: %u.", depth);
+	fail_unless(max_depth > 0 && max_depth <= 4, "Max depth %u.", max_depth);
+	fail_unless(overruns > 0, "No overruns counted.");
+
+	sr_session_destroy(qc.session);
+	sr_input_free(in);
+
+	/* Retained packets keep their own data. */
+	i = qc.data->len;
+	for (l = qc.retained; l; l = l->next) {
+		packet = l->data;
+		logic = packet->payload;
+		i -= logic->length;
+		fail_unless(!memcmp(logic->data, qc.data->data + i,
+				logic->length), "Retained packet changed.");
+		sr_packet_free(packet);
+	}
+	fail_unless(i == 0);
+	g_slist_free(qc.retained);
+	g_byte_array_free(qc.data, TRUE);
+}
+END_TEST
+
+START_TEST(test_session_datafeed_queue_bogus)
+{
+	int ret;
+
+	/* NULL session, must not segfault. */
+	ret = sr_session_datafeed_queue_set(NULL, 16);
+	fail_unless(ret == SR_ERR_ARG);
+	ret = sr_session_datafeed_queue_stats(NULL, NULL, NULL, NULL);
+	fail_unless(ret == SR_ERR_ARG);
+}
+END_TEST
+
+/*
+ * Check whether the buffer pool statistics of a new session are empty.
+ * If the call fails (or segfaults) this test will fail.
+ */
+START_TEST(test_session_buffer_pool_stats)
+{
+	int ret;
+	uint64_t hits, misses, peak_bytes;
+	struct sr_session *sess;
+
+	sr_session_new(srtest_ctx, &sess);
+	ret = sr_session_buffer_pool_stats(sess, &hits, &misses, &peak_bytes);
+	fail_unless(ret == SR_OK, "sr_session_buffer_pool_stats() failed: %d.", ret);
+	fail_unless(hits == 0 && misses == 0 && peak_bytes == 0);
+	sr_session_destroy(sess);
+
+	/* NULL session, must not segfault. */
+	ret = sr_session_buffer_pool_stats(NULL, &hits, NULL, NULL);
+	fail_unless(ret == SR_ERR_ARG);
+}
+END_TEST
+
+struct pool_check {
+	const uint8_t *data;
+	gboolean retain;
+	struct sr_datafeed_packet *retained;
+};
+
+static void pool_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct pool_check *pc;
+	const struct sr_datafeed_logic *logic;
+
+	(void)sdi;
+
+	pc = cb_data;
+	if (packet->type != SR_DF_LOGIC)
+		return;
+	logic = packet->payload;
+	pc->data = logic->data;
+	if (pc->retain)
+		pc->retained = sr_packet_ref(packet);
+}
+
+/*
+ * Send one logic packet through the queue, and wait until it arrived.
+ * Removing the device delivers the queued packets, so add it back after.
+ */
+static void pool_send(struct sr_session *sess, const struct sr_input *in,
+		gsize size)
+{
+	GString *buf;
+	int ret;
+
+	buf = g_string_sized_new(size);
+	g_string_set_size(buf, size);
+	memset(buf->str, 0x55, size);
+	ret = sr_input_send(in, buf);
+	fail_unless(ret == SR_OK, "sr_input_send() error: %d", ret);
+	g_string_free(buf, TRUE);
+	sr_session_dev_remove_all(sess);
+	sr_session_dev_add(sess, sr_input_dev_inst_get(in));
+}
+
+static void pool_check_stats(struct sr_session *sess, uint64_t exp_hits,
+		uint64_t exp_misses, uint64_t exp_peak_bytes)
+{
+	uint64_t hits, misses, peak_bytes;
+	int ret;
+
+	ret = sr_session_buffer_pool_stats(sess, &hits, &misses, &peak_bytes);
+	fail_unless(ret == SR_OK, "sr_session_buffer_pool_stats() failed: %d.", ret);
+	fail_unless(hits == exp_hits && misses == exp_misses
+			&& peak_bytes == exp_peak_bytes,
+			"Got %" PRIu64 " hits, %" PRIu64 " misses, peak %" PRIu64
+			" bytes.", hits, misses, peak_bytes);
+}
+
+/*
+ * Check buffers for queued packets are taken from the pool by size
+ * class, and reused once the packets are done with.
+ * If any check fails (or the test segfaults) this test will fail.
+ */
+START_TEST(test_session_buffer_pool_reuse)
+{
+	struct sr_session *sess;
+	const struct sr_input *in;
+	struct pool_check pc;
+	const uint8_t *small, *large;
+	GString *buf;
+
+	memset(&pc, 0, sizeof(pc));
+	sr_session_new(srtest_ctx, &sess);
+	sr_session_datafeed_callback_add(sess, pool_datafeed_in, &pc);
+	sr_session_datafeed_queue_set(sess, 16);
+
+	in = sr_input_new(sr_input_find("binary"), NULL);
+	fail_unless(in != NULL, "Failed to create input instance.");
+	buf = g_string_new(NULL);
+	sr_input_send(in, buf);
+	g_string_free(buf, TRUE);
+	sr_session_dev_add(sess, sr_input_dev_inst_get(in));
+
+	/* The first buffer of a size class is allocated... */
+	pool_send(sess, in, 1000);
+	pool_check_stats(sess, 0, 1, 4096);
+	small = pc.data;
+
+	/* ...and reused for the next packet of that class. */
+	pool_send(sess, in, 4096);
+	pool_check_stats(sess, 1, 1, 4096);
+	fail_unless(pc.data == small, "4 KiB buffer not reused.");
+
+	/* Other size classes have their own buffers. */
+	pool_send(sess, in, 5000);
+	pool_check_stats(sess, 1, 2, 4096 + 8192);
+	large = pc.data;
+	fail_unless(large != small);
+	pool_send(sess, in, 1);
+	pool_check_stats(sess, 2, 2, 4096 + 8192);
+	fail_unless(pc.data == small, "4 KiB buffer not reused.");
+	pool_send(sess, in, 8000);
+	pool_check_stats(sess, 3, 2, 4096 + 8192);
+	fail_unless(pc.data == large, "8 KiB buffer not reused.");
+
+	/* A retained packet holds on to its buffer. */
+	pc.retain = TRUE;
+	pool_send(sess, in, 100);
+	pool_check_stats(sess, 4, 2, 4096 + 8192);
+	fail_unless(pc.retained != NULL);
+	pc.retain = FALSE;
+	pool_send(sess, in, 100);
+	pool_check_stats(sess, 4, 3, 2 * 4096 + 8192);
+	fail_unless(pc.data != small);
+
+	/* Until it is freed. */
+	sr_packet_free(pc.retained);
+	pool_send(sess, in, 100);
+	pool_send(sess, in, 100);
+	pool_check_stats(sess, 6, 3, 2 * 4096 + 8192);
+
+	sr_session_destroy(sess);
+	sr_input_free(in);
+}
+END_TEST
+
+static const char vcd_repeat[] =
+	"$timescale 1 us $end\n"
+	"$scope module top $end\n"
+	"$var wire 1 ! a $end\n"
+	"$var wire 1 \" b $end\n"
+	"$upscope $end\n"
+	"$enddefinitions $end\n"
+	"#0\n1!\n0\"\n"
+	"#100000\n0!\n1\"\n"
+	"#100010\n1!\n"
+	"#100011\n";
+
+struct repeat_check {
+	GByteArray *samples;
+	GArray *counts;
+	unsigned int num_logic;
+};
+
+static void repeat_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct repeat_check *rc;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_repeat *repeat;
+	uint64_t i;
+
+	(void)sdi;
+
+	rc = cb_data;
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		fail_unless(logic->unitsize == 1);
+		g_byte_array_append(rc->samples, logic->data, logic->length);
+		rc->num_logic++;
+	} else if (packet->type == SR_DF_LOGIC_REPEAT) {
+		repeat = packet->payload;
+		fail_unless(repeat->unitsize == 1);
+		for (i = 0; i < repeat->count; i++)
+			g_byte_array_append(rc->samples, repeat->data, 1);
+		g_array_append_val(rc->counts, repeat->count);
+	}
+}
+
+/* Feed vcd_repeat to a session through the VCD input module. */
+static void repeat_run(struct repeat_check *rc, gboolean logic_repeat)
+{
+	struct sr_session *sess;
+	const struct sr_input *in;
+	GString *buf;
+	const char *body;
+	int ret;
+
+	sr_session_new(srtest_ctx, &sess);
+	sr_session_datafeed_callback_add(sess, repeat_datafeed_in, rc);
+	if (logic_repeat)
+		sr_session_logic_repeat_set(sess, TRUE);
+
+	in = sr_input_new(sr_input_find("vcd"), NULL);
+	fail_unless(in != NULL, "Failed to create input instance.");
+	body = strstr(vcd_repeat, "#0");
+	buf = g_string_new_len(vcd_repeat, body - vcd_repeat);
+	fail_unless(sr_input_send(in, buf) == SR_OK);
+	fail_unless(sr_input_dev_inst_get(in) != NULL, "VCD header not parsed.");
+	sr_session_dev_add(sess, sr_input_dev_inst_get(in));
+	g_string_assign(buf, body);
+	ret = sr_input_send(in, buf);
+	fail_unless(ret == SR_OK, "sr_input_send() error: %d", ret);
+	fail_unless(sr_input_end(in) == SR_OK);
+	g_string_free(buf, TRUE);
+
+	sr_session_destroy(sess);
+	sr_input_free(in);
+}
+
+static void repeat_check_samples(const struct repeat_check *rc)
+{
+	unsigned int i;
+	uint8_t exp;
+
+	fail_unless(rc->samples->len == 100011, "Got %u samples.",
+			rc->samples->len);
+	for (i = 0; i < rc->samples->len; i++) {
+		exp = i < 100000 ? 0x01 : i < 100010 ? 0x02 : 0x03;
+		fail_unless(rc->samples->data[i] == exp,
+				"Sample %u is 0x%02x, expected 0x%02x.",
+				i, rc->samples->data[i], exp);
+	}
+}
+
+/*
+ * Check the session expands the VCD input's SR_DF_LOGIC_REPEAT packets
+ * for callbacks, unless they asked for them with
+ * sr_session_logic_repeat_set().
+ */
+START_TEST(test_session_logic_repeat)
+{
+	static const uint64_t exp_counts[] = { 100000, 10, 1 };
+	struct repeat_check rc;
+	unsigned int i;
+
+	rc.samples = g_byte_array_new();
+	rc.counts = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+	rc.num_logic = 0;
+	repeat_run(&rc, FALSE);
+	repeat_check_samples(&rc);
+	fail_unless(rc.counts->len == 0, "Got unexpanded repeat packets.");
+	/* The first stretch doesn't fit into a single packet. */
+	fail_unless(rc.num_logic > 3, "Got %u logic packets.", rc.num_logic);
+
+	g_byte_array_set_size(rc.samples, 0);
+	rc.num_logic = 0;
+	repeat_run(&rc, TRUE);
+	repeat_check_samples(&rc);
+	fail_unless(rc.num_logic == 0, "Got %u logic packets.", rc.num_logic);
+	fail_unless(rc.counts->len == G_N_ELEMENTS(exp_counts),
+			"Got %u repeat packets.", rc.counts->len);
+	for (i = 0; i < G_N_ELEMENTS(exp_counts); i++)
+		fail_unless(g_array_index(rc.counts, uint64_t, i) == exp_counts[i],
+				"Repeat packet %u has count %" PRIu64 ".", i,
+				g_array_index(rc.counts, uint64_t, i));
+
+	g_byte_array_free(rc.samples, TRUE);
+	g_array_free(rc.counts, TRUE);
+}
+END_TEST
+
+struct loop_check {
+	int order[4];
+	int revents[4];
+	int num_calls;
+	gint64 start;
+	gint64 elapsed[4];
+};
+
+struct loop_source {
+	struct loop_check *lc;
+	int id;
+	gboolean read;
+};
+
+/* Record the call and remove the source. */
+static int loop_source_cb(int fd, int revents, void *cb_data)
+{
+	struct loop_source *ls;
+	struct loop_check *lc;
+	char c;
+
+	ls = cb_data;
+	lc = ls->lc;
+	if (ls->read && (revents & G_IO_IN))
+		fail_unless(read(fd, &c, 1) == 1);
+	if (lc->num_calls < 4) {
+		lc->order[lc->num_calls] = ls->id;
+		lc->revents[lc->num_calls] = revents;
+		lc->elapsed[lc->num_calls] = g_get_monotonic_time() - lc->start;
+	}
+	lc->num_calls++;
+
+	return FALSE;
+}
+
+/* A session with a device to run, sources are added by the caller. */
+static struct sr_session *loop_session_new(const struct sr_input **in,
+		struct loop_check *lc)
+{
+	struct sr_session *sess;
+	GString *buf;
+
+	memset(lc, 0, sizeof(struct loop_check));
+	sr_session_new(srtest_ctx, &sess);
+	*in = sr_input_new(sr_input_find("binary"), NULL);
+	fail_unless(*in != NULL, "Failed to create input instance.");
+	buf = g_string_new(NULL);
+	sr_input_send(*in, buf);
+	g_string_free(buf, TRUE);
+	sr_session_dev_add(sess, sr_input_dev_inst_get(*in));
+
+	return sess;
+}
+
+/*
+ * Run the session with the poll() loop, or with the epoll loop when
+ * epoll is set. epoll is enabled after the sources were added.
+ */
+static void loop_session_run(struct sr_session *sess, struct loop_check *lc,
+		gboolean epoll)
+{
+	int ret;
+
+	ret = sr_session_epoll_set(sess, epoll);
+	fail_unless(ret == SR_OK, "sr_session_epoll_set() failed: %d.", ret);
+	lc->start = g_get_monotonic_time();
+	ret = sr_session_run(sess);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+}
+
+/*
+ * Check a source fires when its descriptor is ready, and a source
+ * whose descriptor isn't ready fires once its timeout expired.
+ */
+START_TEST(test_session_source_fd)
+{
+	struct sr_session *sess;
+	const struct sr_input *in;
+	struct loop_check lc;
+	struct loop_source ls[2];
+	int fds[2], idle[2];
+
+	sess = loop_session_new(&in, &lc);
+	fail_unless(pipe(fds) == 0 && pipe(idle) == 0);
+	ls[0] = (struct loop_source){ &lc, 0, TRUE };
+	ls[1] = (struct loop_source){ &lc, 1, TRUE };
+	sr_session_source_add(sess, fds[0], G_IO_IN, -1, loop_source_cb, &ls[0]);
+	sr_session_source_add(sess, idle[0], G_IO_IN, 50, loop_source_cb, &ls[1]);
+	fail_unless(write(fds[1], "x", 1) == 1);
+	/* Note: _i is the loop variable from tcase_add_loop_test(). */
+	loop_session_run(sess, &lc, _i);
+
+	fail_unless(lc.num_calls == 2, "%d calls.", lc.num_calls);
+	fail_unless(lc.order[0] == 0 && (lc.revents[0] & G_IO_IN));
+	fail_unless(lc.order[1] == 1 && lc.revents[1] == 0);
+	fail_unless(lc.elapsed[1] >= 50 * G_TIME_SPAN_MILLISECOND,
+			"Timeout fired after %" G_GINT64_FORMAT " us.",
+			lc.elapsed[1]);
+
+	close(fds[0]);
+	close(fds[1]);
+	close(idle[0]);
+	close(idle[1]);
+	sr_session_destroy(sess);
+	sr_input_free(in);
+}
+END_TEST
+
+/*
+ * Check sources without a descriptor fire in the order of their
+ * timeouts, not in the order they were added.
+ */
+START_TEST(test_session_source_timeout_order)
+{
+	struct sr_session *sess;
+	const struct sr_input *in;
+	struct loop_check lc;
+	struct loop_source ls[3];
+	GPollFD pollfd[3];
+	static const int timeouts[] = { 60, 20, 40 };
+	int i;
+
+	sess = loop_session_new(&in, &lc);
+	for (i = 0; i < 3; i++) {
+		/* Sources are told apart by their GPollFD. */
+		pollfd[i].fd = -1;
+		pollfd[i].events = 0;
+		ls[i] = (struct loop_source){ &lc, i, FALSE };
+		sr_session_source_add_pollfd(sess, &pollfd[i], timeouts[i],
+				loop_source_cb, &ls[i]);
+	}
+	/* Note: _i is the loop variable from tcase_add_loop_test(). */
+	loop_session_run(sess, &lc, _i);
+
+	fail_unless(lc.num_calls == 3, "%d calls.", lc.num_calls);
+	fail_unless(lc.order[0] == 1 && lc.order[1] == 2 && lc.order[2] == 0,
+			"Fired in order %d, %d, %d.",
+			lc.order[0], lc.order[1], lc.order[2]);
+	for (i = 0; i < 3; i++)
+		fail_unless(lc.elapsed[i] >= timeouts[lc.order[i]]
+				* G_TIME_SPAN_MILLISECOND);
+
+	sr_session_destroy(sess);
+	sr_input_free(in);
+}
+END_TEST
+
+struct repeat_source {
+	int max_calls;
+	int num_calls;
+	gint64 first;
+	gint64 last;
+	gint64 min_interval;
+};
+
+/* Record the time of the call, and keep the source for max_calls. */
+static int repeat_source_cb(int fd, int revents, void *cb_data)
+{
+	struct repeat_source *rs;
+	gint64 now;
+
+	(void)fd;
+	(void)revents;
+
+	rs = cb_data;
+	now = g_get_monotonic_time();
+	if (rs->num_calls == 0)
+		rs->first = now;
+	else if (rs->num_calls == 1 || now - rs->last < rs->min_interval)
+		rs->min_interval = now - rs->last;
+	rs->last = now;
+
+	return ++rs->num_calls < rs->max_calls;
+}
+
+/*
+ * Check a source's timeout counts from its last callback, and that a
+ * source with a longer timeout fires while a shorter one keeps firing.
+ */
+START_TEST(test_session_source_timeout_repeat)
+{
+	struct sr_session *sess;
+	const struct sr_input *in;
+	struct loop_check lc;
+	struct repeat_source rs[2];
+	GPollFD pollfd[2];
+	static const int timeouts[] = { 10, 30 };
+	int i;
+
+	sess = loop_session_new(&in, &lc);
+	memset(rs, 0, sizeof(rs));
+	rs[0].max_calls = 8;
+	rs[1].max_calls = 2;
+	for (i = 0; i < 2; i++) {
+		pollfd[i].fd = -1;
+		pollfd[i].events = 0;
+		sr_session_source_add_pollfd(sess, &pollfd[i], timeouts[i],
+				repeat_source_cb, &rs[i]);
+	}
+	/* Note: _i is the loop variable from tcase_add_loop_test(). */
+	loop_session_run(sess, &lc, _i);
+
+	for (i = 0; i < 2; i++) {
+		fail_unless(rs[i].num_calls == rs[i].max_calls,
+				"Source %d fired %d times.", i, rs[i].num_calls);
+		fail_unless(rs[i].first - lc.start
+				>= timeouts[i] * G_TIME_SPAN_MILLISECOND,
+				"Source %d fired after %" G_GINT64_FORMAT " us.",
+				i, rs[i].first - lc.start);
+		fail_unless(rs[i].min_interval
+				>= timeouts[i] * G_TIME_SPAN_MILLISECOND,
+				"Source %d fired again after %" G_GINT64_FORMAT
+				" us.", i, rs[i].min_interval);
+	}
+	fail_unless(rs[1].first < rs[0].last,
+			"Longer timeout only fired after the shorter one.");
+
+	sr_session_destroy(sess);
+	sr_input_free(in);
+}
+END_TEST
+
+/*
+ * Check two sources polling the same descriptor both fire. epoll
+ * refuses to register a descriptor twice (EEXIST).
+ */
+START_TEST(test_session_source_duplicate_fd)
+{
+	struct sr_session *sess;
+	const struct sr_input *in;
+	struct loop_check lc;
+	struct loop_source ls[2];
+	GPollFD pollfd[2];
+	int fds[2];
+
+	sess = loop_session_new(&in, &lc);
+	fail_unless(pipe(fds) == 0);
+	fail_unless(write(fds[1], "xy", 2) == 2);
+	pollfd[0].fd = pollfd[1].fd = fds[0];
+	pollfd[0].events = pollfd[1].events = G_IO_IN;
+	ls[0] = (struct loop_source){ &lc, 0, FALSE };
+	ls[1] = (struct loop_source){ &lc, 1, FALSE };
+	sr_session_source_add_pollfd(sess, &pollfd[0], -1,
+			loop_source_cb, &ls[0]);
+	sr_session_source_add_pollfd(sess, &pollfd[1], -1,
+			loop_source_cb, &ls[1]);
+	/* Note: _i is the loop variable from tcase_add_loop_test(). */
+	loop_session_run(sess, &lc, _i);
+
+	fail_unless(lc.num_calls == 2, "%d calls.", lc.num_calls);
+	fail_unless(lc.order[0] != lc.order[1]);
+	fail_unless((lc.revents[0] & G_IO_IN) && (lc.revents[1] & G_IO_IN));
+
+	close(fds[0]);
+	close(fds[1]);
+	sr_session_destroy(sess);
+	sr_input_free(in);
+}
+END_TEST
+
+/*
+ * Check a source on a regular file fires right away, as poll() reports
+ * files as always ready. epoll refuses them (EPERM).
+ */
+START_TEST(test_session_source_regular_file)
+{
+	struct sr_session *sess;
+	const struct sr_input *in;
+	struct loop_check lc;
+	struct loop_source ls;
+	GError *error;
+	gchar *filename;
+	int fd;
+
+	sess = loop_session_new(&in, &lc);
+	error = NULL;
+	fd = g_file_open_tmp("sigrok-test-XXXXXX", &filename, &error);
+	fail_unless(fd >= 0, "Failed to create temporary file.");
+	ls = (struct loop_source){ &lc, 0, FALSE };
+	sr_session_source_add(sess, fd, G_IO_IN, 1000, loop_source_cb, &ls);
+	/* Note: _i is the loop variable from tcase_add_loop_test(). */
+	loop_session_run(sess, &lc, _i);
+
+	fail_unless(lc.num_calls == 1, "%d calls.", lc.num_calls);
+	fail_unless(lc.revents[0] & G_IO_IN);
+	fail_unless(lc.elapsed[0] < 1000 * G_TIME_SPAN_MILLISECOND,
+			"Waited for the timeout.");
+
+	close(fd);
+	g_unlink(filename);
+	g_free(filename);
+	sr_session_destroy(sess);
+	sr_input_free(in);
+}
+END_TEST
+
+/* Check the epoll loop can be switched on and off. */
+START_TEST(test_session_epoll_set)
+{
+	struct sr_session *sess;
+	int ret;
+
+	ret = sr_session_epoll_set(NULL, TRUE);
+	fail_unless(ret == SR_ERR_ARG, "NULL session accepted: %d.", ret);
+
+	sr_session_new(srtest_ctx, &sess);
+	ret = sr_session_epoll_set(sess, TRUE);
+	fail_unless(ret == SR_OK, "sr_session_epoll_set() failed: %d.", ret);
+	ret = sr_session_epoll_set(sess, TRUE);
+	fail_unless(ret == SR_OK, "sr_session_epoll_set() failed: %d.", ret);
+	ret = sr_session_epoll_set(sess, FALSE);
+	fail_unless(ret == SR_OK, "sr_session_epoll_set() failed: %d.", ret);
+	ret = sr_session_epoll_set(sess, FALSE);
+	fail_unless(ret == SR_OK, "sr_session_epoll_set() failed: %d.", ret);
+	/* The session frees the loop. */
+	sr_session_epoll_set(sess, TRUE);
+	sr_session_destroy(sess);
+}
+END_TEST
+
 Suite *suite_session(void)
 {
 	Suite *s;
@@ -209,5 +1000,34 @@ Suite *suite_session(void)
 	tcase_add_test(tc, test_session_trigger_get_null);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("datafeed_queue");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_session_datafeed_queue);
+	tcase_add_test(tc, test_session_datafeed_queue_bogus);
+	tcase_add_test(tc, test_session_datafeed_queue_send);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("event_loop");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_session_epoll_set);
+	/* Loop 0 runs the poll() loop, loop 1 the epoll loop. */
+	tcase_add_loop_test(tc, test_session_source_fd, 0, 2);
+	tcase_add_loop_test(tc, test_session_source_timeout_order, 0, 2);
+	tcase_add_loop_test(tc, test_session_source_timeout_repeat, 0, 2);
+	tcase_add_loop_test(tc, test_session_source_duplicate_fd, 0, 2);
+	tcase_add_loop_test(tc, test_session_source_regular_file, 0, 2);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("buffer_pool");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_session_buffer_pool_stats);
+	tcase_add_test(tc, test_session_buffer_pool_reuse);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("logic_repeat");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_session_logic_repeat);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
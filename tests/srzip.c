@@ -0,0 +1,529 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <check.h>
+#include "../include/libsigrok/libsigrok.h"
+#include "lib.h"
+
+#define SRZIP_CHANNELS    16
+#define SRZIP_UNITSIZE    2
+#define SRZIP_SAMPLES     50000
+#define SRZIP_SAMPLERATE  SR_MHZ(1)
+/* Small chunks, so a capture spans many of them. */
+#define SRZIP_CHUNK_SIZE  4096
+/* Packets don't line up with the chunks. */
+#define SRZIP_PACKET_SIZE 3002
+
+static struct sr_dev_inst *srzip_sdi;
+
+static void srzip_setup(void)
+{
+	char name[8];
+	int i;
+
+	srtest_setup();
+	srzip_sdi = sr_dev_inst_user_new("Vendor", "Model", "Version");
+	for (i = 0; i < SRZIP_CHANNELS; i++) {
+		g_snprintf(name, sizeof(name), "D%d", i);
+		sr_dev_inst_channel_add(srzip_sdi, i, SR_CHANNEL_LOGIC, name);
+	}
+}
+
+/* Samples which change in most bits, but still compress. */
+static uint8_t *srzip_data_new(void)
+{
+	uint8_t *data;
+	uint16_t sample;
+	int i;
+
+	data = g_malloc(SRZIP_SAMPLES * SRZIP_UNITSIZE);
+	for (i = 0; i < SRZIP_SAMPLES; i++) {
+		sample = i ^ (i >> 3) ^ (i << 7);
+		data[i * 2] = sample & 0xff;
+		data[i * 2 + 1] = sample >> 8;
+	}
+
+	return data;
+}
+
+static char *srzip_filename_new(void)
+{
+	GError *error;
+	char *filename;
+	int fd;
+
+	error = NULL;
+	fd = g_file_open_tmp("sigrok-test-XXXXXX.sr", &filename, &error);
+	fail_unless(fd != -1, "Failed to create temporary file.");
+	close(fd);
+
+	return filename;
+}
+
+/* Save the data through the srzip output with the given options. */
+static void srzip_write(const char *filename, const uint8_t *data,
+		uint64_t length, GHashTable *params)
+{
+	const struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_logic logic;
+	struct sr_config src;
+	GString *out;
+	uint64_t offset;
+
+	if (!params)
+		params = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+				(GDestroyNotify)g_variant_unref);
+	g_hash_table_insert(params, "filename",
+			g_variant_ref_sink(g_variant_new_string(filename)));
+	g_hash_table_insert(params, "chunksize",
+			g_variant_ref_sink(g_variant_new_uint64(SRZIP_CHUNK_SIZE)));
+	o = sr_output_new(sr_output_find("srzip"), params, srzip_sdi);
+	g_hash_table_destroy(params);
+	fail_unless(o != NULL, "Failed to create the srzip output.");
+
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_new_uint64(SRZIP_SAMPLERATE);
+	meta.config = g_slist_append(NULL, &src);
+	fail_unless(sr_output_send(o, &packet, &out) == SR_OK);
+	g_slist_free(meta.config);
+	g_variant_unref(g_variant_ref_sink(src.data));
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.unitsize = SRZIP_UNITSIZE;
+	for (offset = 0; offset < length; offset += logic.length) {
+		logic.length = MIN(SRZIP_PACKET_SIZE, length - offset);
+		logic.data = (void *)(data + offset);
+		fail_unless(sr_output_send(o, &packet, &out) == SR_OK);
+	}
+
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	fail_unless(sr_output_send(o, &packet, &out) == SR_OK);
+	sr_output_free(o);
+}
+
+static unsigned int srzip_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t srzip_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * List the entries in the zip central directory, one line each with the
+ * name, compression method, CRC and sizes. The dates are left out.
+ */
+static char *srzip_entries(const char *filename)
+{
+	GString *entries;
+	gchar *buf;
+	gsize len;
+	const uint8_t *eocd, *p;
+	unsigned int count, i, name_len;
+
+	fail_unless(g_file_get_contents(filename, &buf, &len, NULL));
+	fail_unless(len >= 22, "'%s' is too short.", filename);
+	eocd = (const uint8_t *)buf + len - 22;
+	fail_unless(srzip_le32(eocd) == 0x06054b50,
+			"No end of central directory in '%s'.", filename);
+
+	entries = g_string_new(NULL);
+	count = srzip_le16(eocd + 10);
+	p = (const uint8_t *)buf + srzip_le32(eocd + 16);
+	for (i = 0; i < count; i++) {
+		fail_unless(srzip_le32(p) == 0x02014b50);
+		name_len = srzip_le16(p + 28);
+		g_string_append_printf(entries, "%.*s %u %08x %u %u\n",
+				name_len, p + 46, srzip_le16(p + 10),
+				srzip_le32(p + 16), srzip_le32(p + 20),
+				srzip_le32(p + 24));
+		p += 46 + name_len + srzip_le16(p + 30) + srzip_le16(p + 32);
+	}
+	g_free(buf);
+
+	return g_string_free(entries, FALSE);
+}
+
+/* Make the stored data of the entry undecodable. */
+static void srzip_corrupt(const char *filename, const char *entry)
+{
+	gchar *buf;
+	gsize len;
+	uint8_t *eocd, *p, *local;
+	unsigned int count, i, name_len;
+
+	fail_unless(g_file_get_contents(filename, &buf, &len, NULL));
+	eocd = (uint8_t *)buf + len - 22;
+	count = srzip_le16(eocd + 10);
+	p = (uint8_t *)buf + srzip_le32(eocd + 16);
+	for (i = 0; i < count; i++) {
+		name_len = srzip_le16(p + 28);
+		if (name_len == strlen(entry) && !memcmp(p + 46, entry, name_len))
+			break;
+		p += 46 + name_len + srzip_le16(p + 30) + srzip_le16(p + 32);
+	}
+	fail_unless(i < count, "No '%s' in '%s'.", entry, filename);
+	fail_unless(srzip_le16(p + 10) == 8, "'%s' is not deflated.", entry);
+
+	/* A deflate block can't start with reserved block type 3. */
+	local = (uint8_t *)buf + srzip_le32(p + 42);
+	local[30 + srzip_le16(local + 26) + srzip_le16(local + 28)] = 0xff;
+	fail_unless(g_file_set_contents(filename, buf, len, NULL));
+	g_free(buf);
+}
+
+static void srzip_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+
+	(void)sdi;
+
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		fail_unless(logic->unitsize == SRZIP_UNITSIZE);
+		g_byte_array_append(cb_data, logic->data, logic->length);
+	}
+}
+
+/*
+ * Replay the session file from sample start on, limited to limit samples
+ * if that is not 0. Returns the samples it sent.
+ */
+static GByteArray *srzip_read(const char *filename, uint64_t start,
+		uint64_t limit)
+{
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	GVariant *gvar;
+	GByteArray *samples;
+
+	fail_unless(sr_session_load(srtest_ctx, filename, &session) == SR_OK,
+			"Failed to load '%s'.", filename);
+	fail_unless(sr_session_dev_list(session, &devices) == SR_OK);
+	fail_unless(g_slist_length(devices) == 1);
+	sdi = devices->data;
+	g_slist_free(devices);
+
+	fail_unless(sr_config_get(sr_dev_inst_driver_get(sdi), sdi, NULL,
+			SR_CONF_SAMPLERATE, &gvar) == SR_OK);
+	fail_unless(g_variant_get_uint64(gvar) == SRZIP_SAMPLERATE);
+	g_variant_unref(gvar);
+	fail_unless(sr_config_set(sdi, NULL, SR_CONF_CAPTURE_START,
+			g_variant_new_uint64(start)) == SR_OK);
+	if (limit)
+		fail_unless(sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+				g_variant_new_uint64(limit)) == SR_OK);
+
+	samples = g_byte_array_new();
+	sr_session_datafeed_callback_add(session, srzip_datafeed_in, samples);
+	fail_unless(sr_session_start(session) == SR_OK);
+	fail_unless(sr_session_run(session) == SR_OK);
+	sr_session_destroy(session);
+
+	return samples;
+}
+
+/* Check that a capture saved in many chunks replays unchanged. */
+START_TEST(test_srzip_roundtrip)
+{
+	GByteArray *samples;
+	uint8_t *data;
+	char *filename;
+
+	data = srzip_data_new();
+	filename = srzip_filename_new();
+	srzip_write(filename, data, SRZIP_SAMPLES * SRZIP_UNITSIZE, NULL);
+
+	samples = srzip_read(filename, 0, 0);
+	fail_unless(samples->len == SRZIP_SAMPLES * SRZIP_UNITSIZE,
+			"Replayed %u bytes.", samples->len);
+	fail_unless(!memcmp(samples->data, data, samples->len),
+			"Replayed samples differ.");
+
+	g_byte_array_free(samples, TRUE);
+	g_unlink(filename);
+	g_free(filename);
+	g_free(data);
+}
+END_TEST
+
+/* Check that the number of workers doesn't change the archive. */
+START_TEST(test_srzip_workers)
+{
+	GHashTable *params;
+	uint8_t *data;
+	char *filename[2], *entries[2], name[16];
+	unsigned int i, n;
+
+	data = srzip_data_new();
+	for (i = 0; i < 2; i++) {
+		params = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+				(GDestroyNotify)g_variant_unref);
+		g_hash_table_insert(params, "workers",
+				g_variant_ref_sink(g_variant_new_uint32(i ? 4 : 1)));
+		filename[i] = srzip_filename_new();
+		srzip_write(filename[i], data, SRZIP_SAMPLES * SRZIP_UNITSIZE,
+				params);
+		entries[i] = srzip_entries(filename[i]);
+	}
+
+	fail_unless(!strcmp(entries[0], entries[1]),
+			"Archives differ:\n%s\n%s", entries[0], entries[1]);
+	/* The chunks are in order, all there, and compressed. */
+	n = (SRZIP_SAMPLES * SRZIP_UNITSIZE + SRZIP_CHUNK_SIZE - 1)
+			/ SRZIP_CHUNK_SIZE;
+	for (i = 1; i <= n + 1; i++) {
+		g_snprintf(name, sizeof(name), "\nlogic-1-%u ", i);
+		if (i <= n)
+			fail_unless(strstr(entries[0], name) != NULL,
+					"No chunk %u:\n%s", i, entries[0]);
+		else
+			fail_unless(strstr(entries[0], name) == NULL,
+					"Extra chunk %u:\n%s", i, entries[0]);
+	}
+	g_snprintf(name, sizeof(name), "\nlogic-1-%u 8 ", n);
+	fail_unless(strstr(entries[0], name) != NULL,
+			"Chunks not deflated:\n%s", entries[0]);
+
+	for (i = 0; i < 2; i++) {
+		g_unlink(filename[i]);
+		g_free(filename[i]);
+		g_free(entries[i]);
+	}
+	g_free(data);
+}
+END_TEST
+
+/* Check replay of ranges starting in and spanning several chunks. */
+START_TEST(test_srzip_replay_range)
+{
+	static const struct {
+		uint64_t start;
+		uint64_t limit;
+	} ranges[] = {
+		/* Chunks hold SRZIP_CHUNK_SIZE / SRZIP_UNITSIZE samples. */
+		{ 2048, 0 },
+		{ 3000, 0 },
+		{ 1000, 5000 },
+		{ 2047, 2 },
+		{ 4095, 2049 },
+		{ SRZIP_SAMPLES - 10, 100 },
+		{ SRZIP_SAMPLES, 0 },
+		{ SRZIP_SAMPLES + 1, 10 },
+	};
+	GByteArray *samples;
+	uint64_t start, num;
+	uint8_t *data;
+	char *filename;
+	unsigned int i;
+
+	data = srzip_data_new();
+	filename = srzip_filename_new();
+	srzip_write(filename, data, SRZIP_SAMPLES * SRZIP_UNITSIZE, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(ranges); i++) {
+		start = MIN(ranges[i].start, SRZIP_SAMPLES);
+		num = SRZIP_SAMPLES - start;
+		if (ranges[i].limit)
+			num = MIN(num, ranges[i].limit);
+		samples = srzip_read(filename, ranges[i].start, ranges[i].limit);
+		fail_unless(samples->len == num * SRZIP_UNITSIZE,
+				"Range %u: replayed %u bytes, expected %" PRIu64 ".",
+				i, samples->len, num * SRZIP_UNITSIZE);
+		fail_unless(num == 0 || !memcmp(samples->data,
+				data + start * SRZIP_UNITSIZE, samples->len),
+				"Range %u: samples differ.", i);
+		g_byte_array_free(samples, TRUE);
+	}
+
+	g_unlink(filename);
+	g_free(filename);
+	g_free(data);
+}
+END_TEST
+
+/* Check that a read error while seeking to the start stops the replay. */
+START_TEST(test_srzip_replay_read_error)
+{
+	GByteArray *samples;
+	uint8_t *data;
+	char *filename;
+
+	data = srzip_data_new();
+	filename = srzip_filename_new();
+	srzip_write(filename, data, SRZIP_SAMPLES * SRZIP_UNITSIZE, NULL);
+	srzip_corrupt(filename, "logic-1-3");
+
+	/* Sample 5000 is in the third chunk. */
+	samples = srzip_read(filename, 5000, 0);
+	fail_unless(samples->len == 0,
+			"Replayed %u bytes past the read error.", samples->len);
+	g_byte_array_free(samples, TRUE);
+
+	/* Replay up to the broken chunk still works. */
+	samples = srzip_read(filename, 1000, 3000);
+	fail_unless(samples->len == 3000 * SRZIP_UNITSIZE);
+	fail_unless(!memcmp(samples->data, data + 1000 * SRZIP_UNITSIZE,
+			samples->len));
+	g_byte_array_free(samples, TRUE);
+
+	g_unlink(filename);
+	g_free(filename);
+	g_free(data);
+}
+END_TEST
+
+/*
+ * Expected overview block k of the given level: the last sample in the
+ * block, then the channels changing anywhere in it.
+ */
+static void srzip_overview_block(const uint8_t *data, int level, uint64_t k,
+		uint8_t *block)
+{
+	uint64_t block_samples, first, last, i;
+	int j;
+
+	block_samples = 1;
+	while (level-- > 0)
+		block_samples *= 256;
+	first = k * block_samples;
+	last = MIN(first + block_samples, SRZIP_SAMPLES) - 1;
+
+	memcpy(block, data + last * SRZIP_UNITSIZE, SRZIP_UNITSIZE);
+	memset(block + SRZIP_UNITSIZE, 0, SRZIP_UNITSIZE);
+	for (i = MAX(first, 1); i <= last; i++) {
+		for (j = 0; j < SRZIP_UNITSIZE; j++)
+			block[SRZIP_UNITSIZE + j] |= data[i * SRZIP_UNITSIZE + j]
+					^ data[(i - 1) * SRZIP_UNITSIZE + j];
+	}
+}
+
+static void srzip_overview_check(const char *filename, const uint8_t *data,
+		int level, uint64_t start, uint64_t num_samples,
+		uint64_t first_block, uint64_t num_blocks)
+{
+	uint8_t *blocks, expected[2 * SRZIP_UNITSIZE];
+	uint64_t n, k;
+	int unitsize;
+
+	fail_unless(sr_session_overview_get(filename, level, start,
+			num_samples, &blocks, &n, &unitsize) == SR_OK,
+			"Level %d: no overview.", level);
+	fail_unless(unitsize == SRZIP_UNITSIZE);
+	fail_unless(n == num_blocks, "Level %d: %" PRIu64 " blocks, "
+			"expected %" PRIu64 ".", level, n, num_blocks);
+	for (k = 0; k < n; k++) {
+		srzip_overview_block(data, level, first_block + k, expected);
+		fail_unless(!memcmp(blocks + k * sizeof(expected), expected,
+				sizeof(expected)), "Level %d: block %" PRIu64
+				" differs.", level, first_block + k);
+	}
+	g_free(blocks);
+}
+
+/* Check every level of the overview against the samples. */
+START_TEST(test_srzip_overview)
+{
+	GHashTable *params;
+	uint8_t *data, *blocks;
+	uint64_t n;
+	char *filename;
+	int unitsize, i;
+
+	/* Some channels are quiet for whole blocks. */
+	data = g_malloc(SRZIP_SAMPLES * SRZIP_UNITSIZE);
+	for (i = 0; i < SRZIP_SAMPLES; i++) {
+		data[i * 2] = (i / 97) & 0xff;
+		data[i * 2 + 1] = (i / 20000) & 1 ? 0x80 : 0x01;
+	}
+
+	params = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify)g_variant_unref);
+	g_hash_table_insert(params, "overview",
+			g_variant_ref_sink(g_variant_new_boolean(TRUE)));
+	filename = srzip_filename_new();
+	srzip_write(filename, data, SRZIP_SAMPLES * SRZIP_UNITSIZE, params);
+
+	/* Level 1 has 256 samples per block, the last one partial. */
+	srzip_overview_check(filename, data, 1, 0, SRZIP_SAMPLES,
+			0, (SRZIP_SAMPLES + 255) / 256);
+	srzip_overview_check(filename, data, 1, 1000, 3000, 3, 13);
+	srzip_overview_check(filename, data, 1, SRZIP_SAMPLES - 1, 100,
+			(SRZIP_SAMPLES - 1) / 256, 1);
+	srzip_overview_check(filename, data, 1,
+			(SRZIP_SAMPLES + 255) / 256 * 256, 100, 0, 0);
+	/* Level 2 covers the whole capture in one block, so it's the last. */
+	srzip_overview_check(filename, data, 2, 0, SRZIP_SAMPLES, 0, 1);
+	srzip_overview_check(filename, data, 2, 40000, 1, 0, 1);
+
+	fail_unless(sr_session_overview_get(filename, 3, 0, SRZIP_SAMPLES,
+			&blocks, &n, &unitsize) == SR_ERR_NA);
+	fail_unless(sr_session_overview_get(filename, 0, 0, SRZIP_SAMPLES,
+			&blocks, &n, &unitsize) == SR_ERR_ARG);
+
+	/* Without the option, there is no overview. */
+	srzip_write(filename, data, SRZIP_SAMPLES * SRZIP_UNITSIZE, NULL);
+	fail_unless(sr_session_overview_get(filename, 1, 0, SRZIP_SAMPLES,
+			&blocks, &n, &unitsize) == SR_ERR_NA);
+
+	g_unlink(filename);
+	g_free(filename);
+	g_free(data);
+}
+END_TEST
+
+Suite *suite_srzip(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("srzip");
+
+	tc = tcase_create("roundtrip");
+	tcase_add_checked_fixture(tc, srzip_setup, srtest_teardown);
+	tcase_add_test(tc, test_srzip_roundtrip);
+	tcase_add_test(tc, test_srzip_workers);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("replay");
+	tcase_add_checked_fixture(tc, srzip_setup, srtest_teardown);
+	tcase_add_test(tc, test_srzip_replay_range);
+	tcase_add_test(tc, test_srzip_replay_read_error);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("overview");
+	tcase_add_checked_fixture(tc, srzip_setup, srtest_teardown);
+	tcase_add_test(tc, test_srzip_overview);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
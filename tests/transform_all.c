@@ -19,6 +19,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "../include/libsigrok/libsigrok.h"
 #include "lib.h"
@@ -96,6 +97,481 @@ START_TEST(test_transform_options)
 }
 END_TEST
 
+static GHashTable *options_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)g_variant_unref);
+}
+
+static void option_set(GHashTable *options, const char *key, GVariant *value)
+{
+	g_hash_table_insert(options, g_strdup(key), g_variant_ref_sink(value));
+}
+
+/*
+ * Import data through the given input module in pieces of chunk_size
+ * bytes, with the given transform on the session. The channels in the
+ * disabled mask of indices are disabled before the transform is created.
+ */
+static void transform_run(const char *input_id, GHashTable *input_options,
+		const GString *data, gsize chunk_size, uint64_t disabled,
+		const char *transform_id, GHashTable *transform_options,
+		sr_datafeed_callback cb, void *cb_data)
+{
+	struct sr_session *session;
+	const struct sr_input *in;
+	const struct sr_transform *t;
+	struct sr_dev_inst *sdi;
+	struct sr_channel *ch;
+	GSList *l;
+	GString *buf;
+	gsize i, len;
+	int ret;
+
+	in = sr_input_new(sr_input_find((char *)input_id), input_options);
+	fail_unless(in != NULL, "Failed to create '%s' input.", input_id);
+	sr_session_new(srtest_ctx, &session);
+	sr_session_datafeed_callback_add(session, cb, cb_data);
+
+	buf = g_string_new(NULL);
+	sdi = NULL;
+	t = NULL;
+	for (i = 0; i < data->len; i += len) {
+		len = MIN(chunk_size, data->len - i);
+		g_string_assign(buf, "");
+		g_string_append_len(buf, data->str + i, len);
+		ret = sr_input_send(in, buf);
+		fail_unless(ret == SR_OK, "sr_input_send() error: %d", ret);
+		if (!sdi && (sdi = sr_input_dev_inst_get(in))) {
+			sr_session_dev_add(session, sdi);
+			for (l = sr_dev_inst_channels_get(sdi); l; l = l->next) {
+				ch = l->data;
+				if (disabled & (UINT64_C(1) << ch->index))
+					sr_dev_channel_enable(ch, FALSE);
+			}
+			t = sr_transform_new(sr_transform_find(
+					(char *)transform_id),
+					transform_options, sdi);
+			fail_unless(t != NULL, "Failed to create '%s' transform.",
+					transform_id);
+		}
+	}
+	ret = sr_input_end(in);
+	fail_unless(ret == SR_OK, "sr_input_end() error: %d", ret);
+	fail_unless(sdi != NULL, "Device not ready.");
+
+	g_string_free(buf, TRUE);
+	sr_session_destroy(session);
+	sr_transform_free(t);
+	sr_input_free(in);
+}
+
+#define DECIMATE_SAMPLES 95
+#define DECIMATE_FACTOR 10
+#define DECIMATE_FRAMES 100
+#define DECIMATE_ANALOG_FACTOR 8
+#define DECIMATE_ANALOG_RATE 48000
+
+struct decimate_check {
+	uint64_t samplerate;
+	uint64_t bucket_size;
+	GByteArray *logic;
+	GArray *minmax;
+	GArray *mean;
+};
+
+static void decimate_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_meta *meta;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_config *src;
+	struct decimate_check *dc;
+	GSList *l;
+
+	(void)sdi;
+
+	dc = cb_data;
+	switch (packet->type) {
+	case SR_DF_META:
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			fail_unless(src->key != SR_CONF_AVG_SAMPLES,
+					"Meta packet has SR_CONF_AVG_SAMPLES.");
+			if (src->key == SR_CONF_SAMPLERATE)
+				dc->samplerate = g_variant_get_uint64(src->data);
+			else if (src->key == SR_CONF_BUCKET_SIZE)
+				dc->bucket_size = g_variant_get_uint64(src->data);
+		}
+		break;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		fail_unless(logic->unitsize == 2);
+		fail_unless(logic->length % 4 == 0, "Partial logic bucket.");
+		g_byte_array_append(dc->logic, logic->data, logic->length);
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		fail_unless(g_slist_length(analog->channels) == 2);
+		fail_unless(analog->num_samples % 2 == 0, "Partial analog bucket.");
+		if (analog->mqflags & SR_MQFLAG_AVG) {
+			g_array_append_vals(dc->mean, analog->data,
+					analog->num_samples * 2);
+		} else {
+			fail_unless((analog->mqflags & (SR_MQFLAG_MIN
+					| SR_MQFLAG_MAX)) == (SR_MQFLAG_MIN
+					| SR_MQFLAG_MAX), "Bucket flags not set.");
+			g_array_append_vals(dc->minmax, analog->data,
+					analog->num_samples * 2);
+		}
+		break;
+	}
+}
+
+static void decimate_check_init(struct decimate_check *dc)
+{
+	memset(dc, 0, sizeof(*dc));
+	dc->logic = g_byte_array_new();
+	dc->minmax = g_array_new(FALSE, FALSE, sizeof(float));
+	dc->mean = g_array_new(FALSE, FALSE, sizeof(float));
+}
+
+static void decimate_check_free(struct decimate_check *dc)
+{
+	g_byte_array_free(dc->logic, TRUE);
+	g_array_free(dc->minmax, TRUE);
+	g_array_free(dc->mean, TRUE);
+}
+
+/*
+ * Check 16 logic channels decimate to the last sample and the channels
+ * which toggled per bucket, however the samples are split into packets.
+ */
+START_TEST(test_transform_decimate_logic)
+{
+	const gsize chunk_sizes[] = { DECIMATE_SAMPLES * 2, 7, 1 };
+	struct decimate_check dc;
+	GHashTable *input_options, *options;
+	GString *data;
+	GRand *r;
+	uint16_t samples[DECIMATE_SAMPLES], value, last, toggled;
+	uint8_t *bucket;
+	unsigned int i, b, k;
+
+	r = g_rand_new_with_seed(1);
+	value = 0x1234;
+	data = g_string_new(NULL);
+	for (i = 0; i < DECIMATE_SAMPLES; i++) {
+		if (g_rand_int_range(r, 0, 3) == 0)
+			value ^= 1 << g_rand_int_range(r, 0, 16);
+		samples[i] = value;
+		g_string_append_c(data, value & 0xff);
+		g_string_append_c(data, value >> 8);
+	}
+	g_rand_free(r);
+
+	input_options = options_new();
+	option_set(input_options, "numchannels", g_variant_new_int32(16));
+	option_set(input_options, "samplerate", g_variant_new_uint64(SR_MHZ(1)));
+	options = options_new();
+	option_set(options, "factor", g_variant_new_uint64(DECIMATE_FACTOR));
+
+	for (i = 0; i < G_N_ELEMENTS(chunk_sizes); i++) {
+		decimate_check_init(&dc);
+		transform_run("binary", input_options, data, chunk_sizes[i], 0,
+				"decimate", options, decimate_datafeed_in, &dc);
+
+		fail_unless(dc.samplerate == SR_MHZ(1) * 2 / DECIMATE_FACTOR,
+				"Got samplerate %" PRIu64 ".", dc.samplerate);
+		fail_unless(dc.bucket_size == DECIMATE_FACTOR,
+				"Got bucket size %" PRIu64 ".", dc.bucket_size);
+		/* The partial bucket at the end is dropped. */
+		fail_unless(dc.logic->len == DECIMATE_SAMPLES / DECIMATE_FACTOR * 4,
+				"Got %u bytes of logic data.", dc.logic->len);
+		for (b = 0; b < DECIMATE_SAMPLES / DECIMATE_FACTOR; b++) {
+			toggled = 0;
+			for (k = b * DECIMATE_FACTOR; k < (b + 1) * DECIMATE_FACTOR; k++)
+				toggled |= samples[k] ^ samples[k ? k - 1 : 0];
+			bucket = dc.logic->data + b * 4;
+			last = bucket[0] | bucket[1] << 8;
+			fail_unless(last == samples[k - 1],
+					"Bucket %u: last sample 0x%04x, expected 0x%04x.",
+					b, last, samples[k - 1]);
+			fail_unless((bucket[2] | bucket[3] << 8) == toggled,
+					"Bucket %u: toggled 0x%04x, expected 0x%04x.",
+					b, bucket[2] | bucket[3] << 8, toggled);
+		}
+		decimate_check_free(&dc);
+	}
+
+	g_hash_table_destroy(input_options);
+	g_hash_table_destroy(options);
+	g_string_free(data, TRUE);
+}
+END_TEST
+
+static void append_le32(GString *s, uint32_t v)
+{
+	g_string_append_c(s, v & 0xff);
+	g_string_append_c(s, (v >> 8) & 0xff);
+	g_string_append_c(s, (v >> 16) & 0xff);
+	g_string_append_c(s, v >> 24);
+}
+
+/* A WAV file with two channels of float samples. */
+static GString *decimate_wav(const float *samples, unsigned int num_frames)
+{
+	GString *wav;
+	unsigned int i, size;
+	uint32_t v;
+
+	size = num_frames * 2 * sizeof(float);
+	wav = g_string_new("RIFF");
+	append_le32(wav, 36 + size);
+	g_string_append(wav, "WAVEfmt ");
+	append_le32(wav, 16);
+	append_le32(wav, 3 | 2 << 16);
+	append_le32(wav, DECIMATE_ANALOG_RATE);
+	append_le32(wav, DECIMATE_ANALOG_RATE * 2 * sizeof(float));
+	append_le32(wav, 2 * sizeof(float) | 32 << 16);
+	g_string_append(wav, "data");
+	append_le32(wav, size);
+	for (i = 0; i < num_frames * 2; i++) {
+		memcpy(&v, samples + i, sizeof(v));
+		append_le32(wav, v);
+	}
+
+	return wav;
+}
+
+/*
+ * Check two analog channels decimate to their minimum and maximum per
+ * bucket, with the mean in separate packets if asked for, however the
+ * samples are split into packets.
+ */
+START_TEST(test_transform_decimate_analog)
+{
+	const gsize chunk_sizes[] = { G_MAXSIZE, 20, 3 };
+	struct decimate_check dc;
+	GHashTable *options;
+	GString *wav;
+	GRand *r;
+	float samples[DECIMATE_FRAMES * 2], min, max, v, got;
+	double sum;
+	unsigned int i, b, c, k, num_buckets;
+	gboolean mean;
+
+	r = g_rand_new_with_seed(2);
+	for (i = 0; i < DECIMATE_FRAMES * 2; i++)
+		samples[i] = g_rand_int_range(r, -1000, 1001) / 100.0f;
+	g_rand_free(r);
+	wav = decimate_wav(samples, DECIMATE_FRAMES);
+	num_buckets = DECIMATE_FRAMES / DECIMATE_ANALOG_FACTOR;
+
+	for (mean = FALSE; mean <= TRUE; mean++) {
+		options = options_new();
+		option_set(options, "factor",
+				g_variant_new_uint64(DECIMATE_ANALOG_FACTOR));
+		option_set(options, "mean", g_variant_new_boolean(mean));
+		for (i = 0; i < G_N_ELEMENTS(chunk_sizes); i++) {
+			decimate_check_init(&dc);
+			transform_run("wav", NULL, wav, chunk_sizes[i], 0,
+					"decimate", options,
+					decimate_datafeed_in, &dc);
+
+			fail_unless(dc.samplerate == DECIMATE_ANALOG_RATE * 2
+					/ DECIMATE_ANALOG_FACTOR,
+					"Got samplerate %" PRIu64 ".", dc.samplerate);
+			fail_unless(dc.bucket_size == DECIMATE_ANALOG_FACTOR,
+					"Got bucket size %" PRIu64 ".", dc.bucket_size);
+			fail_unless(dc.minmax->len == num_buckets * 2 * 2,
+					"Got %u min/max values.", dc.minmax->len);
+			fail_unless(dc.mean->len == (mean ? num_buckets * 2 * 2 : 0),
+					"Got %u mean values.", dc.mean->len);
+			for (b = 0; b < num_buckets; b++) {
+				for (c = 0; c < 2; c++) {
+					k = b * DECIMATE_ANALOG_FACTOR;
+					min = max = samples[k * 2 + c];
+					sum = 0;
+					for (; k < (b + 1) * DECIMATE_ANALOG_FACTOR; k++) {
+						v = samples[k * 2 + c];
+						min = MIN(min, v);
+						max = MAX(max, v);
+						sum += v;
+					}
+					got = g_array_index(dc.minmax, float, b * 4 + c);
+					fail_unless(got == min, "Bucket %u channel %u: "
+							"minimum %f, expected %f.",
+							b, c, got, min);
+					got = g_array_index(dc.minmax, float, b * 4 + 2 + c);
+					fail_unless(got == max, "Bucket %u channel %u: "
+							"maximum %f, expected %f.",
+							b, c, got, max);
+					if (!mean)
+						continue;
+					v = sum / DECIMATE_ANALOG_FACTOR;
+					fail_unless(g_array_index(dc.mean, float,
+							b * 4 + c) == v && g_array_index(
+							dc.mean, float, b * 4 + 2 + c) == v,
+							"Bucket %u channel %u: wrong mean.",
+							b, c);
+				}
+			}
+			decimate_check_free(&dc);
+		}
+		g_hash_table_destroy(options);
+	}
+
+	g_string_free(wav, TRUE);
+}
+END_TEST
+
+#define REPACK_SAMPLES 203
+
+struct repack_check {
+	uint64_t packed_channels;
+	gboolean got_meta;
+	unsigned int unitsize;
+	GByteArray *logic;
+};
+
+static void repack_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_meta *meta;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_config *src;
+	struct repack_check *rc;
+	GSList *l;
+
+	(void)sdi;
+
+	rc = cb_data;
+	switch (packet->type) {
+	case SR_DF_META:
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			if (src->key != SR_CONF_PACKED_CHANNELS)
+				continue;
+			fail_unless(!rc->got_meta, "Channels announced twice.");
+			fail_unless(rc->logic->len == 0,
+					"Channels announced after the samples.");
+			rc->packed_channels = g_variant_get_uint64(src->data);
+			rc->got_meta = TRUE;
+		}
+		break;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		fail_unless(!rc->unitsize || logic->unitsize == rc->unitsize,
+				"Unitsize changed from %u to %u.", rc->unitsize,
+				logic->unitsize);
+		rc->unitsize = logic->unitsize;
+		g_byte_array_append(rc->logic, logic->data, logic->length);
+		break;
+	}
+}
+
+/*
+ * Check logic samples of num_channels channels are packed down to the
+ * enabled ones, which are announced ahead of the samples.
+ */
+static void repack_check_mask(unsigned int num_channels, uint64_t enabled)
+{
+	const gsize chunk_sizes[] = { G_MAXSIZE, 7, 1 };
+	struct repack_check rc;
+	GHashTable *options;
+	GString *data;
+	GRand *r;
+	uint64_t all, sample, packed, used;
+	unsigned int in_unitsize, unitsize, num_enabled, i, j, c, bit;
+
+	all = (UINT64_C(1) << num_channels) - 1;
+	in_unitsize = (num_channels + 7) / 8;
+	num_enabled = 0;
+	for (c = 0; c < num_channels; c++)
+		num_enabled += (enabled >> c) & 1;
+	unitsize = (num_enabled + 7) / 8;
+	/* Samples already packed are passed on with the rest left in. */
+	used = (UINT64_C(1) << num_enabled) - 1;
+
+	r = g_rand_new_with_seed(num_channels);
+	data = g_string_new(NULL);
+	for (i = 0; i < REPACK_SAMPLES * in_unitsize; i++)
+		g_string_append_c(data, g_rand_int_range(r, 0, 256));
+	g_rand_free(r);
+
+	options = options_new();
+	option_set(options, "numchannels", g_variant_new_int32(num_channels));
+	option_set(options, "samplerate", g_variant_new_uint64(SR_MHZ(1)));
+
+	for (i = 0; i < G_N_ELEMENTS(chunk_sizes); i++) {
+		memset(&rc, 0, sizeof(rc));
+		rc.logic = g_byte_array_new();
+		transform_run("binary", options, data, chunk_sizes[i],
+				all & ~enabled, "repack", NULL,
+				repack_datafeed_in, &rc);
+
+		fail_unless(rc.got_meta, "Channels not announced.");
+		fail_unless(rc.packed_channels == enabled,
+				"Announced channels 0x%" PRIx64 ", expected 0x%"
+				PRIx64 ".", rc.packed_channels, enabled);
+		fail_unless(rc.unitsize == unitsize, "Got unitsize %u, expected %u.",
+				rc.unitsize, unitsize);
+		fail_unless(rc.logic->len == REPACK_SAMPLES * unitsize,
+				"Got %u bytes of logic data.", rc.logic->len);
+		for (j = 0; j < REPACK_SAMPLES; j++) {
+			sample = 0;
+			for (c = 0; c < in_unitsize; c++)
+				sample |= (uint64_t)(uint8_t)data->str[j * in_unitsize + c]
+					<< (8 * c);
+			packed = 0;
+			for (c = 0, bit = 0; c < num_channels; c++) {
+				if (!(enabled & (UINT64_C(1) << c)))
+					continue;
+				packed |= ((sample >> c) & 1) << bit++;
+			}
+			sample = 0;
+			for (c = 0; c < unitsize; c++)
+				sample |= (uint64_t)rc.logic->data[j * unitsize + c]
+					<< (8 * c);
+			fail_unless((sample & used) == packed,
+					"Sample %u is 0x%" PRIx64 ", expected 0x%"
+					PRIx64 ".", j, sample & used, packed);
+		}
+		g_byte_array_free(rc.logic, TRUE);
+	}
+
+	g_hash_table_destroy(options);
+	g_string_free(data, TRUE);
+}
+
+/* The lowest channels enabled, so only the unitsize changes. */
+START_TEST(test_transform_repack_in_order)
+{
+	repack_check_mask(16, 0x3ff);
+	repack_check_mask(16, 0xff);
+}
+END_TEST
+
+/* Channels spread over the sample packed into a single byte. */
+START_TEST(test_transform_repack_sparse)
+{
+	repack_check_mask(16, 0x8212);
+	repack_check_mask(8, 0xa5);
+}
+END_TEST
+
+/* More than 8 channels out of order, into an odd unitsize. */
+START_TEST(test_transform_repack_wide)
+{
+	repack_check_mask(24, 0xeff7fb);
+	repack_check_mask(40, UINT64_C(0xf0f0f0f0f0));
+}
+END_TEST
+
 Suite *suite_transform_all(void)
 {
 	Suite *s;
@@ -112,5 +588,18 @@ Suite *suite_transform_all(void)
 	tcase_add_test(tc, test_transform_options);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("decimate");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_transform_decimate_logic);
+	tcase_add_test(tc, test_transform_decimate_analog);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("repack");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_add_test(tc, test_transform_repack_in_order);
+	tcase_add_test(tc, test_transform_repack_sparse);
+	tcase_add_test(tc, test_transform_repack_wide);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
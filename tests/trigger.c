@@ -249,6 +249,206 @@ START_TEST(test_trigger_match_add_bogus)
 }
 END_TEST
 
+/*
+ * Soft trigger cases, run on the logic patterns of the demo driver. The
+ * expected trigger sample and its value were produced by the soft trigger
+ * as it was before it learned to follow matches across buffers, from the
+ * first 1024 samples of each pattern passed in a single buffer.
+ */
+#define SOFT_TRIGGER_SAMPLERATE  SR_KHZ(4)
+#define SOFT_TRIGGER_LIMIT       256
+/* Time to wait on triggers which never fire, about three periods. */
+#define SOFT_TRIGGER_WAIT_MS     200
+
+static const struct soft_trigger_case {
+	const char *pattern;
+	int num_stages;
+	/* Channel and match pairs, a zero match ends the stage. */
+	struct {
+		int channel;
+		int match;
+	} stages[4][4];
+	int trigger_sample;
+	uint8_t trigger_value;
+} soft_trigger_cases[] = {
+	{ "incremental", 1, { { { 7, SR_TRIGGER_RISING }, }, }, 128, 0x80 },
+	{ "incremental", 1, { { { 7, SR_TRIGGER_ONE }, { 6, SR_TRIGGER_ONE }, { 5, SR_TRIGGER_ONE }, { 4, SR_TRIGGER_ONE }, }, }, 240, 0xf0 },
+	{ "incremental", 2, { { { 7, SR_TRIGGER_RISING }, }, { { 0, SR_TRIGGER_ONE }, }, }, 129, 0x81 },
+	{ "incremental", 1, { { { 6, SR_TRIGGER_FALLING }, }, }, 128, 0x80 },
+	{ "incremental", 2, { { { 7, SR_TRIGGER_RISING }, }, { { 0, SR_TRIGGER_RISING }, }, }, 129, 0x81 },
+	{ "incremental", 3, { { { 4, SR_TRIGGER_RISING }, }, { { 5, SR_TRIGGER_ONE }, }, { { 6, SR_TRIGGER_ZERO }, }, }, 50, 0x32 },
+	{ "sigrok", 2, { { { 7, SR_TRIGGER_FALLING }, }, { { 6, SR_TRIGGER_ONE }, }, }, -1, 0x00 },
+	{ "sigrok", 2, { { { 0, SR_TRIGGER_ONE }, { 7, SR_TRIGGER_ONE }, }, { { 3, SR_TRIGGER_EDGE }, }, }, 1, 0xb6 },
+	{ "incremental", 2, { { { 7, SR_TRIGGER_ONE }, { 0, SR_TRIGGER_ONE }, }, { { 1, SR_TRIGGER_RISING }, }, }, 130, 0x82 },
+	{ "sigrok", 3, { { { 1, SR_TRIGGER_EDGE }, }, { { 2, SR_TRIGGER_EDGE }, }, { { 3, SR_TRIGGER_EDGE }, }, }, 42, 0xeb },
+	{ "incremental", 4, { { { 0, SR_TRIGGER_RISING }, }, { { 0, SR_TRIGGER_FALLING }, }, { { 0, SR_TRIGGER_RISING }, }, { { 0, SR_TRIGGER_FALLING }, }, }, 4, 0x04 },
+	{ "sigrok", 2, { { { 4, SR_TRIGGER_RISING }, { 3, SR_TRIGGER_ONE }, }, { { 6, SR_TRIGGER_EDGE }, }, }, 12, 0xff },
+	{ "incremental", 2, { { { 2, SR_TRIGGER_EDGE }, { 1, SR_TRIGGER_EDGE }, }, { { 1, SR_TRIGGER_EDGE }, }, }, -1, 0x00 },
+	{ "sigrok", 1, { { { 7, SR_TRIGGER_RISING }, { 3, SR_TRIGGER_RISING }, }, }, -1, 0x00 },
+	{ "incremental", 2, { { { 2, SR_TRIGGER_ONE }, }, { { 1, SR_TRIGGER_FALLING }, { 2, SR_TRIGGER_RISING }, }, }, -1, 0x00 },
+	{ "sigrok", 4, { { { 7, SR_TRIGGER_EDGE }, }, { { 4, SR_TRIGGER_RISING }, }, { { 2, SR_TRIGGER_EDGE }, { 5, SR_TRIGGER_ZERO }, }, { { 6, SR_TRIGGER_ONE }, { 5, SR_TRIGGER_EDGE }, }, }, -1, 0x00 },
+	{ "incremental", 2, { { { 1, SR_TRIGGER_ONE }, { 0, SR_TRIGGER_RISING }, }, { { 1, SR_TRIGGER_EDGE }, { 2, SR_TRIGGER_EDGE }, }, }, 4, 0x04 },
+	{ "incremental", 1, { { { 0, SR_TRIGGER_ONE }, { 4, SR_TRIGGER_ONE }, }, }, 17, 0x11 },
+	{ "incremental", 4, { { { 7, SR_TRIGGER_ONE }, { 6, SR_TRIGGER_ONE }, }, { { 1, SR_TRIGGER_RISING }, { 2, SR_TRIGGER_ZERO }, }, { { 5, SR_TRIGGER_RISING }, }, { { 2, SR_TRIGGER_EDGE }, { 7, SR_TRIGGER_RISING }, }, }, -1, 0x00 },
+	{ "sigrok", 1, { { { 1, SR_TRIGGER_RISING }, { 6, SR_TRIGGER_ONE }, }, }, 5, 0xff },
+	{ "incremental", 1, { { { 0, SR_TRIGGER_FALLING }, { 5, SR_TRIGGER_RISING }, }, }, 32, 0x20 },
+	{ "sigrok", 1, { { { 2, SR_TRIGGER_ONE }, }, }, 1, 0xb6 },
+	{ "sigrok", 1, { { { 5, SR_TRIGGER_EDGE }, }, }, 1, 0xb6 },
+	{ "incremental", 1, { { { 7, SR_TRIGGER_ZERO }, }, }, 0, 0x00 },
+	{ "sigrok", 3, { { { 7, SR_TRIGGER_FALLING }, { 1, SR_TRIGGER_RISING }, }, { { 3, SR_TRIGGER_ONE }, { 2, SR_TRIGGER_RISING }, }, { { 7, SR_TRIGGER_ONE }, }, }, -1, 0x00 },
+};
+
+/* Datafeed seen by the soft-trigger tests. */
+static int soft_triggers;
+static uint64_t soft_pre_trigger_samples;
+static uint64_t soft_post_trigger_samples;
+static int soft_trigger_value;
+
+static void soft_trigger_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+
+	(void)sdi;
+	(void)cb_data;
+
+	if (packet->type == SR_DF_TRIGGER) {
+		soft_triggers++;
+	} else if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		fail_unless(logic->unitsize == 1);
+		if (!soft_triggers) {
+			soft_pre_trigger_samples += logic->length;
+		} else {
+			if (!soft_post_trigger_samples && logic->length)
+				soft_trigger_value = ((const uint8_t *)logic->data)[0];
+			soft_post_trigger_samples += logic->length;
+		}
+	}
+}
+
+static int soft_trigger_timeout(int fd, int revents, void *cb_data)
+{
+	(void)fd;
+	(void)revents;
+
+	sr_session_stop(cb_data);
+
+	return FALSE;
+}
+
+static struct sr_dev_inst *soft_trigger_demo_open(void)
+{
+	struct sr_dev_driver *driver;
+	struct sr_config src[2];
+	struct sr_dev_inst *sdi;
+	GSList *options, *devices;
+
+	driver = srtest_driver_get("demo");
+	fail_unless(driver != NULL, "No demo driver found.");
+	srtest_driver_init(srtest_ctx, driver);
+
+	src[0].key = SR_CONF_NUM_LOGIC_CHANNELS;
+	src[0].data = g_variant_new_int32(8);
+	src[1].key = SR_CONF_NUM_ANALOG_CHANNELS;
+	src[1].data = g_variant_new_int32(0);
+	options = g_slist_append(g_slist_append(NULL, &src[0]), &src[1]);
+	devices = sr_driver_scan(driver, options);
+	g_slist_free(options);
+	g_variant_unref(g_variant_ref_sink(src[0].data));
+	g_variant_unref(g_variant_ref_sink(src[1].data));
+
+	fail_unless(devices != NULL, "Demo device not found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+	fail_unless(sr_dev_open(sdi) == SR_OK);
+	fail_unless(sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(SOFT_TRIGGER_SAMPLERATE)) == SR_OK);
+	fail_unless(sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(SOFT_TRIGGER_LIMIT)) == SR_OK);
+	/* Keep every sample before the trigger. */
+	fail_unless(sr_config_set(sdi, NULL, SR_CONF_CAPTURE_RATIO,
+			g_variant_new_uint64(100)) == SR_OK);
+
+	return sdi;
+}
+
+static void soft_trigger_run(struct sr_dev_inst *sdi,
+		const struct soft_trigger_case *tc)
+{
+	struct sr_session *session;
+	struct sr_trigger *trigger;
+	struct sr_trigger_stage *stage;
+	struct sr_channel *ch;
+	int i, j;
+
+	fail_unless(sr_config_set(sdi, sr_dev_inst_channel_groups_get(sdi)->data,
+			SR_CONF_PATTERN_MODE, g_variant_new_string(tc->pattern)) == SR_OK);
+
+	trigger = sr_trigger_new(NULL);
+	for (i = 0; i < tc->num_stages; i++) {
+		stage = sr_trigger_stage_add(trigger);
+		for (j = 0; j < 4 && tc->stages[i][j].match; j++) {
+			ch = g_slist_nth_data(sr_dev_inst_channels_get(sdi),
+					tc->stages[i][j].channel);
+			fail_unless(sr_trigger_match_add(stage, ch,
+					tc->stages[i][j].match, 0) == SR_OK);
+		}
+	}
+
+	soft_triggers = 0;
+	soft_pre_trigger_samples = soft_post_trigger_samples = 0;
+	soft_trigger_value = -1;
+
+	sr_session_new(srtest_ctx, &session);
+	sr_session_dev_add(session, sdi);
+	sr_session_trigger_set(session, trigger);
+	sr_session_datafeed_callback_add(session, soft_trigger_datafeed_in, NULL);
+	fail_unless(sr_session_start(session) == SR_OK);
+	if (tc->trigger_sample < 0)
+		sr_session_source_add(session, -1, 0, SOFT_TRIGGER_WAIT_MS,
+				soft_trigger_timeout, session);
+	fail_unless(sr_session_run(session) == SR_OK);
+	sr_session_destroy(session);
+}
+
+/* Check the trigger position and the samples around it on the demo device. */
+START_TEST(test_soft_trigger_demo)
+{
+	const struct soft_trigger_case *tc;
+	struct sr_dev_inst *sdi;
+	unsigned int i;
+
+	sdi = soft_trigger_demo_open();
+	for (i = 0; i < G_N_ELEMENTS(soft_trigger_cases); i++) {
+		tc = &soft_trigger_cases[i];
+		soft_trigger_run(sdi, tc);
+		if (tc->trigger_sample < 0) {
+			fail_unless(soft_triggers == 0,
+					"Case %u: unexpected trigger.", i);
+			fail_unless(soft_pre_trigger_samples == 0 &&
+					soft_post_trigger_samples == 0,
+					"Case %u: samples sent without a trigger.", i);
+			continue;
+		}
+		fail_unless(soft_triggers == 1, "Case %u: %d triggers.",
+				i, soft_triggers);
+		fail_unless(soft_pre_trigger_samples == (uint64_t)tc->trigger_sample,
+				"Case %u: triggered after %" PRIu64 " samples, "
+				"expected %d.", i, soft_pre_trigger_samples,
+				tc->trigger_sample);
+		fail_unless(soft_trigger_value == tc->trigger_value,
+				"Case %u: trigger sample 0x%02x, expected 0x%02x.",
+				i, soft_trigger_value, tc->trigger_value);
+		fail_unless(soft_pre_trigger_samples + soft_post_trigger_samples
+				== SOFT_TRIGGER_LIMIT,
+				"Case %u: %" PRIu64 " samples sent.", i,
+				soft_pre_trigger_samples + soft_post_trigger_samples);
+	}
+	sr_dev_close(sdi);
+}
+END_TEST
+
 Suite *suite_trigger(void)
 {
 	Suite *s;
@@ -276,5 +476,11 @@ Suite *suite_trigger(void)
 	tcase_add_test(tc, test_trigger_match_add_bogus);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("soft_trigger");
+	tcase_add_checked_fixture(tc, srtest_setup, srtest_teardown);
+	tcase_set_timeout(tc, 60);
+	tcase_add_test(tc, test_soft_trigger_demo);
+	suite_add_tcase(s, tc);
+
 	return s;
 }